@@ -14,6 +14,7 @@ cl_mem	buffers[MAX_BUFFERS];
 DLL_EXPORT int fNCbuild_kernels(int argc, void *argv[])
 {
 	int 		result;
+	double		start = fCaptureClock();
 	cl_kernel*	kernel_ptr;
 
 	if (argc != 8)
@@ -42,6 +43,106 @@ DLL_EXPORT int fNCbuild_kernels(int argc, void *argv[])
 
 	}
 
+	fCaptureCall(CAPTURE_BUILD_KERNELS, argc, argv, result, start);
+	return(result);
+
+}
+
+DLL_EXPORT int fNCregister_kernels(int argc, void *argv[])
+{
+	int 		result;
+	double		start = fCaptureClock();
+	cl_kernel*	kernel_ptr;
+
+	if (argc != 9)
+	{
+		result = -1;
+	} 
+	else
+	{
+
+		kernel_ptr = (cl_kernel *) calloc (MAX_KERNELS, sizeof(cl_kernel));
+
+		char* argv_8_ =  (*(idls *) argv[8]).s;
+
+		result = fRegisterKernels(	*(	cl_command_queue **)	argv[0],	// command queue
+																kernel_ptr,	//
+									*(	cl_uint			  *)	argv[2],	// number of kernels
+									 (	idls			  *)	argv[3],	// kernel file paths
+									 (	idls			  *)	argv[4],	// kernel function names
+									 (	idls			  *)	argv[5],	// compile options
+									*(	cl_bool			  *)	argv[6],	// prefetch
+									*(	cl_bool			  *)	argv[7],	// verbose
+																argv_8_);	// log file
+
+		// Return address to input parameter
+		*(cl_kernel **) argv[1] = kernel_ptr;
+
+	}
+
+	fCaptureCall(CAPTURE_REGISTER_KERNELS, argc, argv, result, start);
+	return(result);
+
+}
+
+DLL_EXPORT int fNCdevice_caps(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 4)
+	{
+		result = -1;
+	}
+	else
+	{
+		result = fDeviceCaps(*(	cl_command_queue **)	argv[0],	// command queue
+							  (	cl_ulong		  *)	argv[1],	// capabilities, DEVICE_CAPS_N
+							 *(	cl_bool			  *)	argv[2],	// verbose
+							 (*(idls			  *)	argv[3]).s);// log file
+	}
+
+	return(result);
+
+}
+
+DLL_EXPORT int fNCselect_device(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 5)
+	{
+		result = -1;
+	}
+	else
+	{
+		result = fSelectDevicePolicy(*(	cl_int	*)	argv[0],	// ranking policy
+									 (*(idls	*)	argv[1]).s,	// device name, "" for any
+									  *(cl_int	*)	argv[2],	// device index, -1 for any
+									  *(cl_bool	*)	argv[3],	// verbose
+									 (*(idls	*)	argv[4]).s);// log file
+	}
+
+	return(result);
+
+}
+
+DLL_EXPORT int fNCnative_threads(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		result = fNativeThreads(*(	cl_uint	*)	argv[0],	// threads, 0 = all
+								*(	cl_bool	*)	argv[1],	// verbose
+								(*(	idls	*)	argv[2]).s);// log file
+	}
+
+	fCaptureCall(CAPTURE_NATIVE_THREADS, argc, argv, result, start);
 	return(result);
 
 }
@@ -49,6 +150,7 @@ DLL_EXPORT int fNCbuild_kernels(int argc, void *argv[])
 DLL_EXPORT int fNCcreate_buffer(int argc, void *argv[])
 {
 	int result;
+	double start = fCaptureClock();
 
 	if (argc != 8)
 	{
@@ -74,6 +176,7 @@ DLL_EXPORT int fNCcreate_buffer(int argc, void *argv[])
 		//*(cl_mem **) argv[1] = buffers;  
 	}
 
+	fCaptureCall(CAPTURE_CREATE_BUFFER, argc, argv, result, start);
 	return(result);
 
 }
@@ -92,6 +195,9 @@ DLL_EXPORT int fNCcreate_image(int argc, void *argv[])
 		cl_mem*	argv_1_ = &buffers[*(cl_uint*) argv[1]];
 		char*	argv_9_ = (*(idls *) argv[9]).s;
 
+		// The slot gets a new object, the old buffer is no longer tracked
+		fResidencyRelease(argv_1_);
+
 		//command_queue is a global variable defined above
 		result = fCreateImage(	*(cl_command_queue **)	argv[0],	// command queue*
 														argv_1_,	// cl_mem
@@ -116,6 +222,7 @@ DLL_EXPORT int fNCcreate_image(int argc, void *argv[])
 DLL_EXPORT int fNCcreate_command_queue(int argc, void *argv[])
 {
 	int					result;
+	double				start = fCaptureClock();
 	cl_command_queue*	cq_ptr; 
 	
 	if (argc != 4)
@@ -140,6 +247,7 @@ DLL_EXPORT int fNCcreate_command_queue(int argc, void *argv[])
 
 	}
 
+	fCaptureCall(CAPTURE_CREATE_QUEUE, argc, argv, result, start);
 	return(result);
 
 }
@@ -147,6 +255,7 @@ DLL_EXPORT int fNCcreate_command_queue(int argc, void *argv[])
 DLL_EXPORT int fNCexecute_kernel(int argc, void *argv[])
 {
 	int			result;
+	double		start = fCaptureClock();
 	size_t		global[3];
 	size_t		local[3];
 	cl_uint4	temp4;
@@ -168,12 +277,19 @@ DLL_EXPORT int fNCexecute_kernel(int argc, void *argv[])
 		//fprintf(pfile, "Info: start of fExecuteKernel. \n");
 		//fclose(pfile);
 
+		// Registered kernels are built on first use
+		result = fLazyKernel(argv_2_, argv_6_, argv_7_);
+
+		// Buffers spilled to host go back to the device before the launch
+		if (result >= 0) result = fResidencyLaunch(*argv_2_, NULL, argv_6_, argv_7_);
+
 		temp4 = (*(cl_uint4 *) argv[4]);
 		global[0] = temp4.s[0];
 		global[1] = temp4.s[1];
 		global[2] = temp4.s[2];
 
-		if (*(cl_bool *) argv[3]) // use local?
+		// A failure above skips the launch, but is still captured below
+		if (result >= 0 && *(cl_bool *) argv[3]) // use local?
 		{
 			temp4 = (*(cl_uint4 *) argv[5]);
 			local[0] = temp4.s[0];
@@ -188,7 +304,7 @@ DLL_EXPORT int fNCexecute_kernel(int argc, void *argv[])
 									argv_6_,		// verbose
 									argv_7_);		// log_file
 		}
-		else
+		else if (result >= 0)
 		{
 			result = fExecuteKernel(argv_0_,		// command queue
 									argv_2_,		// kernel
@@ -201,6 +317,7 @@ DLL_EXPORT int fNCexecute_kernel(int argc, void *argv[])
 
 	}
 
+	fCaptureCall(CAPTURE_EXECUTE_KERNEL, argc, argv, result, start);
 	return(result);
 
 
@@ -210,6 +327,7 @@ DLL_EXPORT int fNCexecute_kernel(int argc, void *argv[])
 DLL_EXPORT int fNCread_buffer(int argc, void *argv[])
 {
 	int result;
+	double start = fCaptureClock();
 
 	if (argc != 6)
 	{
@@ -219,21 +337,29 @@ DLL_EXPORT int fNCread_buffer(int argc, void *argv[])
 	{
 
 		cl_command_queue*	argv_0_ = *(cl_command_queue **) argv[0];
-		cl_mem*				argv_1_ = &buffers[*(cl_uint *) argv[1]];
+		char*				argv_5_ = (*(idls *) argv[5]).s;
+		cl_mem*				argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[4], argv_5_);
 		void*				argv_2_ = argv[2];
 		cl_ulong			argv_3_ = *(cl_ulong *) argv[3];
 		cl_bool				argv_4_ = *(cl_bool *) argv[4];
-		char*				argv_5_ = (*(idls *) argv[5]).s;
 
-		//command_queue is a global variable defined above
-		result = fReadBuffer(argv_0_,	// command queue*
-							 argv_1_,	// cl_mem
-							 argv_2_,	// data pointer
-							 argv_3_,	// data size
-							 argv_4_,	// verbose
-							 argv_5_);	// log_file
+		if (argv_1_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			//command_queue is a global variable defined above
+			result = fReadBuffer(argv_0_,	// command queue*
+								 argv_1_,	// cl_mem
+								 argv_2_,	// data pointer
+								 argv_3_,	// data size
+								 argv_4_,	// verbose
+								 argv_5_);	// log_file
+		}
 	}
 
+	fCaptureCall(CAPTURE_READ_BUFFER, argc, argv, result, start);
 	return(result);
 }
 
@@ -247,6 +373,7 @@ DLL_EXPORT int fNCread_image(int argc, void *argv[])
 DLL_EXPORT int fNCrelease_buffer(int argc, void *argv[])
 {
 	int result;
+	double start = fCaptureClock();
 
 	if (argc != 3)
 	{
@@ -259,12 +386,21 @@ DLL_EXPORT int fNCrelease_buffer(int argc, void *argv[])
 		cl_bool	argv_1_ = *(cl_bool *) argv[1];
 		char*	argv_2_ = (*(idls *) argv[2]).s;
 
-		//command_queue is a global variable defined above
-		result = fReleaseBuffer(argv_0_,	// cl_mem
-								argv_1_,	// verbose
-								argv_2_);	// log_file
+		if (fResidencyRelease(&buffers[*(cl_uint*) argv[0]]))
+		{
+			// spilled to host, there is no device buffer left
+			result = 0;
+		}
+		else
+		{
+			//command_queue is a global variable defined above
+			result = fReleaseBuffer(argv_0_,	// cl_mem
+									argv_1_,	// verbose
+									argv_2_);	// log_file
+		}
 	}
 
+	fCaptureCall(CAPTURE_RELEASE_BUFFER, argc, argv, result, start);
 	return(result);
 
 }
@@ -296,6 +432,7 @@ DLL_EXPORT int fNCrelease_image(int argc, void *argv[])
 DLL_EXPORT int fNCrelease_command_queue(int argc, void *argv[])
 {
 	int result;
+	double start = fCaptureClock();
 
 	if (argc != 3)
 	{
@@ -312,6 +449,7 @@ DLL_EXPORT int fNCrelease_command_queue(int argc, void *argv[])
 
 	}
 
+	fCaptureCall(CAPTURE_RELEASE_QUEUE, argc, argv, result, start);
 	return(result);
 
 }
@@ -319,6 +457,7 @@ DLL_EXPORT int fNCrelease_command_queue(int argc, void *argv[])
 DLL_EXPORT int fNCrelease_kernels(int argc, void *argv[])
 {
 	int result;
+	double start = fCaptureClock();
 			
 	if (argc != 4)
 	{
@@ -337,6 +476,7 @@ DLL_EXPORT int fNCrelease_kernels(int argc, void *argv[])
 
 	}
 
+	fCaptureCall(CAPTURE_RELEASE_KERNELS, argc, argv, result, start);
 	return(result);
 
 }
@@ -344,6 +484,7 @@ DLL_EXPORT int fNCrelease_kernels(int argc, void *argv[])
 DLL_EXPORT int fNCset_kernel_arg(int argc, void * argv[])
 {
 	int 		result;
+	double		start = fCaptureClock();
 	void* 		argv_4_;
 	
 	if (argc != 8)
@@ -353,32 +494,57 @@ DLL_EXPORT int fNCset_kernel_arg(int argc, void * argv[])
 	else
 	{
 		cl_kernel*	argv_0_ = *(cl_kernel **) argv[0];
-		cl_kernel	argv_1_ = argv_0_[*(cl_uint *) argv[1]];
 		cl_uint		argv_2_ = *(cl_uint *) argv[2];
 		cl_ulong	argv_3_ = *(cl_ulong *) argv[3];
 		cl_bool		argv_6_ = *(cl_bool *) argv[6];
 		char*		argv_7_ = (*(idls *) argv[7]).s;
 
-		if (*(cl_bool *) argv[5]) // is argv[4] data or cl_mem
-		{
-			// cl_mem
-			argv_4_ = (void *) &buffers[*(cl_uint *) argv[4]];
-		}
-		else
+		// Registered kernels are built on first use; a failure is still captured
+		result = fLazyKernel(&argv_0_[*(cl_uint *) argv[1]], argv_6_, argv_7_);
+
+		if (result >= 0)
 		{
-			// data
-			argv_4_ = (void *) argv[4];
-		}	
+			cl_kernel	argv_1_ = argv_0_[*(cl_uint *) argv[1]];
+
+			if (*(cl_bool *) argv[5]) // is argv[4] data or cl_mem
+			{
+				// cl_mem
+				argv_4_ = (void *) fResident(*(cl_uint *) argv[4], CL_FALSE, argv_6_, argv_7_);
+			}
+			else
+			{
+				// data
+				argv_4_ = (void *) argv[4];
+			}	
 		
-		result = fSetKernelArg(argv_1_,	// kernel
-							   argv_2_,	// arg_index
-							   argv_3_,	// arg_size
-							   argv_4_,	// arg_value (void*)
-							   argv_6_,	// verbose
-							   argv_7_);// log_file
-
+			if (argv_4_ == NULL)
+			{
+				result = -2;
+			}
+			else if (*(cl_bool *) argv[5] && fSvmPointer(*(cl_mem *) argv_4_, NULL, NULL) != NULL)
+			{
+				// Shared virtual memory goes by its pointer
+				result = fSvmSetArg(argv_1_, argv_2_, *(cl_mem *) argv_4_, argv_6_, argv_7_);
+			}
+			else
+			{
+				result = fSetKernelArg(argv_1_,	// kernel
+									   argv_2_,	// arg_index
+									   argv_3_,	// arg_size
+									   argv_4_,	// arg_value (void*)
+									   argv_6_,	// verbose
+									   argv_7_);// log_file
+			}
+
+			// Remember the buffer to bring it back before the kernel runs
+			if (result >= 0)
+			{
+				fResidencyBindArg(argv_1_, argv_2_, *(cl_bool *) argv[5] ? *(cl_uint *) argv[4] : MAX_BUFFERS);
+			}
+		}
 	}
 
+	fCaptureCall(CAPTURE_SET_KERNEL_ARG, argc, argv, result, start);
 	return(result);
 
 }
@@ -391,6 +557,7 @@ DLL_EXPORT int fNCunload(int argc, void *argv[])
 DLL_EXPORT int fNCwrite_buffer(int argc, void *argv[])
 {
 	int result;
+	double start = fCaptureClock();
 
 	if (argc != 6)
 	{
@@ -398,21 +565,29 @@ DLL_EXPORT int fNCwrite_buffer(int argc, void *argv[])
 	} 
 	else
 	{
-		cl_mem*	argv_1_ = &buffers[*(cl_uint*) argv[1]];
 		char*	argv_5_ = (*(idls *) argv[5]).s;
+		cl_mem*	argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[4], argv_5_);
 
-		//command_queue is a global variable defined above
-		result = fWriteBuffer(	*(cl_command_queue **)	argv[0],	// command queue*
-														argv_1_,	// cl_mem*
-								 (	void			*)	argv[2],	// content
-								*(	cl_ulong		*)	argv[3],	// content_size
-								*(	cl_bool			*)	argv[4],	// verbose
-														argv_5_);	// log_file
+		if (argv_1_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			//command_queue is a global variable defined above
+			result = fWriteBuffer(	*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// cl_mem*
+									 (	void			*)	argv[2],	// content
+									*(	cl_ulong		*)	argv[3],	// content_size
+									*(	cl_bool			*)	argv[4],	// verbose
+															argv_5_);	// log_file
+		}
 
 		// Return address to input parameter
 		//*(cl_mem **) argv[1] = buffers;  
 	}
 
+	fCaptureCall(CAPTURE_WRITE_BUFFER, argc, argv, result, start);
 	return(result);
 
 
@@ -423,4 +598,1479 @@ DLL_EXPORT int fNCwrite_image(int argc, void *argv[])
 {
 
 	return(1);
-}
\ No newline at end of file
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sinogram preprocessing on resident buffers.
+//
+DLL_EXPORT int fNCsino_gather(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 9)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_8_ = (*(idls *) argv[8]).s;
+		cl_mem*	argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[7], argv_8_);
+		cl_mem*	argv_2_ = fResident(*(cl_uint *) argv[2], CL_FALSE, *(cl_bool *) argv[7], argv_8_);
+		cl_mem*	argv_3_ = fResident(*(cl_uint *) argv[3], CL_FALSE, *(cl_bool *) argv[7], argv_8_);
+
+		if (argv_1_ == NULL || argv_2_ == NULL || argv_3_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fSinoGather(	*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// full sinogram
+															argv_2_,	// subset sinogram
+															argv_3_,	// subset indices (int)
+									*(	cl_bool			*)	argv[4],	// use subset indices
+									*(	cl_uint4		*)	argv[5],	// size of the full sinogram
+									*(	cl_uint4		*)	argv[6],	// trim0, ntrim, nsubset, swap
+									*(	cl_bool			*)	argv[7],	// verbose
+															argv_8_);	// log_file
+		}
+	}
+
+	fCaptureCall(CAPTURE_SINO_GATHER, argc, argv, result, start);
+	return(result);
+
+}
+
+DLL_EXPORT int fNCsino_scatter(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 10)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_9_ = (*(idls *) argv[9]).s;
+		cl_mem*	argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[8], argv_9_);
+		cl_mem*	argv_2_ = fResident(*(cl_uint *) argv[2], CL_FALSE, *(cl_bool *) argv[8], argv_9_);
+		cl_mem*	argv_3_ = fResident(*(cl_uint *) argv[3], CL_FALSE, *(cl_bool *) argv[8], argv_9_);
+
+		if (argv_1_ == NULL || argv_2_ == NULL || argv_3_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fSinoScatter(	*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// subset sinogram
+															argv_2_,	// full sinogram
+															argv_3_,	// subset indices (int)
+									*(	cl_bool			*)	argv[4],	// use subset indices
+									*(	cl_uint4		*)	argv[5],	// size of the full sinogram
+									*(	cl_uint4		*)	argv[6],	// trim0, ntrim, nsubset, swap
+									*(	cl_bool			*)	argv[7],	// accumulate
+									*(	cl_bool			*)	argv[8],	// verbose
+															argv_9_);	// log_file
+		}
+	}
+
+	fCaptureCall(CAPTURE_SINO_SCATTER, argc, argv, result, start);
+	return(result);
+
+}
+
+DLL_EXPORT int fNCsino_swap(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 6)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_5_ = (*(idls *) argv[5]).s;
+		cl_mem*	argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[4], argv_5_);
+		cl_mem*	argv_2_ = fResident(*(cl_uint *) argv[2], CL_FALSE, *(cl_bool *) argv[4], argv_5_);
+
+		if (argv_1_ == NULL || argv_2_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fSinoSwap(	*(cl_command_queue **)	argv[0],	// command queue*
+														argv_1_,	// source
+														argv_2_,	// destination
+								*(	cl_uint4		*)	argv[3],	// size of the source
+								*(	cl_bool			*)	argv[4],	// verbose
+														argv_5_);	// log_file
+		}
+	}
+
+	fCaptureCall(CAPTURE_SINO_SWAP, argc, argv, result, start);
+	return(result);
+
+}
+
+DLL_EXPORT int fNCsino_rebin(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 7)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_6_ = (*(idls *) argv[6]).s;
+		cl_mem*	argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[5], argv_6_);
+		cl_mem*	argv_2_ = fResident(*(cl_uint *) argv[2], CL_FALSE, *(cl_bool *) argv[5], argv_6_);
+
+		if (argv_1_ == NULL || argv_2_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fSinoRebin(	*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// source
+															argv_2_,	// destination
+									*(	cl_uint4		*)	argv[3],	// size of the source
+									*(	cl_uint4		*)	argv[4],	// det_rebin, angle_rebin
+									*(	cl_bool			*)	argv[5],	// verbose
+															argv_6_);	// log_file
+		}
+	}
+
+	fCaptureCall(CAPTURE_SINO_REBIN, argc, argv, result, start);
+	return(result);
+
+}
+
+DLL_EXPORT int fNCrelease_sino(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_2_ = (*(idls *) argv[2]).s;
+
+		result = fReleaseSinoKernels(*(cl_command_queue **) argv[0],	// command queue*
+									 *(cl_bool *) argv[1],				// verbose
+												  argv_2_);				// log_file
+	}
+
+	return(result);
+
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Partial transfers and sub-buffers.
+//
+DLL_EXPORT int fNCread_buffer_region(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 7)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_command_queue*	argv_0_ = *(cl_command_queue **) argv[0];
+		char*				argv_6_ = (*(idls *) argv[6]).s;
+		cl_mem*				argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[5], argv_6_);
+
+		if (argv_1_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fReadBufferRegion(argv_0_,					// command queue*
+									   argv_1_,					// cl_mem
+									   argv[2],					// data pointer
+									   *(cl_ulong *) argv[3],	// offset (bytes)
+									   *(cl_ulong *) argv[4],	// data size (bytes)
+									   *(cl_bool *)  argv[5],	// verbose
+									   argv_6_);				// log_file
+		}
+	}
+
+	fCaptureCall(CAPTURE_READ_BUFFER_REGION, argc, argv, result, start);
+	return(result);
+}
+
+DLL_EXPORT int fNCwrite_buffer_region(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 7)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_command_queue*	argv_0_ = *(cl_command_queue **) argv[0];
+		char*				argv_6_ = (*(idls *) argv[6]).s;
+		cl_mem*				argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[5], argv_6_);
+
+		if (argv_1_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fWriteBufferRegion(argv_0_,				// command queue*
+										argv_1_,				// cl_mem
+										argv[2],				// data pointer
+										*(cl_ulong *) argv[3],	// offset (bytes)
+										*(cl_ulong *) argv[4],	// data size (bytes)
+										*(cl_bool *)  argv[5],	// verbose
+										argv_6_);				// log_file
+		}
+	}
+
+	fCaptureCall(CAPTURE_WRITE_BUFFER_REGION, argc, argv, result, start);
+	return(result);
+}
+
+DLL_EXPORT int fNCread_buffer_rect(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 9)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_command_queue*	argv_0_ = *(cl_command_queue **) argv[0];
+		char*				argv_8_ = (*(idls *) argv[8]).s;
+		cl_mem*				argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[7], argv_8_);
+
+		if (argv_1_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fReadBufferRect(argv_0_,				// command queue*
+									 argv_1_,				// cl_mem
+									 argv[2],				// data pointer
+									 (cl_ulong *) argv[3],	// buffer origin [3]
+									 (cl_ulong *) argv[4],	// host origin [3]
+									 (cl_ulong *) argv[5],	// region [3]
+									 (cl_ulong *) argv[6],	// buffer row/slice, host row/slice pitch [4]
+									 *(cl_bool *) argv[7],	// verbose
+									 argv_8_);				// log_file
+		}
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCwrite_buffer_rect(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 9)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_command_queue*	argv_0_ = *(cl_command_queue **) argv[0];
+		char*				argv_8_ = (*(idls *) argv[8]).s;
+		cl_mem*				argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[7], argv_8_);
+
+		if (argv_1_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fWriteBufferRect(argv_0_,				// command queue*
+									  argv_1_,				// cl_mem
+									  argv[2],				// data pointer
+									  (cl_ulong *) argv[3],	// buffer origin [3]
+									  (cl_ulong *) argv[4],	// host origin [3]
+									  (cl_ulong *) argv[5],	// region [3]
+									  (cl_ulong *) argv[6],	// buffer row/slice, host row/slice pitch [4]
+									  *(cl_bool *) argv[7],	// verbose
+									  argv_8_);				// log_file
+		}
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCcreate_sub_buffer(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 7)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_6_ = (*(idls *) argv[6]).s;
+		cl_mem*	argv_0_ = fResident(*(cl_uint *) argv[0], CL_TRUE, *(cl_bool *) argv[5], argv_6_);
+		cl_mem*	argv_1_ = &buffers[*(cl_uint *) argv[1]];
+
+		if (argv_0_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			// The slot gets a new object, the old buffer is no longer tracked
+			fResidencyRelease(argv_1_);
+
+			result = fCreateSubBuffer(argv_0_,					// parent cl_mem
+									  argv_1_,					// sub-buffer cl_mem
+									  *(cl_ulong *) argv[2],	// origin (bytes)
+									  *(cl_ulong *) argv[3],	// size (bytes)
+									  *(cl_int *)   argv[4],	// read_write
+									  *(cl_bool *)  argv[5],	// verbose
+									  argv_6_);					// log_file
+		}
+	}
+
+	return(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Buffer creation without a host upload.
+//
+DLL_EXPORT int fNCcreate_buffer_empty(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 6)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_mem*	argv_1_ = &buffers[*(cl_uint*) argv[1]];
+		char*	argv_5_ = (*(idls *) argv[5]).s;
+
+		result = fAllocateBuffer(	*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// cl_mem
+									*(	cl_ulong		*)	argv[2],	// content_size
+									*(	cl_int			*)	argv[3],	// read_write
+															0,			// uninitialized
+															NULL,		// pattern
+															0,			// pattern_size
+															NULL,		// source
+									*(	cl_bool			*)	argv[4],	// verbose
+															argv_5_);	// log_file
+	}
+
+	fCaptureCall(CAPTURE_CREATE_BUFFER_EMPTY, argc, argv, result, start);
+	return(result);
+}
+
+DLL_EXPORT int fNCcreate_buffer_fill(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 8)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_mem*	argv_1_ = &buffers[*(cl_uint*) argv[1]];
+		char*	argv_7_ = (*(idls *) argv[7]).s;
+
+		result = fAllocateBuffer(	*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// cl_mem
+									*(	cl_ulong		*)	argv[2],	// content_size
+									*(	cl_int			*)	argv[3],	// read_write
+															1,			// fill
+									 (	void			*)	argv[4],	// pattern
+									*(	cl_ulong		*)	argv[5],	// pattern_size
+															NULL,		// source
+									*(	cl_bool			*)	argv[6],	// verbose
+															argv_7_);	// log_file
+	}
+
+	fCaptureCall(CAPTURE_CREATE_BUFFER_FILL, argc, argv, result, start);
+	return(result);
+}
+
+DLL_EXPORT int fNCcreate_buffer_copy(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 7)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_mem*	argv_1_ = &buffers[*(cl_uint*) argv[1]];
+		char*	argv_6_ = (*(idls *) argv[6]).s;
+		cl_mem*	argv_2_ = fResident(*(cl_uint *) argv[2], CL_FALSE, *(cl_bool *) argv[5], argv_6_);
+
+		if (argv_2_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fAllocateBuffer(	*(cl_command_queue **)	argv[0],	// command queue*
+																argv_1_,	// cl_mem
+										*(	cl_ulong		*)	argv[3],	// content_size, 0 = size of source
+										*(	cl_int			*)	argv[4],	// read_write
+																2,			// copy
+																NULL,		// pattern
+																0,			// pattern_size
+																argv_2_,	// source
+										*(	cl_bool			*)	argv[5],	// verbose
+																argv_6_);	// log_file
+		}
+	}
+
+	fCaptureCall(CAPTURE_CREATE_BUFFER_COPY, argc, argv, result, start);
+	return(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Geometry generation.
+//
+DLL_EXPORT int fNCgeom_srclocs(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 14)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_bool	argv_3_  = *(cl_bool *) argv[3];
+		char*	argv_13_ = (*(idls *) argv[13]).s;
+		cl_mem*	argv_1_  = argv_3_ ? fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[12], argv_13_) : NULL;
+		cl_bool	argv_10_ = *(cl_ulong *) argv[11] != 0 && *(cl_int *) argv[10] >= 0;
+
+		if (argv_3_ && argv_1_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fGeomSourceLocations(	*(cl_command_queue **)	argv[0],	// command queue*
+																	argv_1_,	// cl_mem, if to_device
+											 (	cl_float		*)	argv[2],	// srclocs (4 x nsubset), if not to_device
+																	argv_3_,	// to_device
+											 (	cl_float		*)	argv[4],	// tube angles
+											 (	cl_float		*)	argv[5],	// tablepos (nrangles x ndetplanes)
+											 (	cl_float		*)	argv[6],	// align
+											 (	cl_float		*)	argv[7],	// zalign
+											*(	cl_ulong		*)	argv[8],	// nrangles
+											*(	cl_uint			*)	argv[9],	// ndetplanes
+								argv_10_ ?	 (	cl_int			*)	argv[10] : NULL,	// subset, -1 = all
+											*(	cl_ulong		*)	argv[11],	// nsubset
+											*(	cl_bool			*)	argv[12],	// verbose
+																	argv_13_);	// log_file
+		}
+	}
+
+	fCaptureCall(CAPTURE_GEOM_SRCLOCS, argc, argv, result, start);
+	return(result);
+}
+
+DLL_EXPORT int fNCgeom_motion(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 9)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_bool	argv_3_ = *(cl_bool *) argv[3];
+		char*	argv_8_ = (*(idls *) argv[8]).s;
+		cl_mem*	argv_1_ = argv_3_ ? fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[7], argv_8_) : NULL;
+		cl_bool	argv_5_ = *(cl_ulong *) argv[6] != 0 && *(cl_int *) argv[5] >= 0;
+
+		if (argv_3_ && argv_1_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fGeomMotionMatrices(	*(cl_command_queue **)	argv[0],	// command queue*
+																	argv_1_,	// cl_mem, if to_device
+											 (	cl_float		*)	argv[2],	// matrices (4 x 4 x nsubset), if not to_device
+																	argv_3_,	// to_device
+											 (	cl_float		*)	argv[4],	// rigmotion (6 x nrangles)
+								argv_5_ ?	 (	cl_int			*)	argv[5] : NULL,	// subset, -1 = all
+											*(	cl_ulong		*)	argv[6],	// nsubset
+											*(	cl_bool			*)	argv[7],	// verbose
+																	argv_8_);	// log_file
+		}
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCgeom_detector(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 9)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_8_ = (*(idls *) argv[8]).s;
+
+		result = fGeomDetectorFan(*(cl_uint *)  argv[0],	// nchannels
+								  *(cl_uint *)  argv[1],	// ndetplanes
+								   (cl_float *) argv[2],	// fan_coroffset, fanangle, focus2detector, focus2center, zfactor
+								   (cl_float *) argv[3],	// tablepos[0, *]
+								   (cl_float *) argv[4],	// detcols0 (out)
+								   (cl_float *) argv[5],	// detrows0 (out)
+								   (cl_float *) argv[6],	// detplanes0 (out)
+								  *(cl_bool *)  argv[7],	// verbose
+								  argv_8_);					// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCgeom_initial_coords(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 11)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_10_ = (*(idls *) argv[10]).s;
+
+		result = fGeomInitialCoords( (cl_float *) argv[0],	// detcols0
+									 (cl_float *) argv[1],	// detrows0
+									*(cl_uint *)  argv[2],	// number of detcols0
+									 (cl_float *) argv[3],	// detplanes0
+									*(cl_uint *)  argv[4],	// number of detplanes0
+									 (cl_float *) argv[5],	// center [3]
+									 (cl_float *) argv[6],	// source [3]
+									*(cl_bool *)  argv[7],	// bin centers instead of boundaries
+									 (cl_float *) argv[8],	// initial_coords (out)
+									*(cl_bool *)  argv[9],	// verbose
+									argv_10_);				// log_file
+	}
+
+	return(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Deformation field warping (nonrigid motion states).
+//
+DLL_EXPORT int fNCwarp_set_state(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 6)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_5_ = (*(idls *) argv[5]).s;
+
+		result = fWarpSetState(	*(cl_command_queue **)	argv[0],	// command queue*
+								*(	cl_uint			*)	argv[1],	// motion state
+								 (	cl_float		*)	argv[2],	// field (fx, fy, fz, 3)
+								*(	cl_uint4		*)	argv[3],	// fx, fy, fz, half
+								*(	cl_bool			*)	argv[4],	// verbose
+														argv_5_);	// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCwarp(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 9)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_8_ = (*(idls *) argv[8]).s;
+		cl_mem*	argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[7], argv_8_);
+		cl_mem*	argv_2_ = fResident(*(cl_uint *) argv[2], CL_FALSE, *(cl_bool *) argv[7], argv_8_);
+
+		if (argv_1_ == NULL || argv_2_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fWarpApply(	*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// source image
+															argv_2_,	// destination image
+									*(	cl_uint			*)	argv[3],	// motion state
+									*(	cl_uint4		*)	argv[4],	// nx, ny, nz, -
+									*(	cl_bool			*)	argv[5],	// adjoint
+									*(	cl_bool			*)	argv[6],	// accumulate
+									*(	cl_bool			*)	argv[7],	// verbose
+															argv_8_);	// log_file
+		}
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCwarp_compose(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 7)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_6_ = (*(idls *) argv[6]).s;
+
+		result = fWarpCompose(	*(cl_command_queue **)	argv[0],	// command queue*
+								*(	cl_uint			*)	argv[1],	// output state
+								*(	cl_uint			*)	argv[2],	// first warp
+								*(	cl_uint			*)	argv[3],	// second warp
+								*(	cl_uint4		*)	argv[4],	// nx, ny, nz, -
+								*(	cl_bool			*)	argv[5],	// verbose
+														argv_6_);	// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCwarp_bind_state(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 5)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_mem*	argv_2_ = &buffers[*(cl_uint*) argv[2]];
+		char*	argv_4_ = (*(idls *) argv[4]).s;
+
+		// The slot gets a new object, the old buffer is no longer tracked
+		fResidencyRelease(argv_2_);
+
+		result = fWarpBindState(*(cl_command_queue **) argv[0],	// command queue*
+								*(cl_uint *) argv[1],			// motion state
+											 argv_2_,			// cl_mem
+								*(cl_bool *) argv[3],			// verbose
+											 argv_4_);			// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCrelease_warp(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_2_ = (*(idls *) argv[2]).s;
+
+		result = fReleaseWarp(*(cl_command_queue **) argv[0],	// command queue*
+							  *(cl_bool *) argv[1],				// verbose
+										   argv_2_);			// log_file
+	}
+
+	return(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Multiresolution: shared command queues and resampling between levels.
+//
+DLL_EXPORT int fNCcreate_command_queue_shared(int argc, void *argv[])
+{
+	int					result;
+	double				start = fCaptureClock();
+	cl_command_queue*	cq_ptr;
+
+	if (argc != 4)
+	{
+		result = -1;
+	}
+	else
+	{
+		cq_ptr = (cl_command_queue *) malloc (sizeof(cl_command_queue));
+
+		char* argv_3_ = (*(idls *) argv[3]).s;
+
+		result = fCreateCommandQueueShared(							cq_ptr,		// command queue*
+											*(	cl_command_queue **)	argv[1],	// queue to share the context with
+											*(	cl_bool *)				argv[2],	// verbose
+																		argv_3_);	// log_file
+
+		// Return address to input parameter
+		*(cl_command_queue **) argv[0] = cq_ptr;
+	}
+
+	fCaptureCall(CAPTURE_CREATE_QUEUE_SHARED, argc, argv, result, start);
+	return(result);
+}
+
+DLL_EXPORT int fNCresample_down(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 8)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_7_ = (*(idls *) argv[7]).s;
+		cl_mem*	argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[6], argv_7_);
+		cl_mem*	argv_2_ = fResident(*(cl_uint *) argv[2], CL_FALSE, *(cl_bool *) argv[6], argv_7_);
+
+		if (argv_1_ == NULL || argv_2_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fResampleDown(	*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// source
+															argv_2_,	// destination
+									*(	cl_uint4		*)	argv[3],	// size of the source
+									*(	cl_uint4		*)	argv[4],	// factor per axis
+									*(	cl_bool			*)	argv[5],	// average (1) or sum (0)
+									*(	cl_bool			*)	argv[6],	// verbose
+															argv_7_);	// log_file
+		}
+	}
+
+	fCaptureCall(CAPTURE_RESAMPLE_DOWN, argc, argv, result, start);
+	return(result);
+}
+
+DLL_EXPORT int fNCresample_up(int argc, void *argv[])
+{
+	int result;
+	double start = fCaptureClock();
+
+	if (argc != 8)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_7_ = (*(idls *) argv[7]).s;
+		cl_mem*	argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[6], argv_7_);
+		cl_mem*	argv_2_ = fResident(*(cl_uint *) argv[2], CL_FALSE, *(cl_bool *) argv[6], argv_7_);
+
+		if (argv_1_ == NULL || argv_2_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fResampleUp(	*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// source
+															argv_2_,	// destination
+									*(	cl_uint4		*)	argv[3],	// size of the source
+									*(	cl_uint4		*)	argv[4],	// size of the destination
+									*(	cl_float		*)	argv[5],	// scale
+									*(	cl_bool			*)	argv[6],	// verbose
+															argv_7_);	// log_file
+		}
+	}
+
+	fCaptureCall(CAPTURE_RESAMPLE_UP, argc, argv, result, start);
+	return(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Cached sparse system matrix.
+//
+DLL_EXPORT int fNCsysmat_record_begin(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 7)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_mem*	argv_1_ = &buffers[*(cl_uint*) argv[1]];
+		cl_mem*	argv_2_ = &buffers[*(cl_uint*) argv[2]];
+		char*	argv_6_ = (*(idls *) argv[6]).s;
+
+		// The slot gets a new object, the old buffer is no longer tracked
+		fResidencyRelease(argv_1_);
+		fResidencyRelease(argv_2_);
+
+		result = fSysmatRecordBegin(*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// coordinate list (out)
+															argv_2_,	// counter (out)
+									*(	cl_ulong		*)	argv[3],	// capacity (coefficients)
+									*(	cl_ulong		*)	argv[4],	// memory budget, 0 = default
+									*(	cl_bool			*)	argv[5],	// verbose
+															argv_6_);	// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCsysmat_build(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 12)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_11_ = (*(idls *) argv[11]).s;
+		cl_mem*	argv_1_  = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[10], argv_11_);
+		cl_mem*	argv_2_  = fResident(*(cl_uint *) argv[2], CL_FALSE, *(cl_bool *) argv[10], argv_11_);
+
+		if (argv_1_ == NULL || argv_2_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fSysmatBuild(	*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// coordinate list
+															argv_2_,	// counter
+									*(	cl_ulong		*)	argv[3],	// rows (sinogram bins)
+									*(	cl_ulong		*)	argv[4],	// columns (voxels)
+									*(	cl_ulong		*)	argv[5],	// rows per view
+									(	cl_ulong		*)	argv[6],	// key [SYSMAT_KEY_SIZE]
+									*(	cl_bool			*)	argv[7],	// half precision weights
+									*(	cl_int			*)	argv[8],	// placement: 0 auto, 1 device, 2 host
+									*(	cl_ulong		*)	argv[9],	// memory budget, 0 = default
+									*(	cl_bool			*)	argv[10],	// verbose
+															argv_11_);	// log_file
+		}
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCsysmat_project(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 11)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_10_ = (*(idls *) argv[10]).s;
+		cl_mem*	argv_1_  = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[9], argv_10_);
+		cl_mem*	argv_2_  = fResident(*(cl_uint *) argv[2], CL_FALSE, *(cl_bool *) argv[9], argv_10_);
+		cl_mem*	argv_3_  = fResident(*(cl_uint *) argv[3], CL_FALSE, *(cl_bool *) argv[9], argv_10_);
+
+		if (argv_1_ == NULL || argv_2_ == NULL || argv_3_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fSysmatProject(*(cl_command_queue **)	argv[0],	// command queue*
+															argv_1_,	// input
+															argv_2_,	// output
+															argv_3_,	// subset views (int)
+									*(	cl_bool			*)	argv[4],	// use subset
+									*(	cl_ulong		*)	argv[5],	// number of views
+									(	cl_ulong		*)	argv[6],	// key [SYSMAT_KEY_SIZE]
+									*(	cl_bool			*)	argv[7],	// transpose (back projection)
+									*(	cl_bool			*)	argv[8],	// accumulate
+									*(	cl_bool			*)	argv[9],	// verbose
+															argv_10_);	// log_file
+		}
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCsysmat_status(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 4)
+	{
+		result = -1;
+	}
+	else
+	{
+		result = fSysmatStatus(	*(cl_command_queue **)	argv[0],	// command queue*
+								(	cl_int			*)	argv[1],	// status (out)
+								(	cl_ulong		*)	argv[2],	// rows, columns, rows per view (out)
+								(	cl_ulong		*)	argv[3]);	// key [SYSMAT_KEY_SIZE] (out)
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCrelease_sysmat(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_2_ = (*(idls *) argv[2]).s;
+
+		result = fReleaseSysmat(*(cl_command_queue **) argv[0],	// command queue*
+								*(cl_bool *) argv[1],				// verbose
+											 argv_2_);				// log_file
+	}
+
+	return(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Projection server shared by IDL sessions.
+//
+DLL_EXPORT int fNCserver_run(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_0_ = (*(idls *) argv[0]).s;
+		char*	argv_2_ = (*(idls *) argv[2]).s;
+
+		result = fServerRun(argv_0_,					// socket path
+							*(cl_bool *) argv[1],		// verbose
+							argv_2_);					// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCserver_connect(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_0_ = (*(idls *) argv[0]).s;
+		char*	argv_2_ = (*(idls *) argv[2]).s;
+
+		result = fClientConnect(argv_0_,				// socket path
+								*(cl_bool *) argv[1],	// verbose
+								argv_2_);				// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCserver_disconnect(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_2_ = (*(idls *) argv[2]).s;
+
+		result = fClientDisconnect(	*(cl_bool *) argv[0],	// stop the server
+									*(cl_bool *) argv[1],	// verbose
+									argv_2_);				// log_file
+	}
+
+	return(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Workload capture and replay.
+//
+DLL_EXPORT int fNCcapture_start(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 5)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_0_ = (*(idls *) argv[0]).s;
+		char* argv_4_ = (*(idls *) argv[4]).s;
+
+		result = fCaptureStart(	argv_0_,				// trace file
+								*(cl_int *)  argv[1],	// content: 0 full, 1 hashed, 2 sampled
+								*(cl_uint *) argv[2],	// keep every n-th word when sampled
+								*(cl_bool *) argv[3],	// verbose
+								argv_4_);				// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCcapture_stop(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 2)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_1_ = (*(idls *) argv[1]).s;
+
+		result = fCaptureStop(	*(cl_bool *) argv[0],	// verbose
+								argv_1_);				// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCreplay(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 7)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_0_ = (*(idls *) argv[0]).s;
+		char* argv_2_ = (*(idls *) argv[2]).s;
+		char* argv_3_ = (*(idls *) argv[3]).s;
+		char* argv_6_ = (*(idls *) argv[6]).s;
+
+		result = fReplayTrace(	argv_0_,				// trace file
+								*(cl_int *)  argv[1],	// force_cpu of the queues, -1 as recorded
+								argv_2_,				// kernel directory, "" for the recorded sources
+								argv_3_,				// report file, "" for stdout
+								*(cl_bool *) argv[4],	// JSON report
+								*(cl_bool *) argv[5],	// verbose
+								argv_6_);				// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCmemory_budget(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_2_ = (*(idls *) argv[2]).s;
+
+		result = fResidencyBudget(	*(cl_ulong *) argv[0],	// bytes per device, 0 = global memory
+									*(cl_bool *)  argv[1],	// verbose
+									argv_2_);				// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCmemory_status(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 4)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_3_ = (*(idls *) argv[3]).s;
+
+		result = fResidencyStatus(	*(cl_command_queue **) argv[0],	// command queue*
+									(cl_ulong *) argv[1],			// status[8] (out)
+									*(cl_bool *) argv[2],			// verbose
+									argv_3_);						// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCarena_alloc(int argc, void *argv[])
+{
+	int		result;
+	void*	ptr = NULL;
+
+	if (argc != 5)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_4_ = (*(idls *) argv[4]).s;
+
+		result = fArenaAlloc(	*(cl_ulong *) argv[0],	// size (bytes)
+								*(cl_bool *)  argv[1],	// huge pages
+								&ptr,					// block
+								*(cl_bool *)  argv[3],	// verbose
+								argv_4_);				// log_file
+
+		// Address of the block as ULONG64
+		*(cl_ulong *) argv[2] = (cl_ulong)(size_t) ptr;
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCarena_free(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		result = fArenaFree((void *)(size_t) *(cl_ulong *) argv[0]);
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCarena_status(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 4)
+	{
+		result = -1;
+	}
+	else
+	{
+		// Pooled blocks go back to the system first when asked
+		if (*(cl_bool *) argv[1]) fArenaTrim();
+
+		result = fArenaStatus((cl_ulong *) argv[0]);	// status[4] (out)
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCbuffer_in_place(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 4)
+	{
+		result = -1;
+	}
+	else
+	{
+		char*	argv_3_ = (*(idls *) argv[3]).s;
+		cl_mem*	argv_1_ = fResident(*(cl_uint *) argv[1], CL_FALSE, *(cl_bool *) argv[2], argv_3_);
+
+		if (argv_1_ == NULL)
+		{
+			result = -2;
+		}
+		else
+		{
+			result = fArenaInPlace(	*(cl_command_queue **) argv[0],	// command queue*
+									*argv_1_,						// cl_mem
+									*(cl_bool *) argv[2],			// verbose
+									argv_3_);						// log_file
+		}
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCcreate_buffer_svm(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 8)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_mem*	argv_1_ = &buffers[*(cl_uint*) argv[1]];
+		char*	argv_7_ = (*(idls *) argv[7]).s;
+
+		// The slot gets a new object, the old buffer is no longer tracked
+		fResidencyRelease(argv_1_);
+
+		result = fSvmCreate(*(cl_command_queue **) argv[0],	// command queue*
+							argv_1_,						// cl_mem
+							(void *) argv[2],				// content (NULL: none)
+							*(cl_ulong *) argv[3],			// content_size
+							*(cl_int *) argv[4],			// read_write
+							*(cl_uint *) argv[5],			// mode (SVM_*, 0 = fastest)
+							*(cl_bool *) argv[6],			// verbose
+							argv_7_);						// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCexecute_kernel_tiled(int argc, void *argv[])
+{
+	int			result;
+	double		start = fCaptureClock();
+	size_t		global[3];
+	size_t		local[3];
+	cl_uint4	temp4;
+
+	if (argc != 11)
+	{
+		result = -1;
+	}
+	else
+	{
+		cl_command_queue*	argv_0_ = *(cl_command_queue **) argv[0];
+		cl_kernel*			argv_1_ = *(cl_kernel **) argv[1];
+		cl_kernel*			argv_2_ = &argv_1_[*(cl_uint *) argv[2]];
+		cl_bool				argv_9_ = *(cl_bool *) argv[9];
+		char*				argv_10_ = (*(idls *) argv[10]).s;
+
+		// Registered kernels are built on first use; fTileExecute brings the
+		// spilled buffers back and keeps them on the device until fTileWait
+		result = fLazyKernel(argv_2_, argv_9_, argv_10_);
+
+		temp4 = (*(cl_uint4 *) argv[4]);
+		global[0] = temp4.s[0];
+		global[1] = temp4.s[1];
+		global[2] = temp4.s[2];
+
+		temp4 = (*(cl_uint4 *) argv[5]);
+		local[0] = temp4.s[0];
+		local[1] = temp4.s[1];
+		local[2] = temp4.s[2];
+
+		if (result >= 0)
+		{
+			result = fTileExecute(argv_0_,								// command queue
+								  argv_2_,								// kernel
+								  (cl_uint)(3),							// work dimension
+								  global,								// global size
+								  *(cl_bool *) argv[3] ? local : NULL,	// local size (use local?)
+								  *(cl_ulong *) argv[6],				// slices per tile (0 = adaptive)
+								  *(cl_uint *) argv[7],					// tiles in flight (0 = 2)
+								  *(cl_bool *) argv[8],					// wait
+								  argv_9_,								// verbose
+								  argv_10_);							// log_file
+		}
+	}
+
+	fCaptureCall(CAPTURE_EXECUTE_KERNEL_TILED, argc, argv, result, start);
+	return(result);
+}
+
+DLL_EXPORT int fNCtile_progress(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 2)
+	{
+		result = -1;
+	}
+	else
+	{
+		result = fTileProgress(	*(cl_command_queue **) argv[0],	// command queue*
+								(cl_ulong *) argv[1]);			// status[4] (out)
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCtile_cancel(int argc, void *argv[])
+{
+	int		result;
+	double	start = fCaptureClock();
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_2_ = (*(idls *) argv[2]).s;
+
+		result = fTileCancel(	*(cl_command_queue **) argv[0],	// command queue*
+								*(cl_bool *) argv[1],			// verbose
+								argv_2_);						// log_file
+	}
+
+	fCaptureCall(CAPTURE_TILE_CANCEL, argc, argv, result, start);
+	return(result);
+}
+
+DLL_EXPORT int fNCtile_wait(int argc, void *argv[])
+{
+	int		result;
+	double	start = fCaptureClock();
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_2_ = (*(idls *) argv[2]).s;
+
+		result = fTileWait(	*(cl_command_queue **) argv[0],	// command queue*
+							*(cl_bool *) argv[1],			// verbose
+							argv_2_);						// log_file
+	}
+
+	fCaptureCall(CAPTURE_TILE_WAIT, argc, argv, result, start);
+	return(result);
+}
+
+DLL_EXPORT int fNCplan(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 6)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_5_ = (*(idls *) argv[5]).s;
+
+		result = fPlan(	*(cl_command_queue **) argv[0],	// command queue*
+						(cl_ulong *) argv[1],			// nrcols, nrrows, nrplanes, ndetcols, ndetplanes, nrangles
+						(cl_uint *)  argv[2],			// subsets (0 = recommend), det_rebin, angle_rebin
+						(double *)   argv[3],			// plan[PLAN_N] (out)
+						*(cl_bool *) argv[4],			// verbose
+						argv_5_);						// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCplan_sample(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 8)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_7_ = (*(idls *) argv[7]).s;
+
+		result = fPlanSample(	*(cl_command_queue **) argv[0],	// command queue*
+								*(cl_bool *)  argv[1],			// back projection
+								(cl_ulong *)  argv[2],			// dims, nrangles = views of the launch
+								*(double *)   argv[3],			// seconds
+								*(cl_ulong *) argv[4],			// transfer bytes, 0 if not measured
+								*(double *)   argv[5],			// transfer seconds
+								*(cl_bool *)  argv[6],			// verbose
+								argv_7_);						// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCplan_load(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_0_ = (*(idls *) argv[0]).s;
+		char* argv_2_ = (*(idls *) argv[2]).s;
+
+		result = fPlanLoad(	argv_0_,				// calibration file
+							*(cl_bool *) argv[1],	// verbose
+							argv_2_);				// log_file
+	}
+
+	return(result);
+}
+
+DLL_EXPORT int fNCplan_save(int argc, void *argv[])
+{
+	int result;
+
+	if (argc != 3)
+	{
+		result = -1;
+	}
+	else
+	{
+		char* argv_0_ = (*(idls *) argv[0]).s;
+		char* argv_2_ = (*(idls *) argv[2]).s;
+
+		result = fPlanSave(	argv_0_,				// calibration file
+							*(cl_bool *) argv[1],	// verbose
+							argv_2_);				// log_file
+	}
+
+	return(result);
+}
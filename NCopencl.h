@@ -57,4 +57,85 @@ DLL_EXPORT int fNCwrite_buffer(int argc, void* argv[]);
 DLL_EXPORT int fNCcreate_image(int argc, void *argv[]);
 DLL_EXPORT int fNCrelease_image(int argc, void *argv[]);
 DLL_EXPORT int fNCread_image(int argc, void *argv[]);
-DLL_EXPORT int fNCwrite_image(int argc, void *argv[]);
\ No newline at end of file
+DLL_EXPORT int fNCwrite_image(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCsino_gather(int argc, void *argv[]);
+DLL_EXPORT int fNCsino_scatter(int argc, void *argv[]);
+DLL_EXPORT int fNCsino_swap(int argc, void *argv[]);
+DLL_EXPORT int fNCsino_rebin(int argc, void *argv[]);
+DLL_EXPORT int fNCrelease_sino(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCread_buffer_region(int argc, void *argv[]);
+DLL_EXPORT int fNCwrite_buffer_region(int argc, void *argv[]);
+DLL_EXPORT int fNCread_buffer_rect(int argc, void *argv[]);
+DLL_EXPORT int fNCwrite_buffer_rect(int argc, void *argv[]);
+DLL_EXPORT int fNCcreate_sub_buffer(int argc, void *argv[]);
+DLL_EXPORT int fNCcreate_buffer_empty(int argc, void *argv[]);
+DLL_EXPORT int fNCcreate_buffer_fill(int argc, void *argv[]);
+DLL_EXPORT int fNCcreate_buffer_copy(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCgeom_srclocs(int argc, void *argv[]);
+DLL_EXPORT int fNCgeom_motion(int argc, void *argv[]);
+DLL_EXPORT int fNCgeom_detector(int argc, void *argv[]);
+DLL_EXPORT int fNCgeom_initial_coords(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCwarp_set_state(int argc, void *argv[]);
+DLL_EXPORT int fNCwarp(int argc, void *argv[]);
+DLL_EXPORT int fNCwarp_compose(int argc, void *argv[]);
+DLL_EXPORT int fNCwarp_bind_state(int argc, void *argv[]);
+DLL_EXPORT int fNCrelease_warp(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCcreate_command_queue_shared(int argc, void *argv[]);
+DLL_EXPORT int fNCresample_down(int argc, void *argv[]);
+DLL_EXPORT int fNCresample_up(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCsysmat_record_begin(int argc, void *argv[]);
+DLL_EXPORT int fNCsysmat_build(int argc, void *argv[]);
+DLL_EXPORT int fNCsysmat_project(int argc, void *argv[]);
+DLL_EXPORT int fNCsysmat_status(int argc, void *argv[]);
+DLL_EXPORT int fNCrelease_sysmat(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCserver_run(int argc, void *argv[]);
+DLL_EXPORT int fNCserver_connect(int argc, void *argv[]);
+DLL_EXPORT int fNCserver_disconnect(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCregister_kernels(int argc, void *argv[]);
+DLL_EXPORT int fNCdevice_caps(int argc, void *argv[]);
+DLL_EXPORT int fNCselect_device(int argc, void *argv[]);
+DLL_EXPORT int fNCnative_threads(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCcapture_start(int argc, void *argv[]);
+DLL_EXPORT int fNCcapture_stop(int argc, void *argv[]);
+DLL_EXPORT int fNCreplay(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCmemory_budget(int argc, void *argv[]);
+DLL_EXPORT int fNCmemory_status(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCarena_alloc(int argc, void *argv[]);
+DLL_EXPORT int fNCarena_free(int argc, void *argv[]);
+DLL_EXPORT int fNCarena_status(int argc, void *argv[]);
+DLL_EXPORT int fNCbuffer_in_place(int argc, void *argv[]);
+DLL_EXPORT int fNCcreate_buffer_svm(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCexecute_kernel_tiled(int argc, void *argv[]);
+DLL_EXPORT int fNCtile_progress(int argc, void *argv[]);
+DLL_EXPORT int fNCtile_cancel(int argc, void *argv[]);
+DLL_EXPORT int fNCtile_wait(int argc, void *argv[]);
+
+//
+DLL_EXPORT int fNCplan(int argc, void *argv[]);
+DLL_EXPORT int fNCplan_sample(int argc, void *argv[]);
+DLL_EXPORT int fNCplan_load(int argc, void *argv[]);
+DLL_EXPORT int fNCplan_save(int argc, void *argv[]);
\ No newline at end of file
@@ -0,0 +1,579 @@
+// NCopencl.hpp : C++ interface of the library, for programs that link it.
+// Move-only owners of the queue, buffers, kernels and events, over the same
+// internals as the fNC entry points (device selection, the native and server
+// backends, kernel specialization), without argv packing or idls strings.
+// The context and device of OpenCL queues are kept for programs that also
+// call OpenCL directly, and nothing is logged unless the session was opened
+// with a log file.
+//
+// The internals are only exported from the shared library on Unix; on
+// Windows, build the library sources into the program instead.
+//
+// Errors are the negative codes of the entry points, returned by every call.
+// Buffers are owned by the program, not kept in buffers[] slots: they are
+// not moved to the host by the residency accounting, and captures and
+// replays do not see them.
+//
+//	ncocl::Session	session;
+//	ncocl::Program	program;
+//	ncocl::Buffer	volume;
+//
+//	session.open(0);
+//	session.build(program, "forward.cl", "forward");
+//	session.create(volume, &image[0], image.size() * sizeof(float));
+//
+//	ncocl::Kernel forward = program.kernel(0);
+//	session.launch(forward, ncocl::NDRange(nrcols, nrrows), ncocl::NDRange(), volume, scale, n);
+//	session.read(volume, &image[0], image.size() * sizeof(float));
+//
+
+
+#pragma once
+
+#include "NCopencl.h"
+
+#include <string>
+#include <vector>
+
+// Internals used by the classes, as declared in NCopencl_help.h
+int fCreateCommandQueue(cl_command_queue* commands, cl_bool force_cpu, cl_bool verbose, char* log_file);
+int fCreateCommandQueueShared(cl_command_queue* commands, cl_command_queue* source, cl_bool verbose, char* log_file);
+int fReleaseCommandQueue(cl_command_queue* commands, cl_bool verbose, char* log_file);
+int fCreateBuffer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong content_size, cl_int read_write, cl_bool use_host_ptr, cl_bool verbose, char* log_file);
+int fAllocateBuffer(cl_command_queue* commands, cl_mem* mem_ptr, cl_ulong content_size, cl_int read_write, cl_int mode, void* pattern, cl_ulong pattern_size, cl_mem* source, cl_bool verbose, char* log_file);
+int fReleaseBuffer(cl_mem mem_ptr, cl_bool verbose, char* log_file);
+int fWriteBuffer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong content_size, cl_bool verbose, char* log_file);
+int fWriteBufferRegion(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong offset, cl_ulong content_size, cl_bool verbose, char* log_file);
+int fReadBuffer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong content_size, cl_bool verbose, char* log_file);
+int fReadBufferRegion(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong offset, cl_ulong content_size, cl_bool verbose, char* log_file);
+int fBuildKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl_ulong n_kernels, idls* file_paths, idls* function_names, idls* compile_options, cl_bool verbose, char* log_file);
+int fReleaseKernels(cl_kernel kernels[MAX_KERNELS], cl_int n_kernels, cl_bool verbose, char* log_file);
+int fSetKernelArg(cl_kernel kernel, cl_uint arg_index, cl_ulong arg_size, void* arg_value, cl_bool verbose, char* log_file);
+int fExecuteKernel(cl_command_queue* commands, cl_kernel* kernel, cl_uint work_dim, size_t* global, size_t* local, cl_bool verbose, char* log_file);
+#define TILE_NONE		0	// states of Session::progress
+#define TILE_RUNNING	1
+#define TILE_DONE		2
+#define TILE_CANCELLED	3
+#define TILE_FAILED		4
+
+int fTileExecute(cl_command_queue* commands, cl_kernel* kernel, cl_uint work_dim, size_t* global, size_t* local, cl_ulong tile, cl_uint in_flight,
+				 cl_bool wait, cl_bool verbose, char* log_file);
+int fTileWait(cl_command_queue* commands, cl_bool verbose, char* log_file);
+int fTileProgress(cl_command_queue* commands, cl_ulong* status);
+int fTileCancel(cl_command_queue* commands, cl_bool verbose, char* log_file);
+cl_kernel fSpecKernel(cl_kernel kernel, cl_bool verbose, char* log_file);
+cl_bool fNativeQueue(cl_command_queue* commands);
+cl_bool fNativeKernel(cl_kernel kernel);
+cl_bool fClientActive();
+
+namespace ncocl
+{
+
+inline char* fNoLog()
+{
+	static char none[1] = "";
+	return(none);
+}
+
+class Session;
+class Program;
+
+///////////////////////////////////////////////////////////////////////////////
+// Global or local work size of a launch, one to three dimensions. The
+// default local size leaves it to the runtime.
+//
+struct NDRange
+{
+	cl_uint	dims;
+	size_t	size[3];
+
+	NDRange() : dims(0) { size[0] = size[1] = size[2] = 1; }
+	NDRange(size_t x) : dims(1) { size[0] = x; size[1] = size[2] = 1; }
+	NDRange(size_t x, size_t y) : dims(2) { size[0] = x; size[1] = y; size[2] = 1; }
+	NDRange(size_t x, size_t y, size_t z) : dims(3) { size[0] = x; size[1] = y; size[2] = z; }
+};
+
+// Local memory argument of the given size in bytes
+struct Local
+{
+	size_t	bytes;
+
+	explicit Local(size_t n) : bytes(n) {}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Device buffer, released with the object.
+//
+class Buffer
+{
+public:
+	Buffer() : mem_(NULL), size_(0) {}
+	~Buffer() { release(); }
+
+	Buffer(Buffer&& other) : mem_(other.mem_), size_(other.size_) { other.mem_ = NULL; other.size_ = 0; }
+	Buffer& operator=(Buffer&& other)
+	{
+		if (this != &other)
+		{
+			release();
+			mem_ = other.mem_; size_ = other.size_;
+			other.mem_ = NULL; other.size_ = 0;
+		}
+		return(*this);
+	}
+	Buffer(const Buffer&) = delete;
+	Buffer& operator=(const Buffer&) = delete;
+
+	int release()
+	{
+		int result = 0;
+
+		if (mem_ != NULL) result = fReleaseBuffer(mem_, CL_FALSE, fNoLog());
+		mem_ = NULL;
+		size_ = 0;
+		return(result);
+	}
+
+	cl_mem		handle() const { return(mem_); }
+	cl_ulong	size() const { return(size_); }
+	bool		valid() const { return(mem_ != NULL); }
+
+private:
+	friend class Session;
+
+	cl_mem		mem_;
+	cl_ulong	size_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// One reference to a kernel, with typed argument setters. Kernels of the
+// native backend are not reference counted and must not outlive their
+// Program.
+//
+class Kernel
+{
+public:
+	Kernel() : kernel_(NULL), owned_(false) {}
+	explicit Kernel(cl_kernel kernel) : kernel_(kernel), owned_(false)
+	{
+		if (kernel_ != NULL && !fNativeKernel(kernel_) && !fClientActive())
+		{
+			owned_ = clRetainKernel(kernel_) == CL_SUCCESS;
+		}
+	}
+	~Kernel() { release(); }
+
+	Kernel(Kernel&& other) : kernel_(other.kernel_), owned_(other.owned_) { other.kernel_ = NULL; other.owned_ = false; }
+	Kernel& operator=(Kernel&& other)
+	{
+		if (this != &other)
+		{
+			release();
+			kernel_ = other.kernel_; owned_ = other.owned_;
+			other.kernel_ = NULL; other.owned_ = false;
+		}
+		return(*this);
+	}
+	Kernel(const Kernel&) = delete;
+	Kernel& operator=(const Kernel&) = delete;
+
+	void release()
+	{
+		if (owned_) clReleaseKernel(kernel_);
+		kernel_ = NULL;
+		owned_ = false;
+	}
+
+	// Scalar or vector argument (cl_float, cl_uint4, ...)
+	template <typename T>
+	int set(cl_uint index, const T& value)
+	{
+		return(fSetKernelArg(kernel_, index, sizeof(T), (void*) &value, CL_FALSE, fNoLog()));
+	}
+
+	int set(cl_uint index, const Buffer& buffer)
+	{
+		cl_mem mem = buffer.handle();
+		return(fSetKernelArg(kernel_, index, sizeof(cl_mem), &mem, CL_FALSE, fNoLog()));
+	}
+
+	int set(cl_uint index, const Local& local)
+	{
+		return(fSetKernelArg(kernel_, index, local.bytes, NULL, CL_FALSE, fNoLog()));
+	}
+
+	// Arguments first, first + 1, ... in order
+	int set_args(cl_uint) { return(0); }
+
+	template <typename T, typename... Rest>
+	int set_args(cl_uint first, const T& value, const Rest&... rest)
+	{
+		int result = set(first, value);
+		if (result < 0) return(result);
+		return(set_args(first + 1, rest...));
+	}
+
+	cl_kernel	handle() const { return(kernel_); }
+	bool		valid() const { return(kernel_ != NULL); }
+
+private:
+	cl_kernel	kernel_;
+	bool		owned_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Kernels built together (fBuildKernels), released with the object.
+//
+class Program
+{
+public:
+	Program() : kernels_(NULL), n_kernels_(0) {}
+	~Program() { release(); }
+
+	Program(Program&& other) : kernels_(other.kernels_), n_kernels_(other.n_kernels_) { other.kernels_ = NULL; other.n_kernels_ = 0; }
+	Program& operator=(Program&& other)
+	{
+		if (this != &other)
+		{
+			release();
+			kernels_ = other.kernels_; n_kernels_ = other.n_kernels_;
+			other.kernels_ = NULL; other.n_kernels_ = 0;
+		}
+		return(*this);
+	}
+	Program(const Program&) = delete;
+	Program& operator=(const Program&) = delete;
+
+	int release()
+	{
+		int result = 0;
+
+		if (kernels_ != NULL)
+		{
+			result = fReleaseKernels(kernels_, (cl_int) n_kernels_, CL_FALSE, fNoLog());
+			delete[] kernels_;
+		}
+		kernels_ = NULL;
+		n_kernels_ = 0;
+		return(result);
+	}
+
+	Kernel		kernel(cl_uint index) const { return(Kernel(index < n_kernels_ ? kernels_[index] : NULL)); }
+	cl_uint		size() const { return(n_kernels_); }
+
+private:
+	friend class Session;
+
+	cl_kernel*	kernels_;
+	cl_uint		n_kernels_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Completion of an asynchronous launch, released with the object. Empty
+// (already complete) when the launch ran synchronously.
+//
+class Event
+{
+public:
+	Event() : event_(NULL) {}
+	~Event() { release(); }
+
+	Event(Event&& other) : event_(other.event_) { other.event_ = NULL; }
+	Event& operator=(Event&& other)
+	{
+		if (this != &other)
+		{
+			release();
+			event_ = other.event_;
+			other.event_ = NULL;
+		}
+		return(*this);
+	}
+	Event(const Event&) = delete;
+	Event& operator=(const Event&) = delete;
+
+	void release()
+	{
+		if (event_ != NULL) clReleaseEvent(event_);
+		event_ = NULL;
+	}
+
+	int wait()
+	{
+		if (event_ == NULL) return(0);
+		return(clWaitForEvents(1, &event_) == CL_SUCCESS ? 0 : -3);
+	}
+
+	// Device time from start to end (profiling queues), 0 if unknown
+	double seconds() const
+	{
+		cl_ulong start = 0, end = 0;
+
+		if (event_ == NULL) return(0.0);
+		clGetEventProfilingInfo(event_, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+		clGetEventProfilingInfo(event_, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+		return(end > start ? (end - start) * 1e-9 : 0.0);
+	}
+
+	cl_event	handle() const { return(event_); }
+
+private:
+	friend class Session;
+
+	cl_event	event_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Command queue on the selected device (fCreateCommandQueue), released with
+// the object.
+//
+class Session
+{
+public:
+	Session() : queue_(NULL), context_(NULL), device_(NULL), verbose_(CL_FALSE) {}
+	~Session() { close(); }
+
+	Session(Session&& other) : queue_(other.queue_), context_(other.context_), device_(other.device_),
+		verbose_(other.verbose_), log_(std::move(other.log_))
+	{
+		other.queue_ = NULL;
+	}
+	Session& operator=(Session&& other)
+	{
+		if (this != &other)
+		{
+			close();
+			queue_ = other.queue_; context_ = other.context_; device_ = other.device_;
+			verbose_ = other.verbose_; log_ = std::move(other.log_);
+			other.queue_ = NULL;
+		}
+		return(*this);
+	}
+	Session(const Session&) = delete;
+	Session& operator=(const Session&) = delete;
+
+	// force_cpu as fNCcreate_command_queue (0 auto, 1 CPU, 2 native);
+	// a log file turns verbose logging on for the session's calls
+	int open(cl_int force_cpu, const char* log_file = NULL)
+	{
+		close();
+		fLog(log_file);
+		queue_ = new cl_command_queue;
+		int result = fCreateCommandQueue(queue_, (cl_bool) force_cpu, verbose_, fLogFile());
+		return(fOpened(result));
+	}
+
+	// Queue on the context and device of another session
+	int share(const Session& other, const char* log_file = NULL)
+	{
+		close();
+		fLog(log_file);
+		queue_ = new cl_command_queue;
+		int result = fCreateCommandQueueShared(queue_, other.queue_, verbose_, fLogFile());
+		return(fOpened(result));
+	}
+
+	int close()
+	{
+		int result = 0;
+
+		if (queue_ != NULL)
+		{
+			result = fReleaseCommandQueue(queue_, verbose_, fLogFile());
+			delete queue_;
+		}
+		queue_ = NULL;
+		context_ = NULL;
+		device_ = NULL;
+		return(result);
+	}
+
+	// Buffer filled with content (fCreateBuffer); read_write 0/1/2 as the
+	// entry points
+	int create(Buffer& buffer, const void* content, cl_ulong bytes, cl_int read_write = 0, cl_bool use_host_ptr = CL_FALSE)
+	{
+		buffer.release();
+		int result = fCreateBuffer(queue_, &buffer.mem_, (void*) content, bytes, read_write, use_host_ptr, verbose_, fLogFile());
+		if (result >= 0) buffer.size_ = bytes;
+		else buffer.mem_ = NULL;
+		return(result);
+	}
+
+	// Buffer without host transfer, left uninitialized (fAllocateBuffer)
+	int allocate(Buffer& buffer, cl_ulong bytes, cl_int read_write = 0)
+	{
+		buffer.release();
+		int result = fAllocateBuffer(queue_, &buffer.mem_, bytes, read_write, 0, NULL, 0, NULL, verbose_, fLogFile());
+		if (result >= 0) buffer.size_ = bytes;
+		else buffer.mem_ = NULL;
+		return(result);
+	}
+
+	int write(Buffer& buffer, const void* content, cl_ulong bytes, cl_ulong offset = 0)
+	{
+		if (offset == 0) return(fWriteBuffer(queue_, &buffer.mem_, (void*) content, bytes, verbose_, fLogFile()));
+		return(fWriteBufferRegion(queue_, &buffer.mem_, (void*) content, offset, bytes, verbose_, fLogFile()));
+	}
+
+	int read(const Buffer& buffer, void* content, cl_ulong bytes, cl_ulong offset = 0)
+	{
+		cl_mem mem = buffer.mem_;
+
+		if (offset == 0) return(fReadBuffer(queue_, &mem, content, bytes, verbose_, fLogFile()));
+		return(fReadBufferRegion(queue_, &mem, content, offset, bytes, verbose_, fLogFile()));
+	}
+
+	template <typename T>
+	int write(Buffer& buffer, const std::vector<T>& content)
+	{
+		return(write(buffer, content.data(), content.size() * sizeof(T)));
+	}
+
+	template <typename T>
+	int read(const Buffer& buffer, std::vector<T>& content)
+	{
+		return(read(buffer, content.data(), content.size() * sizeof(T)));
+	}
+
+	// Kernels of one or more files and functions (fBuildKernels), with the
+	// program cache and embedded kernels as the entry points
+	int build(Program& program, const std::vector<std::string>& files, const std::vector<std::string>& functions,
+			  const std::vector<std::string>& options = std::vector<std::string>())
+	{
+		std::vector<idls>	file_paths;
+		std::vector<idls>	function_names;
+		std::vector<idls>	compile_options;
+
+		if (files.size() != functions.size() || functions.empty() || functions.size() > MAX_KERNELS) return(-1);
+
+		for (size_t ii = 0; ii < functions.size(); ii++)
+		{
+			file_paths.push_back(fString(files[ii]));
+			function_names.push_back(fString(functions[ii]));
+			compile_options.push_back(fString(ii < options.size() ? options[ii] : std::string()));
+		}
+
+		program.release();
+		program.kernels_ = new cl_kernel[MAX_KERNELS]();
+		int result = fBuildKernels(queue_, program.kernels_, functions.size(), &file_paths[0], &function_names[0],
+								   &compile_options[0], verbose_, fLogFile());
+		if (result < 0)
+		{
+			delete[] program.kernels_;
+			program.kernels_ = NULL;
+			return(result);
+		}
+		program.n_kernels_ = (cl_uint) functions.size();
+		return(result);
+	}
+
+	int build(Program& program, const std::string& file, const std::string& function, const std::string& options = std::string())
+	{
+		return(build(program, std::vector<std::string>(1, file), std::vector<std::string>(1, function), std::vector<std::string>(1, options)));
+	}
+
+	// Launch and wait (fExecuteKernel), with the kernel's current arguments
+	int launch(Kernel& kernel, const NDRange& global, const NDRange& local = NDRange())
+	{
+		cl_kernel	handle = kernel.handle();
+		size_t		global_size[3] = {global.size[0], global.size[1], global.size[2]};
+		size_t		local_size[3] = {local.size[0], local.size[1], local.size[2]};
+
+		return(fExecuteKernel(queue_, &handle, global.dims, global_size, local.dims ? local_size : NULL, verbose_, fLogFile()));
+	}
+
+	// Set arguments 0, 1, ... then launch and wait
+	template <typename... Args>
+	int launch(Kernel& kernel, const NDRange& global, const NDRange& local, const Args&... args)
+	{
+		int result = kernel.set_args(0, args...);
+		if (result < 0) return(result);
+		return(launch(kernel, global, local));
+	}
+
+	// Launch in tiles along the last dimension larger than 1 (fTileExecute):
+	// tile slices per tile, 0 sized for about 50 ms. Without wait, follow
+	// with progress, cancel and wait_tiles before touching the kernel.
+	int launch_tiled(Kernel& kernel, const NDRange& global, const NDRange& local = NDRange(), cl_ulong tile = 0, cl_uint in_flight = 2,
+					 bool wait = true)
+	{
+		cl_kernel	handle = kernel.handle();
+		size_t		global_size[3] = {global.size[0], global.size[1], global.size[2]};
+		size_t		local_size[3] = {local.size[0], local.size[1], local.size[2]};
+
+		return(fTileExecute(queue_, &handle, global.dims, global_size, local.dims ? local_size : NULL, tile, in_flight,
+							wait ? CL_TRUE : CL_FALSE, verbose_, fLogFile()));
+	}
+
+	// status[4]: slices done, slices in total, state (TILE_*), slices per tile
+	int progress(cl_ulong status[4]) const { return(fTileProgress(queue_, status)); }
+	int cancel() { return(fTileCancel(queue_, verbose_, fLogFile())); }
+	int wait_tiles() { return(fTileWait(queue_, verbose_, fLogFile())); }
+
+	// Launch without waiting; the event completes with the kernel. The
+	// native and server backends run it synchronously (empty event).
+	int enqueue(Kernel& kernel, const NDRange& global, const NDRange& local, Event& event)
+	{
+		event.release();
+		if (context_ == NULL) return(launch(kernel, global, local));
+
+		cl_int error = clEnqueueNDRangeKernel(*queue_, fSpecKernel(kernel.handle(), verbose_, fLogFile()), global.dims, NULL,
+											  global.size, local.dims ? local.size : NULL, 0, NULL, &event.event_);
+		return(error == CL_SUCCESS ? 0 : -3);
+	}
+
+	int finish()
+	{
+		if (context_ == NULL) return(0);
+		return(clFinish(*queue_) == CL_SUCCESS ? 0 : -3);
+	}
+
+	cl_command_queue*	queue() const { return(queue_); }
+	cl_context			context() const { return(context_); }
+	cl_device_id		device() const { return(device_); }
+
+private:
+	static idls fString(const std::string& s)
+	{
+		idls	str;
+
+		str.slen	= (short) s.size();
+		str.stype	= 0;
+		str.s		= (char*) s.c_str();
+		return(str);
+	}
+
+	void fLog(const char* log_file)
+	{
+		verbose_ = log_file != NULL && log_file[0] != '\0';
+		log_ = verbose_ ? log_file : "";
+	}
+
+	char* fLogFile() { return(verbose_ ? &log_[0] : fNoLog()); }
+
+	// Context and device of OpenCL queues (not native or server ones); a
+	// NULL context also sends enqueue and finish to the synchronous path
+	int fOpened(int result)
+	{
+		if (result < 0)
+		{
+			delete queue_;
+			queue_ = NULL;
+			return(result);
+		}
+		if (!fClientActive() && !fNativeQueue(queue_))
+		{
+			clGetCommandQueueInfo(*queue_, CL_QUEUE_CONTEXT, sizeof(cl_context), &context_, NULL);
+			clGetCommandQueueInfo(*queue_, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device_, NULL);
+		}
+		return(result);
+	}
+
+	cl_command_queue*	queue_;
+	cl_context			context_;
+	cl_device_id		device_;
+	cl_bool				verbose_;
+	std::string			log_;
+};
+
+}
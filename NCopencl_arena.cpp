@@ -0,0 +1,249 @@
+// NCopencl_arena.cpp : Host arena for CL_MEM_USE_HOST_PTR buffers.
+// Runtimes only use host memory in place when it is aligned to the device
+// (CL_DEVICE_MEM_BASE_ADDR_ALIGN, in practice the page); IDL arrays are not,
+// so the use_host_ptr path silently copies. The arena hands out page aligned
+// blocks, on Linux optionally backed by transparent huge pages, that IDL
+// wraps as arrays (NCOCL_ARENA_ARRAY in NCopencl_dlm.cpp) or C callers use
+// directly.
+//
+// Freed blocks stay in the pool and are reused by later allocations of up to
+// twice their size; fArenaTrim gives them back to the system.
+// fArenaInPlace tells whether a buffer really uses its host memory: the
+// mapping of an in-place buffer returns the host pointer itself.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <mutex>
+#include <vector>
+
+#ifdef WIN32
+	#include <malloc.h>
+#else
+	#include <stdlib.h>
+	#include <sys/mman.h>
+#endif
+
+#define ARENA_PAGE		4096
+#define ARENA_HUGE_PAGE	(2 * 1024 * 1024)
+
+typedef struct {
+	void*		ptr;
+	cl_ulong	size;
+	cl_bool		huge;
+	cl_bool		used;
+} arena_block;
+
+static std::mutex					arena_lock;
+static std::vector<arena_block>		arena;
+
+int fArenaAlloc(cl_ulong size, cl_bool huge, void** ptr, cl_bool verbose, char* log_file)
+{
+	std::lock_guard<std::mutex>	lock(arena_lock);
+	FILE*						pfile = NULL;
+	cl_ulong					align = huge ? ARENA_HUGE_PAGE : ARENA_PAGE;
+	cl_ulong					rounded = (size + align - 1) / align * align;
+	size_t						best = arena.size();
+
+	*ptr = NULL;
+	if (size == 0) return(-1);
+
+	// Smallest free block that fits, without wasting more than half of it
+	for (size_t ii = 0; ii < arena.size(); ii++)
+	{
+		if (!arena[ii].used && arena[ii].huge == huge && arena[ii].size >= rounded && arena[ii].size <= 2 * rounded &&
+			(best == arena.size() || arena[ii].size < arena[best].size))
+		{
+			best = ii;
+		}
+	}
+
+	if (best < arena.size())
+	{
+		arena[best].used = CL_TRUE;
+		*ptr = arena[best].ptr;
+
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: Arena block of %llu bytes reused for %llu bytes.\n", (unsigned long long) arena[best].size, (unsigned long long) size);
+			fclose(pfile);
+		}
+		return(0);
+	}
+
+	void* block = NULL;
+#ifdef WIN32
+	block = _aligned_malloc((size_t) rounded, (size_t) align);
+#else
+	if (posix_memalign(&block, (size_t) align, (size_t) rounded) != 0) block = NULL;
+#ifdef MADV_HUGEPAGE
+	if (block != NULL && huge) madvise(block, (size_t) rounded, MADV_HUGEPAGE);
+#endif
+#endif
+
+	if (block == NULL)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to allocate arena block of %llu bytes!\n", (unsigned long long) rounded);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+
+	arena_block entry;
+	entry.ptr	= block;
+	entry.size	= rounded;
+	entry.huge	= huge;
+	entry.used	= CL_TRUE;
+	arena.push_back(entry);
+	*ptr = block;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Arena block of %llu bytes allocated%s.\n", (unsigned long long) rounded, huge ? " (huge pages)" : "");
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+int fArenaFree(void* ptr)
+{
+	std::lock_guard<std::mutex> lock(arena_lock);
+
+	for (size_t ii = 0; ii < arena.size(); ii++)
+	{
+		if (arena[ii].ptr == ptr && arena[ii].used)
+		{
+			arena[ii].used = CL_FALSE;
+			return(0);
+		}
+	}
+
+	return(-1);
+}
+
+cl_ulong fArenaTrim(void)
+{
+	std::lock_guard<std::mutex>	lock(arena_lock);
+	cl_ulong					released = 0;
+
+	for (size_t ii = arena.size(); ii-- > 0;)
+	{
+		if (!arena[ii].used)
+		{
+#ifdef WIN32
+			_aligned_free(arena[ii].ptr);
+#else
+			free(arena[ii].ptr);
+#endif
+			released += arena[ii].size;
+			arena.erase(arena.begin() + ii);
+		}
+	}
+
+	return(released);
+}
+
+// status[4]: bytes in use, bytes pooled, blocks, bytes on huge pages
+int fArenaStatus(cl_ulong* status)
+{
+	std::lock_guard<std::mutex> lock(arena_lock);
+
+	status[0] = status[1] = status[2] = status[3] = 0;
+	for (size_t ii = 0; ii < arena.size(); ii++)
+	{
+		status[arena[ii].used ? 0 : 1] += arena[ii].size;
+		if (arena[ii].huge) status[3] += arena[ii].size;
+	}
+	status[2] = arena.size();
+
+	return(0);
+}
+
+cl_bool fArenaOwns(const void* ptr)
+{
+	std::lock_guard<std::mutex> lock(arena_lock);
+
+	for (size_t ii = 0; ii < arena.size(); ii++)
+	{
+		if ((const char*) ptr >= (const char*) arena[ii].ptr && (const char*) ptr < (const char*) arena[ii].ptr + arena[ii].size)
+		{
+			return(CL_TRUE);
+		}
+	}
+
+	return(CL_FALSE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 1 if the buffer works on its host memory, 0 if the runtime keeps a copy
+// (or the buffer has no host memory), negative on error.
+//
+int fArenaInPlace(cl_command_queue* commands, cl_mem mem, cl_bool verbose, char* log_file)
+{
+	cl_int			error;
+	void*			host = NULL;
+	size_t			size = 0;
+	FILE*			pfile = NULL;
+
+	if (mem == NULL) return(-1);
+
+	clGetMemObjectInfo(mem, CL_MEM_HOST_PTR, sizeof(host), &host, NULL);
+	clGetMemObjectInfo(mem, CL_MEM_SIZE, sizeof(size), &size, NULL);
+	if (host == NULL || size == 0) return(0);
+
+	void* mapped = clEnqueueMapBuffer(*commands, mem, CL_TRUE, CL_MAP_READ, 0, size, 0, NULL, NULL, &error);
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to map buffer! %d \n", error);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+	clEnqueueUnmapMemObject(*commands, mem, mapped, 0, NULL, NULL);
+	clFinish(*commands);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Host memory %s (%s, %s).\n", mapped == host ? "used in place" : "copied by the runtime",
+				(size_t) host % ARENA_PAGE == 0 ? "page aligned" : "not page aligned",
+				fArenaOwns(host) ? "arena" : "not arena");
+		fclose(pfile);
+	}
+
+	return(mapped == host ? 1 : 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Warn (verbose only) about use_host_ptr memory the runtime is likely to copy
+//
+void fArenaCheck(cl_command_queue* commands, const void* content, cl_bool verbose, char* log_file)
+{
+	cl_device_id	device_id;
+	cl_uint			align_bits = 0;
+	FILE*			pfile = NULL;
+
+	if (!verbose) return;
+
+	clGetCommandQueueInfo(*commands, CL_QUEUE_DEVICE, sizeof(device_id), &device_id, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(align_bits), &align_bits, NULL);
+
+	size_t align = align_bits / 8 > ARENA_PAGE ? align_bits / 8 : ARENA_PAGE;
+	if ((size_t) content % align != 0)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Warning: Host memory not aligned to %llu bytes, the runtime may copy it (use the arena).\n", (unsigned long long) align);
+		fclose(pfile);
+	}
+}
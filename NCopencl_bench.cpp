@@ -0,0 +1,372 @@
+// NCopencl_bench.cpp : Microbenchmark of the fNC entry points, called the way
+// IDL's call_external calls them (argc/argv, strings as idls), so the
+// wrapper's own overhead can be measured without an IDL session.
+//
+//   opencl_bench [-device auto|gpu|cpu|native|<name>] [-sizes n,n,...]
+//                [-reps n] [-json] [-out file] [-log file]
+//
+// Sizes are in bytes (default 4 KB to 64 MB). Every entry point is timed with
+// verbose off and on (logging to -log, default opencl_bench.log), buffers
+// with and without use_host_ptr. The results are written as CSV (or JSON) to
+// -out or stdout: latency per call (min, median, mean) in microseconds and,
+// for transfers, the throughput in MB/s. Any OpenCL runtime will do, a CPU
+// one such as PoCL included; with -device native the kernels are skipped.
+//
+
+
+#include "NCopencl.h"
+#ifndef WIN32
+	#include "NCopencl.hpp"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define BENCH_BUFFER 0
+
+typedef struct {
+	std::string		op;
+	cl_ulong		size;
+	cl_bool			verbose;
+	cl_bool			host_ptr;
+	int				reps;
+	double			min_us;
+	double			median_us;
+	double			mean_us;
+	double			mbps;
+} bench_result;
+
+static std::vector<bench_result>	results;
+static int							failures = 0;
+
+static const char* bench_source =
+	"__kernel void bench_scale(__global float* x, float a, uint n)\n"
+	"{\n"
+	"	size_t i = get_global_id(0);\n"
+	"	if (i < n) x[i] *= a;\n"
+	"}\n";
+
+static idls fString(const char* s)
+{
+	idls	str;
+
+	str.slen	= (short) strlen(s);
+	str.stype	= 0;
+	str.s		= (char*) s;
+	return(str);
+}
+
+static double fMicroseconds(std::chrono::steady_clock::time_point start)
+{
+	return(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+}
+
+static int fCheck(const char* what, int result)
+{
+	if (result < 0)
+	{
+		fprintf(stderr, "%s failed: %d\n", what, result);
+		failures++;
+	}
+	return(result);
+}
+
+// Summarize the timings of one configuration.
+static void fRecord(const char* op, cl_ulong size, cl_bool verbose, cl_bool host_ptr, std::vector<double>& times, cl_bool transfer)
+{
+	bench_result	result;
+	double			sum = 0.0;
+
+	if (times.empty()) return;
+
+	std::sort(times.begin(), times.end());
+	for (size_t ii = 0; ii < times.size(); ii++) sum += times[ii];
+
+	result.op			= op;
+	result.size			= size;
+	result.verbose		= verbose;
+	result.host_ptr		= host_ptr;
+	result.reps			= (int) times.size();
+	result.min_us		= times[0];
+	result.median_us	= times[times.size() / 2];
+	result.mean_us		= sum / times.size();
+	result.mbps			= transfer && result.median_us > 0.0 ? size / result.median_us : 0.0;
+	results.push_back(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// fNCcreate_buffer, fNCwrite_buffer and fNCread_buffer for one buffer size.
+//
+static void fBenchBuffers(void* queue, cl_ulong size, cl_bool verbose, cl_bool host_ptr, int reps, idls* log_file)
+{
+	std::vector<float>		host(size / sizeof(float) + 1, 1.0f);
+	std::vector<double>		times;
+	cl_uint					index = BENCH_BUFFER;
+	cl_int					read_write = 0;
+	void*					content = &host[0];
+	void*					args[8];
+	void*					release[3] = {&index, &verbose, log_file};
+
+	args[0] = &queue;	args[1] = &index;	args[2] = content;	args[3] = &size;
+	args[4] = &read_write;	args[5] = &host_ptr;	args[6] = &verbose;	args[7] = log_file;
+
+	for (int rr = 0; rr < reps; rr++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (fCheck("fNCcreate_buffer", fNCcreate_buffer(8, args)) < 0) return;
+		times.push_back(fMicroseconds(start));
+		if (rr < reps - 1) fNCrelease_buffer(3, release);
+	}
+	fRecord("fNCcreate_buffer", size, verbose, host_ptr, times, CL_TRUE);
+
+	// The last buffer stays for the transfers
+	args[4] = &verbose;
+	args[5] = log_file;
+
+	times.clear();
+	for (int rr = 0; rr < reps; rr++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (fCheck("fNCwrite_buffer", fNCwrite_buffer(6, args)) < 0) break;
+		times.push_back(fMicroseconds(start));
+	}
+	fRecord("fNCwrite_buffer", size, verbose, host_ptr, times, CL_TRUE);
+
+	times.clear();
+	for (int rr = 0; rr < reps; rr++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (fCheck("fNCread_buffer", fNCread_buffer(6, args)) < 0) break;
+		times.push_back(fMicroseconds(start));
+	}
+	fRecord("fNCread_buffer", size, verbose, host_ptr, times, CL_TRUE);
+
+	fNCrelease_buffer(3, release);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// fNCbuild_kernels, fNCset_kernel_arg and fNCexecute_kernel. The first build
+// compiles, later ones are served by the program cache; both are reported.
+//
+static void fBenchKernels(void* queue, std::vector<cl_ulong>& sizes, cl_bool verbose, int reps, const char* kernel_file, idls* log_file)
+{
+	std::vector<double>		times;
+	cl_kernel*				kernels = NULL;
+	cl_uint					n_kernels = 1;
+	idls					path = fString(kernel_file);
+	idls					name = fString("bench_scale");
+	idls					options = fString("");
+	void*					build[8] = {&queue, &kernels, &n_kernels, &path, &name, &options, &verbose, log_file};
+	void*					release[4] = {&kernels, &n_kernels, &verbose, log_file};
+
+	for (int rr = 0; rr <= reps; rr++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (fCheck("fNCbuild_kernels", fNCbuild_kernels(8, build)) < 0) return;
+		times.push_back(fMicroseconds(start));
+		if (rr == 0)
+		{
+			fRecord("fNCbuild_kernels (compile)", 0, verbose, CL_FALSE, times, CL_FALSE);
+			times.clear();
+		}
+		if (rr < reps) fNCrelease_kernels(4, release);
+	}
+	fRecord("fNCbuild_kernels (cached)", 0, verbose, CL_FALSE, times, CL_FALSE);
+
+	for (size_t ss = 0; ss < sizes.size(); ss++)
+	{
+		std::vector<float>	host(sizes[ss] / sizeof(float) + 1, 1.0f);
+		cl_uint				index = BENCH_BUFFER;
+		cl_int				read_write = 0;
+		cl_bool				host_ptr = CL_FALSE;
+		cl_ulong			size = sizes[ss];
+		void*				create[8] = {&queue, &index, &host[0], &size, &read_write, &host_ptr, &verbose, log_file};
+		void*				free_buffer[3] = {&index, &verbose, log_file};
+
+		if (fCheck("fNCcreate_buffer", fNCcreate_buffer(8, create)) < 0) break;
+
+		cl_uint				kernel_index = 0;
+		cl_uint				arg_index;
+		cl_ulong			arg_size;
+		cl_bool				is_mem;
+		cl_float			scale = 1.0f;
+		cl_uint				n = (cl_uint) (size / sizeof(float));
+		void*				arg[8] = {&kernels, &kernel_index, &arg_index, &arg_size, NULL, &is_mem, &verbose, log_file};
+
+		// cl_mem argument by buffer index, then the two scalars
+		times.clear();
+		for (int rr = 0; rr < reps; rr++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			arg_index = 0; arg_size = sizeof(cl_mem); arg[4] = &index; is_mem = CL_TRUE;
+			if (fCheck("fNCset_kernel_arg", fNCset_kernel_arg(8, arg)) < 0) break;
+			arg_index = 1; arg_size = sizeof(cl_float); arg[4] = &scale; is_mem = CL_FALSE;
+			fNCset_kernel_arg(8, arg);
+			arg_index = 2; arg_size = sizeof(cl_uint); arg[4] = &n;
+			fNCset_kernel_arg(8, arg);
+			times.push_back(fMicroseconds(start) / 3);
+		}
+		fRecord("fNCset_kernel_arg", size, verbose, host_ptr, times, CL_FALSE);
+
+#ifndef WIN32
+		// The scalars through the C++ interface, which never logs
+		if (!verbose)
+		{
+			ncocl::Kernel	cxx_kernel(kernels[kernel_index]);
+
+			times.clear();
+			for (int rr = 0; rr < reps; rr++)
+			{
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				cxx_kernel.set(1, scale);
+				cxx_kernel.set(2, n);
+				times.push_back(fMicroseconds(start) / 2);
+			}
+			fRecord("ncocl::Kernel::set", size, verbose, host_ptr, times, CL_FALSE);
+		}
+#endif
+
+		cl_bool		use_local = CL_FALSE;
+		cl_uint4	global = {{n, 1, 1, 0}};
+		cl_uint4	local = {{1, 1, 1, 0}};
+		void*		execute[8] = {&queue, &kernels, &kernel_index, &use_local, &global, &local, &verbose, log_file};
+
+		times.clear();
+		for (int rr = 0; rr < reps; rr++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			if (fCheck("fNCexecute_kernel", fNCexecute_kernel(8, execute)) < 0) break;
+			times.push_back(fMicroseconds(start));
+		}
+		fRecord("fNCexecute_kernel", size, verbose, host_ptr, times, CL_TRUE);
+
+		fNCrelease_buffer(3, free_buffer);
+	}
+
+	fNCrelease_kernels(4, release);
+}
+
+static void fWriteResults(FILE* out, cl_bool json)
+{
+	if (json) fprintf(out, "[\n");
+	else fprintf(out, "op,size_bytes,verbose,host_ptr,reps,min_us,median_us,mean_us,mb_per_s\n");
+
+	for (size_t ii = 0; ii < results.size(); ii++)
+	{
+		bench_result* r = &results[ii];
+		if (json)
+		{
+			fprintf(out, "  {\"op\": \"%s\", \"size_bytes\": %llu, \"verbose\": %d, \"host_ptr\": %d, \"reps\": %d, "
+						 "\"min_us\": %.3f, \"median_us\": %.3f, \"mean_us\": %.3f, \"mb_per_s\": %.1f}%s\n",
+					r->op.c_str(), (unsigned long long) r->size, r->verbose, r->host_ptr, r->reps,
+					r->min_us, r->median_us, r->mean_us, r->mbps, ii + 1 < results.size() ? "," : "");
+		}
+		else
+		{
+			fprintf(out, "%s,%llu,%d,%d,%d,%.3f,%.3f,%.3f,%.1f\n", r->op.c_str(), (unsigned long long) r->size,
+					r->verbose, r->host_ptr, r->reps, r->min_us, r->median_us, r->mean_us, r->mbps);
+		}
+	}
+
+	if (json) fprintf(out, "]\n");
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<cl_ulong>	sizes;
+	std::string				device = "auto";
+	std::string				log_path = "opencl_bench.log";
+	std::string				kernel_file = "opencl_bench.cl";
+	const char*				out_path = NULL;
+	cl_bool					json = CL_FALSE;
+	int						reps = 20;
+	FILE*					out = stdout;
+
+	for (int ii = 1; ii < argc; ii++)
+	{
+		std::string arg = argv[ii];
+		if (arg == "-json") json = CL_TRUE;
+		else if (arg == "-device" && ii + 1 < argc) device = argv[++ii];
+		else if (arg == "-reps" && ii + 1 < argc) reps = atoi(argv[++ii]);
+		else if (arg == "-out" && ii + 1 < argc) out_path = argv[++ii];
+		else if (arg == "-log" && ii + 1 < argc) log_path = argv[++ii];
+		else if (arg == "-sizes" && ii + 1 < argc)
+		{
+			for (char* s = strtok(argv[++ii], ","); s != NULL; s = strtok(NULL, ","))
+			{
+				sizes.push_back(strtoull(s, NULL, 10));
+			}
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-device auto|gpu|cpu|native|<name>] [-sizes n,n,...] [-reps n] [-json] [-out file] [-log file]\n", argv[0]);
+			return(1);
+		}
+	}
+	if (reps < 1) reps = 1;
+	if (sizes.empty())
+	{
+		for (cl_ulong size = 4096; size <= (64 << 20); size *= 16) sizes.push_back(size);
+	}
+
+	// The kernel is read from file, as the projectors' kernels are
+	FILE* source = fopen(kernel_file.c_str(), "w");
+	if (source == NULL)
+	{
+		fprintf(stderr, "Cannot write %s\n", kernel_file.c_str());
+		return(1);
+	}
+	fputs(bench_source, source);
+	fclose(source);
+
+	idls	log_file = fString(log_path.c_str());
+	cl_bool	force_cpu = device == "cpu" ? 1 : (device == "native" ? 2 : 0);
+
+	if (device != "auto" && device != "gpu" && device != "cpu" && device != "native")
+	{
+		cl_int	policy = 0;
+		cl_int	index = -1;
+		cl_bool	verbose = CL_FALSE;
+		idls	name = fString(device.c_str());
+		void*	select[5] = {&policy, &name, &index, &verbose, &log_file};
+
+		if (fCheck("fNCselect_device", fNCselect_device(5, select)) < 0) return(1);
+	}
+
+	// Verbose decides the queue properties (profiling), so one queue each
+	for (cl_bool verbose = CL_FALSE; verbose <= CL_TRUE; verbose++)
+	{
+		void*	queue = NULL;
+		void*	create[4] = {&queue, &force_cpu, &verbose, &log_file};
+		void*	release[3] = {&queue, &verbose, &log_file};
+
+		if (fCheck("fNCcreate_command_queue", fNCcreate_command_queue(4, create)) < 0) return(1);
+
+		for (size_t ss = 0; ss < sizes.size(); ss++)
+		{
+			fBenchBuffers(queue, sizes[ss], verbose, CL_FALSE, reps, &log_file);
+			fBenchBuffers(queue, sizes[ss], verbose, CL_TRUE, reps, &log_file);
+		}
+		if (force_cpu != 2) fBenchKernels(queue, sizes, verbose, reps, kernel_file.c_str(), &log_file);
+
+		fNCrelease_command_queue(3, release);
+	}
+
+	remove(kernel_file.c_str());
+
+	if (out_path != NULL)
+	{
+		out = fopen(out_path, "w");
+		if (out == NULL)
+		{
+			fprintf(stderr, "Cannot write %s\n", out_path);
+			return(1);
+		}
+	}
+	fWriteResults(out, json);
+	if (out != stdout) fclose(out);
+
+	return(failures > 0 ? 1 : 0);
+}
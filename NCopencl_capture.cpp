@@ -0,0 +1,708 @@
+// NCopencl_capture.cpp : Workload capture and replay. Between fCaptureStart
+// and fCaptureStop every call of the entry points below is appended to a
+// binary trace: its arguments, the kernel sources it builds, the host data it
+// uploads, the size and hash of the data it reads back, its result and how
+// long it took. fReplayTrace (or the opencl_replay executable) runs a trace
+// again, on any device, and compares the timings call type by call type.
+//
+// Uploaded data goes into the trace in full, as a hash only (replayed as
+// 1.0f words) or sampled (every n-th word, replayed repeated n times). Data
+// of up to CAPTURE_SMALL bytes (kernel argument values, fill patterns), of
+// read-only buffers (geometry, tables) and the geometry inputs is always kept
+// in full.
+//
+// Recorded: command queues, kernels and tiled launches (not their progress),
+// buffer creation / transfers / release, the sinogram preprocessing, the
+// pyramid resampling, the source locations and the native thread count.
+// Images, rectangular transfers, sub-buffers, motion matrices, warps and the
+// cached system matrix are not; buffers filled by them hold no data in a
+// replay.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define CAPTURE_MAGIC		0x4543415254434e4eULL	// "NNCTRACE"
+#define CAPTURE_VERSION		1
+#define CAPTURE_SMALL		256
+#define CAPTURE_NULL		3						// content mode of a NULL pointer
+#define CAPTURE_MAX_ARGS	16
+
+// Argument codes, one per argv element:
+//   q / k  command queue / kernels created by the call (handle out)
+//   Q / K  command queue / kernels used by the call
+//   i      4 byte scalar (cl_uint, cl_int, cl_bool, cl_float)
+//   l      cl_ulong
+//   v      16 byte vector (cl_uint4, cl_float4)
+//   S      idls string
+//   N      idls strings
+//   P      kernel file paths, with the file contents
+//   D      host data uploaded
+//   G      host data uploaded, always in full (geometry)
+//   O      host data read back
+// The op's size function gives the count of N and P and the bytes of D, G
+// and O. Every entry point ends in verbose and log file.
+typedef struct {
+	const char*	name;
+	int			argc;
+	const char*	codes;
+	int			(*function)(int argc, void* argv[]);
+	cl_ulong	(*size)(int arg, void* argv[]);
+} capture_op;
+
+static cl_ulong fSizeKernels(int /* arg */, void* argv[])
+{
+	return(*(cl_uint *) argv[2]);
+}
+
+static cl_ulong fSizeKernelArg(int /* arg */, void* argv[])
+{
+	return(*(cl_bool *) argv[5] ? sizeof(cl_uint) : *(cl_ulong *) argv[3]);
+}
+
+static cl_ulong fSizeBuffer(int /* arg */, void* argv[])
+{
+	return(*(cl_ulong *) argv[3]);
+}
+
+static cl_ulong fSizeFill(int /* arg */, void* argv[])
+{
+	return(*(cl_ulong *) argv[5]);
+}
+
+static cl_ulong fSizeRegion(int /* arg */, void* argv[])
+{
+	return(*(cl_ulong *) argv[4]);
+}
+
+static cl_ulong fSizeSrclocs(int arg, void* argv[])
+{
+	cl_ulong nrangles	= *(cl_ulong *) argv[8];
+	cl_ulong nsubset	= *(cl_ulong *) argv[11];
+
+	switch (arg)
+	{
+	case 2:		return(*(cl_bool *) argv[3] ? 0 : 4 * sizeof(cl_float) * nsubset);
+	case 5:		return(sizeof(cl_float) * nrangles * *(cl_uint *) argv[9]);
+	case 10:	return(nsubset != 0 && *(cl_int *) argv[10] >= 0 ? sizeof(cl_int) * nsubset : sizeof(cl_int));
+	default:	return(sizeof(cl_float) * nrangles);
+	}
+}
+
+static const capture_op capture_ops[CAPTURE_OPS] = {
+	{"build_kernels",				8,	"QkiPNNiS",			fNCbuild_kernels,				fSizeKernels},
+	{"register_kernels",			9,	"QkiPNNiiS",		fNCregister_kernels,			fSizeKernels},
+	{"create_command_queue",		4,	"qiiS",				fNCcreate_command_queue,		NULL},
+	{"create_command_queue_shared",	4,	"qQiS",				fNCcreate_command_queue_shared,	NULL},
+	{"release_command_queue",		3,	"QiS",				fNCrelease_command_queue,		NULL},
+	{"release_kernels",				4,	"KiiS",				fNCrelease_kernels,				NULL},
+	{"set_kernel_arg",				8,	"KiilDiiS",			fNCset_kernel_arg,				fSizeKernelArg},
+	{"execute_kernel",				8,	"QKiivviS",			fNCexecute_kernel,				NULL},
+	{"create_buffer",				8,	"QiDliiiS",			fNCcreate_buffer,				fSizeBuffer},
+	{"create_buffer_empty",			6,	"QiliiS",			fNCcreate_buffer_empty,			NULL},
+	{"create_buffer_fill",			8,	"QiliDliS",			fNCcreate_buffer_fill,			fSizeFill},
+	{"create_buffer_copy",			7,	"QiiliiS",			fNCcreate_buffer_copy,			NULL},
+	{"write_buffer",				6,	"QiDliS",			fNCwrite_buffer,				fSizeBuffer},
+	{"read_buffer",					6,	"QiOliS",			fNCread_buffer,					fSizeBuffer},
+	{"write_buffer_region",			7,	"QiDlliS",			fNCwrite_buffer_region,			fSizeRegion},
+	{"read_buffer_region",			7,	"QiOlliS",			fNCread_buffer_region,			fSizeRegion},
+	{"release_buffer",				3,	"iiS",				fNCrelease_buffer,				NULL},
+	{"sino_gather",					9,	"QiiiivviS",		fNCsino_gather,					NULL},
+	{"sino_scatter",				10,	"QiiiivviiS",		fNCsino_scatter,				NULL},
+	{"sino_swap",					6,	"QiiviS",			fNCsino_swap,					NULL},
+	{"sino_rebin",					7,	"QiivviS",			fNCsino_rebin,					NULL},
+	{"resample_down",				8,	"QiivviiS",			fNCresample_down,				NULL},
+	{"resample_up",					8,	"QiivviiS",			fNCresample_up,					NULL},
+	{"native_threads",				3,	"iiS",				fNCnative_threads,				NULL},
+	{"geom_srclocs",				14,	"QiOiGGGGliGliS",	fNCgeom_srclocs,				fSizeSrclocs},
+	{"execute_kernel_tiled",		11,	"QKiivvliiiS",		fNCexecute_kernel_tiled,		NULL},
+	{"tile_cancel",					3,	"QiS",				fNCtile_cancel,					NULL},
+	{"tile_wait",					3,	"QiS",				fNCtile_wait,					NULL},
+};
+
+static std::mutex							capture_lock;
+static std::atomic<bool>					capture_on(false);
+static FILE*								capture_file = NULL;
+static cl_int								capture_content = CAPTURE_CONTENT_FULL;
+static cl_uint								capture_sample = 1;
+static cl_ulong								capture_calls = 0;
+static std::chrono::steady_clock::time_point	capture_epoch;
+
+///////////////////////////////////////////////////////////////////////////////
+// FNV-1a over 8 byte words, then the tail bytes.
+//
+static cl_ulong fCaptureHash(const void* data, cl_ulong size)
+{
+	const unsigned char*	bytes = (const unsigned char*) data;
+	cl_ulong				hash = 0xcbf29ce484222325ULL;
+	cl_ulong				word;
+	cl_ulong				ii;
+
+	for (ii = 0; ii + 8 <= size; ii += 8)
+	{
+		memcpy(&word, bytes + ii, 8);
+		hash = (hash ^ word) * 0x100000001b3ULL;
+	}
+	for (; ii < size; ii++)
+	{
+		hash = (hash ^ bytes[ii]) * 0x100000001b3ULL;
+	}
+	return(hash);
+}
+
+static void fPut(const void* data, size_t size)
+{
+	fwrite(data, 1, size, capture_file);
+}
+
+static void fPutString(const char* s)
+{
+	cl_uint len = s != NULL ? (cl_uint) strlen(s) : 0;
+
+	fPut(&len, sizeof(len));
+	fPut(s, len);
+}
+
+static void fPutData(const void* data, cl_ulong size, cl_bool full)
+{
+	cl_int		mode = data == NULL ? CAPTURE_NULL : (full || size <= CAPTURE_SMALL ? CAPTURE_CONTENT_FULL : capture_content);
+	cl_ulong	hash = data != NULL ? fCaptureHash(data, size) : 0;
+
+	fPut(&size, sizeof(size));
+	fPut(&mode, sizeof(mode));
+	fPut(&hash, sizeof(hash));
+
+	if (mode == CAPTURE_CONTENT_FULL)
+	{
+		fPut(data, (size_t) size);
+	}
+	else if (mode == CAPTURE_CONTENT_SAMPLE)
+	{
+		const cl_uint*	words = (const cl_uint*) data;
+		cl_ulong		n_words = size / sizeof(cl_uint);
+
+		fPut(&capture_sample, sizeof(capture_sample));
+		for (cl_ulong ii = 0; ii < n_words; ii += capture_sample)
+		{
+			fPut(&words[ii], sizeof(cl_uint));
+		}
+	}
+}
+
+static void fPutFile(const char* path)
+{
+	FILE*				pfile = path != NULL ? fopen(path, "rb") : NULL;
+	std::vector<char>	source;
+	cl_ulong			size = 0;
+
+	if (pfile != NULL)
+	{
+		fseek(pfile, 0, SEEK_END);
+		size = (cl_ulong) ftell(pfile);
+		fseek(pfile, 0, SEEK_SET);
+		source.resize((size_t) size + 1);
+		size = (cl_ulong) fread(&source[0], 1, (size_t) size, pfile);
+		fclose(pfile);
+	}
+
+	// a name of the embedded registry has no file: size 0
+	fPut(&size, sizeof(size));
+	if (size > 0) fPut(&source[0], (size_t) size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Seconds since the capture started, the start time of a call; 0 when no
+// capture runs.
+//
+double fCaptureClock()
+{
+	if (!capture_on) return(0.0);
+	return(std::chrono::duration<double>(std::chrono::steady_clock::now() - capture_epoch).count());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Append a finished call to the trace. The entry point calls it after its
+// work, with the start time from fCaptureClock: input arguments are still in
+// argv, the handles it created and the data it read back are there now.
+//
+void fCaptureCall(cl_uint op, int argc, void* argv[], int result, double start)
+{
+	if (!capture_on || op >= CAPTURE_OPS || argc != capture_ops[op].argc) return;
+
+	double						seconds = fCaptureClock() - start;
+	const char*					codes = capture_ops[op].codes;
+	std::lock_guard<std::mutex>	lock(capture_lock);
+
+	if (capture_file == NULL) return;
+
+	fPut(&op, sizeof(op));
+	fPut(&result, sizeof(result));
+	fPut(&start, sizeof(start));
+	fPut(&seconds, sizeof(seconds));
+
+	for (int arg = 0; codes[arg] != 0; arg++)
+	{
+		char		code = codes[arg];
+		cl_ulong	size = capture_ops[op].size != NULL ? capture_ops[op].size(arg, argv) : 0;
+		cl_ulong	handle;
+
+		switch (code)
+		{
+		case 'q': case 'Q': case 'k': case 'K':
+			handle = (cl_ulong) (size_t) *(void **) argv[arg];
+			fPut(&handle, sizeof(handle));
+			break;
+		case 'i':
+			fPut(argv[arg], 4);
+			break;
+		case 'l':
+			fPut(argv[arg], 8);
+			break;
+		case 'v':
+			fPut(argv[arg], 16);
+			break;
+		case 'S':
+			fPutString((*(idls *) argv[arg]).s);
+			break;
+		case 'N':
+		case 'P':
+			for (cl_ulong ii = 0; ii < size; ii++)
+			{
+				char* s = ((idls *) argv[arg])[ii].s;
+				fPutString(s);
+				if (code == 'P') fPutFile(s);
+			}
+			break;
+		case 'D':
+		case 'G':
+			fPutData(argv[arg], size, code == 'G' || (op == CAPTURE_CREATE_BUFFER && *(cl_int *) argv[4] == 2));
+			break;
+		case 'O':
+			handle = argv[arg] != NULL && size > 0 && result >= 0 ? fCaptureHash(argv[arg], size) : 0;
+			fPut(&size, sizeof(size));
+			fPut(&handle, sizeof(handle));
+			break;
+		}
+	}
+	capture_calls++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start capturing into path (a trace running already is closed first).
+//
+int fCaptureStart(char* path, cl_int content, cl_uint sample, cl_bool verbose, char* log_file)
+{
+	FILE*						pfile = NULL;
+	cl_ulong					magic = CAPTURE_MAGIC;
+	cl_uint						version = CAPTURE_VERSION;
+	std::lock_guard<std::mutex>	lock(capture_lock);
+
+	if (content < CAPTURE_CONTENT_FULL || content > CAPTURE_CONTENT_SAMPLE)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Unknown capture content mode %d. \n", content);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+
+	if (capture_file != NULL) fclose(capture_file);
+	capture_on = false;
+
+	capture_file = fopen(path, "wb");
+	if (capture_file == NULL)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to open capture file %s. \n", path);
+			fclose(pfile);
+		}
+		return(-3);
+	}
+
+	capture_content	= content;
+	capture_sample	= sample > 0 ? sample : 1;
+	capture_calls	= 0;
+	capture_epoch	= std::chrono::steady_clock::now();
+
+	fPut(&magic, sizeof(magic));
+	fPut(&version, sizeof(version));
+	fPut(&capture_content, sizeof(capture_content));
+	fPut(&capture_sample, sizeof(capture_sample));
+	capture_on = true;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Capturing calls to %s (content %s). \n", path,
+				content == CAPTURE_CONTENT_FULL ? "full" : (content == CAPTURE_CONTENT_HASH ? "hashed" : "sampled"));
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+int fCaptureStop(cl_bool verbose, char* log_file)
+{
+	FILE*						pfile = NULL;
+	std::lock_guard<std::mutex>	lock(capture_lock);
+
+	capture_on = false;
+	if (capture_file == NULL) return(0);
+
+	fclose(capture_file);
+	capture_file = NULL;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Capture stopped after %llu calls. \n", (unsigned long long) capture_calls);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Replay.
+//
+typedef struct {
+	cl_ulong	calls;
+	cl_ulong	failed;
+	double		recorded;
+	double		replayed;
+} replay_stats;
+
+static bool fGet(FILE* pfile, void* data, size_t size)
+{
+	return(fread(data, 1, size, pfile) == size);
+}
+
+static bool fGetString(FILE* pfile, std::string& s)
+{
+	cl_uint len;
+
+	if (!fGet(pfile, &len, sizeof(len))) return(false);
+	s.resize(len);
+	return(len == 0 || fGet(pfile, &s[0], len));
+}
+
+static bool fGetData(FILE* pfile, std::vector<char>& data, bool* is_null)
+{
+	cl_ulong	size;
+	cl_int		mode;
+	cl_ulong	hash;
+	cl_uint		sample;
+
+	if (!fGet(pfile, &size, sizeof(size)) || !fGet(pfile, &mode, sizeof(mode)) || !fGet(pfile, &hash, sizeof(hash))) return(false);
+
+	*is_null = mode == CAPTURE_NULL;
+	data.assign((size_t) size, 0);
+
+	if (mode == CAPTURE_CONTENT_FULL)
+	{
+		return(size == 0 || fGet(pfile, &data[0], (size_t) size));
+	}
+	if (mode == CAPTURE_CONTENT_SAMPLE)
+	{
+		cl_uint		word;
+		cl_ulong	n_words = size / sizeof(cl_uint);
+
+		if (!fGet(pfile, &sample, sizeof(sample))) return(false);
+		for (cl_ulong ii = 0; ii < n_words; ii += sample)
+		{
+			if (!fGet(pfile, &word, sizeof(word))) return(false);
+			for (cl_ulong jj = ii; jj < ii + sample && jj < n_words; jj++)
+			{
+				memcpy(&data[(size_t) jj * sizeof(cl_uint)], &word, sizeof(word));
+			}
+		}
+	}
+	else if (mode == CAPTURE_CONTENT_HASH)
+	{
+		cl_float one = 1.0f;
+
+		for (cl_ulong jj = 0; jj < size / sizeof(cl_float); jj++)
+		{
+			memcpy(&data[(size_t) jj * sizeof(cl_float)], &one, sizeof(one));
+		}
+	}
+	return(true);
+}
+
+// The kernel file for a recorded path: the one in kernel_dir if it has it,
+// else the recorded source, written next to the trace.
+static std::string fReplayKernelFile(const std::string& path, const std::vector<char>& source, char* trace_path, char* kernel_dir)
+{
+	size_t		slash = path.find_last_of("/\\");
+	std::string	base = slash == std::string::npos ? path : path.substr(slash + 1);
+	FILE*		pfile;
+	char		hash[32];
+
+	if (kernel_dir != NULL && kernel_dir[0] != 0)
+	{
+		std::string candidate = std::string(kernel_dir) + "/" + base;
+		pfile = fopen(candidate.c_str(), "rb");
+		if (pfile != NULL)
+		{
+			fclose(pfile);
+			return(candidate);
+		}
+	}
+	if (source.empty()) return(path);
+
+	sprintf(hash, "%016llx", (unsigned long long) fCaptureHash(&source[0], source.size()));
+	std::string file = std::string(trace_path) + "." + hash + "." + base;
+
+	pfile = fopen(file.c_str(), "rb");
+	if (pfile != NULL)
+	{
+		fclose(pfile);
+		return(file);
+	}
+	pfile = fopen(file.c_str(), "wb");
+	if (pfile == NULL) return(path);
+	fwrite(&source[0], 1, source.size(), pfile);
+	fclose(pfile);
+	return(file);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Run the calls of a trace again and report, per call type, the calls, the
+// recorded and the replayed seconds (CSV or JSON, to report or stdout).
+// force_cpu >= 0 replaces that of the recorded queues; kernel_dir, when set,
+// has the kernel files to use instead of the recorded sources. Reads back are
+// compared with the recorded hashes when the trace has the data in full.
+//
+int fReplayTrace(char* path, cl_int force_cpu, char* kernel_dir, char* report, cl_bool json, cl_bool verbose, char* log_file)
+{
+	FILE*							pfile = NULL;
+	FILE*							trace;
+	FILE*							out = stdout;
+	cl_ulong						magic;
+	cl_uint							version;
+	cl_int							content;
+	cl_uint							sample;
+	std::map<cl_ulong, void*>		handles;
+	replay_stats					stats[CAPTURE_OPS];
+	cl_ulong						checked = 0;
+	cl_ulong						mismatched = 0;
+	idls							log_idls;
+	int								result = 0;
+
+	trace = fopen(path, "rb");
+	if (trace == NULL || !fGet(trace, &magic, sizeof(magic)) || magic != CAPTURE_MAGIC ||
+		!fGet(trace, &version, sizeof(version)) || version != CAPTURE_VERSION ||
+		!fGet(trace, &content, sizeof(content)) || !fGet(trace, &sample, sizeof(sample)))
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: %s is not a capture trace. \n", path);
+			fclose(pfile);
+		}
+		if (trace != NULL) fclose(trace);
+		return(-3);
+	}
+
+	memset(stats, 0, sizeof(stats));
+	log_idls.s		= log_file;
+	log_idls.slen	= (short) strlen(log_file);
+	log_idls.stype	= 0;
+
+	cl_uint op;
+	while (fGet(trace, &op, sizeof(op)))
+	{
+		cl_int						recorded_result;
+		double						start;
+		double						seconds;
+		void*						argv[CAPTURE_MAX_ARGS];
+		void*						handle[CAPTURE_MAX_ARGS];
+		cl_ulong					recorded[CAPTURE_MAX_ARGS];
+		cl_ulong					scalar[CAPTURE_MAX_ARGS][2];
+		std::string					strings[CAPTURE_MAX_ARGS];
+		std::vector<std::string>	names[CAPTURE_MAX_ARGS];
+		std::vector<idls>			arrays[CAPTURE_MAX_ARGS];
+		std::vector<char>			blobs[CAPTURE_MAX_ARGS];
+		cl_ulong					output_hash[CAPTURE_MAX_ARGS];
+		bool						ok = op < CAPTURE_OPS;
+
+		ok = ok && fGet(trace, &recorded_result, sizeof(recorded_result)) && fGet(trace, &start, sizeof(start)) && fGet(trace, &seconds, sizeof(seconds));
+		if (!ok)
+		{
+			result = -4;
+			break;
+		}
+
+		const char*	codes = capture_ops[op].codes;
+		int			argc = capture_ops[op].argc;
+		int			arg;
+
+		memset(output_hash, 0, sizeof(output_hash));
+		for (arg = 0; codes[arg] != 0 && ok; arg++)
+		{
+			char		code = codes[arg];
+			bool		is_null = false;
+			cl_ulong	size;
+
+			switch (code)
+			{
+			case 'q': case 'Q': case 'k': case 'K':
+				ok = fGet(trace, &recorded[arg], sizeof(cl_ulong));
+				handle[arg] = code == 'Q' || code == 'K' ? handles[recorded[arg]] : NULL;
+				argv[arg] = &handle[arg];
+				break;
+			case 'i':
+			case 'l':
+			case 'v':
+				ok = fGet(trace, scalar[arg], code == 'i' ? 4 : (code == 'l' ? 8 : 16));
+				argv[arg] = scalar[arg];
+				break;
+			case 'S':
+				ok = fGetString(trace, strings[arg]);
+				arrays[arg].resize(1);
+				arrays[arg][0].s = (char*) strings[arg].c_str();
+				arrays[arg][0].slen = (short) strings[arg].size();
+				arrays[arg][0].stype = 0;
+				argv[arg] = &arrays[arg][0];
+				break;
+			case 'N':
+			case 'P':
+				names[arg].resize((size_t) capture_ops[op].size(arg, argv));
+				arrays[arg].resize(names[arg].size());
+				for (size_t ii = 0; ii < names[arg].size() && ok; ii++)
+				{
+					ok = fGetString(trace, names[arg][ii]);
+					if (ok && code == 'P')
+					{
+						std::vector<char> source;
+						ok = fGet(trace, &size, sizeof(size));
+						source.resize((size_t) size);
+						ok = ok && (size == 0 || fGet(trace, &source[0], (size_t) size));
+						names[arg][ii] = fReplayKernelFile(names[arg][ii], source, path, kernel_dir);
+					}
+				}
+				for (size_t ii = 0; ii < names[arg].size(); ii++)
+				{
+					arrays[arg][ii].s = (char*) names[arg][ii].c_str();
+					arrays[arg][ii].slen = (short) names[arg][ii].size();
+					arrays[arg][ii].stype = 0;
+				}
+				argv[arg] = arrays[arg].empty() ? NULL : &arrays[arg][0];
+				break;
+			case 'D':
+			case 'G':
+				ok = fGetData(trace, blobs[arg], &is_null);
+				argv[arg] = is_null ? NULL : (blobs[arg].empty() ? (void*) scalar[arg] : (void*) &blobs[arg][0]);
+				break;
+			case 'O':
+				ok = fGet(trace, &size, sizeof(size)) && fGet(trace, &output_hash[arg], sizeof(cl_ulong));
+				blobs[arg].resize((size_t) size + 1);
+				argv[arg] = &blobs[arg][0];
+				break;
+			}
+		}
+		if (!ok || arg != argc)
+		{
+			result = -4;
+			break;
+		}
+
+		// the replay's own device, log and verbosity
+		if (op == CAPTURE_CREATE_QUEUE && force_cpu >= 0) *(cl_int *) argv[1] = force_cpu;
+		*(cl_bool *) argv[argc - 2] = verbose;
+		argv[argc - 1] = &log_idls;
+
+		std::chrono::steady_clock::time_point replay_start = std::chrono::steady_clock::now();
+		int call_result = capture_ops[op].function(argc, argv);
+		double replayed = std::chrono::duration<double>(std::chrono::steady_clock::now() - replay_start).count();
+
+		stats[op].calls++;
+		stats[op].failed  += call_result < 0 ? 1 : 0;
+		stats[op].recorded += seconds;
+		stats[op].replayed += replayed;
+
+		for (arg = 0; codes[arg] != 0; arg++)
+		{
+			char code = codes[arg];
+
+			if (code == 'q' || code == 'k')
+			{
+				handles[recorded[arg]] = handle[arg];
+			}
+			else if (code == 'O' && content == CAPTURE_CONTENT_FULL && output_hash[arg] != 0 && call_result >= 0)
+			{
+				checked++;
+				mismatched += fCaptureHash(argv[arg], blobs[arg].size() - 1) != output_hash[arg] ? 1 : 0;
+			}
+		}
+	}
+	fclose(trace);
+
+	if (report != NULL && report[0] != 0)
+	{
+		out = fopen(report, "w");
+		if (out == NULL) out = stdout;
+	}
+
+	double total_recorded = 0.0;
+	double total_replayed = 0.0;
+
+	if (json) fprintf(out, "{\n  \"calls\": [\n");
+	else fprintf(out, "call,calls,failed,recorded_s,replayed_s,ratio\n");
+	for (cl_uint ii = 0, first = 1; ii < CAPTURE_OPS; ii++)
+	{
+		if (stats[ii].calls == 0) continue;
+		total_recorded += stats[ii].recorded;
+		total_replayed += stats[ii].replayed;
+
+		double ratio = stats[ii].recorded > 0.0 ? stats[ii].replayed / stats[ii].recorded : 0.0;
+		if (json)
+		{
+			fprintf(out, "%s    {\"call\": \"%s\", \"calls\": %llu, \"failed\": %llu, \"recorded_s\": %.6f, \"replayed_s\": %.6f, \"ratio\": %.3f}",
+					first ? "" : ",\n", capture_ops[ii].name, (unsigned long long) stats[ii].calls,
+					(unsigned long long) stats[ii].failed, stats[ii].recorded, stats[ii].replayed, ratio);
+		}
+		else
+		{
+			fprintf(out, "%s,%llu,%llu,%.6f,%.6f,%.3f\n", capture_ops[ii].name, (unsigned long long) stats[ii].calls,
+					(unsigned long long) stats[ii].failed, stats[ii].recorded, stats[ii].replayed, ratio);
+		}
+		first = 0;
+	}
+	if (json)
+	{
+		fprintf(out, "\n  ],\n  \"recorded_s\": %.6f,\n  \"replayed_s\": %.6f,\n  \"reads_checked\": %llu,\n  \"reads_differing\": %llu\n}\n",
+				total_recorded, total_replayed, (unsigned long long) checked, (unsigned long long) mismatched);
+	}
+	else
+	{
+		fprintf(out, "total,,,%.6f,%.6f,%.3f\n", total_recorded, total_replayed,
+				total_recorded > 0.0 ? total_replayed / total_recorded : 0.0);
+		if (content == CAPTURE_CONTENT_FULL)
+		{
+			fprintf(out, "# reads checked %llu, differing %llu\n", (unsigned long long) checked, (unsigned long long) mismatched);
+		}
+	}
+	if (out != stdout) fclose(out);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Replayed %s: %.6f s (recorded %.6f s). \n", path, total_replayed, total_recorded);
+		fclose(pfile);
+	}
+
+	return(result);
+}
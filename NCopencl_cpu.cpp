@@ -0,0 +1,1200 @@
+// NCopencl_cpu.cpp : Native CPU backend. With force_cpu = 2, fCreateCommandQueue
+// does not touch OpenCL at all (so it also works on nodes without a CPU runtime):
+// buffers live in host memory, and the spiral CT distance driven projector of
+// distd_sinogram_spiralct_pic.cl (proj and back, same arguments, also the
+// reference kernels/distd_sinogram_spiralct_pic_ref.cl) runs as
+// vectorized C++ on a work-stealing thread pool. The buffer, kernel argument
+// and execute calls of the bridge end up here. The library modules built on
+// OpenCL programs (sinogram, warp, pyramid, system matrix) are not available.
+//
+// Geometry, for view v of a launch (float4 arguments as packed in IDL):
+//   srclocs0[v] = (tube angle in radians, table position, align, zalign)
+//   detbins0    = system center, source, then the (ndet + 1) x (nplanes + 1)
+//                 detector bin boundaries (columns fastest) at tube angle 0
+// The source moves by align along the detector columns and by zalign in z,
+// which takes it zalign * zalign_cotg away from the detector (tilted anode).
+// All points turn over the tube angle about the system axis, shift by the
+// table position in z and, with -D MC, go through the view's motion matrix.
+// Voxel (i, j, k) spans img_offset + [i, j, k] * vox_size up to the next one.
+//
+// Distance driven: per view the image is cut in slabs along the axis closest
+// to the central ray; on every slab the detector column footprint is overlapped
+// with the voxels across the slab, and the plane footprints with the voxels in
+// z. Projections are line integrals in mm, the back projection is their exact
+// transpose, and both add to the output buffer like the OpenCL kernels do.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define NATIVE_MAX_MEMS			64
+#define NATIVE_MAX_KERNELS		(4 * MAX_KERNELS)
+#define NATIVE_MAX_ARGS			16
+#define NATIVE_ARG_SIZE			16
+
+// Views whose geometry the back projector holds at once.
+#define NATIVE_VIEWS_PER_PASS	64
+
+#define NATIVE_PROJ 1
+#define NATIVE_BACK 2
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMD over detector planes. NATIVE_LANES planes are handled per instruction;
+// plane arrays are padded to a multiple of it with zero weight lanes.
+//
+#if defined(__AVX512F__)
+#define NATIVE_LANES 16
+typedef __m512 vfloat;
+#define v_load(p)			_mm512_loadu_ps(p)
+#define v_store(p, a)		_mm512_storeu_ps(p, a)
+#define v_set1(x)			_mm512_set1_ps(x)
+#define v_zero()			_mm512_setzero_ps()
+#define v_sub(a, b)			_mm512_sub_ps(a, b)
+#define v_mul(a, b)			_mm512_mul_ps(a, b)
+#define v_min(a, b)			_mm512_min_ps(a, b)
+#define v_max(a, b)			_mm512_max_ps(a, b)
+#define v_fmadd(a, b, c)	_mm512_fmadd_ps(a, b, c)
+#define v_hsum(a)			_mm512_reduce_add_ps(a)
+#elif defined(__AVX2__)
+#define NATIVE_LANES 8
+typedef __m256 vfloat;
+#define v_load(p)			_mm256_loadu_ps(p)
+#define v_store(p, a)		_mm256_storeu_ps(p, a)
+#define v_set1(x)			_mm256_set1_ps(x)
+#define v_zero()			_mm256_setzero_ps()
+#define v_sub(a, b)			_mm256_sub_ps(a, b)
+#define v_mul(a, b)			_mm256_mul_ps(a, b)
+#define v_min(a, b)			_mm256_min_ps(a, b)
+#define v_max(a, b)			_mm256_max_ps(a, b)
+#ifdef __FMA__
+#define v_fmadd(a, b, c)	_mm256_fmadd_ps(a, b, c)
+#else
+#define v_fmadd(a, b, c)	_mm256_add_ps(_mm256_mul_ps(a, b), c)
+#endif
+static inline float v_hsum(__m256 a)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return(_mm_cvtss_f32(s));
+}
+#else
+#define NATIVE_LANES 1
+typedef float vfloat;
+#define v_load(p)			(*(p))
+#define v_store(p, a)		(*(p) = (a))
+#define v_set1(x)			(x)
+#define v_zero()			(0.0f)
+#define v_sub(a, b)			((a) - (b))
+#define v_mul(a, b)			((a) * (b))
+#define v_min(a, b)			((a) < (b) ? (a) : (b))
+#define v_max(a, b)			((a) > (b) ? (a) : (b))
+#define v_fmadd(a, b, c)	((a) * (b) + (c))
+#define v_hsum(a)			(a)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Host memory objects and kernels, handed out as cl_mem and cl_kernel.
+//
+typedef struct
+{
+	cl_ulong	size;
+	void*		data;
+} native_mem;
+
+typedef struct
+{
+	cl_int		type;		// NATIVE_PROJ or NATIVE_BACK
+	cl_bool		motion;		// built with -D MC
+	cl_uchar	args[NATIVE_MAX_ARGS][NATIVE_ARG_SIZE];
+} native_kernel;
+
+static native_mem*		native_mems[NATIVE_MAX_MEMS];
+static native_kernel*	native_kernels[NATIVE_MAX_KERNELS];
+
+// The native command queue is a tag address, shared by all its users.
+static char				native_queue_tag;
+static cl_uint			native_queue_users = 0;
+
+#define NATIVE_QUEUE ((cl_command_queue) &native_queue_tag)
+
+///////////////////////////////////////////////////////////////////////////////
+// Work-stealing thread pool. A job runs body(task, worker) for every task in
+// [0, n): each worker starts on its own slice of the range and, once that is
+// drained, takes the upper half of what another worker has left. The calling
+// thread is worker 0.
+//
+typedef struct
+{
+	std::mutex	lock;
+	cl_ulong	first;
+	cl_ulong	last;
+} native_slice;
+
+typedef std::function<void(cl_ulong, cl_uint)> native_body;
+
+static std::vector<std::thread>	native_workers;
+static native_slice*			native_slices = NULL;
+static cl_uint					native_nthreads = 0;
+static cl_uint					native_requested = 0;	// 0: all hardware threads
+static std::mutex				native_job_lock;
+static std::condition_variable	native_job_start;
+static std::condition_variable	native_job_done;
+static const native_body*		native_job = NULL;
+static cl_ulong					native_job_id = 0;
+static cl_uint					native_job_running = 0;
+static cl_bool					native_stop = CL_FALSE;
+
+static cl_bool fNativeNextTask(cl_uint self, cl_ulong* task)
+{
+	native_slice* own = &native_slices[self];
+
+	{
+		std::lock_guard<std::mutex> guard(own->lock);
+		if (own->first < own->last)
+		{
+			*task = own->first++;
+			return(CL_TRUE);
+		}
+	}
+
+	for (cl_uint tt = 1; tt < native_nthreads; tt++)
+	{
+		native_slice*	victim = &native_slices[(self + tt) % native_nthreads];
+		cl_ulong		first, last;
+
+		{
+			std::lock_guard<std::mutex> guard(victim->lock);
+			if (victim->first >= victim->last) continue;
+			last         = victim->last;
+			first        = victim->first + (victim->last - victim->first) / 2;
+			victim->last = first;
+		}
+
+		std::lock_guard<std::mutex> guard(own->lock);
+		own->first = first + 1;
+		own->last  = last;
+		*task      = first;
+		return(CL_TRUE);
+	}
+
+	return(CL_FALSE);
+}
+
+static void fNativeWork(cl_uint self)
+{
+	cl_ulong task;
+
+	while (fNativeNextTask(self, &task))
+	{
+		(*native_job)(task, self);
+	}
+}
+
+static void fNativeWorker(cl_uint self, cl_ulong seen)
+{
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(native_job_lock);
+			native_job_start.wait(lock, [&] { return(native_stop || native_job_id != seen); });
+			if (native_stop) return;
+			seen = native_job_id;
+		}
+
+		fNativeWork(self);
+
+		{
+			std::lock_guard<std::mutex> guard(native_job_lock);
+			if (--native_job_running == 0) native_job_done.notify_one();
+		}
+	}
+}
+
+static void fNativeRun(cl_ulong n, const native_body& body)
+{
+	if (native_nthreads <= 1 || n <= 1)
+	{
+		for (cl_ulong ii = 0; ii < n; ii++) body(ii, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(native_job_lock);
+		for (cl_uint tt = 0; tt < native_nthreads; tt++)
+		{
+			std::lock_guard<std::mutex> slice_guard(native_slices[tt].lock);
+			native_slices[tt].first = n * tt / native_nthreads;
+			native_slices[tt].last  = n * (tt + 1) / native_nthreads;
+		}
+		native_job         = &body;
+		native_job_running = native_nthreads - 1;
+		native_job_id++;
+	}
+	native_job_start.notify_all();
+
+	fNativeWork(0);
+
+	std::unique_lock<std::mutex> lock(native_job_lock);
+	native_job_done.wait(lock, [] { return(native_job_running == 0); });
+	native_job = NULL;
+}
+
+static void fNativeStartPool()
+{
+	native_nthreads = native_requested > 0 ? native_requested : std::thread::hardware_concurrency();
+	if (native_nthreads < 1) native_nthreads = 1;
+
+	native_stop   = CL_FALSE;
+	native_slices = new native_slice[native_nthreads];
+	for (cl_uint tt = 1; tt < native_nthreads; tt++)
+	{
+		native_workers.push_back(std::thread(fNativeWorker, tt, native_job_id));
+	}
+}
+
+static void fNativeStopPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(native_job_lock);
+		native_stop = CL_TRUE;
+	}
+	native_job_start.notify_all();
+
+	for (size_t tt = 0; tt < native_workers.size(); tt++)
+	{
+		native_workers[tt].join();
+	}
+	native_workers.clear();
+
+	delete[] native_slices;
+	native_slices   = NULL;
+	native_nthreads = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Command queue.
+//
+cl_bool fNativeQueue(cl_command_queue* commands)
+{
+	return(commands != NULL && *commands == NATIVE_QUEUE);
+}
+
+int fNativeCreateQueue(cl_command_queue* commands, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+#if defined(__GNUC__) && (defined(__AVX512F__) || defined(__AVX2__))
+#if defined(__AVX512F__)
+	if (!__builtin_cpu_supports("avx512f"))
+#else
+	if (!__builtin_cpu_supports("avx2"))
+#endif
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: The native CPU backend was built for %d wide vectors, not supported by this CPU.\n", NATIVE_LANES);
+			fclose(pfile);
+		}
+		return(-5);
+	}
+#endif
+
+	if (native_queue_users++ == 0)
+	{
+		fNativeStartPool();
+	}
+	*commands = NATIVE_QUEUE;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: using the native CPU backend, %u threads, %d float lanes.\n", native_nthreads, NATIVE_LANES);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+int fNativeShareQueue(cl_command_queue* commands, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	native_queue_users++;
+	*commands = NATIVE_QUEUE;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Native CPU backend shared, %u queues.\n", native_queue_users);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+int fNativeReleaseQueue(cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	if (native_queue_users > 0 && --native_queue_users == 0)
+	{
+		fNativeStopPool();
+
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: Native CPU backend released.\n");
+			fclose(pfile);
+		}
+	}
+
+	return(0);
+}
+
+// Size of the thread pool, 0 for all hardware threads; a running pool is
+// restarted with the new size.
+int fNativeThreads(cl_uint n_threads, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	native_requested = n_threads;
+	if (native_queue_users > 0)
+	{
+		fNativeStopPool();
+		fNativeStartPool();
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Native CPU backend uses %u threads.\n", n_threads > 0 ? n_threads : std::thread::hardware_concurrency());
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+int fNativeUnsupported(const char* what, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Error: %s is not available on the native CPU backend.\n", what);
+		fclose(pfile);
+	}
+
+	return(-1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Buffers.
+//
+cl_bool fNativeMem(cl_mem mem)
+{
+	for (int ii = 0; ii < NATIVE_MAX_MEMS; ii++)
+	{
+		if (mem != NULL && (cl_mem) native_mems[ii] == mem) return(CL_TRUE);
+	}
+	return(CL_FALSE);
+}
+
+void* fNativeMemPtr(cl_mem mem, cl_ulong* size)
+{
+	if (!fNativeMem(mem)) return(NULL);
+
+	if (size != NULL) *size = ((native_mem*) mem)->size;
+	return(((native_mem*) mem)->data);
+}
+
+// mode 0 : zeros, 1 : pattern repeated, 2 : copy of source (size 0 = all of
+// it), 3 : copy of the host content in pattern
+int fNativeAllocate(cl_mem* mem_ptr, cl_ulong size, cl_int mode, void* pattern, cl_ulong pattern_size, cl_mem* source, cl_bool verbose, char* log_file)
+{
+	native_mem*	mem;
+	cl_ulong	source_size = 0;
+	void*		source_data = NULL;
+	int			slot;
+	FILE*		pfile = NULL;
+
+	if (mode == 2)
+	{
+		source_data = fNativeMemPtr(*source, &source_size);
+		if (source_data == NULL)
+		{
+			return(fNativeUnsupported("Copying a non-native buffer", verbose, log_file));
+		}
+		if (size == 0 || size > source_size) size = source_size;
+	}
+	if (mode == 1 && (pattern_size == 0 || size % pattern_size != 0))
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Invalid fill pattern size %llu for %llu bytes.\n", (unsigned long long) pattern_size, (unsigned long long) size);
+			fclose(pfile);
+		}
+		return(-1);
+	}
+
+	for (slot = 0; slot < NATIVE_MAX_MEMS && native_mems[slot] != NULL; slot++);
+
+	mem = (native_mem*) malloc(sizeof(native_mem));
+	if (slot == NATIVE_MAX_MEMS || mem == NULL || (mem->data = calloc(size > 0 ? size : 1, 1)) == NULL)
+	{
+		free(mem);
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to allocate native buffer!\n");
+			fprintf(pfile, "Info: Content size (bytes): %llu.\n", (unsigned long long) size);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+	mem->size = size;
+
+	switch (mode)
+	{
+		case 1 :
+			for (cl_ulong ii = 0; ii < size; ii += pattern_size)
+			{
+				memcpy((char*) mem->data + ii, pattern, pattern_size);
+			}
+			break;
+		case 2 :
+			memcpy(mem->data, source_data, size);
+			break;
+		case 3 :
+			memcpy(mem->data, pattern, size);
+			break;
+	}
+
+	native_mems[slot] = mem;
+	*mem_ptr = (cl_mem) mem;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Native buffer allocated (%llu bytes).\n", (unsigned long long) size);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+int fNativeTransfer(cl_mem* mem_ptr, void* content, cl_ulong offset, cl_ulong size, cl_bool write, cl_bool verbose, char* log_file)
+{
+	cl_ulong	mem_size;
+	char*		data = (char*) fNativeMemPtr(*mem_ptr, &mem_size);
+	FILE*		pfile = NULL;
+
+	if (data == NULL || offset + size > mem_size)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Invalid native buffer transfer of %llu bytes at %llu.\n", (unsigned long long) size, (unsigned long long) offset);
+			fclose(pfile);
+		}
+		return(-1);
+	}
+
+	if (write)
+	{
+		memcpy(data + offset, content, size);
+	}
+	else
+	{
+		memcpy(content, data + offset, size);
+	}
+
+	return(0);
+}
+
+int fNativeRelease(cl_mem mem, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	for (int ii = 0; ii < NATIVE_MAX_MEMS; ii++)
+	{
+		if ((cl_mem) native_mems[ii] == mem)
+		{
+			free(native_mems[ii]->data);
+			free(native_mems[ii]);
+			native_mems[ii] = NULL;
+
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Info: Native buffer released.\n");
+				fclose(pfile);
+			}
+			return(0);
+		}
+	}
+
+	return(-1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Kernels. Only the distance driven spiral CT projector has a native version.
+//
+cl_bool fNativeKernel(cl_kernel kernel)
+{
+	for (int ii = 0; ii < NATIVE_MAX_KERNELS; ii++)
+	{
+		if (kernel != NULL && (cl_kernel) native_kernels[ii] == kernel) return(CL_TRUE);
+	}
+	return(CL_FALSE);
+}
+
+static cl_bool fNativeOption(const char* options, const char* name)
+{
+	size_t		length = strlen(name);
+	const char*	found  = options;
+
+	while ((found = strstr(found, name)) != NULL)
+	{
+		if (found[length] == '\0' || found[length] == ' ') return(CL_TRUE);
+		found += length;
+	}
+	return(CL_FALSE);
+}
+
+int fNativeBuildKernels(cl_kernel* kernels, cl_ulong n_kernels, idls* file_paths, idls* function_names, idls* compile_options, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	for (cl_ulong ii = 0; ii < n_kernels; ii++)
+	{
+		native_kernel*	kernel;
+		int				slot;
+
+		if (strstr(file_paths[ii].s, "distd_sinogram_spiralct_pic.cl") == NULL
+			&& strstr(file_paths[ii].s, "distd_sinogram_spiralct_pic_ref.cl") == NULL)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: No native version of kernel nr. %llu (%s).\n", (unsigned long long) ii, file_paths[ii].s);
+				fclose(pfile);
+			}
+			return(-8);
+		}
+
+		for (slot = 0; slot < NATIVE_MAX_KERNELS && native_kernels[slot] != NULL; slot++);
+		if (slot == NATIVE_MAX_KERNELS)
+		{
+			return(-10);
+		}
+
+		kernel         = (native_kernel*) calloc(1, sizeof(native_kernel));
+		kernel->type   = fNativeOption(compile_options[ii].s, "-D BACK_PROJECT") ? NATIVE_BACK : NATIVE_PROJ;
+		kernel->motion = fNativeOption(compile_options[ii].s, "-D MC");
+
+		native_kernels[slot] = kernel;
+		kernels[ii] = (cl_kernel) kernel;
+
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: Native kernel nr. %llu (%s): %s%s.\n", (unsigned long long) ii, function_names[ii].s, kernel->type == NATIVE_BACK ? "back projection" : "projection", kernel->motion ? " with motion" : "");
+			if (fNativeOption(compile_options[ii].s, "-D RECORD_SYSMAT"))
+			{
+				fprintf(pfile, "Info: RECORD_SYSMAT is ignored by the native backend.\n");
+			}
+			fclose(pfile);
+		}
+	}
+
+	return(0);
+}
+
+int fNativeSetKernelArg(cl_kernel kernel, cl_uint arg_index, cl_ulong arg_size, void* arg_value, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	if (arg_index >= NATIVE_MAX_ARGS || arg_size > NATIVE_ARG_SIZE)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Invalid native kernel argument %u (%llu bytes).\n", arg_index, (unsigned long long) arg_size);
+			fclose(pfile);
+		}
+		return(-1);
+	}
+
+	memcpy(((native_kernel*) kernel)->args[arg_index], arg_value, arg_size);
+
+	return(0);
+}
+
+int fNativeReleaseKernel(cl_kernel kernel, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	for (int ii = 0; ii < NATIVE_MAX_KERNELS; ii++)
+	{
+		if ((cl_kernel) native_kernels[ii] == kernel)
+		{
+			free(native_kernels[ii]);
+			native_kernels[ii] = NULL;
+			return(0);
+		}
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Error: Not a native kernel!\n");
+		fclose(pfile);
+	}
+
+	return(-1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Distance driven spiral CT projector.
+//
+typedef struct
+{
+	float*			image;
+	float*			sino;
+	const float*	srclocs;
+	const float*	detbins;
+	const float*	mc;			// NULL without motion
+	cl_uint			n[3];		// image size
+	float			offset[3];
+	float			vox[3];
+	float			cotg;
+	cl_uint			ndet;
+	cl_uint			nplanes;
+	cl_uint			npad;		// nplanes rounded up to NATIVE_LANES
+	cl_uint			nviews;
+} native_proj;
+
+// Per view: slabs along axis sa (1 = image rows, 0 = columns), the source
+// position and the slopes of the rays, per unit along the slab axis.
+typedef struct
+{
+	cl_uint		sa;
+	cl_uint		ta;
+	float		src[3];
+	float*		ka;		// ndet + 1 column boundary rays, across the slab
+	float*		kz;		// ndet x (nplanes + 1) plane boundary rays, in z
+	float*		len;	// ndet x npad bin center rays, path length per slab
+} native_view;
+
+// Per worker scratch: detector points, plane footprints, collapsed image column.
+typedef struct
+{
+	std::vector<float>	points;
+	std::vector<float>	geometry;
+	std::vector<float>	acc;
+	std::vector<float>	zlo;
+	std::vector<float>	zhi;
+	std::vector<float>	zscale;
+	std::vector<cl_int>	kfirst;
+	std::vector<cl_int>	klast;
+	std::vector<float>	wt;
+	std::vector<float>	column;
+} native_scratch;
+
+static cl_ulong fNativeGeometrySize(const native_proj* p)
+{
+	return((p->ndet + 1) + (cl_ulong) p->ndet * (p->nplanes + 1) + (cl_ulong) p->ndet * p->npad);
+}
+
+static void fNativeTransform(const native_proj* p, cl_uint view, const float* local, float* world)
+{
+	const float*	srcloc = &p->srclocs[4 * view];
+	const float*	center = p->detbins;
+	float			c = cosf(srcloc[0]);
+	float			s = sinf(srcloc[0]);
+	float			x = local[0] - center[0];
+	float			y = local[1] - center[1];
+	float			w[3];
+
+	w[0] = center[0] + c * x - s * y;
+	w[1] = center[1] + s * x + c * y;
+	w[2] = local[2] + srcloc[1];
+
+	if (p->mc != NULL)
+	{
+		const float* m = &p->mc[16 * view];
+
+		for (int rr = 0; rr < 3; rr++)
+		{
+			world[rr] = m[4*rr] * w[0] + m[4*rr + 1] * w[1] + m[4*rr + 2] * w[2] + m[4*rr + 3];
+		}
+	}
+	else
+	{
+		world[0] = w[0];
+		world[1] = w[1];
+		world[2] = w[2];
+	}
+}
+
+static void fNativeViewGeometry(const native_proj* p, cl_uint view, float* block, native_scratch* scratch, native_view* g)
+{
+	cl_uint		ndet    = p->ndet;
+	cl_uint		nplanes = p->nplanes;
+	cl_uint		npad    = p->npad;
+	cl_uint		ncols   = ndet + 1;
+	float*		pts;
+	float		local[3];
+	const float* srcloc = &p->srclocs[4 * view];
+
+	scratch->points.resize(3 * (size_t) ncols * (nplanes + 1));
+	pts = &scratch->points[0];
+
+	// source with the flying focal spot offsets
+	local[0] = p->detbins[4] + srcloc[2];
+	local[1] = p->detbins[5] - srcloc[3] * p->cotg;
+	local[2] = p->detbins[6] + srcloc[3];
+	fNativeTransform(p, view, local, g->src);
+
+	for (cl_uint pp = 0; pp <= nplanes; pp++)
+	{
+		for (cl_uint cc = 0; cc < ncols; cc++)
+		{
+			fNativeTransform(p, view, &p->detbins[4 * (2 + cc + ncols * pp)], &pts[3 * (cc + ncols * pp)]);
+		}
+	}
+
+	// slabs across the axis closest to the central ray
+	const float* mid = &pts[3 * (ndet / 2 + ncols * (nplanes / 2))];
+	g->sa = fabsf(mid[1] - g->src[1]) >= fabsf(mid[0] - g->src[0]) ? 1 : 0;
+	g->ta = 1 - g->sa;
+
+	g->ka  = block;
+	g->kz  = g->ka + ncols;
+	g->len = g->kz + (size_t) ndet * (nplanes + 1);
+
+	for (cl_uint cc = 0; cc < ncols; cc++)
+	{
+		const float* d = &pts[3 * (cc + ncols * (nplanes / 2))];
+		g->ka[cc] = (d[g->ta] - g->src[g->ta]) / (d[g->sa] - g->src[g->sa]);
+	}
+
+	for (cl_uint cc = 0; cc < ndet; cc++)
+	{
+		for (cl_uint pp = 0; pp <= nplanes; pp++)
+		{
+			const float*	d0 = &pts[3 * (cc + ncols * pp)];
+			const float*	d1 = &pts[3 * (cc + 1 + ncols * pp)];
+			float			ds = 0.5f * (d0[g->sa] + d1[g->sa]) - g->src[g->sa];
+
+			g->kz[cc * (nplanes + 1) + pp] = (0.5f * (d0[2] + d1[2]) - g->src[2]) / ds;
+		}
+
+		float dt = 0.5f * (g->ka[cc] + g->ka[cc + 1]);
+		for (cl_uint pp = 0; pp < npad; pp++)
+		{
+			if (pp < nplanes)
+			{
+				float dz = 0.5f * (g->kz[cc * (nplanes + 1) + pp] + g->kz[cc * (nplanes + 1) + pp + 1]);
+				g->len[cc * npad + pp] = p->vox[g->sa] * sqrtf(1.0f + dt * dt + dz * dz);
+			}
+			else
+			{
+				g->len[cc * npad + pp] = 0.0f;
+			}
+		}
+	}
+}
+
+// Footprint of column cc on the slab at distance ds from the source: voxels
+// [*t_first, *t_last) across the slab with weights wt, voxels [*k_first,
+// *k_last) in z, and per plane its z range and path length / width. Returns
+// false when the footprint misses the image.
+static cl_bool fNativeFootprint(const native_proj* p, const native_view* g, cl_uint cc, float ds, native_scratch* scratch, cl_int* t_first, cl_int* t_last, cl_int* k_first, cl_int* k_last)
+{
+	cl_uint		nplanes = p->nplanes;
+	cl_uint		npad    = p->npad;
+	float		t0      = p->offset[g->ta];
+	float		vt      = p->vox[g->ta];
+	cl_int		nt      = (cl_int) p->n[g->ta];
+	float		z0      = p->offset[2];
+	float		vz      = p->vox[2];
+	cl_int		nz      = (cl_int) p->n[2];
+	float		a0      = g->src[g->ta] + g->ka[cc] * ds;
+	float		a1      = g->src[g->ta] + g->ka[cc + 1] * ds;
+	float		alo     = a0 < a1 ? a0 : a1;
+	float		ahi     = a0 < a1 ? a1 : a0;
+	float		zmin    = 1e30f;
+	float		zmax    = -1e30f;
+	const float* kz     = &g->kz[cc * (nplanes + 1)];
+
+	if (ahi <= alo) return(CL_FALSE);
+
+	*t_first = (cl_int) floorf((alo - t0) / vt);
+	*t_last  = (cl_int) ceilf((ahi - t0) / vt);
+	if (*t_first < 0)  *t_first = 0;
+	if (*t_last  > nt) *t_last  = nt;
+	if (*t_first >= *t_last) return(CL_FALSE);
+
+	for (cl_int tt = *t_first; tt < *t_last; tt++)
+	{
+		float lo = t0 + tt * vt;
+		float hi = lo + vt;
+		scratch->wt[tt - *t_first] = ((ahi < hi ? ahi : hi) - (alo > lo ? alo : lo)) / (ahi - alo);
+	}
+
+	float* zlo    = &scratch->zlo[0];
+	float* zhi    = &scratch->zhi[0];
+	float* zscale = &scratch->zscale[0];
+
+	for (cl_uint pp = 0; pp < npad; pp++)
+	{
+		if (pp < nplanes)
+		{
+			float b0 = g->src[2] + kz[pp] * ds;
+			float b1 = g->src[2] + kz[pp + 1] * ds;
+
+			zlo[pp]    = b0 < b1 ? b0 : b1;
+			zhi[pp]    = b0 < b1 ? b1 : b0;
+			zscale[pp] = zhi[pp] > zlo[pp] ? g->len[cc * npad + pp] / (zhi[pp] - zlo[pp]) : 0.0f;
+		}
+		else
+		{
+			zlo[pp]    = 0.0f;
+			zhi[pp]    = 0.0f;
+			zscale[pp] = 0.0f;
+		}
+
+		// voxel range per block of planes
+		if (pp % NATIVE_LANES == 0)
+		{
+			zmin = 1e30f;
+			zmax = -1e30f;
+		}
+		if (zscale[pp] > 0.0f)
+		{
+			if (zlo[pp] < zmin) zmin = zlo[pp];
+			if (zhi[pp] > zmax) zmax = zhi[pp];
+		}
+		if (pp % NATIVE_LANES == NATIVE_LANES - 1)
+		{
+			cl_int kf = zmax > zmin ? (cl_int) floorf((zmin - z0) / vz) : 0;
+			cl_int kl = zmax > zmin ? (cl_int) ceilf((zmax - z0) / vz)  : 0;
+
+			scratch->kfirst[pp / NATIVE_LANES] = kf < 0 ? 0 : kf;
+			scratch->klast[pp / NATIVE_LANES]  = kl > nz ? nz : kl;
+		}
+	}
+
+	*k_first = nz;
+	*k_last  = 0;
+	for (cl_uint bb = 0; bb < npad / NATIVE_LANES; bb++)
+	{
+		if (scratch->kfirst[bb] >= scratch->klast[bb]) continue;
+		if (scratch->kfirst[bb] < *k_first) *k_first = scratch->kfirst[bb];
+		if (scratch->klast[bb]  > *k_last)  *k_last  = scratch->klast[bb];
+	}
+
+	return(*k_first < *k_last);
+}
+
+// acc[p] += zscale[p] * sum_k overlap(p, k) * column[k]
+static void fNativeZForward(const native_proj* p, const native_scratch* scratch, const float* column, float* acc)
+{
+	float z0 = p->offset[2];
+	float vz = p->vox[2];
+
+	for (cl_uint bb = 0; bb < p->npad; bb += NATIVE_LANES)
+	{
+		vfloat	lo  = v_load(&scratch->zlo[bb]);
+		vfloat	hi  = v_load(&scratch->zhi[bb]);
+		vfloat	sum = v_zero();
+
+		for (cl_int kk = scratch->kfirst[bb / NATIVE_LANES]; kk < scratch->klast[bb / NATIVE_LANES]; kk++)
+		{
+			vfloat zk0 = v_set1(z0 + kk * vz);
+			vfloat zk1 = v_set1(z0 + (kk + 1) * vz);
+			vfloat w   = v_max(v_zero(), v_sub(v_min(hi, zk1), v_max(lo, zk0)));
+
+			sum = v_fmadd(w, v_set1(column[kk]), sum);
+		}
+
+		v_store(&acc[bb], v_fmadd(sum, v_load(&scratch->zscale[bb]), v_load(&acc[bb])));
+	}
+}
+
+// column[k] = sum_p overlap(p, k) * zscale[p] * sino[p], the transpose
+static void fNativeZBack(const native_proj* p, const native_scratch* scratch, const float* sino, float* column, cl_int k_first, cl_int k_last)
+{
+	float z0 = p->offset[2];
+	float vz = p->vox[2];
+
+	for (cl_int kk = k_first; kk < k_last; kk++)
+	{
+		column[kk] = 0.0f;
+	}
+
+	for (cl_uint bb = 0; bb < p->npad; bb += NATIVE_LANES)
+	{
+		vfloat	lo    = v_load(&scratch->zlo[bb]);
+		vfloat	hi    = v_load(&scratch->zhi[bb]);
+		vfloat	value = v_mul(v_load(&sino[bb]), v_load(&scratch->zscale[bb]));
+
+		for (cl_int kk = scratch->kfirst[bb / NATIVE_LANES]; kk < scratch->klast[bb / NATIVE_LANES]; kk++)
+		{
+			vfloat zk0 = v_set1(z0 + kk * vz);
+			vfloat zk1 = v_set1(z0 + (kk + 1) * vz);
+			vfloat w   = v_max(v_zero(), v_sub(v_min(hi, zk1), v_max(lo, zk0)));
+
+			column[kk] += v_hsum(v_mul(w, value));
+		}
+	}
+}
+
+static void fNativeScratch(const native_proj* p, native_scratch* scratch)
+{
+	cl_uint nt = p->n[0] > p->n[1] ? p->n[0] : p->n[1];
+
+	scratch->geometry.resize(fNativeGeometrySize(p));
+	scratch->acc.resize((size_t) p->ndet * p->npad);
+	scratch->zlo.resize(p->npad);
+	scratch->zhi.resize(p->npad);
+	scratch->zscale.resize(p->npad);
+	scratch->kfirst.resize(p->npad / NATIVE_LANES);
+	scratch->klast.resize(p->npad / NATIVE_LANES);
+	scratch->wt.resize(nt + 1);
+	scratch->column.resize(p->n[2]);
+}
+
+// Image strides across the slab (t), along the slab axis (s) and in z.
+static void fNativeStrides(const native_proj* p, const native_view* g, cl_ulong* st, cl_ulong* ss, cl_ulong* sz)
+{
+	*st = g->ta == 0 ? 1 : p->n[0];
+	*ss = g->sa == 0 ? 1 : p->n[0];
+	*sz = (cl_ulong) p->n[0] * p->n[1];
+}
+
+static void fNativeForwardView(const native_proj* p, cl_uint view, native_scratch* scratch)
+{
+	native_view	g;
+	cl_ulong	st, ss, sz;
+	float*		acc    = &scratch->acc[0];
+	float*		column = &scratch->column[0];
+
+	fNativeViewGeometry(p, view, &scratch->geometry[0], scratch, &g);
+	fNativeStrides(p, &g, &st, &ss, &sz);
+	memset(acc, 0, scratch->acc.size() * sizeof(float));
+
+	for (cl_uint jj = 0; jj < p->n[g.sa]; jj++)
+	{
+		float	ds    = p->offset[g.sa] + (jj + 0.5f) * p->vox[g.sa] - g.src[g.sa];
+		float*	slab  = p->image + jj * ss;
+
+		for (cl_uint cc = 0; cc < p->ndet; cc++)
+		{
+			cl_int t_first, t_last, k_first, k_last;
+
+			if (!fNativeFootprint(p, &g, cc, ds, scratch, &t_first, &t_last, &k_first, &k_last)) continue;
+
+			// collapse the voxels across the slab
+			for (cl_int kk = k_first; kk < k_last; kk++)
+			{
+				const float*	row = slab + kk * sz;
+				float			sum = 0.0f;
+
+				for (cl_int tt = t_first; tt < t_last; tt++)
+				{
+					sum += scratch->wt[tt - t_first] * row[tt * st];
+				}
+				column[kk] = sum;
+			}
+
+			fNativeZForward(p, scratch, column, &acc[cc * p->npad]);
+		}
+	}
+
+	float* sino = p->sino + (cl_ulong) p->ndet * p->nplanes * view;
+	for (cl_uint pp = 0; pp < p->nplanes; pp++)
+	{
+		for (cl_uint cc = 0; cc < p->ndet; cc++)
+		{
+			sino[cc + p->ndet * pp] += acc[cc * p->npad + pp];
+		}
+	}
+}
+
+static void fNativeBackSlab(const native_proj* p, const native_view* g, const float* view_sino, cl_uint jj, native_scratch* scratch)
+{
+	cl_ulong	st, ss, sz;
+	float*		column = &scratch->column[0];
+	float		ds     = p->offset[g->sa] + (jj + 0.5f) * p->vox[g->sa] - g->src[g->sa];
+
+	fNativeStrides(p, g, &st, &ss, &sz);
+	float* slab = p->image + jj * ss;
+
+	for (cl_uint cc = 0; cc < p->ndet; cc++)
+	{
+		cl_int t_first, t_last, k_first, k_last;
+
+		if (!fNativeFootprint(p, g, cc, ds, scratch, &t_first, &t_last, &k_first, &k_last)) continue;
+
+		fNativeZBack(p, scratch, &view_sino[cc * p->npad], column, k_first, k_last);
+
+		for (cl_int kk = k_first; kk < k_last; kk++)
+		{
+			float* row = slab + kk * sz;
+
+			for (cl_int tt = t_first; tt < t_last; tt++)
+			{
+				row[tt * st] += scratch->wt[tt - t_first] * column[kk];
+			}
+		}
+	}
+}
+
+static void fNativeProject(const native_proj* p, cl_bool back)
+{
+	std::vector<native_scratch> scratch(native_nthreads > 0 ? native_nthreads : 1);
+
+	for (size_t tt = 0; tt < scratch.size(); tt++)
+	{
+		fNativeScratch(p, &scratch[tt]);
+	}
+
+	if (!back)
+	{
+		// every view writes its own sinogram rows
+		fNativeRun(p->nviews, [&](cl_ulong view, cl_uint worker)
+		{
+			fNativeForwardView(p, (cl_uint) view, &scratch[worker]);
+		});
+		return;
+	}
+
+	// Back projection: per pass of views, the geometry and transposed sinogram
+	// first, then every slab is a task, one axis after the other, so no two
+	// workers write the same voxel.
+	cl_ulong					geometry_size = fNativeGeometrySize(p);
+	cl_ulong					view_size     = (cl_ulong) p->ndet * p->npad;
+	std::vector<float>			geometry(geometry_size * NATIVE_VIEWS_PER_PASS);
+	std::vector<float>			sino(view_size * NATIVE_VIEWS_PER_PASS);
+	std::vector<native_view>	views(NATIVE_VIEWS_PER_PASS);
+
+	for (cl_uint first = 0; first < p->nviews; first += NATIVE_VIEWS_PER_PASS)
+	{
+		cl_uint npass = p->nviews - first < NATIVE_VIEWS_PER_PASS ? p->nviews - first : NATIVE_VIEWS_PER_PASS;
+
+		fNativeRun(npass, [&](cl_ulong vv, cl_uint worker)
+		{
+			const float*	src = p->sino + (cl_ulong) p->ndet * p->nplanes * (first + vv);
+			float*			dst = &sino[view_size * vv];
+
+			fNativeViewGeometry(p, first + (cl_uint) vv, &geometry[geometry_size * vv], &scratch[worker], &views[vv]);
+
+			for (cl_uint cc = 0; cc < p->ndet; cc++)
+			{
+				for (cl_uint pp = 0; pp < p->npad; pp++)
+				{
+					dst[cc * p->npad + pp] = pp < p->nplanes ? src[cc + p->ndet * pp] : 0.0f;
+				}
+			}
+		});
+
+		for (cl_uint sa = 0; sa < 2; sa++)
+		{
+			fNativeRun(p->n[sa], [&](cl_ulong jj, cl_uint worker)
+			{
+				for (cl_uint vv = 0; vv < npass; vv++)
+				{
+					if (views[vv].sa != sa) continue;
+					fNativeBackSlab(p, &views[vv], &sino[view_size * vv], (cl_uint) jj, &scratch[worker]);
+				}
+			});
+		}
+	}
+}
+
+static void* fNativeArgMem(native_kernel* kernel, cl_uint index, cl_ulong* size)
+{
+	cl_mem mem;
+
+	memcpy(&mem, kernel->args[index], sizeof(cl_mem));
+	return(fNativeMemPtr(mem, size));
+}
+
+int fNativeExecuteKernel(cl_kernel kernel, cl_bool verbose, char* log_file)
+{
+	native_kernel*	k = (native_kernel*) kernel;
+	native_proj		p;
+	cl_uint			size_img[4];
+	cl_uint			size_sino[4];
+	cl_float		img_offset[4];
+	cl_float		vox_size[4];
+	cl_float		zalign_cotg[4];
+	cl_ulong		image_size = 0, sino_size = 0, srclocs_size = 0, detbins_size = 0, mc_size = 0;
+	FILE*			pfile = NULL;
+
+	memcpy(size_img,    k->args[4], sizeof(size_img));
+	memcpy(size_sino,   k->args[5], sizeof(size_sino));
+	memcpy(img_offset,  k->args[6], sizeof(img_offset));
+	memcpy(vox_size,    k->args[7], sizeof(vox_size));
+	memcpy(zalign_cotg, k->args[8], sizeof(zalign_cotg));
+
+	p.image   = (float*)       fNativeArgMem(k, 0, &image_size);
+	p.sino    = (float*)       fNativeArgMem(k, 1, &sino_size);
+	p.srclocs = (const float*) fNativeArgMem(k, 2, &srclocs_size);
+	p.detbins = (const float*) fNativeArgMem(k, 3, &detbins_size);
+	p.mc      = k->motion ? (const float*) fNativeArgMem(k, 9, &mc_size) : NULL;
+
+	for (int ii = 0; ii < 3; ii++)
+	{
+		p.n[ii]      = size_img[ii];
+		p.offset[ii] = img_offset[ii];
+		p.vox[ii]    = vox_size[ii];
+	}
+	p.cotg    = zalign_cotg[0];
+	p.ndet    = size_sino[0];
+	p.nplanes = size_sino[1];
+	p.nviews  = size_sino[2];
+	p.npad    = (p.nplanes + NATIVE_LANES - 1) / NATIVE_LANES * NATIVE_LANES;
+
+	if (p.image == NULL || p.sino == NULL || p.srclocs == NULL || p.detbins == NULL || (k->motion && p.mc == NULL)
+		|| image_size   < 4 * (cl_ulong) p.n[0] * p.n[1] * p.n[2]
+		|| sino_size    < 4 * (cl_ulong) p.ndet * p.nplanes * p.nviews
+		|| srclocs_size < 16 * (cl_ulong) p.nviews
+		|| detbins_size < 16 * (2 + (cl_ulong) (p.ndet + 1) * (p.nplanes + 1))
+		|| (k->motion && mc_size < 64 * (cl_ulong) p.nviews))
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Native kernel arguments missing or too small.\n");
+			fclose(pfile);
+		}
+		return(-1);
+	}
+
+	fNativeProject(&p, k->type == NATIVE_BACK);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Native %s of %u views done.\n", k->type == NATIVE_BACK ? "back projection" : "projection", p.nviews);
+		fclose(pfile);
+	}
+
+	return(0);
+}
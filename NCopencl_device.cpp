@@ -0,0 +1,410 @@
+// NCopencl_device.cpp : Device discovery and selection. The platforms and
+// devices are enumerated once per process; later command queues pick their
+// device from that list without querying the runtime again.
+//
+// By default the fastest device is used: the GPU (or, with force_cpu or
+// without GPUs, the CPU) ranked highest by the selection policy. A device can
+// also be chosen by (part of) its name or by its index in the discovery list.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <mutex>
+
+#define MAX_DISCOVERED_DEVICES 16
+#define CALIBRATE_ITEMS  65536
+#define CALIBRATE_LOOPS  1024
+#define CALIBRATE_STR(x) #x
+#define CALIBRATE_DEFINE(x) "-D CALIBRATE_LOOPS=" CALIBRATE_STR(x)
+
+typedef struct {
+	cl_device_id	device_id;
+	cl_device_type	type;
+	cl_uint			platform;
+	char			name[128];
+	cl_uint			compute_units;
+	cl_uint			clock_mhz;
+	cl_ulong		global_mem_size;
+	double			gflops;			// calibration, < 0 not measured yet
+} discovered_device;
+
+static std::mutex			device_lock;
+static discovered_device	discovered[MAX_DISCOVERED_DEVICES];
+static cl_uint				discovered_nn = 0;
+static cl_bool				discovered_done = CL_FALSE;
+
+static cl_int				selection_policy = DEVICE_RANK_THROUGHPUT;
+static char					selection_name[128] = "";
+static cl_int				selection_index = -1;
+
+// Each work item runs a dependent chain of 2 * CALIBRATE_LOOPS mads; the loop
+// count is passed as a build option.
+static const char* calibrate_source =
+	"__kernel void calibrate(__global float* out, float seed)\n"
+	"{\n"
+	"	float a = (float) get_global_id(0) * seed;\n"
+	"	float b = seed;\n"
+	"	for (int ii = 0; ii < CALIBRATE_LOOPS; ii++)\n"
+	"	{\n"
+	"		a = mad(a, b, 0.5f);\n"
+	"		b = mad(b, a, -0.5f);\n"
+	"	}\n"
+	"	out[get_global_id(0)] = a + b;\n"
+	"}\n";
+
+///////////////////////////////////////////////////////////////////////////////
+// Enumerate all platforms and devices, once. The overview is logged then.
+//
+static int fDiscoverDevices(cl_bool verbose, char* log_file)
+{
+	cl_platform_id*		platform_id;
+	cl_uint				platform_nn = 0;
+	cl_device_id*		device_list;
+	cl_uint				device_nn;
+	char				platform_name[128];
+	discovered_device*	device;
+	cl_int				error;
+	FILE*				pfile = NULL;
+
+	if (discovered_done) return(0);
+
+	error = clGetPlatformIDs(0, NULL, &platform_nn);
+	if (error != CL_SUCCESS || platform_nn == 0)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to get Platform ID! %d \n", error);
+			fclose(pfile);
+		}
+		return(-3);
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: %d platform IDs found.\n", platform_nn);
+		fclose(pfile);
+	}
+
+	platform_id = (cl_platform_id*) malloc (platform_nn * sizeof(cl_platform_id));
+	error = clGetPlatformIDs(platform_nn, platform_id, NULL);
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to get Platform ID! %d \n", error);
+			fclose(pfile);
+		}
+		free(platform_id);
+		return(-3);
+	}
+
+	if(verbose){pfile = fopen(log_file, "a");}
+	for (cl_uint index = 0; index < platform_nn; index++)
+	{
+		platform_name[0] = 0;
+		clGetPlatformInfo(platform_id[index], CL_PLATFORM_NAME, sizeof(platform_name), platform_name, NULL);
+		if(verbose){fprintf(pfile, "=== Platform %d: %s.\n", index+1, platform_name);}
+
+		// A platform without devices is not an error
+		device_nn = 0;
+		error = clGetDeviceIDs(platform_id[index], CL_DEVICE_TYPE_ALL, 0, NULL, &device_nn);
+		if (error != CL_SUCCESS || device_nn == 0) continue;
+
+		device_list = (cl_device_id*) malloc (device_nn * sizeof(cl_device_id));
+		error = clGetDeviceIDs(platform_id[index], CL_DEVICE_TYPE_ALL, device_nn, device_list, NULL);
+
+		for (cl_uint index2 = 0; index2 < device_nn && error == CL_SUCCESS; index2++)
+		{
+			if (discovered_nn == MAX_DISCOVERED_DEVICES)
+			{
+				if(verbose){fprintf(pfile, "Warning: More than %d devices, the rest is ignored.\n", MAX_DISCOVERED_DEVICES);}
+				break;
+			}
+
+			device = &discovered[discovered_nn];
+			memset(device, 0, sizeof(discovered_device));
+			device->device_id	= device_list[index2];
+			device->platform	= index;
+			device->gflops		= -1.0;
+
+			error = clGetDeviceInfo(device->device_id, CL_DEVICE_NAME, sizeof(device->name), device->name, NULL);
+			if (error == CL_SUCCESS) error = clGetDeviceInfo(device->device_id, CL_DEVICE_TYPE, sizeof(cl_device_type), &device->type, NULL);
+			if (error == CL_SUCCESS) error = clGetDeviceInfo(device->device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &device->compute_units, NULL);
+			if (error == CL_SUCCESS) error = clGetDeviceInfo(device->device_id, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(cl_uint), &device->clock_mhz, NULL);
+			if (error == CL_SUCCESS) error = clGetDeviceInfo(device->device_id, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &device->global_mem_size, NULL);
+
+			if(verbose){fprintf(pfile, "------- Device %d: %s (index %u, %u compute units at %u MHz, %llu MB).\n", index2+1, device->name,
+								discovered_nn, device->compute_units, device->clock_mhz, (unsigned long long) (device->global_mem_size >> 20));}
+			discovered_nn++;
+		}
+		free(device_list);
+
+		if (error != CL_SUCCESS)
+		{
+			if (verbose)
+			{
+				fprintf(pfile, "Error generating device overview! %d \n", error);
+				fclose(pfile);
+			}
+			discovered_nn = 0;
+			free(platform_id);
+			return(-4);
+		}
+	}
+	if(verbose){fclose(pfile);}
+	free(platform_id);
+
+	if (discovered_nn == 0)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to get Device ID! %d \n", CL_DEVICE_NOT_FOUND);
+			fclose(pfile);
+		}
+		return(-5);
+	}
+
+	discovered_done = CL_TRUE;
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Time a chain of mads on the device, in GFLOP/s; 0 when it cannot run.
+// One warm-up launch, the second one is timed with a profiling event.
+//
+static double fCalibrateDevice(discovered_device* device, cl_bool verbose, char* log_file)
+{
+	cl_context			context = NULL;
+	cl_command_queue	queue = NULL;
+	cl_program			program = NULL;
+	cl_kernel			kernel = NULL;
+	cl_mem				out = NULL;
+	cl_event			event = NULL;
+	cl_float			seed = 0.999f;
+	cl_ulong			start = 0;
+	cl_ulong			end = 0;
+	size_t				global = CALIBRATE_ITEMS;
+	double				gflops = 0.0;
+	cl_int				error;
+	FILE*				pfile = NULL;
+
+	context = clCreateContext(0, 1, &device->device_id, NULL, NULL, &error);
+	if (error == CL_SUCCESS) queue = clCreateCommandQueue(context, device->device_id, CL_QUEUE_PROFILING_ENABLE, &error);
+	if (error == CL_SUCCESS) program = clCreateProgramWithSource(context, 1, &calibrate_source, NULL, &error);
+	if (error == CL_SUCCESS) error = clBuildProgram(program, 1, &device->device_id, "-cl-mad-enable " CALIBRATE_DEFINE(CALIBRATE_LOOPS), NULL, NULL);
+	if (error == CL_SUCCESS) kernel = clCreateKernel(program, "calibrate", &error);
+	if (error == CL_SUCCESS) out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, global * sizeof(cl_float), NULL, &error);
+	if (error == CL_SUCCESS) error = clSetKernelArg(kernel, 0, sizeof(cl_mem), &out);
+	if (error == CL_SUCCESS) error = clSetKernelArg(kernel, 1, sizeof(cl_float), &seed);
+	if (error == CL_SUCCESS) error = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, NULL, 0, NULL, NULL);
+	if (error == CL_SUCCESS) error = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, NULL, 0, NULL, &event);
+	if (error == CL_SUCCESS) error = clWaitForEvents(1, &event);
+	if (error == CL_SUCCESS) error = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+	if (error == CL_SUCCESS) error = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+
+	if (error == CL_SUCCESS && end > start)
+	{
+		gflops = (double) global * CALIBRATE_LOOPS * 2 * 2 / (double) (end - start);
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		if (error != CL_SUCCESS) fprintf(pfile, "Warning: Calibration of %s failed! %d\n", device->name, error);
+		else fprintf(pfile, "Info: Calibration of %s: %.1f GFLOP/s.\n", device->name, gflops);
+		fclose(pfile);
+	}
+
+	if (event)		clReleaseEvent(event);
+	if (out)		clReleaseMemObject(out);
+	if (kernel)		clReleaseKernel(kernel);
+	if (program)	clReleaseProgram(program);
+	if (queue)		clReleaseCommandQueue(queue);
+	if (context)	clReleaseContext(context);
+
+	return(gflops);
+}
+
+// Rank of a device under the selection policy, higher is better.
+static double fDeviceScore(discovered_device* device, cl_bool verbose, char* log_file)
+{
+	switch (selection_policy)
+	{
+	case DEVICE_RANK_MEMORY:
+		return((double) device->global_mem_size);
+	case DEVICE_RANK_CALIBRATE:
+		if (device->gflops < 0.0) device->gflops = fCalibrateDevice(device, verbose, log_file);
+		return(device->gflops);
+	default:
+		return((double) device->compute_units * device->clock_mhz);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Device for a new command queue. An index or name set by fSelectDevicePolicy
+// wins; otherwise the best ranked GPU or accelerator, or with force_cpu (or
+// without any) the best ranked CPU.
+//
+int fSelectDevice(cl_bool force_cpu, cl_device_id* device_id, cl_bool verbose, char* log_file)
+{
+	int			result;
+	int			best = -1;
+	double		score;
+	double		best_score = -1.0;
+	cl_bool		want_cpu = force_cpu != 0;
+	cl_bool		is_cpu;
+	FILE*		pfile = NULL;
+
+	std::lock_guard<std::mutex> lock(device_lock);
+
+	result = fDiscoverDevices(verbose, log_file);
+	if (result < 0) return(result);
+
+	if (selection_index >= 0)
+	{
+		if ((cl_uint) selection_index >= discovered_nn)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: No device with index %d, %u devices found!\n", selection_index, discovered_nn);
+				fclose(pfile);
+			}
+			return(-5);
+		}
+		best = selection_index;
+	}
+	else if (selection_name[0] != 0)
+	{
+		for (cl_uint ii = 0; ii < discovered_nn && best < 0; ii++)
+		{
+			if (strstr(discovered[ii].name, selection_name) != NULL) best = (int) ii;
+		}
+		if (best < 0)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: No device matches '%s'!\n", selection_name);
+				fclose(pfile);
+			}
+			return(-5);
+		}
+	}
+	else
+	{
+		if (!want_cpu)
+		{
+			want_cpu = CL_TRUE;
+			for (cl_uint ii = 0; ii < discovered_nn; ii++)
+			{
+				if (!(discovered[ii].type & CL_DEVICE_TYPE_CPU)) want_cpu = CL_FALSE;
+			}
+		}
+
+		for (cl_uint ii = 0; ii < discovered_nn; ii++)
+		{
+			is_cpu = (discovered[ii].type & CL_DEVICE_TYPE_CPU) != 0;
+			if (is_cpu != want_cpu) continue;
+
+			score = fDeviceScore(&discovered[ii], verbose, log_file);
+			if (score > best_score)
+			{
+				best		= (int) ii;
+				best_score	= score;
+			}
+		}
+		if (best < 0)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: Failed to get Device ID! %d \n", CL_DEVICE_NOT_FOUND);
+				fclose(pfile);
+			}
+			return(-5);
+		}
+	}
+
+	*device_id = discovered[best].device_id;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: using %s as compute device.\n", discovered[best].name);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// How later command queues choose their device: a ranking policy, or a fixed
+// device by name (substring, "" for none) or index (-1 for none).
+//
+int fSelectDevicePolicy(cl_int policy, char* name, cl_int index, cl_bool verbose, char* log_file)
+{
+	FILE*	pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientUnsupported("Device selection", verbose, log_file));
+	}
+
+	if (policy < DEVICE_RANK_THROUGHPUT || policy > DEVICE_RANK_CALIBRATE)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Unknown device ranking policy %d!\n", policy);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+
+	std::lock_guard<std::mutex> lock(device_lock);
+
+	selection_policy	= policy;
+	selection_index		= index;
+	strncpy(selection_name, name != NULL ? name : "", sizeof(selection_name) - 1);
+	selection_name[sizeof(selection_name) - 1] = 0;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		if (index >= 0) fprintf(pfile, "Info: Device %d selected.\n", index);
+		else if (selection_name[0] != 0) fprintf(pfile, "Info: Device '%s' selected.\n", selection_name);
+		else fprintf(pfile, "Info: Devices ranked by %s.\n", policy == DEVICE_RANK_MEMORY ? "global memory"
+					 : policy == DEVICE_RANK_CALIBRATE ? "calibration" : "compute units x clock");
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Measured GFLOP/s of a device (see fCalibrateDevice), once per device; 0
+// when it is not among the discovered devices or the calibration failed.
+//
+double fDeviceGflops(cl_device_id device_id, cl_bool verbose, char* log_file)
+{
+	std::lock_guard<std::mutex> lock(device_lock);
+
+	if (fDiscoverDevices(verbose, log_file) < 0) return(0.0);
+
+	for (cl_uint ii = 0; ii < discovered_nn; ii++)
+	{
+		if (discovered[ii].device_id != device_id) continue;
+
+		if (discovered[ii].gflops < 0.0) discovered[ii].gflops = fCalibrateDevice(&discovered[ii], verbose, log_file);
+		return(discovered[ii].gflops);
+	}
+
+	return(0.0);
+}
@@ -0,0 +1,303 @@
+// NCopencl_dlm.cpp : IDL Dynamically Loadable Module front end of the library.
+//
+// The typed system routines below take the IDL variables themselves instead of
+// the call_external argv array: scalars are converted in place, arrays are
+// passed as their data pointer and byte size from the IDL descriptor (no copy,
+// no size(/type) table in IDL). Each routine calls the fNC entry point with
+// the same arguments, so capture, residency and lazy kernels behave alike.
+//
+// The module is described by opencl_wrapper.dlm, which has to sit next to the
+// library (with the library's base name) and be on IDL_DLM_PATH. It must be
+// the same file as the one niopencl calls through call_external, or the two
+// would not share the buffers and kernels.
+//
+//   b = NCOCL_SET_KERNEL_ARG(kernel_list, kernel_index, arg_index, value, is_mem, verbose, log_file)
+//   b = NCOCL_EXECUTE_KERNEL(queue, kernel_list, kernel_index, use_local, global, local, verbose, log_file)
+//   b = NCOCL_CREATE_BUFFER(queue, index, data, read_write, use_host_ptr, verbose, log_file)
+//   b = NCOCL_WRITE_BUFFER(queue, index, data, verbose, log_file)
+//   b = NCOCL_READ_BUFFER(queue, index, data, verbose, log_file)  ; data is filled in place
+//   b = NCOCL_RELEASE_BUFFER(index, verbose, log_file)
+//   a = NCOCL_ARENA_ARRAY(type, dims, huge, verbose, log_file)  ; page aligned, see NCopencl_arena.cpp
+//   a = NCOCL_SVM_ARRAY(index, type, dims)  ; fine grained SVM buffer, see NCopencl_svm.cpp
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include "idl_export.h"
+
+extern cl_mem	buffers[MAX_BUFFERS];
+
+// Numeric types of the size(/type) tables of niopencl
+static void fDlmType(int type)
+{
+	switch (type)
+	{
+	case IDL_TYP_BYTE:
+	case IDL_TYP_INT:
+	case IDL_TYP_LONG:
+	case IDL_TYP_FLOAT:
+	case IDL_TYP_DOUBLE:
+	case IDL_TYP_UINT:
+	case IDL_TYP_ULONG:
+	case IDL_TYP_LONG64:
+	case IDL_TYP_ULONG64:
+		break;
+	default:
+		IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP, "Variable size could not be determined.");
+	}
+}
+
+// Data pointer and size in bytes of a numeric IDL variable
+static void fDlmData(IDL_VPTR v, void** data, cl_ulong* size)
+{
+	IDL_MEMINT	n;
+	char*		pd;
+
+	fDlmType(v->type);
+	IDL_VarGetData(v, &n, &pd, TRUE);
+	*data = (void *) pd;
+	*size = (cl_ulong) n * IDL_TypeSizeFunc(v->type);
+}
+
+// IDL string as the idls of the call_external interface
+static idls fDlmString(IDL_VPTR v)
+{
+	idls	str;
+
+	str.s		= IDL_VarGetString(v);
+	str.slen	= (short) strlen(str.s);
+	str.stype	= 0;
+	return(str);
+}
+
+// Pointer kept by niopencl as ULONG64 (command queue, kernel list)
+static void* fDlmPointer(IDL_VPTR v)
+{
+	return((void *)(size_t) IDL_ULong64Scalar(v));
+}
+
+// global/local work sizes, up to three dimensions
+static cl_uint4 fDlmSize(IDL_VPTR v)
+{
+	cl_uint4	size;
+	IDL_VPTR	ul;
+	IDL_MEMINT	n;
+	char*		pd;
+
+	memset(&size, 0, sizeof(size));
+	ul = IDL_CvtULng(1, &v);
+	IDL_VarGetData(ul, &n, &pd, TRUE);
+	for (IDL_MEMINT ii = 0; ii < n && ii < 3; ii++)
+	{
+		size.s[ii] = ((IDL_ULONG *) pd)[ii];
+	}
+	if (ul != v) IDL_Deltmp(ul);
+
+	return(size);
+}
+
+static IDL_VPTR ncocl_set_kernel_arg(int argc, IDL_VPTR argv[], char* argk)
+{
+	void*		kernel_list = fDlmPointer(argv[0]);
+	cl_uint		kernel_index = IDL_ULongScalar(argv[1]);
+	cl_uint		arg_index = IDL_ULongScalar(argv[2]);
+	cl_bool		is_mem = IDL_LongScalar(argv[4]) != 0;
+	cl_bool		verbose = IDL_LongScalar(argv[5]);
+	idls		log_file = fDlmString(argv[6]);
+	cl_uint		index;
+	cl_ulong	arg_size;
+	void*		arg_value;
+
+	if (is_mem)
+	{
+		// Index of the buffer, set as cl_mem by fNCset_kernel_arg
+		index = IDL_ULongScalar(argv[3]);
+		arg_value = &index;
+		arg_size = sizeof(cl_mem);
+	}
+	else
+	{
+		fDlmData(argv[3], &arg_value, &arg_size);
+	}
+
+	void* args[8] = {&kernel_list, &kernel_index, &arg_index, &arg_size, arg_value, &is_mem, &verbose, &log_file};
+	return(IDL_GettmpLong(fNCset_kernel_arg(8, args)));
+}
+
+static IDL_VPTR ncocl_execute_kernel(int argc, IDL_VPTR argv[], char* argk)
+{
+	void*		queue = fDlmPointer(argv[0]);
+	void*		kernel_list = fDlmPointer(argv[1]);
+	cl_uint		kernel_index = IDL_ULongScalar(argv[2]);
+	cl_uint		use_local = IDL_ULongScalar(argv[3]);
+	cl_uint4	global = fDlmSize(argv[4]);
+	cl_uint4	local = fDlmSize(argv[5]);
+	cl_bool		verbose = IDL_LongScalar(argv[6]);
+	idls		log_file = fDlmString(argv[7]);
+
+	void* args[8] = {&queue, &kernel_list, &kernel_index, &use_local, &global, &local, &verbose, &log_file};
+	return(IDL_GettmpLong(fNCexecute_kernel(8, args)));
+}
+
+static IDL_VPTR ncocl_create_buffer(int argc, IDL_VPTR argv[], char* argk)
+{
+	void*		queue = fDlmPointer(argv[0]);
+	cl_uint		index = IDL_ULongScalar(argv[1]);
+	cl_int		read_write = IDL_LongScalar(argv[3]);
+	cl_bool		use_host_ptr = IDL_LongScalar(argv[4]) != 0;
+	cl_bool		verbose = IDL_LongScalar(argv[5]);
+	idls		log_file = fDlmString(argv[6]);
+	void*		data;
+	cl_ulong	size;
+
+	// use_host_ptr keeps the IDL memory, which must then outlive the buffer
+	fDlmData(argv[2], &data, &size);
+
+	void* args[8] = {&queue, &index, data, &size, &read_write, &use_host_ptr, &verbose, &log_file};
+	return(IDL_GettmpLong(fNCcreate_buffer(8, args)));
+}
+
+static IDL_VPTR ncocl_write_buffer(int argc, IDL_VPTR argv[], char* argk)
+{
+	void*		queue = fDlmPointer(argv[0]);
+	cl_uint		index = IDL_ULongScalar(argv[1]);
+	cl_bool		verbose = IDL_LongScalar(argv[3]);
+	idls		log_file = fDlmString(argv[4]);
+	void*		data;
+	cl_ulong	size;
+
+	fDlmData(argv[2], &data, &size);
+
+	void* args[6] = {&queue, &index, data, &size, &verbose, &log_file};
+	return(IDL_GettmpLong(fNCwrite_buffer(6, args)));
+}
+
+static IDL_VPTR ncocl_read_buffer(int argc, IDL_VPTR argv[], char* argk)
+{
+	void*		queue = fDlmPointer(argv[0]);
+	cl_uint		index = IDL_ULongScalar(argv[1]);
+	cl_bool		verbose = IDL_LongScalar(argv[3]);
+	idls		log_file = fDlmString(argv[4]);
+	void*		data;
+	cl_ulong	size;
+
+	// Read straight into the caller's variable
+	IDL_EXCLUDE_EXPR(argv[2]);
+	fDlmData(argv[2], &data, &size);
+
+	void* args[6] = {&queue, &index, data, &size, &verbose, &log_file};
+	return(IDL_GettmpLong(fNCread_buffer(6, args)));
+}
+
+static IDL_VPTR ncocl_release_buffer(int argc, IDL_VPTR argv[], char* argk)
+{
+	cl_uint		index = IDL_ULongScalar(argv[0]);
+	cl_bool		verbose = IDL_LongScalar(argv[1]);
+	idls		log_file = fDlmString(argv[2]);
+
+	void* args[3] = {&index, &verbose, &log_file};
+	return(IDL_GettmpLong(fNCrelease_buffer(3, args)));
+}
+
+// Dimensions of an array to create, and its size in bytes
+static cl_ulong fDlmDims(IDL_VPTR v, int type, IDL_MEMINT* dim, int* n_dim)
+{
+	IDL_VPTR	dims;
+	IDL_MEMINT	n;
+	char*		pd;
+	cl_ulong	size = IDL_TypeSizeFunc(type);
+
+	dims = IDL_CvtLng64(1, &v);
+	IDL_VarGetData(dims, &n, &pd, TRUE);
+	if (n > IDL_MAX_ARRAY_DIM) n = IDL_MAX_ARRAY_DIM;
+	for (IDL_MEMINT ii = 0; ii < n; ii++)
+	{
+		dim[ii] = (IDL_MEMINT) ((IDL_LONG64 *) pd)[ii];
+		if (dim[ii] <= 0) size = 0;
+		size *= dim[ii];
+	}
+	if (dims != v) IDL_Deltmp(dims);
+	if (size == 0)
+	{
+		IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP, "Array dimensions must be greater than 0.");
+	}
+
+	*n_dim = (int) n;
+	return(size);
+}
+
+// Arena blocks of NCOCL_ARENA_ARRAY go back to the pool with the array
+static void fDlmArenaRelease(UCHAR* data)
+{
+	fArenaFree(data);
+}
+
+static IDL_VPTR ncocl_arena_array(int argc, IDL_VPTR argv[], char* argk)
+{
+	int			type = IDL_LongScalar(argv[0]);
+	cl_bool		huge = IDL_LongScalar(argv[2]) != 0;
+	cl_bool		verbose = IDL_LongScalar(argv[3]);
+	idls		log_file = fDlmString(argv[4]);
+	IDL_MEMINT	dim[IDL_MAX_ARRAY_DIM];
+	int			n_dim;
+	cl_ulong	size;
+	void*		data;
+
+	fDlmType(type);
+	size = fDlmDims(argv[1], type, dim, &n_dim);
+
+	// Contents are undefined, as with make_array(/nozero)
+	if (fArenaAlloc(size, huge, &data, verbose, log_file.s) < 0)
+	{
+		IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP, "Arena allocation failed.");
+	}
+
+	return(IDL_ImportArray(n_dim, dim, type, (UCHAR *) data, fDlmArenaRelease, NULL));
+}
+
+// The array is only valid until the buffer is released
+static IDL_VPTR ncocl_svm_array(int argc, IDL_VPTR argv[], char* argk)
+{
+	cl_uint		index = IDL_ULongScalar(argv[0]);
+	int			type = IDL_LongScalar(argv[1]);
+	IDL_MEMINT	dim[IDL_MAX_ARRAY_DIM];
+	int			n_dim;
+	cl_ulong	size;
+	cl_ulong	svm_size = 0;
+	cl_uint		granularity = 0;
+	void*		data = NULL;
+
+	fDlmType(type);
+	size = fDlmDims(argv[2], type, dim, &n_dim);
+
+	if (index < MAX_BUFFERS) data = fSvmPointer(buffers[index], &granularity, &svm_size);
+	if (data == NULL || granularity == SVM_COARSE)
+	{
+		IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP, "Not a fine grained shared virtual memory buffer.");
+	}
+	if (size > svm_size)
+	{
+		IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP, "Array larger than the buffer.");
+	}
+
+	return(IDL_ImportArray(n_dim, dim, type, (UCHAR *) data, NULL, NULL));
+}
+
+// Called by IDL when the module is loaded
+DLL_EXPORT int IDL_Load(void)
+{
+	static IDL_SYSFUN_DEF2 functions[] = {
+		{{(IDL_SYSRTN_GENERIC) ncocl_set_kernel_arg},	(char *) "NCOCL_SET_KERNEL_ARG",	7, 7, 0, 0},
+		{{(IDL_SYSRTN_GENERIC) ncocl_execute_kernel},	(char *) "NCOCL_EXECUTE_KERNEL",	8, 8, 0, 0},
+		{{(IDL_SYSRTN_GENERIC) ncocl_create_buffer},	(char *) "NCOCL_CREATE_BUFFER",		7, 7, 0, 0},
+		{{(IDL_SYSRTN_GENERIC) ncocl_write_buffer},		(char *) "NCOCL_WRITE_BUFFER",		5, 5, 0, 0},
+		{{(IDL_SYSRTN_GENERIC) ncocl_read_buffer},		(char *) "NCOCL_READ_BUFFER",		5, 5, 0, 0},
+		{{(IDL_SYSRTN_GENERIC) ncocl_release_buffer},	(char *) "NCOCL_RELEASE_BUFFER",	3, 3, 0, 0},
+		{{(IDL_SYSRTN_GENERIC) ncocl_arena_array},		(char *) "NCOCL_ARENA_ARRAY",		5, 5, 0, 0},
+		{{(IDL_SYSRTN_GENERIC) ncocl_svm_array},		(char *) "NCOCL_SVM_ARRAY",			3, 3, 0, 0},
+	};
+
+	return(IDL_SysRtnAdd(functions, TRUE, IDL_CARRAY_ELTS(functions)));
+}
@@ -0,0 +1,293 @@
+// NCopencl_geom.cpp : Helical CT geometry generation. Builds the packed float4
+// buffers used by the spiral CT kernels (detector fan, source locations and
+// rigid motion matrices) without per-view loops in IDL.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+// Views per thread below which the work is done on the calling thread.
+#define GEOM_MIN_VIEWS_PER_THREAD 2048
+
+///////////////////////////////////////////////////////////////////////////////
+// Map a registry buffer for writing, or hand back the host output when the
+// result does not go to the device. Through the projection server the result
+// is computed in host memory and uploaded on unmap.
+//
+static void* fGeomMap(cl_command_queue* commands, cl_mem* mem_ptr, void* host, cl_bool to_device, size_t size, cl_bool verbose, char* log_file)
+{
+	cl_int	error;
+	void*	mapped;
+	FILE*	pfile = NULL;
+
+	if (!to_device)
+	{
+		return(host);
+	}
+	if (fClientActive())
+	{
+		return(malloc(size));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeMemPtr(*mem_ptr, NULL));
+	}
+
+	mapped = clEnqueueMapBuffer(*commands, *mem_ptr, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, size, 0, NULL, NULL, &error);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to map geometry buffer! %d \n", error);
+			fprintf(pfile, "Info: Size (bytes): %llu.\n", (unsigned long long) size);
+			fclose(pfile);
+		}
+		return(NULL);
+	}
+
+	return(mapped);
+}
+
+static int fGeomUnmap(cl_command_queue* commands, cl_mem* mem_ptr, void* mapped, cl_bool to_device, size_t size, cl_bool verbose, char* log_file)
+{
+	cl_int	error;
+	FILE*	pfile = NULL;
+
+	if (!to_device || fNativeQueue(commands))
+	{
+		return(0);
+	}
+	if (fClientActive())
+	{
+		error = fWriteBuffer(commands, mem_ptr, mapped, size, verbose, log_file);
+		free(mapped);
+		return(error);
+	}
+
+	error = clEnqueueUnmapMemObject(*commands, *mem_ptr, mapped, 0, NULL, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to unmap geometry buffer! %d \n", error);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Source locations of a subset of views, one float4 per view:
+//   (tube angle, mean table position over the detector rows, align, zalign)
+// tablepos is the IDL (nrangles, ndetplanes) array. A NULL subset takes the
+// first nsubset views in order.
+//
+int fGeomSourceLocations(cl_command_queue* commands, cl_mem* mem_ptr, cl_float* srclocs, cl_bool to_device, cl_float* angles, cl_float* tablepos, cl_float* align, cl_float* zalign, cl_ulong nrangles, cl_uint ndetplanes, cl_int* subset, cl_ulong nsubset, cl_bool verbose, char* log_file)
+{
+	cl_float*	out;
+	FILE*		pfile = NULL;
+
+	out = (cl_float*) fGeomMap(commands, mem_ptr, srclocs, to_device, 4 * sizeof(cl_float) * nsubset, verbose, log_file);
+	if (out == NULL) return(-2);
+
+	fParallelFor(nsubset, GEOM_MIN_VIEWS_PER_THREAD, [=](cl_ulong first, cl_ulong last)
+	{
+		float inv_planes = 1.0f / (float) ndetplanes;
+
+		for (cl_ulong ii = first; ii < last; ii++)
+		{
+			cl_ulong	view = subset ? (cl_ulong) subset[ii] : ii;
+			float		sum  = 0.0f;
+
+			for (cl_uint pp = 0; pp < ndetplanes; pp++)
+			{
+				sum += tablepos[view + nrangles * pp];
+			}
+
+			out[4*ii + 0] = angles[view];
+			out[4*ii + 1] = sum * inv_planes;
+			out[4*ii + 2] = align[view];
+			out[4*ii + 3] = zalign[view];
+		}
+	});
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Source locations computed for %llu views.\n", (unsigned long long) nsubset);
+		fclose(pfile);
+	}
+
+	return(fGeomUnmap(commands, mem_ptr, out, to_device, 4 * sizeof(cl_float) * nsubset, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Homogeneous rigid motion matrix per view from the 6 x nrangles RIGMOTION
+// array. Each dof is (tx, ty, tz, rx, ry, rz): translations in mm, rotations
+// in degrees about x, then y, then z (R = Rz Ry Rx), translation applied after
+// the rotation. The 4 x 4 output is stored one row after the other, so row r
+// is the float4 (R[r][0], R[r][1], R[r][2], t[r]) as read by the kernels.
+//
+int fGeomMotionMatrices(cl_command_queue* commands, cl_mem* mem_ptr, cl_float* matrices, cl_bool to_device, cl_float* dof, cl_int* subset, cl_ulong nsubset, cl_bool verbose, char* log_file)
+{
+	cl_float*	out;
+	FILE*		pfile = NULL;
+
+	out = (cl_float*) fGeomMap(commands, mem_ptr, matrices, to_device, 16 * sizeof(cl_float) * nsubset, verbose, log_file);
+	if (out == NULL) return(-2);
+
+	fParallelFor(nsubset, GEOM_MIN_VIEWS_PER_THREAD, [=](cl_ulong first, cl_ulong last)
+	{
+		const double deg = 3.14159265358979323846 / 180.0;
+
+		for (cl_ulong ii = first; ii < last; ii++)
+		{
+			cl_ulong		view = subset ? (cl_ulong) subset[ii] : ii;
+			const cl_float*	d    = &dof[6 * view];
+			cl_float*		m    = &out[16 * ii];
+
+			double cx = cos(d[3] * deg), sx = sin(d[3] * deg);
+			double cy = cos(d[4] * deg), sy = sin(d[4] * deg);
+			double cz = cos(d[5] * deg), sz = sin(d[5] * deg);
+
+			m[0]  = (cl_float) (cz * cy);
+			m[1]  = (cl_float) (cz * sy * sx - sz * cx);
+			m[2]  = (cl_float) (cz * sy * cx + sz * sx);
+			m[3]  = d[0];
+			m[4]  = (cl_float) (sz * cy);
+			m[5]  = (cl_float) (sz * sy * sx + cz * cx);
+			m[6]  = (cl_float) (sz * sy * cx - cz * sx);
+			m[7]  = d[1];
+			m[8]  = (cl_float) (-sy);
+			m[9]  = (cl_float) (cy * sx);
+			m[10] = (cl_float) (cy * cx);
+			m[11] = d[2];
+			m[12] = 0.0f;
+			m[13] = 0.0f;
+			m[14] = 0.0f;
+			m[15] = 1.0f;
+		}
+	});
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Motion matrices computed for %llu views.\n", (unsigned long long) nsubset);
+		fclose(pfile);
+	}
+
+	return(fGeomUnmap(commands, mem_ptr, out, to_device, 16 * sizeof(cl_float) * nsubset, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Detector fan of NIdef_projspiralct_ocl, in mm with the rotation axis at 0:
+//   hoeken     = (findgen(nchannels+1) - nchannels/2 + fan_coroffset) * fanangle / nchannels
+//   detcols0   = focus2detector * sin(hoeken)
+//   detrows0   = focus2detector * cos(hoeken) - focus2center
+//   detplanes0 = ([2 t0 - t1, t] - mean) * zfactor, t = tablepos[0, *]
+// fan holds (fan_coroffset, fanangle, focus2detector, focus2center, zfactor).
+// detcols0/detrows0 get nchannels+1 values, detplanes0 ndetplanes+1 values.
+//
+int fGeomDetectorFan(cl_uint nchannels, cl_uint ndetplanes, cl_float* fan, cl_float* tablepos0, cl_float* detcols0, cl_float* detrows0, cl_float* detplanes0, cl_bool verbose, char* log_file)
+{
+	float	fan_coroffset  = fan[0];
+	float	fanangle       = fan[1];
+	float	focus2detector = fan[2];
+	float	focus2center   = fan[3];
+	float	zfactor        = fan[4];
+	float	mean_planes    = 0.0f;
+	FILE*	pfile = NULL;
+
+	for (cl_uint ii = 0; ii <= nchannels; ii++)
+	{
+		float hoek = ((float) ii - nchannels / 2.0f + fan_coroffset) * fanangle / (float) nchannels;
+
+		detcols0[ii] = focus2detector * sinf(hoek);
+		detrows0[ii] = focus2detector * cosf(hoek) - focus2center;
+	}
+
+	if (ndetplanes > 1)
+	{
+		detplanes0[0] = 2 * tablepos0[0] - tablepos0[1];
+	}
+	else
+	{
+		detplanes0[0] = tablepos0[0];
+	}
+	for (cl_uint pp = 0; pp < ndetplanes; pp++)
+	{
+		detplanes0[pp + 1] = tablepos0[pp];
+	}
+	for (cl_uint pp = 0; pp <= ndetplanes; pp++)
+	{
+		mean_planes += detplanes0[pp];
+	}
+	mean_planes /= (float) (ndetplanes + 1);
+	for (cl_uint pp = 0; pp <= ndetplanes; pp++)
+	{
+		detplanes0[pp] = (detplanes0[pp] - mean_planes) * zfactor;
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Detector fan computed for %u channels, %u planes.\n", nchannels, ndetplanes);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pack the kernel's initial coordinates (float4): the system center, the
+// source, then the detector grid with the column index running fastest.
+// With centers set the grid holds bin centers (ray tracing) instead of bin
+// boundaries (distance driven), so it has one point less in each direction.
+//
+int fGeomInitialCoords(cl_float* detcols0, cl_float* detrows0, cl_uint ncols, cl_float* detplanes0, cl_uint nplanes, cl_float* center, cl_float* source, cl_bool centers, cl_float* initial_coords, cl_bool verbose, char* log_file)
+{
+	cl_uint		ncols_out   = centers ? ncols - 1   : ncols;
+	cl_uint		nplanes_out = centers ? nplanes - 1 : nplanes;
+	cl_float*	out = initial_coords;
+	FILE*		pfile = NULL;
+
+	out[0] = center[0];
+	out[1] = center[1];
+	out[2] = center[2];
+	out[3] = 0.0f;
+	out[4] = source[0];
+	out[5] = source[1];
+	out[6] = source[2];
+	out[7] = 1.0f;
+	out += 8;
+
+	for (cl_uint pp = 0; pp < nplanes_out; pp++)
+	{
+		float plane = centers ? (detplanes0[pp] + detplanes0[pp + 1]) / 2.0f : detplanes0[pp];
+
+		for (cl_uint cc = 0; cc < ncols_out; cc++)
+		{
+			out[0] = centers ? (detcols0[cc] + detcols0[cc + 1]) / 2.0f : detcols0[cc];
+			out[1] = centers ? (detrows0[cc] + detrows0[cc + 1]) / 2.0f : detrows0[cc];
+			out[2] = plane;
+			out[3] = 1.0f;
+			out += 4;
+		}
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Initial coordinates packed, %u points.\n", ncols_out * nplanes_out + 2);
+		fclose(pfile);
+	}
+
+	return(0);
+}
@@ -1,4 +1,125 @@
 #include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <mutex>
+#include <string>
+
+// Contexts with extra command queues from fCreateCommandQueueShared.
+#define MAX_SHARED_CONTEXTS 8
+
+static cl_context	shared_contexts[MAX_SHARED_CONTEXTS];
+static cl_uint		shared_queues[MAX_SHARED_CONTEXTS];
+
+// Drop one queue of a shared context; false when it was not shared.
+static cl_bool fReleaseSharedQueue(cl_context context)
+{
+	for (int ii = 0; ii < MAX_SHARED_CONTEXTS; ii++)
+	{
+		if (shared_contexts[ii] == context && shared_queues[ii] > 0)
+		{
+			shared_queues[ii]--;
+			return(CL_TRUE);
+		}
+	}
+	return(CL_FALSE);
+}
+
+// Contexts made by fCreateCommandQueue. A later bridge selecting the same
+// device with the same queue properties gets a queue on the same context
+// (through the shared queue count above) instead of a new context.
+#define MAX_REGISTERED_CONTEXTS 4
+
+typedef struct {
+	cl_context					context;
+	cl_device_id				device_id;
+	cl_command_queue_properties	properties;
+} registered_context;
+
+static registered_context	context_registry[MAX_REGISTERED_CONTEXTS];
+
+// Programs built by fBuildKernels, per context, source text and compile
+// options. The cache holds one reference; kernels of later builds are created
+// from the cached program without compiling again.
+#define MAX_CACHED_PROGRAMS 32
+
+typedef struct {
+	cl_context	context;
+	char*		source;
+	char*		options;
+	cl_program	program;
+} cached_program;
+
+static cached_program		program_cache[MAX_CACHED_PROGRAMS];
+static std::mutex			program_cache_lock;	// lazy builds run on other threads
+
+// Cached program for this source and options, retained for the caller.
+static cl_program fCachedProgram(cl_context context, const char* source, const char* options)
+{
+	std::lock_guard<std::mutex> lock(program_cache_lock);
+
+	for (int ii = 0; ii < MAX_CACHED_PROGRAMS; ii++)
+	{
+		if (program_cache[ii].context == context && strcmp(program_cache[ii].source, source) == 0
+			&& strcmp(program_cache[ii].options, options) == 0)
+		{
+			clRetainProgram(program_cache[ii].program);
+			return(program_cache[ii].program);
+		}
+	}
+	return(NULL);
+}
+
+// Keep a built program; the cache takes over the source text. Without a free
+// entry the program is simply not cached.
+static cl_bool fCacheProgram(cl_context context, char* source, const char* options, cl_program program)
+{
+	std::lock_guard<std::mutex> lock(program_cache_lock);
+
+	for (int ii = 0; ii < MAX_CACHED_PROGRAMS; ii++)
+	{
+		if (program_cache[ii].context != NULL) continue;
+
+		clRetainProgram(program);
+		program_cache[ii].context	= context;
+		program_cache[ii].source	= source;
+		program_cache[ii].options	= (char*) malloc(strlen(options) + 1);
+		program_cache[ii].program	= program;
+		strcpy(program_cache[ii].options, options);
+		return(CL_TRUE);
+	}
+	return(CL_FALSE);
+}
+
+// The last queue of a context goes: drop its registry entry and programs.
+static void fForgetContext(cl_context context, cl_bool verbose, char* log_file)
+{
+	cl_uint	n_programs = 0;
+	FILE*	pfile = NULL;
+
+	for (int ii = 0; ii < MAX_REGISTERED_CONTEXTS; ii++)
+	{
+		if (context_registry[ii].context == context) context_registry[ii].context = NULL;
+	}
+
+	std::lock_guard<std::mutex> lock(program_cache_lock);
+	for (int ii = 0; ii < MAX_CACHED_PROGRAMS; ii++)
+	{
+		if (program_cache[ii].context != context) continue;
+
+		clReleaseProgram(program_cache[ii].program);
+		free(program_cache[ii].source);
+		free(program_cache[ii].options);
+		program_cache[ii].context = NULL;
+		n_programs++;
+	}
+
+	if (verbose && n_programs > 0)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: %u cached programs released.\n", n_programs);
+		fclose(pfile);
+	}
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 // NVIDIA helper function.
@@ -52,7 +173,299 @@ char* oclLoadProgSource(const char* cFilename, const char* cPreamble, size_t* sz
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Build a series of kernels.
+// Registry entry of an embedded kernel source, NULL for file paths.
+//
+const embedded_kernel* fEmbeddedKernel(const char* name)
+{
+	for (int ii = 0; embedded_kernels[ii].name != NULL; ii++)
+	{
+		if (strcmp(embedded_kernels[ii].name, name) == 0) return(&embedded_kernels[ii]);
+	}
+	return(NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Device capabilities, probed on first use of a device and kept.
+//
+#define MAX_PROBED_DEVICES 8
+
+static device_caps	probed_devices[MAX_PROBED_DEVICES];
+static cl_uint		probed_nn = 0;
+static std::mutex	probe_lock;
+
+int fProbeDevice(cl_device_id device_id, device_caps* caps, cl_bool verbose, char* log_file)
+{
+	cl_int		error;
+	size_t		extensions_length = 0;
+	char*		extensions;
+	FILE*		pfile = NULL;
+
+	std::lock_guard<std::mutex> lock(probe_lock);
+
+	for (cl_uint ii = 0; ii < probed_nn; ii++)
+	{
+		if (probed_devices[ii].device_id == device_id)
+		{
+			*caps = probed_devices[ii];
+			return(0);
+		}
+	}
+
+	memset(caps, 0, sizeof(device_caps));
+	caps->device_id = device_id;
+
+	error = clGetDeviceInfo(device_id, CL_DEVICE_TYPE, sizeof(cl_device_type), &caps->type, NULL);
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to probe the device! %d \n", error);
+			fclose(pfile);
+		}
+		return(-4);
+	}
+
+	// Properties a device does not report stay 0
+	clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &caps->compute_units, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &caps->max_work_group_size, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &caps->local_mem_size, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_LOCAL_MEM_TYPE, sizeof(cl_device_local_mem_type), &caps->local_mem_type, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &caps->global_mem_size, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &caps->max_alloc_size, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &caps->host_unified_memory, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_IMAGE_SUPPORT, sizeof(cl_bool), &caps->image_support, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, sizeof(cl_uint), &caps->vector_width_float, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_PREFERRED_VECTOR_WIDTH_HALF, sizeof(cl_uint), &caps->vector_width_half, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT, sizeof(cl_uint), &caps->native_width_float, NULL);
+
+	error = clGetDeviceInfo(device_id, CL_DEVICE_EXTENSIONS, 0, NULL, &extensions_length);
+	if (error == CL_SUCCESS && extensions_length > 0)
+	{
+		extensions = (char*) malloc(extensions_length + 1);
+		clGetDeviceInfo(device_id, CL_DEVICE_EXTENSIONS, extensions_length, extensions, NULL);
+		extensions[extensions_length] = 0;
+		caps->fp16 = strstr(extensions, "cl_khr_fp16") != NULL;
+		caps->fp64 = strstr(extensions, "cl_khr_fp64") != NULL;
+		free(extensions);
+	}
+
+	// Largest power of two work group with a float4 per item in half the
+	// dedicated local memory
+	if (caps->local_mem_type == CL_LOCAL)
+	{
+		for (cl_uint tile = 1; tile <= caps->max_work_group_size && 16 * (cl_ulong) tile <= caps->local_mem_size / 2; tile *= 2)
+		{
+			caps->local_tile = tile;
+		}
+	}
+
+	if (probed_nn < MAX_PROBED_DEVICES) probed_devices[probed_nn++] = *caps;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Device capabilities:\n");
+		fprintf(pfile, "     type %s, %u compute units, work groups up to %lu\n", (caps->type & CL_DEVICE_TYPE_CPU) ? "CPU" : "GPU/accelerator", caps->compute_units, (unsigned long) caps->max_work_group_size);
+		fprintf(pfile, "     local memory %lu bytes (%s), local tile %u\n", (unsigned long) caps->local_mem_size, caps->local_mem_type == CL_LOCAL ? "dedicated" : "global", caps->local_tile);
+		fprintf(pfile, "     global memory %lu MB, largest buffer %lu MB, unified with host %d\n", (unsigned long) (caps->global_mem_size >> 20), (unsigned long) (caps->max_alloc_size >> 20), caps->host_unified_memory);
+		fprintf(pfile, "     float vector width %u (native %u), half %u, fp16 %d, fp64 %d, images %d\n", caps->vector_width_float, caps->native_width_float, caps->vector_width_half, caps->fp16, caps->fp64, caps->image_support);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+// Compile options for a device: the user's options plus what the device
+// offers, unless the user already set it. FAST_MATH also selects the relaxed
+// math compiler flags.
+static void fDeviceOptions(const device_caps* caps, const char* user, std::string& options)
+{
+	char	define[64];
+
+	options = user;
+	if ((caps->type & CL_DEVICE_TYPE_CPU) && strstr(user, "RUN_ON_CPU") == NULL) options += " -D RUN_ON_CPU";
+	if (strstr(user, "DEV_COMPUTE_UNITS") == NULL)
+	{
+		sprintf(define, " -D DEV_COMPUTE_UNITS=%u", caps->compute_units);
+		options += define;
+	}
+	if (strstr(user, "DEV_VECTOR_WIDTH") == NULL && caps->vector_width_float > 0)
+	{
+		sprintf(define, " -D DEV_VECTOR_WIDTH=%u", caps->vector_width_float);
+		options += define;
+	}
+	if (strstr(user, "DEV_LOCAL_TILE") == NULL && caps->local_tile > 0)
+	{
+		sprintf(define, " -D DEV_LOCAL_TILE=%u", caps->local_tile);
+		options += define;
+	}
+	if (caps->host_unified_memory && strstr(user, "DEV_UNIFIED_MEMORY") == NULL) options += " -D DEV_UNIFIED_MEMORY";
+	if (caps->fp16 && strstr(user, "DEV_FP16") == NULL) options += " -D DEV_FP16";
+	if (caps->image_support && strstr(user, "DEV_IMAGES") == NULL) options += " -D DEV_IMAGES";
+	if (strstr(user, "FAST_MATH") != NULL)
+	{
+		if (strstr(user, "-cl-fast-relaxed-math") == NULL) options += " -cl-fast-relaxed-math";
+		if (strstr(user, "-cl-mad-enable") == NULL) options += " -cl-mad-enable";
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Capabilities of the device of a queue, in the order of device_caps.
+//
+int fDeviceCaps(cl_command_queue* commands, cl_ulong caps[DEVICE_CAPS_N], cl_bool verbose, char* log_file)
+{
+	int				result;
+	cl_int			error;
+	cl_device_id	device_id;
+	device_caps		probed;
+
+	if (fClientActive())
+	{
+		return(fClientUnsupported("Device capabilities", verbose, log_file));
+	}
+
+	memset(caps, 0, DEVICE_CAPS_N * sizeof(cl_ulong));
+
+	if (fNativeQueue(commands))
+	{
+		caps[0] = CL_DEVICE_TYPE_CPU;
+		caps[1] = std::thread::hardware_concurrency();
+		caps[7] = CL_TRUE;
+		return(0);
+	}
+
+	error = clGetCommandQueueInfo(*commands, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device_id, NULL);
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			FILE* pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to retreive device! %d \n", error);
+			fclose(pfile);
+		}
+		return(-3);
+	}
+
+	result = fProbeDevice(device_id, &probed, verbose, log_file);
+	if (result != 0) return(result);
+
+	caps[0]  = probed.type;
+	caps[1]  = probed.compute_units;
+	caps[2]  = probed.max_work_group_size;
+	caps[3]  = probed.local_mem_size;
+	caps[4]  = probed.local_mem_type;
+	caps[5]  = probed.global_mem_size;
+	caps[6]  = probed.max_alloc_size;
+	caps[7]  = probed.host_unified_memory;
+	caps[8]  = probed.image_support;
+	caps[9]  = probed.fp16;
+	caps[10] = probed.fp64;
+	caps[11] = probed.vector_width_float;
+	caps[12] = probed.vector_width_half;
+	caps[13] = probed.native_width_float;
+	caps[14] = probed.local_tile;
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build a library-owned program (sinogram, warp, resampling and system matrix
+// kernels) from its source and create its kernels by name. what names the
+// program in the log. On failure nothing is left allocated: -8 program,
+// -9 build, -10 kernel.
+//
+int fBuildLibraryProgram(cl_command_queue* commands, cl_context context, const char* source, const char* what, const char* const* kernel_names, int n_kernels,
+						 cl_program* program, cl_kernel* kernels, cl_bool verbose, char* log_file)
+{
+	cl_int			error;
+	cl_device_id	device_id;
+	FILE*			pfile = NULL;
+
+	for (int ii = 0; ii < n_kernels; ii++) kernels[ii] = NULL;
+
+	*program = clCreateProgramWithSource(context, 1, &source, NULL, &error);
+
+	if (!*program || error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to create %s program! %d \n", what, error);
+			fclose(pfile);
+		}
+		*program = NULL;
+		return(-8);
+	}
+
+	error = clBuildProgram(*program, 0, NULL, "", NULL, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			size_t	build_log_size = 4 * 2048 * sizeof(char);
+			char*	build_log = new char[4*2048];
+
+			clGetCommandQueueInfo(*commands, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device_id, NULL);
+			clGetProgramBuildInfo(*program, device_id, CL_PROGRAM_BUILD_LOG, build_log_size, build_log, NULL);
+
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to build %s program! %d \n", what, error);
+			fprintf(pfile, "Build log: \n%s\n", build_log);
+			fclose(pfile);
+			delete[] build_log;
+		}
+		clReleaseProgram(*program);
+		*program = NULL;
+		return(-9);
+	}
+
+	for (int ii = 0; ii < n_kernels; ii++)
+	{
+		kernels[ii] = clCreateKernel(*program, kernel_names[ii], &error);
+
+		if (!(kernels[ii]) || error != CL_SUCCESS)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: Failed to create %s kernel %s! %d\n", what, kernel_names[ii], error);
+				fclose(pfile);
+			}
+			for (int jj = 0; jj < ii; jj++)
+			{
+				clReleaseKernel(kernels[jj]);
+				kernels[jj] = NULL;
+			}
+			kernels[ii] = NULL;
+			clReleaseProgram(*program);
+			*program = NULL;
+			return(-10);
+		}
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Undo a failed fBuildKernels: the first n_kernels kernels and the program
+// reference each of them holds.
+//
+static void fUnwindKernels(cl_kernel* kernels, cl_program* program, int n_kernels)
+{
+	for (int ii = 0; ii < n_kernels; ii++)
+	{
+		fSpecForget(kernels[ii]);
+		clReleaseKernel(kernels[ii]);
+		clReleaseProgram(program[ii]);
+		kernels[ii] = NULL;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build a series of kernels. A file path that names an embedded kernel source
+// is taken from the registry instead of the file system.
 //
 int fBuildKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl_ulong n_kernels, idls* file_paths, idls* function_names, idls* compile_options, cl_bool verbose, char* log_file)
 {
@@ -63,10 +476,23 @@ int fBuildKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl
 	cl_device_id	device_id;
 	cl_program		program[MAX_KERNELS];
 	size_t			kernel_size;
-	size_t			build_log_size = 4 * 2048 * sizeof(char);
-	char*			build_log = new char[4*2048];
+	const embedded_kernel*	embedded;
+	device_caps		caps;
+	std::string		options;
+	std::string		user_options;
+	std::string		spec;			// -specialize=..., see NCopencl_spec.cpp
+	std::string		spec_source;
 	FILE*			pfile = NULL;
 
+	if (fClientActive())
+	{
+		return(fClientBuildKernels(commands, kernels, n_kernels, file_paths, function_names, compile_options, verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeBuildKernels(kernels, n_kernels, file_paths, function_names, compile_options, verbose, log_file));
+	}
+
 	error = clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
 
 	if (error != CL_SUCCESS)
@@ -87,17 +513,73 @@ int fBuildKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl
 		}
 	}
 
+	// Compile options are completed for the device
+	error = clGetCommandQueueInfo(*commands, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device_id, NULL);
+	if (error == CL_SUCCESS) error = fProbeDevice(device_id, &caps, verbose, log_file);
+	if (error != CL_SUCCESS) return(-4);
 
 	for (int ii = 0; ii < n_kernels; ii++)
 	{
-		source = oclLoadProgSource(file_paths[ii].s, "", &kernel_size);
+		embedded = fEmbeddedKernel(file_paths[ii].s);
+		if (embedded != NULL)
+		{
+			kernel_size = embedded->size;
+			source = (char*) malloc(kernel_size + 1);
+			memcpy((void*) source, embedded->source, kernel_size + 1);
+		}
+		else
+		{
+			source = oclLoadProgSource(file_paths[ii].s, "", &kernel_size);
+		}
 		
 		if (verbose)
 		{
 			pfile = fopen(log_file, "a");
-			fprintf(pfile, "Info: Source file nr. %d read.\n", ii);
+			if (embedded != NULL) fprintf(pfile, "Info: Source nr. %d taken from the embedded %s (sha1 %s).\n", ii, embedded->name, embedded->hash);
+			else fprintf(pfile, "Info: Source file nr. %d read.\n", ii);
 			fclose(pfile);
 		}
+
+		fSpecStrip(compile_options[ii].s, user_options, spec);
+		fDeviceOptions(&caps, user_options.c_str(), options);
+		if (!spec.empty() && source != NULL) spec_source = source;
+
+		// Built before on this context (e.g. by another projector)
+
+		program[ii] = source ? fCachedProgram(context, source, options.c_str()) : NULL;
+		if (program[ii] != NULL)
+		{
+			free((void*) source);
+			kernels[ii] = clCreateKernel(program[ii], function_names[ii].s, &error);
+			if (!(kernels[ii]) || error != CL_SUCCESS)
+			{
+				if (verbose)
+				{
+					pfile = fopen(log_file, "a");
+					fprintf(pfile, "Error: Failed to create compute kernel nr. %d! %d\n", ii, error);
+					fclose(pfile);
+				}
+				clReleaseProgram(program[ii]);
+				fUnwindKernels(kernels, program, ii);
+				return(-10);
+			}
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Info: Compute kernel nr. %d created from a cached program.\n", ii);
+				fclose(pfile);
+			}
+			if (!spec.empty())
+			{
+				error = fSpecRegister(kernels[ii], context, device_id, spec_source.c_str(), options.c_str(), function_names[ii].s, spec, verbose, log_file);
+				if (error != 0)
+				{
+					fUnwindKernels(kernels, program, ii + 1);
+					return(error);
+				}
+			}
+			continue;
+		}
 		
 		program[ii]  = clCreateProgramWithSource(context, 1, &source, &kernel_size, &error);
 		
@@ -112,6 +594,7 @@ int fBuildKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl
 				fprintf(pfile, "-34: CL_INVALID_CONTEXT\n");
 				fclose(pfile);
 			}
+			fUnwindKernels(kernels, program, ii);
 		    return(-8);
 		}
 		else
@@ -124,7 +607,7 @@ int fBuildKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl
 			}
 		}
 
-		error = clBuildProgram(program[ii], 0, NULL, compile_options[ii].s, NULL, NULL);
+		error = clBuildProgram(program[ii], 0, NULL, options.c_str(), NULL, NULL);
 
 		if (error != CL_SUCCESS) // CL_BUILD_PROGRAM_FAILURE -11
 		{
@@ -134,17 +617,23 @@ int fBuildKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl
 				fprintf(pfile, "Error: Failed to build program executable nr. %d! %d \n", ii, error);
 				fprintf(pfile, "-11: CL_BUILD_PROGRAM_FAILURE\n");
 				fprintf(pfile, "Info: Use the Intel Offline Compiler to debug the kernel. Compile options below.\n");
-				fprintf(pfile, compile_options[ii].s);
+				fprintf(pfile, "%s", options.c_str());
 				fprintf(pfile, "\n");
 				
 				// Get build info
+				size_t	build_log_size = 4 * 2048 * sizeof(char);
+				char*	build_log = new char[4*2048];
+
 				fprintf(pfile, "Build log: \n");
 				error = clGetCommandQueueInfo(*commands, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device_id, NULL);
 				error = clGetProgramBuildInfo(program[ii], device_id, CL_PROGRAM_BUILD_LOG, build_log_size, build_log, NULL);
-				fprintf(pfile, build_log);
+				fprintf(pfile, "%s", build_log);
 				fprintf(pfile, "\n");
 				fclose(pfile);
+				delete[] build_log;
 			}
+			clReleaseProgram(program[ii]);
+			fUnwindKernels(kernels, program, ii);
 		    return(-9);
 		}
 		else
@@ -153,12 +642,17 @@ int fBuildKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl
 			{
 				pfile = fopen(log_file, "a");
 				fprintf(pfile, "Info: Program executable nr. %d built. Compile options:\n", ii);
-				fprintf(pfile, compile_options[ii].s);
+				fprintf(pfile, "%s", options.c_str());
 				fprintf(pfile, "\n");
 				fclose(pfile);
 			}
 		}
 
+		if (!fCacheProgram(context, (char*) source, options.c_str(), program[ii]))
+		{
+			free((void*) source);
+		}
+
 		kernels[ii] = clCreateKernel(program[ii], function_names[ii].s, &error);
 		if (!(kernels[ii]) || error != CL_SUCCESS)
 		{
@@ -168,6 +662,8 @@ int fBuildKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl
 				fprintf(pfile, "Error: Failed to create compute kernel nr. %d! %d\n", ii, error);
 				fclose(pfile);
 			}
+			clReleaseProgram(program[ii]);
+			fUnwindKernels(kernels, program, ii);
 			return(-10);
 		}
 		else
@@ -180,6 +676,16 @@ int fBuildKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl
 			}
 		}
 
+		if (!spec.empty())
+		{
+			error = fSpecRegister(kernels[ii], context, device_id, spec_source.c_str(), options.c_str(), function_names[ii].s, spec, verbose, log_file);
+			if (error != 0)
+			{
+				fUnwindKernels(kernels, program, ii + 1);
+				return(error);
+			}
+		}
+
 	}
 
 	return(0);
@@ -194,8 +700,18 @@ int fCreateBuffer(cl_command_queue*	commands, cl_mem* mem_ptr, void* content, cl
 	cl_int			error;
 	cl_context		context;
 	cl_mem_flags	mem_flags;
+	int				result;
 	FILE*			pfile = NULL;
 
+	if (fClientActive())
+	{
+		return(fClientAllocate(commands, mem_ptr, content_size, read_write, 3, content, 0, NULL, verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeAllocate(mem_ptr, content_size, 3, content, 0, NULL, verbose, log_file));
+	}
+
 	error = clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
 
 	if (error != CL_SUCCESS)
@@ -217,8 +733,14 @@ int fCreateBuffer(cl_command_queue*	commands, cl_mem* mem_ptr, void* content, cl
 		}
 	}
 
+	// Over the device memory budget: least recently used buffers go to the host
+	result = fResidencyReserve(commands, content_size, verbose, log_file);
+	if (result < 0) return(result);
+
 	if (use_host_ptr) 
 	{
+		fArenaCheck(commands, content, verbose, log_file);
+
 		mem_flags = CL_MEM_USE_HOST_PTR;
 		*mem_ptr  = clCreateBuffer(context, mem_flags, content_size, content, &error);
 
@@ -230,6 +752,7 @@ int fCreateBuffer(cl_command_queue*	commands, cl_mem* mem_ptr, void* content, cl
 				fprintf(pfile, "Error: Failed to allocate buffer! %d \n", error);
 				fclose(pfile);
 			}
+			return(-2);
 		}
 		else
 		{
@@ -260,14 +783,23 @@ int fCreateBuffer(cl_command_queue*	commands, cl_mem* mem_ptr, void* content, cl
 
 		*mem_ptr = clCreateBuffer(context, mem_flags, content_size, NULL, &error);
 
+		// The runtime ran out before the budget did: move more to the host, once
+		if ((error == CL_MEM_OBJECT_ALLOCATION_FAILURE || error == CL_OUT_OF_RESOURCES) &&
+			fResidencyEvict(commands, content_size, verbose, log_file) > 0)
+		{
+			*mem_ptr = clCreateBuffer(context, mem_flags, content_size, NULL, &error);
+		}
+
 		if (error != CL_SUCCESS)
 		{
 			if (verbose)
 			{
 				pfile = fopen(log_file, "a");
 				fprintf(pfile, "Error: Failed to allocate buffer! %d \n", error);
+				fprintf(pfile, "Info: Content size (bytes): %llu.\n", (unsigned long long) content_size);
 				fclose(pfile);
 			}
+			return(-2);
 		}
 		else
 		{
@@ -303,6 +835,8 @@ int fCreateBuffer(cl_command_queue*	commands, cl_mem* mem_ptr, void* content, cl
 
 	}
 
+	fResidencyAdd(mem_ptr, commands, content_size);
+
 	return(0);
 }
 
@@ -316,6 +850,15 @@ int fCreateImage(cl_command_queue*	commands, cl_mem* mem_ptr, void* content, cl_
 	cl_mem_flags	mem_flags;
 	FILE*			pfile = NULL;
 	cl_image_format format;
+	if (fClientActive())
+	{
+		return(fClientUnsupported("Image memory", verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeUnsupported("Image memory", verbose, log_file));
+	}
+
 	format.image_channel_order = CL_RGBA;
 	format.image_channel_data_type = CL_FLOAT;
 
@@ -359,6 +902,8 @@ int fCreateImage(cl_command_queue*	commands, cl_mem* mem_ptr, void* content, cl_
 
 	if (use_host_ptr) 
 	{
+		fArenaCheck(commands, content, verbose, log_file);
+
 		mem_flags = CL_MEM_USE_HOST_PTR;
 		*mem_ptr  = clCreateImage(context, mem_flags, &format, &desc, content, &error);
 
@@ -449,146 +994,105 @@ int fCreateImage(cl_command_queue*	commands, cl_mem* mem_ptr, void* content, cl_
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Create an OpenCL Command queue from scratch.
+// New command queue on an existing context, counted as a shared queue so the
+// context and its library programs stay until its last queue is released.
 //
-int fCreateCommandQueue(cl_command_queue*	commands, cl_bool force_cpu, cl_bool verbose, char*	log_file)
+static int fShareContext(cl_command_queue* commands, cl_context context, cl_device_id device_id, cl_command_queue_properties properties, cl_bool verbose, char* log_file)
 {
-	cl_platform_id*		platform_id;
-	cl_uint             platform_nn;      // number of platforms
-	cl_device_id*	    device_list;
-	cl_device_id		device_id;
-	cl_context			context;
-	cl_uint				gpu_nn = 0;
-	cl_uint				cpu_nn = 0;
-	cl_uint				temp_uint;
-	cl_char*			device_string;
-	size_t				device_string_length;
-	cl_int				error;
-	FILE*				pfile = NULL;
+	cl_int	error;
+	FILE*	pfile = NULL;
 
-	// Get OpenCL platform, usually 1 per vendor
-	error = clGetPlatformIDs(0, NULL, &platform_nn);
+	*commands = clCreateCommandQueue(context, device_id, properties, &error);
 
-	if (verbose)
+	if (error != CL_SUCCESS)
 	{
-		pfile = fopen(log_file, "a");
-		fprintf(pfile, "Info: %d platform IDs found.\n", platform_nn);
-		fclose(pfile);
-	}
-
-	platform_id = (cl_platform_id*) malloc (platform_nn * sizeof(cl_platform_id));
-
-	error = clGetPlatformIDs(platform_nn, platform_id, NULL);
-
-	if (error != CL_SUCCESS)
-    {
-        if (verbose)
+		if (verbose)
 		{
 			pfile = fopen(log_file, "a");
-			fprintf(pfile, "Error: Failed to get Platform ID! %d \n", error);
+			fprintf(pfile, "Error: Failed to create a command queue! %d \n", error);
 			fclose(pfile);
 		}
-		return(-3);
-    }
-
-	// Get the OpenCL device: use the first GPU device, or if none is available, the first CPU device
-	// can be changed for testing purposes by changing CL_DEVICE_TYPE_GPU into CL_DEVICE_TYPE_CPU below:
-	if(verbose){pfile = fopen(log_file, "a");}
-	for (cl_uint index = 0; index < platform_nn; index++)
-	{
-		error = clGetPlatformInfo(platform_id[index], CL_PLATFORM_NAME, NULL, NULL, &device_string_length);
-		device_string = (cl_char*) malloc (device_string_length * sizeof(cl_char));
-		error = clGetPlatformInfo(platform_id[index], CL_PLATFORM_NAME, device_string_length, device_string, NULL);
-		if(verbose){fprintf(pfile, "=== Platform %d: %s.\n", index+1, device_string);}
-		free(device_string);
-		// Check number of GPU devices
-		error = clGetDeviceIDs(platform_id[index], CL_DEVICE_TYPE_GPU, NULL, NULL, &temp_uint);
-		gpu_nn += temp_uint;
-		// Check number of CPU devices
-		error = clGetDeviceIDs(platform_id[index], CL_DEVICE_TYPE_CPU, NULL, NULL, &temp_uint);
-		cpu_nn += temp_uint;
-		// Get all devices
-		error = clGetDeviceIDs(platform_id[index], CL_DEVICE_TYPE_ALL, NULL, NULL, &temp_uint);
-		device_list = (cl_device_id*) malloc (temp_uint * sizeof(cl_device_id));
-		error = clGetDeviceIDs(platform_id[index], CL_DEVICE_TYPE_ALL, temp_uint, device_list, NULL);
-		for (cl_uint index2 = 0; index2 < temp_uint; index2++)
-		{
-			error = clGetDeviceInfo(device_list[index2], CL_DEVICE_NAME, NULL, NULL, &device_string_length);
-			device_string = (cl_char*) malloc (device_string_length * sizeof(cl_char));
-			error = clGetDeviceInfo(device_list[index2], CL_DEVICE_NAME, device_string_length, device_string, NULL);
-			if(verbose){fprintf(pfile, "------- Device %d: %s.\n", index2+1, device_string);}
-			free(device_string);
-		}
-		if (error != CL_SUCCESS)
-		{
-			if (verbose)
-			{
-				fprintf(pfile, "Error generating device overview! %d \n", error);
-				fclose(pfile);
-			}
-			return(-4);
-		}
+		return(-7);
 	}
-	if(verbose){fclose(pfile);}
 
-	// Get the actual device id
-	if (gpu_nn == 0 || force_cpu)
-	{
-		for (cl_uint index = 0; index < platform_nn; index++)
-		{
-			error = clGetDeviceIDs(platform_id[index], CL_DEVICE_TYPE_CPU, 1, &device_id, NULL);
-		}
-	}
-	else
+	int slot = -1;
+
+	for (int ii = 0; ii < MAX_SHARED_CONTEXTS; ii++)
 	{
-		for (cl_uint index = 0; index < platform_nn; index++)
+		if (shared_queues[ii] > 0 && shared_contexts[ii] == context)
 		{
-			error = clGetDeviceIDs(platform_id[index], CL_DEVICE_TYPE_GPU, 1, &device_id, NULL);
+			slot = ii;
+			break;
 		}
+		if (shared_queues[ii] == 0 && slot < 0) slot = ii;
 	}
 
-	if (error != CL_SUCCESS)
-    {
-        if (verbose)
+	if (slot < 0)
+	{
+		if (verbose)
 		{
 			pfile = fopen(log_file, "a");
-			fprintf(pfile, "Error: Failed to get Device ID! %d \n", error);
+			fprintf(pfile, "Error: Too many shared contexts!\n");
 			fclose(pfile);
 		}
-        return(-5);
-    }
+		clReleaseCommandQueue(*commands);
+		return(-7);
+	}
 
+	clRetainContext(context);
+	shared_contexts[slot] = context;
+	shared_queues[slot]++;
 
-	// Check which device was selected for processing
-	error = clGetDeviceInfo(device_id, CL_DEVICE_NAME, NULL, NULL, &device_string_length);
-	device_string = (cl_char*) malloc (device_string_length * sizeof(cl_char));
-	error = clGetDeviceInfo(device_id, CL_DEVICE_NAME, device_string_length, device_string, NULL);
 	if (verbose)
 	{
 		pfile = fopen(log_file, "a");
-		fprintf(pfile, "Info: using %s as compute device.\n", device_string);
-		// fprintf(pfile, "Info: compile options: \n %s \n", compile_options);
+		fprintf(pfile, "Info: Shared command queue created.\n");
 		fclose(pfile);
 	}
-	free(device_string);
 
-	// Get all device infor
-	//error = clGetDeviceInfo(device_id, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), pthis_device_local_mem_size, NULL);
-	//error = clGetDeviceInfo(device_id, CL_DEVICE_LOCAL_MEM_TYPE, sizeof(cl_device_local_mem_type), pthis_device_local_mem_type, NULL);
-	//error = clGetDeviceInfo(device_id, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), pthis_device_max_work_group_size, NULL);
-	//error = clGetDeviceInfo(device_id, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), pthis_device_host_unified_memory, NULL);
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Create an OpenCL Command queue from scratch.
+//
+int fCreateCommandQueue(cl_command_queue*	commands, cl_bool force_cpu, cl_bool verbose, char*	log_file)
+{
+	cl_device_id		device_id;
+	cl_context			context;
+	cl_int				error;
+	FILE*				pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientCreateQueue(commands, NULL, force_cpu, verbose, log_file));
+	}
+
+	// force_cpu = 2: native CPU backend, no OpenCL runtime needed
+	if (force_cpu == 2)
+	{
+		return(fNativeCreateQueue(commands, verbose, log_file));
+	}
+
+	// Platforms and devices are only enumerated for the first queue
+	error = fSelectDevice(force_cpu, &device_id, verbose, log_file);
+	if (error < 0) return(error);
 
-	//if (verbose)
-	//{
-	//	pfile = fopen(log_file, "a");
-	//	fprintf(pfile, "CL_DEVICE_LOCAL_MEM_SIZE:      %lu bytes\n", *pthis_device_local_mem_size);
-	//	fprintf(pfile, "CL_DEVICE_LOCAL_MEM_TYPE:      %X \n", *pthis_device_local_mem_type);
-	//	fprintf(pfile, "     1: CL_LOCAL\n");
-	//	fprintf(pfile, "     2: CL_GLOBAL\n");
-	//	fprintf(pfile, "CL_DEVICE_MAX_WORK_GROUP_SIZE: %d \n", *pthis_device_max_work_group_size);
-	//	fprintf(pfile, "CL_DEVICE_HOST_UNIFIED_MEMORY: %d \n", *pthis_device_host_unified_memory);
-	//	fclose(pfile);
-	//}
+	// A context on this device is still in use by another bridge
+	for (int ii = 0; ii < MAX_REGISTERED_CONTEXTS; ii++)
+	{
+		if (context_registry[ii].context != NULL && context_registry[ii].device_id == device_id
+			&& context_registry[ii].properties == (verbose ? CL_QUEUE_PROFILING_ENABLE : 0))
+		{
+			return(fShareContext(commands, context_registry[ii].context, context_registry[ii].device_id,
+								 context_registry[ii].properties, verbose, log_file));
+		}
+	}
+
+	// Get all device infor (logged once per device)
+	device_caps caps;
+	error = fProbeDevice(device_id, &caps, verbose, log_file);
+	if (error != CL_SUCCESS) return(-4);
 
 
 	// Create context
@@ -641,10 +1145,60 @@ int fCreateCommandQueue(cl_command_queue*	commands, cl_bool force_cpu, cl_bool v
 		}
 	}
 
+	for (int ii = 0; ii < MAX_REGISTERED_CONTEXTS; ii++)
+	{
+		if (context_registry[ii].context != NULL) continue;
+
+		context_registry[ii].context	= context;
+		context_registry[ii].device_id	= device_id;
+		context_registry[ii].properties	= verbose ? CL_QUEUE_PROFILING_ENABLE : 0;
+		break;
+	}
+
 	return(0);
 
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Create a second command queue on the context and device of an existing one,
+// so buffers can be used by both (e.g. the levels of a resolution pyramid).
+// The context is retained, fReleaseCommandQueue releases it as usual.
+//
+int fCreateCommandQueueShared(cl_command_queue* commands, cl_command_queue* source, cl_bool verbose, char* log_file)
+{
+	cl_context					context;
+	cl_device_id				device_id;
+	cl_command_queue_properties	properties;
+	cl_int						error;
+	FILE*						pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientCreateQueue(commands, source, 0, verbose, log_file));
+	}
+	if (fNativeQueue(source))
+	{
+		return(fNativeShareQueue(commands, verbose, log_file));
+	}
+
+	error  = clGetCommandQueueInfo(*source, CL_QUEUE_CONTEXT,    sizeof(cl_context),                  &context,    NULL);
+	error |= clGetCommandQueueInfo(*source, CL_QUEUE_DEVICE,     sizeof(cl_device_id),                &device_id,  NULL);
+	error |= clGetCommandQueueInfo(*source, CL_QUEUE_PROPERTIES, sizeof(cl_command_queue_properties), &properties, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to retreive the compute context! %d \n", error);
+			fclose(pfile);
+		}
+		return(-6);
+	}
+
+	return(fShareContext(commands, context, device_id, properties, verbose, log_file));
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Execute the prepared OpenCL kernel.
 //
@@ -659,7 +1213,17 @@ int fExecuteKernel(cl_command_queue* commands, cl_kernel* kernel, cl_uint work_d
 
 	FILE*	pfile = NULL;
 
-	error = clEnqueueNDRangeKernel(*commands, *kernel, work_dim, NULL, global, local, 0, NULL, &cmd_event);
+	if (fClientActive())
+	{
+		return(fClientExecuteKernel(commands, kernel, work_dim, global, local, verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeExecuteKernel(*kernel, verbose, log_file));
+	}
+
+	// A specialized variant, when the kernel has one for its current arguments
+	error = clEnqueueNDRangeKernel(*commands, fSpecKernel(*kernel, verbose, log_file), work_dim, NULL, global, local, 0, NULL, &cmd_event);
 
 	if (error != CL_SUCCESS)
 	{
@@ -718,6 +1282,19 @@ int fReadBuffer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_u
 	cl_int	error;
 	FILE*	pfile = NULL;
 	
+	if (fClientActive())
+	{
+		return(fClientTransfer(commands, mem_ptr, content, 0, content_size, CL_FALSE, verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeTransfer(mem_ptr, content, 0, content_size, CL_FALSE, verbose, log_file));
+	}
+	if (fSvmPointer(*mem_ptr, NULL, NULL) != NULL)
+	{
+		return(fSvmTransfer(commands, *mem_ptr, content, content_size, CL_FALSE, verbose, log_file));
+	}
+
 	error = clEnqueueReadBuffer(*commands, *mem_ptr, CL_TRUE, 0, content_size, content, 0, NULL, NULL);
 	
 	if (error != CL_SUCCESS)
@@ -751,7 +1328,17 @@ int fReleaseBuffer(cl_mem mem_ptr, cl_bool verbose, char* log_file)
 	cl_int	error;
 	FILE*	pfile = NULL;
 
+	if (fClientActive())
+	{
+		return(fClientRelease(mem_ptr, verbose, log_file));
+	}
+	if (fNativeMem(mem_ptr))
+	{
+		return(fNativeRelease(mem_ptr, verbose, log_file));
+	}
+
 	error = clReleaseMemObject(mem_ptr);
+	fSvmRelease(mem_ptr);
 	
 	if (error != CL_SUCCESS)
 	{
@@ -816,6 +1403,19 @@ int fReleaseCommandQueue(cl_command_queue* commands, cl_bool verbose, char*	log_
 	cl_int		error;
 	FILE*		pfile = NULL;
 
+	if (fClientActive())
+	{
+		return(fClientReleaseQueue(commands, verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeReleaseQueue(verbose, log_file));
+	}
+
+	// A tiled launch still running on the queue stops first
+	fTileCancel(commands, CL_FALSE, log_file);
+	fTileWait(commands, verbose, log_file);
+
 	// Get context
 	error = clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
 	
@@ -839,6 +1439,17 @@ int fReleaseCommandQueue(cl_command_queue* commands, cl_bool verbose, char*	log_
 		}
 	}
 
+	// Library-owned programs hold a reference to the context. Keep them while
+	// a shared queue still uses it.
+	if (!fReleaseSharedQueue(context))
+	{
+		fForgetContext(context, verbose, log_file);
+		fReleaseSinoKernels(commands, verbose, log_file);
+		fReleaseWarp(commands, verbose, log_file);
+		fReleasePyramidKernels(commands, verbose, log_file);
+		fReleaseSysmat(commands, verbose, log_file);
+	}
+
 	error = clReleaseCommandQueue(*commands);
 
 	if (error != CL_SUCCESS)
@@ -896,8 +1507,26 @@ int fReleaseKernels(cl_kernel kernels[MAX_KERNELS], cl_int n_kernels, cl_bool ve
 	cl_program	program[MAX_KERNELS];
 	FILE*		pfile = NULL;
 
+	if (fClientActive())
+	{
+		return(fClientReleaseKernels(kernels, n_kernels, verbose, log_file));
+	}
+
+	fLazyForget(kernels, n_kernels, verbose, log_file);
+
 	for (int ii = 0; ii < n_kernels; ii++)
 	{
+		// Registered by fRegisterKernels but never used
+		if (kernels[ii] == NULL) continue;
+
+		fResidencyForgetKernel(kernels[ii]);
+
+		if (fNativeKernel(kernels[ii]))
+		{
+			fNativeReleaseKernel(kernels[ii], verbose, log_file);
+			continue;
+		}
+
 		error = clGetKernelInfo(kernels[ii], CL_KERNEL_PROGRAM, sizeof(cl_program), &program[ii], NULL);
 
 		if (error != CL_SUCCESS)
@@ -918,6 +1547,7 @@ int fReleaseKernels(cl_kernel kernels[MAX_KERNELS], cl_int n_kernels, cl_bool ve
 
 		}
 
+		fSpecForget(kernels[ii]);
 		error = clReleaseKernel(kernels[ii]);
 
 		if (error != CL_SUCCESS)
@@ -974,6 +1604,15 @@ int fSetKernelArg(cl_kernel kernel, cl_uint arg_index, cl_ulong arg_size, void*
 	int			error;
 	FILE*		pfile = NULL;
 
+	if (fClientActive())
+	{
+		return(fClientSetKernelArg(kernel, arg_index, arg_size, arg_value, verbose, log_file));
+	}
+	if (fNativeKernel(kernel))
+	{
+		return(fNativeSetKernelArg(kernel, arg_index, arg_size, arg_value, verbose, log_file));
+	}
+
 	error = clSetKernelArg(kernel, arg_index, arg_size, arg_value);
 
 	if (error != CL_SUCCESS)
@@ -985,6 +1624,8 @@ int fSetKernelArg(cl_kernel kernel, cl_uint arg_index, cl_ulong arg_size, void*
 			fclose(pfile);
 		}
 	} else {
+		fSpecSetArg(kernel, arg_index, arg_size, arg_value);
+
 		if (verbose)
 		{
 			pfile = fopen(log_file, "a");
@@ -1005,6 +1646,19 @@ int fWriteBuffer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_
 	cl_int	error;
 	FILE*	pfile = NULL;
 	
+	if (fClientActive())
+	{
+		return(fClientTransfer(commands, mem_ptr, content, 0, content_size, CL_TRUE, verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeTransfer(mem_ptr, content, 0, content_size, CL_TRUE, verbose, log_file));
+	}
+	if (fSvmPointer(*mem_ptr, NULL, NULL) != NULL)
+	{
+		return(fSvmTransfer(commands, *mem_ptr, content, content_size, CL_TRUE, verbose, log_file));
+	}
+
 	error = clEnqueueWriteBuffer(*commands, *mem_ptr, CL_TRUE, 0, content_size, content, 0, NULL, NULL);
 	
 	if (error != CL_SUCCESS)
@@ -1030,4 +1684,432 @@ int fWriteBuffer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_
 	}
 
 	return(0);
-}
\ No newline at end of file
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Read part of an existing OpenCL buffer, starting at offset (bytes).
+//
+int fReadBufferRegion(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong offset, cl_ulong content_size, cl_bool verbose, char* log_file)
+{
+	cl_int	error;
+	FILE*	pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientTransfer(commands, mem_ptr, content, offset, content_size, CL_FALSE, verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeTransfer(mem_ptr, content, offset, content_size, CL_FALSE, verbose, log_file));
+	}
+
+	error = clEnqueueReadBuffer(*commands, *mem_ptr, CL_TRUE, offset, content_size, content, 0, NULL, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to read memory region! %d \n", error);
+			fprintf(pfile, "Info: Offset (bytes): %llu, size (bytes): %llu.\n", (unsigned long long) offset, (unsigned long long) content_size);
+			fclose(pfile);
+		}
+	}
+	else
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: Data read from buffer region.\n");
+			fprintf(pfile, "Info: Offset (bytes): %llu, size (bytes): %llu.\n", (unsigned long long) offset, (unsigned long long) content_size);
+			fclose(pfile);
+		}
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Write data to part of a buffer, starting at offset (bytes).
+//
+int fWriteBufferRegion(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong offset, cl_ulong content_size, cl_bool verbose, char* log_file)
+{
+	cl_int	error;
+	FILE*	pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientTransfer(commands, mem_ptr, content, offset, content_size, CL_TRUE, verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeTransfer(mem_ptr, content, offset, content_size, CL_TRUE, verbose, log_file));
+	}
+
+	error = clEnqueueWriteBuffer(*commands, *mem_ptr, CL_TRUE, offset, content_size, content, 0, NULL, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to write data to buffer region! %d \n", error);
+			fprintf(pfile, "Info: Offset (bytes): %llu, size (bytes): %llu.\n", (unsigned long long) offset, (unsigned long long) content_size);
+			fclose(pfile);
+		}
+	}
+	else
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: Data written to buffer region.\n");
+			fprintf(pfile, "Info: Offset (bytes): %llu, size (bytes): %llu.\n", (unsigned long long) offset, (unsigned long long) content_size);
+			fclose(pfile);
+		}
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Read a 3-D rectangular region of a buffer.
+// Origins and region follow clEnqueueReadBufferRect: the first component is
+// in bytes, the others in rows and slices. pitches holds the buffer row and
+// slice pitch followed by the host row and slice pitch, all in bytes.
+//
+int fReadBufferRect(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong* buffer_origin, cl_ulong* host_origin, cl_ulong* region, cl_ulong* pitches, cl_bool verbose, char* log_file)
+{
+	cl_int	error;
+	size_t	buffer_origin_[3];
+	size_t	host_origin_[3];
+	size_t	region_[3];
+	FILE*	pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientUnsupported("Rectangular reads", verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeUnsupported("Rectangular reads", verbose, log_file));
+	}
+
+	for (int ii = 0; ii < 3; ii++)
+	{
+		buffer_origin_[ii] = (size_t) buffer_origin[ii];
+		host_origin_[ii]   = (size_t) host_origin[ii];
+		region_[ii]        = (size_t) region[ii];
+	}
+
+	error = clEnqueueReadBufferRect(*commands, *mem_ptr, CL_TRUE, buffer_origin_, host_origin_, region_,
+									(size_t) pitches[0], (size_t) pitches[1], (size_t) pitches[2], (size_t) pitches[3],
+									content, 0, NULL, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to read rectangular region! %d \n", error);
+			fprintf(pfile, "Info: Region: %llu, %llu, %llu.\n", (unsigned long long) region[0], (unsigned long long) region[1],
+					(unsigned long long) region[2]);
+			fclose(pfile);
+		}
+	}
+	else
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: Rectangular region read from buffer.\n");
+			fprintf(pfile, "Info: Region: %llu, %llu, %llu.\n", (unsigned long long) region[0], (unsigned long long) region[1],
+					(unsigned long long) region[2]);
+			fclose(pfile);
+		}
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Write a 3-D rectangular region of a buffer. Arguments as fReadBufferRect.
+//
+int fWriteBufferRect(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong* buffer_origin, cl_ulong* host_origin, cl_ulong* region, cl_ulong* pitches, cl_bool verbose, char* log_file)
+{
+	cl_int	error;
+	size_t	buffer_origin_[3];
+	size_t	host_origin_[3];
+	size_t	region_[3];
+	FILE*	pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientUnsupported("Rectangular writes", verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeUnsupported("Rectangular writes", verbose, log_file));
+	}
+
+	for (int ii = 0; ii < 3; ii++)
+	{
+		buffer_origin_[ii] = (size_t) buffer_origin[ii];
+		host_origin_[ii]   = (size_t) host_origin[ii];
+		region_[ii]        = (size_t) region[ii];
+	}
+
+	error = clEnqueueWriteBufferRect(*commands, *mem_ptr, CL_TRUE, buffer_origin_, host_origin_, region_,
+									 (size_t) pitches[0], (size_t) pitches[1], (size_t) pitches[2], (size_t) pitches[3],
+									 content, 0, NULL, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to write rectangular region! %d \n", error);
+			fprintf(pfile, "Info: Region: %llu, %llu, %llu.\n", (unsigned long long) region[0], (unsigned long long) region[1],
+					(unsigned long long) region[2]);
+			fclose(pfile);
+		}
+	}
+	else
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: Rectangular region written to buffer.\n");
+			fprintf(pfile, "Info: Region: %llu, %llu, %llu.\n", (unsigned long long) region[0], (unsigned long long) region[1],
+					(unsigned long long) region[2]);
+			fclose(pfile);
+		}
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Create a view on [origin, origin+size) bytes of an existing buffer.
+// The origin must be a multiple of CL_DEVICE_MEM_BASE_ADDR_ALIGN (bits).
+//
+int fCreateSubBuffer(cl_mem* parent_ptr, cl_mem* mem_ptr, cl_ulong origin, cl_ulong size, cl_int read_write, cl_bool verbose, char* log_file)
+{
+	cl_int				error;
+	cl_mem_flags		mem_flags;
+	cl_buffer_region	region;
+	FILE*				pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientUnsupported("Sub-buffers", verbose, log_file));
+	}
+	if (fNativeMem(*parent_ptr))
+	{
+		return(fNativeUnsupported("Sub-buffers", verbose, log_file));
+	}
+
+	switch (read_write)
+	{
+		case 0 :
+			mem_flags = CL_MEM_READ_WRITE;
+			break;
+		case 1 :
+			mem_flags = CL_MEM_WRITE_ONLY;
+			break;
+		case 2 :
+			mem_flags = CL_MEM_READ_ONLY;
+			break;
+		default:
+			// inherit from the parent
+			mem_flags = 0;
+	}
+
+	region.origin = (size_t) origin;
+	region.size   = (size_t) size;
+
+	*mem_ptr = clCreateSubBuffer(*parent_ptr, mem_flags, CL_BUFFER_CREATE_TYPE_REGION, &region, &error);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to create sub-buffer! %d \n", error);
+			if (error == CL_MISALIGNED_SUB_BUFFER_OFFSET)
+			{
+				fprintf(pfile, "-13: CL_MISALIGNED_SUB_BUFFER_OFFSET\n");
+			}
+			fprintf(pfile, "Info: Origin (bytes): %llu, size (bytes): %llu.\n", (unsigned long long) origin, (unsigned long long) size);
+			fclose(pfile);
+		}
+		*mem_ptr = NULL;
+		return(-13);
+	}
+	else
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: Sub-buffer created.\n");
+			fprintf(pfile, "Info: Origin (bytes): %llu, size (bytes): %llu.\n", (unsigned long long) origin, (unsigned long long) size);
+			fclose(pfile);
+		}
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocate an OpenCL memory buffer without any host transfer.
+//  mode 0 : uninitialized
+//  mode 1 : filled on the device with pattern (clEnqueueFillBuffer)
+//  mode 2 : copy of source on the device (clEnqueueCopyBuffer); a
+//           content_size of 0 takes the size of source
+//
+int fAllocateBuffer(cl_command_queue* commands, cl_mem* mem_ptr, cl_ulong content_size, cl_int read_write, cl_int mode, void* pattern, cl_ulong pattern_size, cl_mem* source, cl_bool verbose, char* log_file)
+{
+	cl_int			error;
+	cl_context		context;
+	cl_mem_flags	mem_flags;
+	size_t			source_size;
+	FILE*			pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientAllocate(commands, mem_ptr, content_size, read_write, mode, pattern, pattern_size, source, verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeAllocate(mem_ptr, content_size, mode, pattern, pattern_size, source, verbose, log_file));
+	}
+
+	error = clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to retreive context! %d \n", error);
+			fclose(pfile);
+		}
+		return(-3);
+	}
+
+	if (mode == 1)
+	{
+		// clEnqueueFillBuffer: power of two pattern up to 128 bytes, dividing the size
+		if (pattern_size == 0 || pattern_size > 128 || (pattern_size & (pattern_size - 1)) != 0 || content_size % pattern_size != 0)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: Invalid fill pattern size %llu for %llu bytes.\n", (unsigned long long) pattern_size,
+						(unsigned long long) content_size);
+				fclose(pfile);
+			}
+			return(-1);
+		}
+	}
+
+	if (mode == 2)
+	{
+		error = clGetMemObjectInfo(*source, CL_MEM_SIZE, sizeof(size_t), &source_size, NULL);
+
+		if (error != CL_SUCCESS)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: Failed to query source buffer! %d \n", error);
+				fclose(pfile);
+			}
+			return(-1);
+		}
+
+		if (content_size == 0 || content_size > source_size)
+		{
+			content_size = source_size;
+		}
+	}
+
+	switch (read_write)
+	{
+		case 0 :
+			mem_flags = CL_MEM_READ_WRITE;
+			break;
+		case 1 :
+			mem_flags = CL_MEM_WRITE_ONLY;
+			break;
+		case 2 :
+			mem_flags = CL_MEM_READ_ONLY;
+			break;
+		default:
+			mem_flags = CL_MEM_READ_WRITE;
+	}
+
+	// Over the device memory budget: least recently used buffers go to the host
+	error = fResidencyReserve(commands, content_size, verbose, log_file);
+	if (error < 0) return(error);
+
+	*mem_ptr = clCreateBuffer(context, mem_flags, content_size, NULL, &error);
+
+	// The runtime ran out before the budget did: move more to the host, once
+	if ((error == CL_MEM_OBJECT_ALLOCATION_FAILURE || error == CL_OUT_OF_RESOURCES) &&
+		fResidencyEvict(commands, content_size, verbose, log_file) > 0)
+	{
+		*mem_ptr = clCreateBuffer(context, mem_flags, content_size, NULL, &error);
+	}
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to allocate buffer! %d \n", error);
+			fprintf(pfile, "Info: Content size (bytes): %llu.\n", (unsigned long long) content_size);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+
+	switch (mode)
+	{
+		case 1 :
+			error = clEnqueueFillBuffer(*commands, *mem_ptr, pattern, pattern_size, 0, content_size, 0, NULL, NULL);
+			break;
+		case 2 :
+			error = clEnqueueCopyBuffer(*commands, *source, *mem_ptr, 0, 0, content_size, 0, NULL, NULL);
+			break;
+		default:
+			error = CL_SUCCESS;
+	}
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to initialize buffer on the device! %d \n", error);
+			fclose(pfile);
+		}
+		clReleaseMemObject(*mem_ptr);
+		*mem_ptr = NULL;
+		return(-2);
+	}
+	else
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: Buffer allocated without host transfer (mode %d).\n", mode);
+			fprintf(pfile, "Info: Content size (bytes): %llu.\n", (unsigned long long) content_size);
+			fclose(pfile);
+		}
+	}
+
+	fResidencyAdd(mem_ptr, commands, content_size);
+
+	return(0);
+}
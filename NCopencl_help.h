@@ -1,8 +1,59 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+// Kernel sources compiled into the library (embed_kernels.cmake), by name
+// relative to KERNEL_DIR; the last entry has name NULL.
+typedef struct {
+	const char*	name;
+	const char*	hash;		// SHA-1 of source
+	const char*	source;		// #include files inlined
+	size_t		size;
+} embedded_kernel;
+
+extern const embedded_kernel embedded_kernels[];
+
+// Device properties probed once per device (fProbeDevice). fNCdevice_caps
+// returns them as cl_ulong[DEVICE_CAPS_N] in this order.
+#define DEVICE_CAPS_N 16
+
+typedef struct {
+	cl_device_id				device_id;
+	cl_device_type				type;
+	cl_uint						compute_units;
+	size_t						max_work_group_size;
+	cl_ulong					local_mem_size;
+	cl_device_local_mem_type	local_mem_type;
+	cl_ulong					global_mem_size;
+	cl_ulong					max_alloc_size;
+	cl_bool						host_unified_memory;
+	cl_bool						image_support;
+	cl_bool						fp16;
+	cl_bool						fp64;
+	cl_uint						vector_width_float;		// preferred
+	cl_uint						vector_width_half;
+	cl_uint						native_width_float;
+	cl_uint						local_tile;				// work items, 0 without dedicated local memory
+} device_caps;
+
+// Device ranking policies of fSelectDevicePolicy.
+#define DEVICE_RANK_THROUGHPUT	0	// compute units x clock
+#define DEVICE_RANK_MEMORY		1	// global memory size
+#define DEVICE_RANK_CALIBRATE	2	// measured with a short kernel
 
 char* oclLoadProgSource(const char* cFilename, const char* cPreamble, size_t* szFinalLength);
+const embedded_kernel* fEmbeddedKernel(const char* name);
+int fProbeDevice(cl_device_id device_id, device_caps* caps, cl_bool verbose, char* log_file);
+int fDeviceCaps(cl_command_queue* commands, cl_ulong caps[DEVICE_CAPS_N], cl_bool verbose, char* log_file);
+int fSelectDevice(cl_bool force_cpu, cl_device_id* device_id, cl_bool verbose, char* log_file);
+int fSelectDevicePolicy(cl_int policy, char* name, cl_int index, cl_bool verbose, char* log_file);
+double fDeviceGflops(cl_device_id device_id, cl_bool verbose, char* log_file);
 int fBuildKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl_ulong n_kernels, idls* file_paths, idls* function_names, idls* compile_options, cl_bool verbose, char* log_file);
+int fBuildLibraryProgram(cl_command_queue* commands, cl_context context, const char* source, const char* what, const char* const* kernel_names, int n_kernels,
+						 cl_program* program, cl_kernel* kernels, cl_bool verbose, char* log_file);
 int fCreateBuffer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong content_size, cl_int read_write, cl_bool use_host_ptr, cl_bool verbose, char* log_file);
 int fCreateCommandQueue(cl_command_queue* commands, cl_bool force_cpu, cl_bool verbose, char* log_file);
+int fCreateCommandQueueShared(cl_command_queue* commands, cl_command_queue* source, cl_bool verbose, char* log_file);
 int fExecuteKernel(cl_command_queue* commands, cl_kernel* kernel, cl_uint work_dim, size_t* global, size_t* local, cl_bool verbose, char* log_file);
 int fReadBuffer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong content_size, cl_bool verbose, char* log_file);
 int fReleaseBuffer(cl_mem mem_ptr, cl_bool verbose, char* log_file);
@@ -12,4 +63,229 @@ int fSetKernelArg(cl_kernel kernel, cl_uint arg_index, cl_ulong arg_size, void*
 int fWriteBuffer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong content_size, cl_bool verbose, char* log_file);
 
 int fCreateImage(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_uint image_width, cl_uint image_height, cl_uint image_depth,  cl_int read_write, cl_bool use_host_ptr, cl_bool verbose, char* log_file);
-int fReleaseImage(cl_mem mem_ptr, cl_bool verbose, char* log_file);
\ No newline at end of file
+int fReleaseImage(cl_mem mem_ptr, cl_bool verbose, char* log_file);
+
+int fSinoGather(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_mem* subset_ptr, cl_bool use_subset, cl_uint4 size_src, cl_uint4 range, cl_bool verbose, char* log_file);
+int fSinoScatter(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_mem* subset_ptr, cl_bool use_subset, cl_uint4 size_dst, cl_uint4 range, cl_bool accumulate, cl_bool verbose, char* log_file);
+int fSinoSwap(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_uint4 size_src, cl_bool verbose, char* log_file);
+int fSinoRebin(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_uint4 size_src, cl_uint4 factor, cl_bool verbose, char* log_file);
+int fReleaseSinoKernels(cl_command_queue* commands, cl_bool verbose, char* log_file);
+
+int fReadBufferRegion(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong offset, cl_ulong content_size, cl_bool verbose, char* log_file);
+int fWriteBufferRegion(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong offset, cl_ulong content_size, cl_bool verbose, char* log_file);
+int fReadBufferRect(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong* buffer_origin, cl_ulong* host_origin, cl_ulong* region, cl_ulong* pitches, cl_bool verbose, char* log_file);
+int fWriteBufferRect(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong* buffer_origin, cl_ulong* host_origin, cl_ulong* region, cl_ulong* pitches, cl_bool verbose, char* log_file);
+int fCreateSubBuffer(cl_mem* parent_ptr, cl_mem* mem_ptr, cl_ulong origin, cl_ulong size, cl_int read_write, cl_bool verbose, char* log_file);
+int fAllocateBuffer(cl_command_queue* commands, cl_mem* mem_ptr, cl_ulong content_size, cl_int read_write, cl_int mode, void* pattern, cl_ulong pattern_size, cl_mem* source, cl_bool verbose, char* log_file);
+
+int fGeomSourceLocations(cl_command_queue* commands, cl_mem* mem_ptr, cl_float* srclocs, cl_bool to_device, cl_float* angles, cl_float* tablepos, cl_float* align, cl_float* zalign, cl_ulong nrangles, cl_uint ndetplanes, cl_int* subset, cl_ulong nsubset, cl_bool verbose, char* log_file);
+int fGeomMotionMatrices(cl_command_queue* commands, cl_mem* mem_ptr, cl_float* matrices, cl_bool to_device, cl_float* dof, cl_int* subset, cl_ulong nsubset, cl_bool verbose, char* log_file);
+int fGeomDetectorFan(cl_uint nchannels, cl_uint ndetplanes, cl_float* fan, cl_float* tablepos0, cl_float* detcols0, cl_float* detrows0, cl_float* detplanes0, cl_bool verbose, char* log_file);
+int fGeomInitialCoords(cl_float* detcols0, cl_float* detrows0, cl_uint ncols, cl_float* detplanes0, cl_uint nplanes, cl_float* center, cl_float* source, cl_bool centers, cl_float* initial_coords, cl_bool verbose, char* log_file);
+
+int fWarpSetState(cl_command_queue* commands, cl_uint state, cl_float* field, cl_uint4 size_field, cl_bool verbose, char* log_file);
+int fWarpApply(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_uint state, cl_uint4 size_img, cl_bool adjoint, cl_bool accumulate, cl_bool verbose, char* log_file);
+int fWarpCompose(cl_command_queue* commands, cl_uint state_out, cl_uint state_a, cl_uint state_b, cl_uint4 size_img, cl_bool verbose, char* log_file);
+int fWarpBindState(cl_command_queue* commands, cl_uint state, cl_mem* mem_ptr, cl_bool verbose, char* log_file);
+int fReleaseWarp(cl_command_queue* commands, cl_bool verbose, char* log_file);
+
+int fResampleDown(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_uint4 size_src, cl_uint4 factor, cl_bool average, cl_bool verbose, char* log_file);
+int fResampleUp(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_uint4 size_src, cl_uint4 size_dst, cl_float scale, cl_bool verbose, char* log_file);
+int fReleasePyramidKernels(cl_command_queue* commands, cl_bool verbose, char* log_file);
+
+// Cached system matrix key: geometry id, image cols, rows, planes,
+// sinogram detectors, planes and views. See NCopencl_sparse.cpp
+#define SYSMAT_KEY_SIZE	7
+
+int fSysmatRecordBegin(cl_command_queue* commands, cl_mem* coo_ptr, cl_mem* count_ptr, cl_ulong max_entries, cl_ulong budget, cl_bool verbose, char* log_file);
+int fSysmatBuild(cl_command_queue* commands, cl_mem* coo_ptr, cl_mem* count_ptr, cl_ulong nrows, cl_ulong ncols, cl_ulong view_rows, const cl_ulong* key, cl_bool use_half, cl_int placement, cl_ulong budget, cl_bool verbose, char* log_file);
+int fSysmatProject(cl_command_queue* commands, cl_mem* x_ptr, cl_mem* y_ptr, cl_mem* subset_ptr, cl_bool use_subset, cl_ulong nsubset, const cl_ulong* key, cl_bool transpose, cl_bool accumulate, cl_bool verbose, char* log_file);
+int fSysmatStatus(cl_command_queue* commands, cl_int* status, cl_ulong* size, cl_ulong* key);
+int fReleaseSysmat(cl_command_queue* commands, cl_bool verbose, char* log_file);
+
+cl_bool fNativeQueue(cl_command_queue* commands);
+int fNativeCreateQueue(cl_command_queue* commands, cl_bool verbose, char* log_file);
+int fNativeShareQueue(cl_command_queue* commands, cl_bool verbose, char* log_file);
+int fNativeReleaseQueue(cl_bool verbose, char* log_file);
+int fNativeThreads(cl_uint n_threads, cl_bool verbose, char* log_file);
+int fNativeUnsupported(const char* what, cl_bool verbose, char* log_file);
+cl_bool fNativeMem(cl_mem mem);
+void* fNativeMemPtr(cl_mem mem, cl_ulong* size);
+int fNativeAllocate(cl_mem* mem_ptr, cl_ulong size, cl_int mode, void* pattern, cl_ulong pattern_size, cl_mem* source, cl_bool verbose, char* log_file);
+int fNativeTransfer(cl_mem* mem_ptr, void* content, cl_ulong offset, cl_ulong size, cl_bool write, cl_bool verbose, char* log_file);
+int fNativeRelease(cl_mem mem, cl_bool verbose, char* log_file);
+cl_bool fNativeKernel(cl_kernel kernel);
+int fNativeBuildKernels(cl_kernel* kernels, cl_ulong n_kernels, idls* file_paths, idls* function_names, idls* compile_options, cl_bool verbose, char* log_file);
+int fNativeSetKernelArg(cl_kernel kernel, cl_uint arg_index, cl_ulong arg_size, void* arg_value, cl_bool verbose, char* log_file);
+int fNativeExecuteKernel(cl_kernel kernel, cl_bool verbose, char* log_file);
+int fNativeReleaseKernel(cl_kernel kernel, cl_bool verbose, char* log_file);
+
+// Library calls forwarded to the projection server, and their flags.
+#define SERVER_SINO_GATHER		20
+#define SERVER_SINO_SCATTER		21
+#define SERVER_SINO_SWAP		22
+#define SERVER_SINO_REBIN		23
+#define SERVER_RESAMPLE_DOWN	24
+#define SERVER_RESAMPLE_UP		25
+#define SERVER_FLAG_SUBSET		1
+#define SERVER_FLAG_OPTION		2	// accumulate (scatter) or average (down)
+
+int fServerRun(char* socket_path, cl_bool verbose, char* log_file);
+int fClientConnect(char* socket_path, cl_bool verbose, char* log_file);
+int fClientDisconnect(cl_bool stop_server, cl_bool verbose, char* log_file);
+cl_bool fClientActive();
+int fClientUnsupported(const char* what, cl_bool verbose, char* log_file);
+int fClientCreateQueue(cl_command_queue* commands, cl_command_queue* source, cl_bool force_cpu, cl_bool verbose, char* log_file);
+int fClientReleaseQueue(cl_command_queue* commands, cl_bool verbose, char* log_file);
+int fClientBuildKernels(cl_command_queue* commands, cl_kernel* kernels, cl_ulong n_kernels, idls* file_paths, idls* function_names, idls* compile_options, cl_bool verbose, char* log_file);
+int fClientReleaseKernels(cl_kernel* kernels, cl_int n_kernels, cl_bool verbose, char* log_file);
+int fClientSetKernelArg(cl_kernel kernel, cl_uint arg_index, cl_ulong arg_size, void* arg_value, cl_bool verbose, char* log_file);
+int fClientExecuteKernel(cl_command_queue* commands, cl_kernel* kernel, cl_uint work_dim, size_t* global, size_t* local, cl_bool verbose, char* log_file);
+int fClientAllocate(cl_command_queue* commands, cl_mem* mem_ptr, cl_ulong size, cl_int read_write, cl_int mode, void* content, cl_ulong content_size, cl_mem* source, cl_bool verbose, char* log_file);
+int fClientTransfer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong offset, cl_ulong size, cl_bool write, cl_bool verbose, char* log_file);
+int fClientRelease(cl_mem mem, cl_bool verbose, char* log_file);
+int fClientLibrary(cl_uint op, cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_mem* subset_ptr, cl_uint flags, cl_uint4 size_a, cl_uint4 size_b, cl_float scale, cl_bool verbose, char* log_file);
+
+// Device memory residency of the buffers[] slots, see NCopencl_residency.cpp.
+int fResidencyReserve(cl_command_queue* commands, cl_ulong size, cl_bool verbose, char* log_file);
+cl_ulong fResidencyEvict(cl_command_queue* commands, cl_ulong size, cl_bool verbose, char* log_file);
+void fResidencyAdd(cl_mem* slot, cl_command_queue* commands, cl_ulong size);
+cl_bool fResidencyRelease(cl_mem* slot);
+cl_mem* fResident(cl_uint index, cl_bool pin, cl_bool verbose, char* log_file);
+void fResidencyBindArg(cl_kernel kernel, cl_uint arg_index, cl_uint index);
+void fResidencyForgetKernel(cl_kernel kernel);
+int fResidencyLaunch(cl_kernel kernel, cl_ulong* held, cl_bool verbose, char* log_file);
+void fResidencyLaunchDone(cl_ulong held);
+int fResidencyBudget(cl_ulong budget, cl_bool verbose, char* log_file);
+int fResidencyStatus(cl_command_queue* commands, cl_ulong* status, cl_bool verbose, char* log_file);
+
+// Host arena, see NCopencl_arena.cpp
+int fArenaAlloc(cl_ulong size, cl_bool huge, void** ptr, cl_bool verbose, char* log_file);
+int fArenaFree(void* ptr);
+cl_ulong fArenaTrim(void);
+int fArenaStatus(cl_ulong* status);
+cl_bool fArenaOwns(const void* ptr);
+int fArenaInPlace(cl_command_queue* commands, cl_mem mem, cl_bool verbose, char* log_file);
+void fArenaCheck(cl_command_queue* commands, const void* content, cl_bool verbose, char* log_file);
+
+// Shared virtual memory buffers, see NCopencl_svm.cpp
+#define SVM_AUTO	0	// fastest of the device
+#define SVM_COARSE	1	// coarse grained buffer
+#define SVM_FINE	2	// fine grained buffer
+#define SVM_SYSTEM	3	// fine grained system, the host memory itself
+
+int fSvmCreate(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong content_size, cl_int read_write, cl_uint mode, cl_bool verbose, char* log_file);
+void* fSvmPointer(cl_mem mem, cl_uint* granularity, cl_ulong* size);
+int fSvmTransfer(cl_command_queue* commands, cl_mem mem, void* content, cl_ulong content_size, cl_bool write, cl_bool verbose, char* log_file);
+int fSvmSetArg(cl_kernel kernel, cl_uint arg_index, cl_mem mem, cl_bool verbose, char* log_file);
+void fSvmRelease(cl_mem mem);
+
+// Tiled kernel launches, see NCopencl_tile.cpp
+#define TILE_NONE		0	// no tiled launch on the queue
+#define TILE_RUNNING	1
+#define TILE_DONE		2
+#define TILE_CANCELLED	3
+#define TILE_FAILED		4
+
+int fTileExecute(cl_command_queue* commands, cl_kernel* kernel, cl_uint work_dim, size_t* global, size_t* local, cl_ulong tile, cl_uint in_flight,
+				 cl_bool wait, cl_bool verbose, char* log_file);
+int fTileWait(cl_command_queue* commands, cl_bool verbose, char* log_file);
+int fTileProgress(cl_command_queue* commands, cl_ulong* status);
+int fTileCancel(cl_command_queue* commands, cl_bool verbose, char* log_file);
+
+// Projection planner, see NCopencl_plan.cpp. fPlan fills double[PLAN_N]:
+// subsets, views per subset, device bytes, device budget, fits the budget,
+// layout (PLAN_LAYOUT_*), image planes per slab, slabs, seconds forward and
+// back (all views), transfer share, profiling samples of the model.
+#define PLAN_N					12
+#define PLAN_LAYOUT_STREAM		0	// image and subset sinogram per subset
+#define PLAN_LAYOUT_RESIDENT	1	// full sinogram kept on the device
+#define PLAN_LAYOUT_SLABS		2	// image in slabs of planes
+
+int fPlanSample(cl_command_queue* commands, cl_bool back, cl_ulong* dims, double seconds, cl_ulong transfer_bytes, double transfer_seconds, cl_bool verbose, char* log_file);
+int fPlanLoad(char* path, cl_bool verbose, char* log_file);
+int fPlanSave(char* path, cl_bool verbose, char* log_file);
+int fPlan(cl_command_queue* commands, cl_ulong* dims, cl_uint* options, double* plan, cl_bool verbose, char* log_file);
+
+// Entry points recorded by the workload capture, see NCopencl_capture.cpp.
+#define CAPTURE_BUILD_KERNELS		0
+#define CAPTURE_REGISTER_KERNELS	1
+#define CAPTURE_CREATE_QUEUE		2
+#define CAPTURE_CREATE_QUEUE_SHARED	3
+#define CAPTURE_RELEASE_QUEUE		4
+#define CAPTURE_RELEASE_KERNELS		5
+#define CAPTURE_SET_KERNEL_ARG		6
+#define CAPTURE_EXECUTE_KERNEL		7
+#define CAPTURE_CREATE_BUFFER		8
+#define CAPTURE_CREATE_BUFFER_EMPTY	9
+#define CAPTURE_CREATE_BUFFER_FILL	10
+#define CAPTURE_CREATE_BUFFER_COPY	11
+#define CAPTURE_WRITE_BUFFER		12
+#define CAPTURE_READ_BUFFER			13
+#define CAPTURE_WRITE_BUFFER_REGION	14
+#define CAPTURE_READ_BUFFER_REGION	15
+#define CAPTURE_RELEASE_BUFFER		16
+#define CAPTURE_SINO_GATHER			17
+#define CAPTURE_SINO_SCATTER		18
+#define CAPTURE_SINO_SWAP			19
+#define CAPTURE_SINO_REBIN			20
+#define CAPTURE_RESAMPLE_DOWN		21
+#define CAPTURE_RESAMPLE_UP			22
+#define CAPTURE_NATIVE_THREADS		23
+#define CAPTURE_GEOM_SRCLOCS		24
+#define CAPTURE_EXECUTE_KERNEL_TILED	25
+#define CAPTURE_TILE_CANCEL			26
+#define CAPTURE_TILE_WAIT			27
+#define CAPTURE_OPS					28
+
+// Content of the uploaded data in a trace.
+#define CAPTURE_CONTENT_FULL		0
+#define CAPTURE_CONTENT_HASH		1
+#define CAPTURE_CONTENT_SAMPLE		2
+
+double fCaptureClock();
+void fCaptureCall(cl_uint op, int argc, void* argv[], int result, double start);
+int fCaptureStart(char* path, cl_int content, cl_uint sample, cl_bool verbose, char* log_file);
+int fCaptureStop(cl_bool verbose, char* log_file);
+int fReplayTrace(char* path, cl_int force_cpu, char* kernel_dir, char* report, cl_bool json, cl_bool verbose, char* log_file);
+
+int fRegisterKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl_ulong n_kernels, idls* file_paths, idls* function_names, idls* compile_options, cl_bool prefetch, cl_bool verbose, char* log_file);
+int fLazyKernel(cl_kernel* slot, cl_bool verbose, char* log_file);
+void fLazyForget(cl_kernel* kernels, cl_ulong n_kernels, cl_bool verbose, char* log_file);
+
+void fSpecStrip(const char* options, std::string& stripped, std::string& spec);
+int fSpecRegister(cl_kernel kernel, cl_context context, cl_device_id device_id, const char* source, const char* options, const char* function_name, const std::string& spec, cl_bool verbose, char* log_file);
+void fSpecSetArg(cl_kernel kernel, cl_uint arg_index, cl_ulong arg_size, void* arg_value);
+cl_kernel fSpecKernel(cl_kernel kernel, cl_bool verbose, char* log_file);
+void fSpecForget(cl_kernel kernel);
+
+///////////////////////////////////////////////////////////////////////////////
+// Run body(first, last) over [0, n) on all hardware threads, with at least
+// min_per_thread items per thread; small ranges stay on the calling thread.
+//
+template <typename F>
+void fParallelFor(cl_ulong n, cl_ulong min_per_thread, F body)
+{
+	cl_ulong n_threads = std::thread::hardware_concurrency();
+
+	if (n_threads > n / min_per_thread) n_threads = n / min_per_thread;
+	if (n_threads <= 1)
+	{
+		body((cl_ulong) 0, n);
+		return;
+	}
+
+	std::vector<std::thread>	workers;
+	cl_ulong					chunk = (n + n_threads - 1) / n_threads;
+
+	for (cl_ulong tt = 0; tt < n_threads; tt++)
+	{
+		cl_ulong first = tt * chunk;
+		cl_ulong last  = first + chunk < n ? first + chunk : n;
+		if (first < last) workers.push_back(std::thread(body, first, last));
+	}
+	for (size_t tt = 0; tt < workers.size(); tt++)
+	{
+		workers[tt].join();
+	}
+}
\ No newline at end of file
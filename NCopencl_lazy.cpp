@@ -0,0 +1,277 @@
+// NCopencl_lazy.cpp : Lazy kernel builds. fRegisterKernels records the source
+// file, function name and compile options of every kernel and leaves its slot
+// in the kernel list empty; the kernel is compiled (through fBuildKernels, so
+// with the program cache) on the first fNCset_kernel_arg or fNCexecute_kernel
+// that uses it. A projector that only ever forward projects never pays for
+// compiling its backprojector.
+//
+// Optionally a prefetch thread builds the registered kernels in list order in
+// the background. A use that finds its kernel being built by the prefetch
+// thread waits for it instead of compiling it a second time.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#define LAZY_PENDING  0
+#define LAZY_BUILDING 1
+
+typedef struct {
+	cl_kernel*			slot;		// entry of the caller's kernel list
+	cl_command_queue	queue;		// retained until the kernel is built
+	std::string			file_path;
+	std::string			function_name;
+	std::string			compile_options;
+	int					state;
+} lazy_kernel;
+
+typedef struct {
+	cl_kernel*			kernels;
+	cl_ulong			n_kernels;
+	cl_bool				cancel;
+	std::thread*		worker;
+} lazy_prefetch;
+
+static std::mutex					lazy_lock;
+static std::condition_variable		lazy_done;
+static std::vector<lazy_kernel>		lazy_kernels;
+static std::vector<lazy_prefetch*>	lazy_prefetches;
+
+// Registered kernel for this slot, or -1 (never registered or already built).
+static int fLazyFind(cl_kernel* slot)
+{
+	for (size_t ii = 0; ii < lazy_kernels.size(); ii++)
+	{
+		if (lazy_kernels[ii].slot == slot) return((int) ii);
+	}
+	return(-1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the kernel of one slot. With wait, a build already running on another
+// thread is waited for; without (the prefetch thread), that slot is skipped.
+//
+static int fLazyBuild(cl_kernel* slot, cl_bool wait, cl_bool verbose, char* log_file)
+{
+	int			result;
+	int			index;
+	cl_kernel	kernel = NULL;
+	idls		file_path;
+	idls		function_name;
+	idls		compile_options;
+	lazy_kernel	entry;
+	FILE*		pfile = NULL;
+
+	std::unique_lock<std::mutex> lock(lazy_lock);
+
+	while ((index = fLazyFind(slot)) >= 0 && lazy_kernels[index].state == LAZY_BUILDING)
+	{
+		if (!wait) return(0);
+		lazy_done.wait(lock);
+	}
+	if (index < 0) return(0);
+
+	lazy_kernels[index].state = LAZY_BUILDING;
+	entry = lazy_kernels[index];
+	lock.unlock();
+
+	memset(&file_path, 0, sizeof(idls));
+	memset(&function_name, 0, sizeof(idls));
+	memset(&compile_options, 0, sizeof(idls));
+	file_path.s			= (char*) entry.file_path.c_str();
+	function_name.s		= (char*) entry.function_name.c_str();
+	compile_options.s	= (char*) entry.compile_options.c_str();
+
+	result = fBuildKernels(&entry.queue, &kernel, 1, &file_path, &function_name, &compile_options, verbose, log_file);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		if (result < 0) fprintf(pfile, "Error: Lazy build of kernel %s failed! %d\n", entry.function_name.c_str(), result);
+		else fprintf(pfile, "Info: Kernel %s built on %s.\n", entry.function_name.c_str(), wait ? "first use" : "prefetch");
+		fclose(pfile);
+	}
+
+	lock.lock();
+	index = fLazyFind(slot);
+	if (result < 0)
+	{
+		// Stays registered, the next use tries again and reports the error
+		lazy_kernels[index].state = LAZY_PENDING;
+	}
+	else
+	{
+		*slot = kernel;
+		clReleaseCommandQueue(lazy_kernels[index].queue);
+		lazy_kernels.erase(lazy_kernels.begin() + index);
+	}
+	lazy_done.notify_all();
+
+	return(result);
+}
+
+static void fLazyPrefetch(lazy_prefetch* prefetch, cl_bool verbose, std::string log_file)
+{
+	for (cl_ulong ii = 0; ii < prefetch->n_kernels; ii++)
+	{
+		{
+			std::lock_guard<std::mutex> lock(lazy_lock);
+			if (prefetch->cancel) return;
+		}
+		fLazyBuild(&prefetch->kernels[ii], CL_FALSE, verbose, (char*) log_file.c_str());
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Register a series of kernels for a build on first use. Kernels for the
+// native backend or a projection server are built right away.
+//
+int fRegisterKernels(cl_command_queue* commands, cl_kernel kernels[MAX_KERNELS], cl_ulong n_kernels, idls* file_paths, idls* function_names, idls* compile_options, cl_bool prefetch, cl_bool verbose, char* log_file)
+{
+	int				error;
+	lazy_kernel		entry;
+	lazy_prefetch*	worker;
+	FILE*			source = NULL;
+	FILE*			pfile = NULL;
+
+	if (fClientActive() || fNativeQueue(commands))
+	{
+		return(fBuildKernels(commands, kernels, n_kernels, file_paths, function_names, compile_options, verbose, log_file));
+	}
+
+	// Missing sources are still reported at setup time
+	for (cl_ulong ii = 0; ii < n_kernels; ii++)
+	{
+		if (fEmbeddedKernel(file_paths[ii].s) != NULL) continue;
+
+		source = fopen(file_paths[ii].s, "rb");
+		if (source == NULL)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: Failed to open source file nr. %d: %s\n", (int) ii, file_paths[ii].s);
+				fclose(pfile);
+			}
+			return(-8);
+		}
+		fclose(source);
+	}
+
+	std::lock_guard<std::mutex> lock(lazy_lock);
+
+	for (cl_ulong ii = 0; ii < n_kernels; ii++)
+	{
+		error = clRetainCommandQueue(*commands);
+		if (error != CL_SUCCESS)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: Failed to retain command queue! %d\n", error);
+				fclose(pfile);
+			}
+			return(-3);
+		}
+
+		kernels[ii]				= NULL;
+		entry.slot				= &kernels[ii];
+		entry.queue				= *commands;
+		entry.file_path			= file_paths[ii].s;
+		entry.function_name		= function_names[ii].s;
+		entry.compile_options	= compile_options[ii].s;
+		entry.state				= LAZY_PENDING;
+		lazy_kernels.push_back(entry);
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: %d kernels registered for a build on first use%s.\n", (int) n_kernels, prefetch ? ", prefetching" : "");
+		fclose(pfile);
+	}
+
+	if (prefetch && n_kernels > 0)
+	{
+		worker				= new lazy_prefetch;
+		worker->kernels		= kernels;
+		worker->n_kernels	= n_kernels;
+		worker->cancel		= CL_FALSE;
+		worker->worker		= new std::thread(fLazyPrefetch, worker, verbose, std::string(log_file));
+		lazy_prefetches.push_back(worker);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Make sure the kernel of a slot is built; slots that were not registered, or
+// are built already, are left alone.
+//
+int fLazyKernel(cl_kernel* slot, cl_bool verbose, char* log_file)
+{
+	return(fLazyBuild(slot, CL_TRUE, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The kernel list is released: stop its prefetch thread and drop the kernels
+// that were never built.
+//
+void fLazyForget(cl_kernel* kernels, cl_ulong n_kernels, cl_bool verbose, char* log_file)
+{
+	std::vector<lazy_prefetch*>	workers;
+	cl_uint						n_unused = 0;
+	FILE*						pfile = NULL;
+
+	{
+		std::lock_guard<std::mutex> lock(lazy_lock);
+		for (size_t ii = 0; ii < lazy_prefetches.size(); )
+		{
+			if (lazy_prefetches[ii]->kernels == kernels)
+			{
+				lazy_prefetches[ii]->cancel = CL_TRUE;
+				workers.push_back(lazy_prefetches[ii]);
+				lazy_prefetches.erase(lazy_prefetches.begin() + ii);
+			}
+			else ii++;
+		}
+	}
+
+	// Let a build in progress finish, its kernel is released with the rest
+	for (size_t ii = 0; ii < workers.size(); ii++)
+	{
+		workers[ii]->worker->join();
+		delete workers[ii]->worker;
+		delete workers[ii];
+	}
+
+	std::unique_lock<std::mutex> lock(lazy_lock);
+	for (size_t ii = 0; ii < lazy_kernels.size(); )
+	{
+		if (lazy_kernels[ii].slot >= kernels && lazy_kernels[ii].slot < kernels + n_kernels)
+		{
+			if (lazy_kernels[ii].state == LAZY_BUILDING)
+			{
+				lazy_done.wait(lock);
+				ii = 0;
+				continue;
+			}
+			clReleaseCommandQueue(lazy_kernels[ii].queue);
+			lazy_kernels.erase(lazy_kernels.begin() + ii);
+			n_unused++;
+		}
+		else ii++;
+	}
+
+	if (verbose && n_unused > 0)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: %u registered kernels were never used and not built.\n", n_unused);
+		fclose(pfile);
+	}
+}
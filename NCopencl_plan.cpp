@@ -0,0 +1,486 @@
+// NCopencl_plan.cpp : Memory and runtime planning of the spiral CT projector
+// (NIproj_distd_spiralct_ocl_pic) before a job is launched.
+//
+// The dimensions of a job are those of the projector description: nrcols,
+// nrrows, nrplanes of the image, ndetcols, ndetplanes, nrangles of the
+// sinogram. A launch projects the views of one subset; its work is counted as
+// sinogram bins times the image extent along the rays (max(nrcols, nrrows)),
+// the slab loop of the distance driven kernels.
+//
+// Runtime model, per direction: seconds = launch + per_work * work, plus the
+// host <-> device transfers at the measured bandwidth. The coefficients are a
+// least squares fit of profiling samples (fPlanSample, e.g. from
+// opencl_projbench -calibrate), kept per device and saved to a calibration
+// file; without samples they are estimated from the device's calibrated
+// GFLOP/s (fDeviceGflops).
+//
+// Memory model: the buffers NIproj creates for a subset (image, subset
+// sinogram, source locations, detector grid, motion matrices, subset
+// indices), plus the full sinogram when it is kept on the device for the
+// back projection. What does not fit the device budget (fResidencyBudget)
+// is split in slabs of image planes; a slab sees the views of its planes and
+// of the detector's width around them.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <cmath>
+#include <mutex>
+
+#define PLAN_MAX_SUBSETS		64
+#define PLAN_EFFICIENCY			0.8		// share of the time spent projecting
+#define PLAN_HEADROOM			0.9		// share of the budget a plan may use
+#define PLAN_FLOPS_PER_STEP		48.0	// reference kernel, per bin and slab step
+#define PLAN_BACK_FACTOR		2.0		// atomic adds of the back projection
+#define PLAN_LAUNCH_SECONDS		20e-6
+#define PLAN_BANDWIDTH			6e9		// PCIe, bytes/s
+#define PLAN_BANDWIDTH_UNIFIED	10e9	// host memory
+#define PLAN_CPU_GFLOPS			4.0		// per thread, native backend
+
+// Least squares sums of seconds over work, per direction
+typedef struct {
+	double	n;
+	double	sx;
+	double	sy;
+	double	sxx;
+	double	sxy;
+} plan_fit;
+
+static std::mutex	plan_lock;
+static plan_fit		plan_fits[2];
+static double		plan_transfer_bytes = 0.0;
+static double		plan_transfer_seconds = 0.0;
+static char			plan_device[128] = "";
+
+typedef struct {
+	double		launch[2];
+	double		per_work[2];
+	double		bandwidth;
+	cl_uint		samples;
+} plan_model;
+
+static double fPlanWork(cl_ulong* dims)
+{
+	return((double) dims[3] * dims[4] * dims[5] * (dims[0] > dims[1] ? dims[0] : dims[1]));
+}
+
+// Name of the queue's device, "native" for the native backend.
+static int fPlanDevice(cl_command_queue* commands, char* name, size_t size)
+{
+	cl_device_id	device_id;
+	cl_int			error;
+
+	if (fNativeQueue(commands))
+	{
+		snprintf(name, size, "%s", "native");
+		return(0);
+	}
+
+	error = clGetCommandQueueInfo(*commands, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device_id, NULL);
+	if (error == CL_SUCCESS) error = clGetDeviceInfo(device_id, CL_DEVICE_NAME, size, name, NULL);
+	if (error != CL_SUCCESS) return(-3);
+
+	name[size - 1] = 0;
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Add the timing of one launch: dims[6] with nrangles the views of the launch,
+// the kernel seconds and, if measured, the bytes and seconds of its
+// transfers (0, 0: the seconds include them). Samples of another device than
+// the ones before replace those.
+//
+int fPlanSample(cl_command_queue* commands, cl_bool back, cl_ulong* dims, double seconds, cl_ulong transfer_bytes, double transfer_seconds, cl_bool verbose, char* log_file)
+{
+	char		device[128];
+	double		work = fPlanWork(dims);
+	plan_fit*	fit;
+	FILE*		pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientUnsupported("Planning", verbose, log_file));
+	}
+
+	if (work <= 0.0 || seconds <= 0.0) return(-1);
+	if (fPlanDevice(commands, device, sizeof(device)) < 0) return(-3);
+
+	std::lock_guard<std::mutex> lock(plan_lock);
+
+	if (strcmp(device, plan_device) != 0)
+	{
+		if (verbose && plan_device[0] != 0)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: Planning samples of %s replaced by those of %s.\n", plan_device, device);
+			fclose(pfile);
+		}
+		memset(plan_fits, 0, sizeof(plan_fits));
+		plan_transfer_bytes		= 0.0;
+		plan_transfer_seconds	= 0.0;
+		strcpy(plan_device, device);
+	}
+
+	fit = &plan_fits[back ? 1 : 0];
+	fit->n		+= 1.0;
+	fit->sx		+= work;
+	fit->sy		+= seconds;
+	fit->sxx	+= work * work;
+	fit->sxy	+= work * seconds;
+
+	if (transfer_bytes > 0 && transfer_seconds > 0.0)
+	{
+		plan_transfer_bytes		+= (double) transfer_bytes;
+		plan_transfer_seconds	+= transfer_seconds;
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Calibration file: the device and the sums of its samples, so that later
+// samples add to them.
+//
+int fPlanLoad(char* path, cl_bool verbose, char* log_file)
+{
+	FILE*		file;
+	char		line[256];
+	plan_fit	fits[2];
+	double		bytes = 0.0;
+	double		seconds = 0.0;
+	char		device[128] = "";
+	int			found = 0;
+	FILE*		pfile = NULL;
+
+	file = fopen(path, "r");
+	if (file == NULL)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Cannot read the planning calibration %s!\n", path);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+
+	memset(fits, 0, sizeof(fits));
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		plan_fit* fit = strncmp(line, "proj ", 5) == 0 ? &fits[0] : (strncmp(line, "back ", 5) == 0 ? &fits[1] : NULL);
+
+		if (strncmp(line, "device ", 7) == 0)
+		{
+			snprintf(device, sizeof(device), "%.*s", (int) sizeof(device) - 1, line + 7);
+			device[strcspn(device, "\r\n")] = 0;
+			found++;
+		}
+		else if (fit != NULL)
+		{
+			if (sscanf(line + 5, "%lf %lf %lf %lf %lf", &fit->n, &fit->sx, &fit->sy, &fit->sxx, &fit->sxy) == 5) found++;
+		}
+		else if (strncmp(line, "transfer ", 9) == 0)
+		{
+			if (sscanf(line + 9, "%lf %lf", &bytes, &seconds) == 2) found++;
+		}
+	}
+	fclose(file);
+
+	if (found != 4)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: %s is not a planning calibration!\n", path);
+			fclose(pfile);
+		}
+		return(-4);
+	}
+
+	std::lock_guard<std::mutex> lock(plan_lock);
+
+	memcpy(plan_fits, fits, sizeof(fits));
+	plan_transfer_bytes		= bytes;
+	plan_transfer_seconds	= seconds;
+	strcpy(plan_device, device);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Planning calibration of %s loaded, %.0f + %.0f samples.\n", device, fits[0].n, fits[1].n);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+int fPlanSave(char* path, cl_bool verbose, char* log_file)
+{
+	FILE*	file;
+	FILE*	pfile = NULL;
+
+	std::lock_guard<std::mutex> lock(plan_lock);
+
+	file = fopen(path, "w");
+	if (file == NULL)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Cannot write the planning calibration %s!\n", path);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+
+	fprintf(file, "# projector planning calibration: samples, sums of work, seconds, work^2, work x seconds\n");
+	fprintf(file, "device %s\n", plan_device);
+	for (int dd = 0; dd < 2; dd++)
+	{
+		plan_fit* fit = &plan_fits[dd];
+		fprintf(file, "%s %.0f %.17g %.17g %.17g %.17g\n", dd ? "back" : "proj", fit->n, fit->sx, fit->sy, fit->sxx, fit->sxy);
+	}
+	fprintf(file, "transfer %.17g %.17g\n", plan_transfer_bytes, plan_transfer_seconds);
+	fclose(file);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Planning calibration of %s saved to %s.\n", plan_device, path);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Coefficients for the queue's device: fitted when there are samples of it,
+// else the estimates. One sample fixes the slope at the estimated launch time.
+//
+static void fPlanModel(const char* device, double gflops, cl_bool unified, plan_model* model)
+{
+	std::lock_guard<std::mutex> lock(plan_lock);
+	cl_bool	same = strcmp(device, plan_device) == 0;
+
+	model->samples		= 0;
+	model->bandwidth	= unified ? PLAN_BANDWIDTH_UNIFIED : PLAN_BANDWIDTH;
+	if (same && plan_transfer_seconds > 0.0) model->bandwidth = plan_transfer_bytes / plan_transfer_seconds;
+
+	for (int dd = 0; dd < 2; dd++)
+	{
+		plan_fit*	fit = &plan_fits[dd];
+		double		det = fit->n * fit->sxx - fit->sx * fit->sx;
+
+		model->launch[dd]	= PLAN_LAUNCH_SECONDS;
+		model->per_work[dd]	= PLAN_FLOPS_PER_STEP / (gflops * 1e9) * (dd ? PLAN_BACK_FACTOR : 1.0);
+		if (!same || fit->n < 1.0) continue;
+
+		model->samples += (cl_uint) fit->n;
+		if (fit->n >= 2.0 && det > 1e-12 * fit->n * fit->sxx)
+		{
+			double slope = (fit->n * fit->sxy - fit->sx * fit->sy) / det;
+			double intercept = (fit->sy - slope * fit->sx) / fit->n;
+
+			if (slope > 0.0 && intercept >= 0.0)
+			{
+				model->launch[dd]	= intercept;
+				model->per_work[dd]	= slope;
+				continue;
+			}
+		}
+		// one work size only, or a fit without meaning: through the launch time
+		if (fit->sy > fit->n * model->launch[dd]) model->per_work[dd] = (fit->sy - fit->n * model->launch[dd]) / fit->sx;
+		else model->launch[dd] = fit->sy / fit->n, model->per_work[dd] = 0.0;
+	}
+}
+
+// Device bytes and seconds (forward, back, transfers of both) of all views in
+// nsubsets subsets, the image in slabs of planes (planes = nrplanes: none).
+typedef struct {
+	cl_ulong	bytes;
+	cl_ulong	largest;
+	double		seconds[2];
+	double		transfer;
+} plan_cost;
+
+static void fPlanCost(cl_ulong* dims, cl_uint nsubsets, cl_ulong planes, cl_bool resident, plan_model* model, plan_cost* cost)
+{
+	cl_ulong	nviews = dims[5];
+	cl_ulong	nsub = (nviews + nsubsets - 1) / nsubsets;
+	cl_ulong	nslabs = (dims[2] + planes - 1) / planes;
+	double		share = nslabs > 1 ? (double) (planes + dims[4] < dims[2] ? planes + dims[4] : dims[2]) / dims[2] : 1.0;
+	cl_ulong	image = 4 * dims[0] * dims[1] * planes;
+	cl_ulong	sino = (cl_ulong) ceil(4.0 * dims[3] * dims[4] * nsub * share);
+	cl_ulong	sino_full = 4 * dims[3] * dims[4] * nviews;
+	cl_ulong	geometry = (16 + 64 + 4) * nsub + 16 * ((dims[3] + 1) * (dims[4] + 1) + 2);
+	cl_ulong	launch_dims[6] = {dims[0], dims[1], dims[2], dims[3], dims[4], nviews};
+	double		work = fPlanWork(launch_dims) * share * nslabs;
+	double		launches = (double) nsubsets * nslabs;
+	double		bytes[2];
+
+	cost->bytes		= image + sino + geometry + (resident ? sino_full : 0);
+	cost->largest	= image > sino ? image : sino;
+	if (resident && sino_full > cost->largest) cost->largest = sino_full;
+
+	// forward: image up, sinogram down; back: sinogram up (not when it is
+	// on the device already), image down
+	bytes[0] = launches * (image + sino);
+	bytes[1] = launches * (image + (resident ? 0 : sino));
+
+	for (int dd = 0; dd < 2; dd++)
+	{
+		cost->seconds[dd] = launches * model->launch[dd] + work * model->per_work[dd] + bytes[dd] / model->bandwidth;
+	}
+	cost->transfer = (bytes[0] + bytes[1]) / model->bandwidth;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Plan a job of dims[6] on the queue's device. options: subsets (0 to
+// recommend), det_rebin, angle_rebin (0 or 1: none). Recommended are the most
+// subsets that still spend PLAN_EFFICIENCY of the time projecting, and the
+// layout that fits the budget: the full sinogram on the device, or per subset,
+// or the image in slabs of as many planes as fit.
+//
+int fPlan(cl_command_queue* commands, cl_ulong* dims, cl_uint* options, double* plan, cl_bool verbose, char* log_file)
+{
+	int				result;
+	cl_ulong		caps[DEVICE_CAPS_N];
+	cl_ulong		status[8];
+	cl_ulong		job[6];
+	cl_ulong		budget;
+	cl_ulong		max_alloc;
+	cl_device_id	device_id;
+	char			device[128];
+	double			gflops;
+	plan_model		model;
+	plan_cost		cost;
+	cl_uint			det_rebin = options[1] > 1 ? options[1] : 1;
+	cl_uint			angle_rebin = options[2] > 1 ? options[2] : 1;
+	cl_uint			nsubsets;
+	cl_uint			layout = PLAN_LAYOUT_RESIDENT;
+	cl_ulong		planes;
+	cl_bool			fits = CL_TRUE;
+	FILE*			pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientUnsupported("Planning", verbose, log_file));
+	}
+
+	memset(plan, 0, PLAN_N * sizeof(double));
+	memcpy(job, dims, sizeof(job));
+	job[3] /= det_rebin;
+	job[5] /= angle_rebin;
+	for (int ii = 0; ii < 6; ii++)
+	{
+		if (job[ii] == 0) return(-1);
+	}
+
+	result = fDeviceCaps(commands, caps, verbose, log_file);
+	if (result < 0) return(result);
+	result = fResidencyStatus(commands, status, CL_FALSE, log_file);
+	if (result < 0) return(result);
+	result = fPlanDevice(commands, device, sizeof(device));
+	if (result < 0) return(result);
+
+	// Native queues use host memory: no budget
+	budget		= (cl_ulong) (status[2] * PLAN_HEADROOM);
+	max_alloc	= status[4];
+
+	if (fNativeQueue(commands))
+	{
+		gflops = PLAN_CPU_GFLOPS * caps[1];
+	}
+	else
+	{
+		clGetCommandQueueInfo(*commands, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device_id, NULL);
+		gflops = fDeviceGflops(device_id, verbose, log_file);
+		if (gflops <= 0.0) gflops = PLAN_CPU_GFLOPS * caps[1];
+	}
+	fPlanModel(device, gflops, caps[7] != 0, &model);
+
+	#define PLAN_FITS(c) (budget == 0 || ((c).bytes <= budget && (max_alloc == 0 || (c).largest <= max_alloc)))
+
+	// Most subsets at the target efficiency, one if none reaches it
+	nsubsets = options[0];
+	if (nsubsets == 0)
+	{
+		double full = model.per_work[0] + model.per_work[1];
+
+		nsubsets = 1;
+		for (cl_uint nn = (cl_uint) (job[5] < PLAN_MAX_SUBSETS ? job[5] : PLAN_MAX_SUBSETS); nn > 1; nn--)
+		{
+			fPlanCost(job, nn, job[2], CL_FALSE, &model, &cost);
+			if (fPlanWork(job) * full >= PLAN_EFFICIENCY * (cost.seconds[0] + cost.seconds[1]))
+			{
+				nsubsets = nn;
+				break;
+			}
+		}
+	}
+	if (nsubsets > job[5]) nsubsets = (cl_uint) job[5];
+
+	// Recommended: rather more subsets (smaller subset sinograms) than slabs
+	if (options[0] == 0)
+	{
+		for (cl_uint nn = nsubsets; nn <= PLAN_MAX_SUBSETS && nn <= job[5]; nn++)
+		{
+			fPlanCost(job, nn, job[2], CL_FALSE, &model, &cost);
+			if (PLAN_FITS(cost))
+			{
+				nsubsets = nn;
+				break;
+			}
+		}
+	}
+
+	// Layout: full sinogram on the device, else per subset, else slabs
+	planes = job[2];
+	fPlanCost(job, nsubsets, planes, CL_TRUE, &model, &cost);
+	if (!PLAN_FITS(cost))
+	{
+		layout = PLAN_LAYOUT_STREAM;
+		fPlanCost(job, nsubsets, planes, CL_FALSE, &model, &cost);
+	}
+	while (!PLAN_FITS(cost) && planes > 1)
+	{
+		layout = PLAN_LAYOUT_SLABS;
+		planes = planes > 8 ? planes * 7 / 8 : planes - 1;
+		fPlanCost(job, nsubsets, planes, CL_FALSE, &model, &cost);
+	}
+	fits = PLAN_FITS(cost);
+
+	#undef PLAN_FITS
+
+	plan[0]		= nsubsets;
+	plan[1]		= (double) ((job[5] + nsubsets - 1) / nsubsets);
+	plan[2]		= (double) cost.bytes;
+	plan[3]		= (double) budget;
+	plan[4]		= fits;
+	plan[5]		= layout;
+	plan[6]		= (double) planes;
+	plan[7]		= (double) ((job[2] + planes - 1) / planes);
+	plan[8]		= cost.seconds[0];
+	plan[9]		= cost.seconds[1];
+	plan[10]	= cost.transfer / (cost.seconds[0] + cost.seconds[1]);
+	plan[11]	= model.samples;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Plan for %llux%llux%llu, %llu columns x %llu planes x %llu views on %s (%s model, %u samples):\n",
+				(unsigned long long) job[0], (unsigned long long) job[1], (unsigned long long) job[2], (unsigned long long) job[3],
+				(unsigned long long) job[4], (unsigned long long) job[5], device, model.samples ? "calibrated" : "estimated", model.samples);
+		fprintf(pfile, "      %u subsets of %.0f views, %s, %.0f planes per slab, %.1f MB", nsubsets, plan[1],
+				layout == PLAN_LAYOUT_RESIDENT ? "sinogram on the device" : (layout == PLAN_LAYOUT_STREAM ? "sinogram per subset" : "image in slabs"),
+				plan[6], plan[2] / 1048576.0);
+		if (budget > 0) fprintf(pfile, " of %.1f MB%s", plan[3] / 1048576.0, fits ? "" : ", DOES NOT FIT");
+		fprintf(pfile, ".\n");
+		fprintf(pfile, "      %.3f s forward, %.3f s back, %.0f%% in transfers.\n", plan[8], plan[9], 100.0 * plan[10]);
+		fclose(pfile);
+	}
+
+	return(fits ? 0 : -5);
+}
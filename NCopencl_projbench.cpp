@@ -0,0 +1,547 @@
+// NCopencl_projbench.cpp : End-to-end benchmark of the spiral CT projector.
+// Runs the flow of NIproj_distd_spiralct_ocl_pic through the fNC entry points
+// (buffer setup, geometry, the ten kernel arguments, forward or back launch,
+// readback) on synthetic helical scans of the scanner models of
+// NIdef_projspiralct_ocl, with the reference kernel kernels/
+// distd_sinogram_spiralct_pic_ref.cl (or -kernel).
+//
+//   opencl_projbench [-device auto|cpu|native|<name>] [-model 16|DefinitionAS|Force|all]
+//                    [-volumes NxNxNz,...] [-views n,...] [-subsets n,...]
+//                    [-threads n,...] [-reps n] [-kernel file] [-calibrate file]
+//                    [-specialize] [-json] [-out file] [-log file]
+//
+// Every combination of model, volume, view count and subset count is run
+// forward and back; a run is all subsets of the views, one launch each. The
+// results (CSV, or JSON) give the median time of a run, voxels x views per
+// second, and the share of it spent in host <-> device transfers. -threads
+// sweeps the thread count of the native backend (-device native) and reports
+// the speedup over the first count; OpenCL runtimes choose their own threads
+// (PoCL e.g. POCL_MAX_PTHREAD_COUNT), those rows have threads 0.
+//
+// -specialize builds the kernels with the geometry arguments as constants
+// (see NCopencl_spec.cpp), numbered as in NIproj_distd_spiralct_ocl_pic.
+//
+// -calibrate adds every run, per launch, to the planning calibration in file
+// (created if it does not exist, see NCopencl_plan.cpp).
+//
+
+
+#include "NCopencl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#ifndef PROJBENCH_KERNEL
+#define PROJBENCH_KERNEL "kernels/distd_sinogram_spiralct_pic_ref.cl"
+#endif
+
+// Buffer numbers as in NIproj_distd_spiralct_ocl_pic
+#define BPTR_IMAGE		0
+#define BPTR_SINO		1
+#define BPTR_SRCLOCS0	2
+#define BPTR_DETBINS0	3
+#define BPTR_MC			4
+
+#define PROJBENCH_PI 3.14159265358979f
+
+// Scanner geometry as in NIdef_projspiralct_ocl (no flying focal spot); the
+// detector rows and views per rotation, which NIdef takes from the data, are
+// those of a typical protocol.
+typedef struct {
+	const char*	name;
+	float		focus2center;
+	float		focus2detector;
+	cl_uint		nchannels;
+	float		fanangle;
+	float		fan_coroffset;
+	float		anodeangle;		// degrees, 0 = none
+	cl_uint		ndetplanes;
+	float		row_mm;			// detector row width at the isocenter
+	cl_uint		views_per_rotation;
+} scanner_model;
+
+static const scanner_model models[] = {
+	{"16",           570.0f, 1040.0f, 672, 2 * PROJBENCH_PI * 672.0f / 4640.0f,             1.25f,  0.0f, 16, 0.75f, 1160},
+	{"DefinitionAS", 595.0f, 1085.0f, 736, 0.067864004196156f * PROJBENCH_PI / 180 * 736, 1.25f, -8.0f, 64, 0.6f,  1152},
+	{"Force",        595.0f, 1085.6f, 920, 50.0f / 180.0f * PROJBENCH_PI,                  2.25f,  8.0f, 96, 0.6f,  1152},
+};
+
+typedef struct {
+	std::string		model;
+	cl_uint			volume[3];
+	cl_uint			views;
+	cl_uint			subsets;
+	cl_bool			back;
+	cl_uint			threads;
+	double			seconds;
+	double			transfer_share;
+	double			speedup;
+} projbench_result;
+
+static std::vector<projbench_result>	results;
+static void*							queue = NULL;
+static cl_bool							verbose = CL_FALSE;
+static idls								log_file;
+
+static idls fString(const char* s)
+{
+	idls	str;
+
+	str.slen	= (short) strlen(s);
+	str.stype	= 0;
+	str.s		= (char*) s;
+	return(str);
+}
+
+static double fSeconds(std::chrono::steady_clock::time_point start)
+{
+	return(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
+
+static void fCheck(const char* what, int result)
+{
+	if (result < 0)
+	{
+		fprintf(stderr, "%s failed: %d\n", what, result);
+		exit(1);
+	}
+}
+
+static std::vector<cl_uint> fList(char* text)
+{
+	std::vector<cl_uint> values;
+
+	for (char* s = strtok(text, ","); s != NULL; s = strtok(NULL, ","))
+	{
+		values.push_back((cl_uint) strtoul(s, NULL, 10));
+	}
+	return(values);
+}
+
+static void fCreateBuffer(cl_uint index, void* content, cl_ulong size, cl_int read_write)
+{
+	cl_bool	host_ptr = CL_FALSE;
+	void*	args[8] = {&queue, &index, content, &size, &read_write, &host_ptr, &verbose, &log_file};
+
+	fCheck("fNCcreate_buffer", fNCcreate_buffer(8, args));
+}
+
+static void fReleaseBuffer(cl_uint index)
+{
+	void* args[3] = {&index, &verbose, &log_file};
+
+	fNCrelease_buffer(3, args);
+}
+
+static void fSetArg(cl_kernel* kernels, cl_uint kernel, cl_uint index, void* value, cl_ulong size, cl_bool is_mem)
+{
+	void* args[8] = {&kernels, &kernel, &index, &size, value, &is_mem, &verbose, &log_file};
+
+	fCheck("fNCset_kernel_arg", fNCset_kernel_arg(8, args));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Synthetic helical scan with pitch 1: view v at tube angle 2 pi v / views
+// per rotation, the table advancing one detector width per rotation. The
+// volume (fov 500 mm, planes of one row width) is centered on the scan.
+//
+typedef struct {
+	const scanner_model*	model;
+	cl_uint					nviews;
+	std::vector<float>		angles;
+	std::vector<float>		tablepos;		// IDL (nviews, ndetplanes)
+	std::vector<float>		align;
+	std::vector<float>		detbins0;		// float4: center, source, detector grid
+	float					center_z;
+} helical_scan;
+
+static void fHelicalScan(const scanner_model* model, cl_uint nviews, helical_scan* scan)
+{
+	cl_uint				np = model->ndetplanes;
+	cl_uint				nc = model->nchannels;
+	float				feed = np * model->row_mm;
+	float				zfactor = model->focus2detector / model->focus2center;
+	float				fan[5] = {model->fan_coroffset, model->fanangle, model->focus2detector, model->focus2center, zfactor};
+	std::vector<float>	plane0(np);
+	std::vector<float>	detcols0(nc + 1), detrows0(nc + 1), detplanes0(np + 1);
+	float				center[3];
+	float				source[3] = {0.0f, -model->focus2center, 0.0f};
+	cl_uint				ncols = nc + 1;
+	cl_uint				nplanes = np + 1;
+	cl_bool				centers = CL_FALSE;
+
+	scan->model		= model;
+	scan->nviews	= nviews;
+	scan->angles.resize(nviews);
+	scan->tablepos.resize((size_t) nviews * np);
+	scan->align.assign(nviews, 0.0f);
+
+	for (cl_uint vv = 0; vv < nviews; vv++)
+	{
+		scan->angles[vv] = 2 * PROJBENCH_PI * (vv % model->views_per_rotation) / model->views_per_rotation;
+		for (cl_uint pp = 0; pp < np; pp++)
+		{
+			scan->tablepos[vv + (size_t) nviews * pp] = feed * vv / model->views_per_rotation + (pp - (np - 1) / 2.0f) * model->row_mm;
+		}
+	}
+	for (cl_uint pp = 0; pp < np; pp++) plane0[pp] = scan->tablepos[(size_t) nviews * pp];
+	scan->center_z = 0.5f * feed * (nviews - 1) / model->views_per_rotation;
+
+	void* detector[9] = {&nc, &np, fan, &plane0[0], &detcols0[0], &detrows0[0], &detplanes0[0], &verbose, &log_file};
+	fCheck("fNCgeom_detector", fNCgeom_detector(9, detector));
+
+	center[0] = 0.0f;
+	center[1] = 0.0f;
+	center[2] = scan->center_z;
+	scan->detbins0.resize(4 * ((size_t) ncols * nplanes + 2));
+
+	void* coords[11] = {&detcols0[0], &detrows0[0], &ncols, &detplanes0[0], &nplanes, center, source, &centers,
+						&scan->detbins0[0], &verbose, &log_file};
+	fCheck("fNCgeom_initial_coords", fNCgeom_initial_coords(11, coords));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// One run: all subsets of the scan, forward or back, as the IDL projector
+// does it per subset. Returns the seconds, and those spent in transfers.
+//
+static double fProjectRun(cl_kernel* kernels, helical_scan* scan, cl_uint* volume, cl_uint nsubsets, cl_bool back, double* transfer)
+{
+	const scanner_model*	model = scan->model;
+	cl_uint					nsub = scan->nviews / nsubsets;
+	cl_ulong				nvox = (cl_ulong) volume[0] * volume[1] * volume[2];
+	cl_ulong				nbins = (cl_ulong) model->nchannels * model->ndetplanes * nsub;
+	std::vector<float>		image(nvox, 1.0f);
+	std::vector<float>		sino(nbins, 1.0f);
+	std::vector<cl_int>		subset(nsub);
+	float					pixel = 500.0f / volume[0];
+	cl_uint					size_img[4] = {volume[0], volume[1], volume[2], 1};
+	cl_uint					size_sino[4] = {model->nchannels, model->ndetplanes, nsub, 1};
+	float					vox_size[4] = {pixel, pixel, model->row_mm, 0.0f};
+	float					img_offset[4] = {-0.5f * volume[0] * pixel, -0.5f * volume[1] * pixel,
+											 scan->center_z - 0.5f * volume[2] * model->row_mm, 1.0f};
+	float					zalign_cotg[4] = {model->anodeangle != 0.0f ? 1.0f / tanf(model->anodeangle * PROJBENCH_PI / 180) : 0.0f, 0, 0, 0};
+	cl_uint					kernel = back ? 1 : 0;
+	cl_uint					buffer;
+	double					total = 0.0;
+
+	*transfer = 0.0;
+
+	for (cl_uint ss = 0; ss < nsubsets; ss++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		for (cl_uint kk = 0; kk < nsub; kk++) subset[kk] = (cl_int) (ss + kk * nsubsets);
+
+		// image and sinogram, to the device
+		fCreateBuffer(BPTR_IMAGE, &image[0], 4 * nvox, 0);
+		fCreateBuffer(BPTR_SINO, &sino[0], 4 * nbins, 0);
+		*transfer += fSeconds(start);
+
+		// geometry of the subset
+		{
+			cl_ulong	size = 16ULL * nsub;
+			cl_int		read_only = 2;
+			cl_uint		index = BPTR_SRCLOCS0;
+			cl_bool		to_device = CL_TRUE;
+			cl_ulong	nrangles = scan->nviews;
+			cl_uint		np = model->ndetplanes;
+			cl_ulong	nsubset = nsub;
+			float		zero = 0.0f;
+			cl_ulong	zero_size = sizeof(float);
+			void*		empty[6] = {&queue, &index, &size, &read_only, &verbose, &log_file};
+			void*		srclocs[14] = {&queue, &index, NULL, &to_device, &scan->angles[0], &scan->tablepos[0],
+									   &scan->align[0], &scan->align[0], &nrangles, &np, &subset[0], &nsubset,
+									   &verbose, &log_file};
+
+			fCheck("fNCcreate_buffer_empty", fNCcreate_buffer_empty(6, empty));
+			fCheck("fNCgeom_srclocs", fNCgeom_srclocs(14, srclocs));
+			fCreateBuffer(BPTR_DETBINS0, &scan->detbins0[0], 4 * scan->detbins0.size(), 2);
+
+			index = BPTR_MC;
+			size = 64ULL * nsub;
+			void* fill[8] = {&queue, &index, &size, &read_only, &zero, &zero_size, &verbose, &log_file};
+			fCheck("fNCcreate_buffer_fill", fNCcreate_buffer_fill(8, fill));
+		}
+
+		// the ten kernel arguments
+		buffer = BPTR_IMAGE;	fSetArg(kernels, kernel, 0, &buffer, sizeof(cl_mem), CL_TRUE);
+		buffer = BPTR_SINO;		fSetArg(kernels, kernel, 1, &buffer, sizeof(cl_mem), CL_TRUE);
+		buffer = BPTR_SRCLOCS0;	fSetArg(kernels, kernel, 2, &buffer, sizeof(cl_mem), CL_TRUE);
+		buffer = BPTR_DETBINS0;	fSetArg(kernels, kernel, 3, &buffer, sizeof(cl_mem), CL_TRUE);
+		fSetArg(kernels, kernel, 4, size_img,    sizeof(size_img),    CL_FALSE);
+		fSetArg(kernels, kernel, 5, size_sino,   sizeof(size_sino),   CL_FALSE);
+		fSetArg(kernels, kernel, 6, img_offset,  sizeof(img_offset),  CL_FALSE);
+		fSetArg(kernels, kernel, 7, vox_size,    sizeof(vox_size),    CL_FALSE);
+		fSetArg(kernels, kernel, 8, zalign_cotg, sizeof(zalign_cotg), CL_FALSE);
+		buffer = BPTR_MC;		fSetArg(kernels, kernel, 9, &buffer, sizeof(cl_mem), CL_TRUE);
+
+		// launch over the sinogram bins
+		{
+			cl_bool		use_local = CL_FALSE;
+			cl_uint4	global = {{size_sino[0], size_sino[1], size_sino[2], 0}};
+			cl_uint4	local = {{0, 0, 0, 0}};
+			void*		execute[8] = {&queue, &kernels, &kernel, &use_local, &global, &local, &verbose, &log_file};
+
+			fCheck("fNCexecute_kernel", fNCexecute_kernel(8, execute));
+		}
+
+		// result back to the host
+		{
+			std::chrono::steady_clock::time_point read = std::chrono::steady_clock::now();
+			cl_uint		index = back ? BPTR_IMAGE : BPTR_SINO;
+			void*		content = back ? (void*) &image[0] : (void*) &sino[0];
+			cl_ulong	size = back ? 4 * nvox : 4 * nbins;
+			void*		args[6] = {&queue, &index, content, &size, &verbose, &log_file};
+
+			fCheck("fNCread_buffer", fNCread_buffer(6, args));
+			*transfer += fSeconds(read);
+		}
+
+		for (cl_uint bb = BPTR_IMAGE; bb <= BPTR_MC; bb++) fReleaseBuffer(bb);
+		total += fSeconds(start);
+	}
+
+	return(total);
+}
+
+static void fWriteResults(FILE* out, cl_bool json)
+{
+	if (json) fprintf(out, "[\n");
+	else fprintf(out, "model,volume,views,subsets,direction,threads,seconds,voxel_views_per_s,transfer_share,speedup\n");
+
+	for (size_t ii = 0; ii < results.size(); ii++)
+	{
+		projbench_result*	r = &results[ii];
+		double				rate = (double) r->volume[0] * r->volume[1] * r->volume[2] * r->views / r->seconds;
+		char				volume[64];
+
+		sprintf(volume, "%ux%ux%u", r->volume[0], r->volume[1], r->volume[2]);
+		if (json)
+		{
+			fprintf(out, "  {\"model\": \"%s\", \"volume\": \"%s\", \"views\": %u, \"subsets\": %u, \"direction\": \"%s\", "
+						 "\"threads\": %u, \"seconds\": %.6f, \"voxel_views_per_s\": %.4g, \"transfer_share\": %.4f, \"speedup\": %.3f}%s\n",
+					r->model.c_str(), volume, r->views, r->subsets, r->back ? "back" : "proj", r->threads, r->seconds,
+					rate, r->transfer_share, r->speedup, ii + 1 < results.size() ? "," : "");
+		}
+		else
+		{
+			fprintf(out, "%s,%s,%u,%u,%s,%u,%.6f,%.4g,%.4f,%.3f\n", r->model.c_str(), volume, r->views, r->subsets,
+					r->back ? "back" : "proj", r->threads, r->seconds, rate, r->transfer_share, r->speedup);
+		}
+	}
+
+	if (json) fprintf(out, "]\n");
+}
+
+int main(int argc, char* argv[])
+{
+	std::string						device = "auto";
+	std::string						model_name = "all";
+	std::string						kernel_file = PROJBENCH_KERNEL;
+	std::string						log_path = "opencl_projbench.log";
+	std::string						calibrate_path = "";
+	std::vector<cl_uint>			volumes;
+	std::vector<cl_uint>			views;
+	std::vector<cl_uint>			subsets;
+	std::vector<cl_uint>			threads;
+	const char*						out_path = NULL;
+	cl_bool							json = CL_FALSE;
+	cl_bool							specialize = CL_FALSE;
+	int								reps = 3;
+	FILE*							out = stdout;
+
+	for (int ii = 1; ii < argc; ii++)
+	{
+		std::string arg = argv[ii];
+		if (arg == "-json") json = CL_TRUE;
+		else if (arg == "-specialize") specialize = CL_TRUE;
+		else if (arg == "-device" && ii + 1 < argc) device = argv[++ii];
+		else if (arg == "-model" && ii + 1 < argc) model_name = argv[++ii];
+		else if (arg == "-kernel" && ii + 1 < argc) kernel_file = argv[++ii];
+		else if (arg == "-reps" && ii + 1 < argc) reps = atoi(argv[++ii]);
+		else if (arg == "-out" && ii + 1 < argc) out_path = argv[++ii];
+		else if (arg == "-calibrate" && ii + 1 < argc) calibrate_path = argv[++ii];
+		else if (arg == "-log" && ii + 1 < argc) { log_path = argv[++ii]; verbose = CL_TRUE; }
+		else if (arg == "-views" && ii + 1 < argc) views = fList(argv[++ii]);
+		else if (arg == "-subsets" && ii + 1 < argc) subsets = fList(argv[++ii]);
+		else if (arg == "-threads" && ii + 1 < argc) threads = fList(argv[++ii]);
+		else if (arg == "-volumes" && ii + 1 < argc)
+		{
+			for (char* s = strtok(argv[++ii], ","); s != NULL; s = strtok(NULL, ","))
+			{
+				cl_uint n[3] = {0, 0, 0};
+				sscanf(s, "%ux%ux%u", &n[0], &n[1], &n[2]);
+				volumes.insert(volumes.end(), n, n + 3);
+			}
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-device auto|cpu|native|<name>] [-model 16|DefinitionAS|Force|all]\n"
+							"       [-volumes NxNxNz,...] [-views n,...] [-subsets n,...] [-threads n,...]\n"
+							"       [-reps n] [-kernel file] [-calibrate file] [-specialize] [-json] [-out file] [-log file]\n", argv[0]);
+			return(1);
+		}
+	}
+	if (reps < 1) reps = 1;
+	if (volumes.empty())
+	{
+		cl_uint n[6] = {128, 128, 32, 256, 256, 64};
+		volumes.assign(n, n + 6);
+	}
+	if (subsets.empty()) subsets.push_back(1), subsets.push_back(8);
+	log_file = fString(log_path.c_str());
+
+	cl_bool force_cpu = device == "cpu" ? 1 : (device == "native" ? 2 : 0);
+	if (force_cpu != 2) threads.assign(1, 0);
+	if (threads.empty()) threads.push_back(0);
+
+	if (device != "auto" && device != "gpu" && device != "cpu" && device != "native")
+	{
+		cl_int	policy = 0;
+		cl_int	index = -1;
+		idls	name = fString(device.c_str());
+		void*	select[5] = {&policy, &name, &index, &verbose, &log_file};
+
+		fCheck("fNCselect_device", fNCselect_device(5, select));
+	}
+
+	void* create[4] = {&queue, &force_cpu, &verbose, &log_file};
+	fCheck("fNCcreate_command_queue", fNCcreate_command_queue(4, create));
+
+	// proj and back, as NIdef_projspiralct_ocl builds them
+	cl_kernel*	kernels = NULL;
+	cl_uint		n_kernels = 2;
+	idls		paths[2] = {fString(kernel_file.c_str()), fString(kernel_file.c_str())};
+	idls		names[2] = {fString("main_kernel"), fString("main_kernel")};
+	std::string	spec = specialize ? " -specialize=4:uint4:size_img,5:uint4:size_sino,7:float4:vox_size,8:float4:zalign_cotg" : "";
+	std::string	proj_options = "-D SPIRAL -D CBCT" + spec;
+	std::string	back_options = "-D SPIRAL -D CBCT -D BACK_PROJECT" + spec;
+	idls		options[2] = {fString(proj_options.c_str()), fString(back_options.c_str())};
+	void*		build[8] = {&queue, &kernels, &n_kernels, paths, names, options, &verbose, &log_file};
+
+	fCheck("fNCbuild_kernels", fNCbuild_kernels(8, build));
+
+	idls calibration = fString(calibrate_path.c_str());
+	if (calibrate_path != "")
+	{
+		FILE* existing = fopen(calibrate_path.c_str(), "r");
+		void* load[3] = {&calibration, &verbose, &log_file};
+
+		if (existing != NULL)
+		{
+			fclose(existing);
+			fCheck("fNCplan_load", fNCplan_load(3, load));
+		}
+	}
+
+	for (size_t mm = 0; mm < sizeof(models) / sizeof(models[0]); mm++)
+	{
+		if (model_name != "all" && model_name != models[mm].name) continue;
+
+		std::vector<cl_uint> model_views = views;
+		if (model_views.empty()) model_views.assign(1, models[mm].views_per_rotation);
+
+		for (size_t vv = 0; vv < model_views.size(); vv++)
+		{
+			helical_scan scan;
+			fHelicalScan(&models[mm], model_views[vv], &scan);
+
+			for (size_t ii = 0; ii + 2 < volumes.size(); ii += 3)
+			{
+				for (size_t ss = 0; ss < subsets.size(); ss++)
+				{
+					if (subsets[ss] < 1 || subsets[ss] > model_views[vv]) continue;
+
+					for (cl_bool back = CL_FALSE; back <= CL_TRUE; back++)
+					{
+						double first = 0.0;
+
+						for (size_t tt = 0; tt < threads.size(); tt++)
+						{
+							projbench_result	result;
+							std::vector<double>	times;
+							std::vector<double>	shares;
+
+							if (force_cpu == 2)
+							{
+								void* args[3] = {&threads[tt], &verbose, &log_file};
+								fNCnative_threads(3, args);
+							}
+
+							for (int rr = 0; rr < reps; rr++)
+							{
+								double transfer;
+								double seconds = fProjectRun(kernels, &scan, &volumes[ii], subsets[ss], back, &transfer);
+								times.push_back(seconds);
+								shares.push_back(transfer / seconds);
+
+								if (calibrate_path != "" && seconds > transfer)
+								{
+									// per launch: image and sinogram up, the result down
+									cl_uint		nsub = model_views[vv] / subsets[ss];
+									cl_ulong	dims[6] = {volumes[ii], volumes[ii + 1], volumes[ii + 2], models[mm].nchannels, models[mm].ndetplanes, nsub};
+									cl_ulong	nvox = dims[0] * dims[1] * dims[2];
+									cl_ulong	nbins = dims[3] * dims[4] * dims[5];
+									cl_ulong	bytes = 4 * (nvox + nbins + (back ? nvox : nbins));
+									double		launch = (seconds - transfer) / subsets[ss];
+									double		launch_transfer = transfer / subsets[ss];
+									void*		sample[8] = {&queue, &back, dims, &launch, &bytes, &launch_transfer, &verbose, &log_file};
+
+									fCheck("fNCplan_sample", fNCplan_sample(8, sample));
+								}
+							}
+							std::sort(times.begin(), times.end());
+							std::sort(shares.begin(), shares.end());
+
+							result.model			= models[mm].name;
+							result.volume[0]		= volumes[ii];
+							result.volume[1]		= volumes[ii + 1];
+							result.volume[2]		= volumes[ii + 2];
+							result.views			= model_views[vv] / subsets[ss] * subsets[ss];
+							result.subsets			= subsets[ss];
+							result.back				= back;
+							result.threads			= threads[tt];
+							result.seconds			= times[times.size() / 2];
+							result.transfer_share	= shares[shares.size() / 2];
+							if (tt == 0) first = result.seconds;
+							result.speedup			= first / result.seconds;
+							results.push_back(result);
+
+							fprintf(stderr, "%s %ux%ux%u, %u views, %u subsets, %s, %u threads: %.3f s\n", result.model.c_str(),
+									result.volume[0], result.volume[1], result.volume[2], result.views, result.subsets,
+									back ? "back" : "proj", result.threads, result.seconds);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void* release_kernels[4] = {&kernels, &n_kernels, &verbose, &log_file};
+	void* release_queue[3] = {&queue, &verbose, &log_file};
+	fNCrelease_kernels(4, release_kernels);
+
+	if (calibrate_path != "")
+	{
+		void* save[3] = {&calibration, &verbose, &log_file};
+		fCheck("fNCplan_save", fNCplan_save(3, save));
+	}
+	fNCrelease_command_queue(3, release_queue);
+
+	if (out_path != NULL)
+	{
+		out = fopen(out_path, "w");
+		if (out == NULL)
+		{
+			fprintf(stderr, "Cannot write %s\n", out_path);
+			return(1);
+		}
+	}
+	fWriteResults(out, json);
+	if (out != stdout) fclose(out);
+
+	return(0);
+}
@@ -0,0 +1,298 @@
+// NCopencl_pyramid.cpp : Device-side 3-D down- and upsampling of volumes and
+// sinograms, used to move between the levels of a multiresolution
+// (coarse-to-fine) reconstruction without going through the host.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <map>
+
+///////////////////////////////////////////////////////////////////////////////
+// Kernel source. Arrays use the IDL layout, x running fastest. Both grids are
+// cell centered and cover the same extent, so a factor of 2 maps voxels
+// (2i, 2i+1) onto voxel i of the coarse grid.
+//
+static const char* pyramid_source =
+"__kernel void resample_down(__global const float* src, __global float* dst,    \n"
+"                            uint4 size_src, uint4 factor, int average)         \n"
+"{                                                                               \n"
+"	// Box filter over factor.x * factor.y * factor.z source voxels; the sum for \n"
+"	// sinograms (as det_rebin), the mean for volumes.                           \n"
+"	uint nx = size_src.x / factor.x;                                             \n"
+"	uint ny = size_src.y / factor.y;                                             \n"
+"	uint nz = size_src.z / factor.z;                                             \n"
+"	uint x  = get_global_id(0);                                                  \n"
+"	uint y  = get_global_id(1);                                                  \n"
+"	uint z  = get_global_id(2);                                                  \n"
+"	if (x >= nx || y >= ny || z >= nz) return;                                   \n"
+"	float sum = 0.0f;                                                            \n"
+"	for (uint k = 0; k < factor.z; k++)                                          \n"
+"	for (uint j = 0; j < factor.y; j++)                                          \n"
+"	{                                                                            \n"
+"		size_t row = (size_t) size_src.x * (y * factor.y + j + (size_t) size_src.y * (z * factor.z + k));\n"
+"		for (uint i = 0; i < factor.x; i++)                                      \n"
+"			sum += src[row + x * factor.x + i];                                  \n"
+"	}                                                                            \n"
+"	if (average) sum /= (float) (factor.x * factor.y * factor.z);                \n"
+"	dst[x + (size_t) nx * (y + (size_t) ny * z)] = sum;                          \n"
+"}                                                                               \n"
+"                                                                                \n"
+"__kernel void resample_up(__global const float* src, __global float* dst,      \n"
+"                          uint4 size_src, uint4 size_dst, float scale)          \n"
+"{                                                                               \n"
+"	// Trilinear interpolation onto the finer grid, edges clamped.               \n"
+"	uint x = get_global_id(0);                                                   \n"
+"	uint y = get_global_id(1);                                                   \n"
+"	uint z = get_global_id(2);                                                   \n"
+"	if (x >= size_dst.x || y >= size_dst.y || z >= size_dst.z) return;          \n"
+"	float3 ratio = convert_float3(size_src.xyz) / convert_float3(size_dst.xyz);  \n"
+"	float3 p  = ((float3) (x, y, z) + 0.5f) * ratio - 0.5f;                      \n"
+"	p = clamp(p, (float3) (0.0f), convert_float3(size_src.xyz) - 1.0f);          \n"
+"	int3   i0 = convert_int3(floor(p));                                          \n"
+"	int3   i1 = min(i0 + 1, convert_int3(size_src.xyz) - 1);                     \n"
+"	float3 w  = p - convert_float3(i0);                                          \n"
+"	size_t r00 = (size_t) size_src.x * (i0.y + (size_t) size_src.y * i0.z);      \n"
+"	size_t r10 = (size_t) size_src.x * (i1.y + (size_t) size_src.y * i0.z);      \n"
+"	size_t r01 = (size_t) size_src.x * (i0.y + (size_t) size_src.y * i1.z);      \n"
+"	size_t r11 = (size_t) size_src.x * (i1.y + (size_t) size_src.y * i1.z);      \n"
+"	float a = mix(src[r00 + i0.x], src[r00 + i1.x], w.x);                        \n"
+"	float b = mix(src[r10 + i0.x], src[r10 + i1.x], w.x);                        \n"
+"	float c = mix(src[r01 + i0.x], src[r01 + i1.x], w.x);                        \n"
+"	float d = mix(src[r11 + i0.x], src[r11 + i1.x], w.x);                        \n"
+"	dst[x + (size_t) size_dst.x * (y + (size_t) size_dst.y * z)] =               \n"
+"		scale * mix(mix(a, b, w.y), mix(c, d, w.y), w.z);                        \n"
+"}                                                                               \n";
+
+#define PYRAMID_DOWN    0
+#define PYRAMID_UP      1
+#define PYRAMID_KERNELS 2
+
+static const char* pyramid_kernel_names[PYRAMID_KERNELS] = {"resample_down", "resample_up"};
+
+typedef struct {
+	cl_program	program;
+	cl_kernel	kernels[PYRAMID_KERNELS];
+} pyramid_set;
+
+// Program is built once per context and shared by all levels.
+static std::map<cl_context, pyramid_set>	pyramid_sets;
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the resampling kernels for the context of the command queue, once
+// per context.
+//
+static int fPyramidProgram(cl_command_queue* commands, pyramid_set** set, cl_bool verbose, char* log_file)
+{
+	cl_int			error;
+	cl_context		context;
+	pyramid_set		entry;
+	FILE*			pfile = NULL;
+
+	if (fNativeQueue(commands))
+	{
+		return(fNativeUnsupported("Resampling kernels", verbose, log_file));
+	}
+
+	error = clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to retreive context! %d \n", error);
+			fclose(pfile);
+		}
+		return(-3);
+	}
+
+	std::map<cl_context, pyramid_set>::iterator it = pyramid_sets.find(context);
+	if (it != pyramid_sets.end())
+	{
+		*set = &it->second;
+		return(0);
+	}
+
+	error = fBuildLibraryProgram(commands, context, pyramid_source, "resampling", pyramid_kernel_names, PYRAMID_KERNELS, &entry.program, entry.kernels, verbose, log_file);
+	if (error < 0) return(error);
+
+	*set = &(pyramid_sets[context] = entry);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Resampling kernels built.\n");
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+static int fPyramidLaunch(cl_command_queue* commands, cl_kernel kernel, size_t* global, cl_bool verbose, char* log_file)
+{
+	cl_int	error;
+	FILE*	pfile = NULL;
+
+	error = clEnqueueNDRangeKernel(*commands, kernel, 3, NULL, global, NULL, 0, NULL, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to execute resampling kernel! %d \n", error);
+			fprintf(pfile, "Info: Global size: %u, %u, %u.\n", (cl_uint) global[0], (cl_uint) global[1], (cl_uint) global[2]);
+			fclose(pfile);
+		}
+		return(-11);
+	}
+
+	clFlush(*commands);
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Downsample by integer factors per axis. average = 0 sums the source voxels
+// (sinograms), average = 1 takes their mean (volumes). The destination has
+// size_src / factor voxels; incomplete groups at the end are dropped.
+//
+int fResampleDown(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_uint4 size_src, cl_uint4 factor, cl_bool average, cl_bool verbose, char* log_file)
+{
+	int			result;
+	cl_int		error = CL_SUCCESS;
+	cl_int		flag  = average ? 1 : 0;
+	size_t		global[3];
+	cl_kernel	kernel;
+	pyramid_set*	set;
+
+	if (fClientActive())
+	{
+		return(fClientLibrary(SERVER_RESAMPLE_DOWN, commands, src_ptr, dst_ptr, NULL, average ? SERVER_FLAG_OPTION : 0, size_src, factor, 0.0f, verbose, log_file));
+	}
+
+	if (factor.s[0] == 0 || factor.s[1] == 0 || factor.s[2] == 0)
+	{
+		return(-1);
+	}
+
+	result = fPyramidProgram(commands, &set, verbose, log_file);
+	if (result != 0) return(result);
+
+	kernel = set->kernels[PYRAMID_DOWN];
+	error |= clSetKernelArg(kernel, 0, sizeof(cl_mem),   src_ptr);
+	error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),   dst_ptr);
+	error |= clSetKernelArg(kernel, 2, sizeof(cl_uint4), &size_src);
+	error |= clSetKernelArg(kernel, 3, sizeof(cl_uint4), &factor);
+	error |= clSetKernelArg(kernel, 4, sizeof(cl_int),   &flag);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			FILE* pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to set downsampling arguments! %d.\n", error);
+			fclose(pfile);
+		}
+		return(-12);
+	}
+
+	global[0] = size_src.s[0] / factor.s[0];
+	global[1] = size_src.s[1] / factor.s[1];
+	global[2] = size_src.s[2] / factor.s[2];
+
+	return(fPyramidLaunch(commands, kernel, global, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Upsample onto the grid size_dst by trilinear interpolation, multiplying
+// by scale (e.g. 1/factor to keep sinogram sums when refining det_rebin).
+//
+int fResampleUp(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_uint4 size_src, cl_uint4 size_dst, cl_float scale, cl_bool verbose, char* log_file)
+{
+	int			result;
+	cl_int		error = CL_SUCCESS;
+	size_t		global[3];
+	cl_kernel	kernel;
+	pyramid_set*	set;
+
+	if (fClientActive())
+	{
+		return(fClientLibrary(SERVER_RESAMPLE_UP, commands, src_ptr, dst_ptr, NULL, 0, size_src, size_dst, scale, verbose, log_file));
+	}
+
+	result = fPyramidProgram(commands, &set, verbose, log_file);
+	if (result != 0) return(result);
+
+	kernel = set->kernels[PYRAMID_UP];
+	error |= clSetKernelArg(kernel, 0, sizeof(cl_mem),   src_ptr);
+	error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),   dst_ptr);
+	error |= clSetKernelArg(kernel, 2, sizeof(cl_uint4), &size_src);
+	error |= clSetKernelArg(kernel, 3, sizeof(cl_uint4), &size_dst);
+	error |= clSetKernelArg(kernel, 4, sizeof(cl_float), &scale);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			FILE* pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to set upsampling arguments! %d.\n", error);
+			fclose(pfile);
+		}
+		return(-12);
+	}
+
+	global[0] = size_dst.s[0];
+	global[1] = size_dst.s[1];
+	global[2] = size_dst.s[2];
+
+	return(fPyramidLaunch(commands, kernel, global, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Release the resampling kernels and program of the context of the queue;
+// other contexts keep theirs.
+//
+int fReleasePyramidKernels(cl_command_queue* commands, cl_bool verbose, char* log_file)
+{
+	cl_context	context;
+	FILE*		pfile = NULL;
+
+	if (fClientActive() || fNativeQueue(commands))
+	{
+		return(0);
+	}
+
+	if (clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL) != CL_SUCCESS)
+	{
+		return(0);
+	}
+
+	std::map<cl_context, pyramid_set>::iterator it = pyramid_sets.find(context);
+	if (it == pyramid_sets.end())
+	{
+		return(0);
+	}
+
+	for (int ii = 0; ii < PYRAMID_KERNELS; ii++)
+	{
+		if (it->second.kernels[ii] != NULL)
+		{
+			clReleaseKernel(it->second.kernels[ii]);
+		}
+	}
+
+	clReleaseProgram(it->second.program);
+	pyramid_sets.erase(it);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Resampling kernels released.\n");
+		fclose(pfile);
+	}
+
+	return(0);
+}
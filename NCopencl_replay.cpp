@@ -0,0 +1,90 @@
+// NCopencl_replay.cpp : Replays a trace of fNCcapture_start on any device and
+// compares the timings with the recorded ones (see NCopencl_capture.cpp).
+//
+//   opencl_replay <trace> [-device recorded|auto|cpu|native|<name>]
+//                 [-kernels dir] [-json] [-out file] [-log file]
+//
+// -kernels takes the kernel files from dir (by file name) instead of the
+// sources in the trace, to time kernel changes on the recorded calls.
+//
+
+
+#include "NCopencl.h"
+
+#include <string>
+
+static idls fString(const char* s)
+{
+	idls	str;
+
+	str.slen	= (short) strlen(s);
+	str.stype	= 0;
+	str.s		= (char*) s;
+	return(str);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string	device = "recorded";
+	std::string	kernel_dir = "";
+	std::string	out_path = "";
+	std::string	log_path = "";
+	cl_bool		json = CL_FALSE;
+	cl_bool		verbose = CL_FALSE;
+	cl_int		force_cpu;
+
+	if (argc < 2 || argv[1][0] == '-')
+	{
+		fprintf(stderr, "Usage: %s <trace> [-device recorded|auto|cpu|native|<name>] [-kernels dir] [-json] [-out file] [-log file]\n", argv[0]);
+		return(1);
+	}
+
+	for (int ii = 2; ii < argc; ii++)
+	{
+		std::string arg = argv[ii];
+		if (arg == "-json") json = CL_TRUE;
+		else if (arg == "-device" && ii + 1 < argc) device = argv[++ii];
+		else if (arg == "-kernels" && ii + 1 < argc) kernel_dir = argv[++ii];
+		else if (arg == "-out" && ii + 1 < argc) out_path = argv[++ii];
+		else if (arg == "-log" && ii + 1 < argc) { log_path = argv[++ii]; verbose = CL_TRUE; }
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", argv[ii]);
+			return(1);
+		}
+	}
+
+	idls trace = fString(argv[1]);
+	idls kernels = fString(kernel_dir.c_str());
+	idls out = fString(out_path.c_str());
+	idls log_file = fString(log_path.c_str());
+
+	if (device == "recorded") force_cpu = -1;
+	else if (device == "cpu") force_cpu = 1;
+	else if (device == "native") force_cpu = 2;
+	else force_cpu = 0;
+
+	if (device != "recorded" && device != "auto" && device != "cpu" && device != "native")
+	{
+		cl_int	policy = 0;
+		cl_int	index = -1;
+		idls	name = fString(device.c_str());
+		void*	select[5] = {&policy, &name, &index, &verbose, &log_file};
+
+		if (fNCselect_device(5, select) < 0)
+		{
+			fprintf(stderr, "No device %s\n", device.c_str());
+			return(1);
+		}
+	}
+
+	void* args[7] = {&trace, &force_cpu, &kernels, &out, &json, &verbose, &log_file};
+	int result = fNCreplay(7, args);
+	if (result < 0)
+	{
+		fprintf(stderr, "Replay of %s failed: %d\n", argv[1], result);
+		return(1);
+	}
+
+	return(0);
+}
@@ -0,0 +1,541 @@
+// NCopencl_residency.cpp : Device memory residency of the buffers[] slots.
+// Every buffer created in a slot is accounted against its device: the budget
+// (CL_DEVICE_GLOBAL_MEM_SIZE unless set with fResidencyBudget), the current
+// and the high-water usage. A single buffer larger than
+// CL_DEVICE_MAX_MEM_ALLOC_SIZE is refused before the runtime is asked.
+//
+// An allocation that does not fit the budget first moves the least recently
+// used buffers of the device to host memory; the slot is empty meanwhile.
+// When an entry point uses the slot again (fResident), or a kernel it was set
+// as argument of is launched (fResidencyLaunch), the buffer is created again
+// and its contents written back, and the kernel argument set again; the
+// arguments of a tiled launch stay on the device until it is waited for
+// (fResidencyLaunchDone). Slots used by sub-buffers, warp states and the
+// system matrix cache, and buffers using host memory, are pinned: they never
+// move.
+//
+// Native and server queues are not accounted (host memory, or the server's).
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <map>
+#include <mutex>
+
+#define MAX_RESIDENCY_DEVICES 16
+
+extern cl_mem	buffers[MAX_BUFFERS];
+
+typedef struct {
+	cl_device_id	device_id;
+	cl_ulong		global_mem_size;
+	cl_ulong		max_alloc_size;
+	cl_ulong		used;
+	cl_ulong		high_water;
+	cl_ulong		on_host;
+	cl_ulong		evictions;
+	cl_ulong		restores;
+} residency_device;
+
+typedef struct {
+	cl_bool				active;
+	cl_command_queue	queue;			// retained while the entry is active
+	cl_context			context;
+	cl_uint				device;
+	cl_ulong			size;
+	cl_mem_flags		flags;
+	cl_ulong			last_use;
+	cl_uint				generation;
+	cl_bool				pinned;
+	cl_bool				launch;			// argument of the launch being prepared
+	cl_uint				held;			// argument of tiled launches still running
+	void*				host;			// contents while evicted, else NULL
+} residency_entry;
+
+typedef struct {
+	cl_uint		index;
+	cl_uint		generation;
+	cl_mem		mem;
+} residency_binding;
+
+static std::recursive_mutex									residency_lock;
+static residency_device										devices[MAX_RESIDENCY_DEVICES];
+static cl_uint												devices_nn = 0;
+static cl_ulong												residency_budget = 0;	// 0: global memory of the device
+static residency_entry										entries[MAX_BUFFERS];
+static cl_ulong												use_clock = 0;
+static std::map<cl_kernel, std::map<cl_uint, residency_binding> >	bindings;
+
+static cl_ulong fBudget(residency_device* device)
+{
+	return(residency_budget > 0 ? residency_budget : device->global_mem_size);
+}
+
+// Accounting record of the queue's device, added on first use.
+static int fResidencyDevice(cl_command_queue queue, cl_uint* index)
+{
+	cl_device_id	device_id;
+
+	if (clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device_id, NULL) != CL_SUCCESS) return(-3);
+
+	for (cl_uint ii = 0; ii < devices_nn; ii++)
+	{
+		if (devices[ii].device_id == device_id)
+		{
+			*index = ii;
+			return(0);
+		}
+	}
+	if (devices_nn == MAX_RESIDENCY_DEVICES) return(-3);
+
+	residency_device* device = &devices[devices_nn];
+	memset(device, 0, sizeof(residency_device));
+	device->device_id = device_id;
+	clGetDeviceInfo(device_id, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &device->global_mem_size, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &device->max_alloc_size, NULL);
+
+	*index = devices_nn++;
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Move the buffer of a slot to host memory.
+//
+static int fEvict(cl_uint index, cl_bool verbose, char* log_file)
+{
+	residency_entry*	entry = &entries[index];
+	residency_device*	device = &devices[entry->device];
+	cl_int				error;
+	FILE*				pfile = NULL;
+
+	entry->host = malloc((size_t) entry->size);
+	if (entry->host == NULL) return(-2);
+
+	error = clEnqueueReadBuffer(entry->queue, buffers[index], CL_TRUE, 0, (size_t) entry->size, entry->host, 0, NULL, NULL);
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to move buffer %u to host memory! %d \n", index, error);
+			fclose(pfile);
+		}
+		free(entry->host);
+		entry->host = NULL;
+		entry->pinned = CL_TRUE;	// cannot be read back: leave it
+		return(-2);
+	}
+
+	clReleaseMemObject(buffers[index]);
+	buffers[index] = NULL;
+
+	device->used -= entry->size;
+	device->on_host += entry->size;
+	device->evictions++;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Buffer %u (%llu bytes) moved to host memory, %llu of %llu bytes in use.\n", index,
+				(unsigned long long) entry->size, (unsigned long long) device->used, (unsigned long long) fBudget(device));
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+// Evict least recently used buffers of the device until size more bytes fit
+// the budget (or, with force, until size bytes were freed). Returns the
+// bytes freed.
+static cl_ulong fEvictFor(cl_uint device_index, cl_ulong size, cl_bool force, cl_bool verbose, char* log_file)
+{
+	residency_device*	device = &devices[device_index];
+	cl_ulong			freed = 0;
+
+	while (force ? freed < size : device->used + size > fBudget(device))
+	{
+		int victim = -1;
+
+		for (cl_uint ii = 0; ii < MAX_BUFFERS; ii++)
+		{
+			residency_entry* entry = &entries[ii];
+
+			if (!entry->active || entry->host != NULL || entry->pinned || entry->launch || entry->held > 0 || entry->device != device_index) continue;
+			if (victim < 0 || entry->last_use < entries[victim].last_use) victim = (int) ii;
+		}
+		if (victim < 0 || fEvict((cl_uint) victim, verbose, log_file) < 0) break;
+		freed += entries[victim].size;
+	}
+
+	return(freed);
+}
+
+static int fReserve(cl_command_queue queue, cl_ulong size, cl_uint* device_index, cl_bool verbose, char* log_file)
+{
+	residency_device*	device;
+	FILE*				pfile = NULL;
+
+	if (fResidencyDevice(queue, device_index) < 0) return(0);
+	device = &devices[*device_index];
+
+	if (device->max_alloc_size > 0 && size > device->max_alloc_size)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Buffer of %llu bytes exceeds the device's largest allocation of %llu bytes.\n",
+					(unsigned long long) size, (unsigned long long) device->max_alloc_size);
+			fclose(pfile);
+		}
+		return(-5);
+	}
+
+	// Over budget with nothing left to move: try anyway, the runtime decides
+	fEvictFor(*device_index, size, CL_FALSE, verbose, log_file);
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Make room for a new buffer of size bytes on the queue's device.
+//
+int fResidencyReserve(cl_command_queue* commands, cl_ulong size, cl_bool verbose, char* log_file)
+{
+	std::lock_guard<std::recursive_mutex>	lock(residency_lock);
+	cl_uint									device_index;
+
+	if (fClientActive() || fNativeQueue(commands)) return(0);
+	return(fReserve(*commands, size, &device_index, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The runtime failed an allocation of size bytes that the budget allowed:
+// move that much to the host. Returns the bytes freed.
+//
+cl_ulong fResidencyEvict(cl_command_queue* commands, cl_ulong size, cl_bool verbose, char* log_file)
+{
+	std::lock_guard<std::recursive_mutex>	lock(residency_lock);
+	cl_uint									device_index;
+
+	if (fClientActive() || fNativeQueue(commands)) return(0);
+	if (fResidencyDevice(*commands, &device_index) < 0) return(0);
+	return(fEvictFor(device_index, size, CL_TRUE, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Account a buffer just created in slot (other memory objects are ignored).
+//
+void fResidencyAdd(cl_mem* slot, cl_command_queue* commands, cl_ulong size)
+{
+	std::lock_guard<std::recursive_mutex>	lock(residency_lock);
+	cl_uint									index = (cl_uint) (slot - buffers);
+	cl_uint									device_index;
+	residency_entry*						entry;
+
+	if (slot < buffers || slot >= buffers + MAX_BUFFERS) return;
+	if (fClientActive() || fNativeQueue(commands)) return;
+	if (fResidencyDevice(*commands, &device_index) < 0) return;
+
+	entry = &entries[index];
+	if (entry->active)
+	{
+		// recreated without a release: the old buffer is not ours any more
+		if (entry->host != NULL) devices[entry->device].on_host -= entry->size;
+		else devices[entry->device].used -= entry->size;
+		free(entry->host);
+		clReleaseCommandQueue(entry->queue);
+	}
+
+	// Evicting and restoring go through this queue, so keep it alive.
+	clRetainCommandQueue(*commands);
+
+	entry->active		= CL_TRUE;
+	entry->queue		= *commands;
+	entry->device		= device_index;
+	entry->size			= size;
+	entry->flags		= 0;
+	entry->last_use		= ++use_clock;
+	entry->generation++;
+	entry->pinned		= CL_FALSE;
+	entry->launch		= CL_FALSE;
+	entry->held			= 0;
+	entry->host			= NULL;
+
+	clGetMemObjectInfo(*slot, CL_MEM_FLAGS, sizeof(cl_mem_flags), &entry->flags, NULL);
+	clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &entry->context, NULL);
+	if (entry->flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR)) entry->pinned = CL_TRUE;
+
+	residency_device* device = &devices[device_index];
+	device->used += size;
+	if (device->used > device->high_water) device->high_water = device->used;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Forget the buffer of a slot that is being released. Returns CL_TRUE when it
+// was in host memory: then there is nothing left to release on the device.
+//
+cl_bool fResidencyRelease(cl_mem* slot)
+{
+	std::lock_guard<std::recursive_mutex>	lock(residency_lock);
+	residency_entry*						entry;
+	cl_bool									evicted;
+
+	if (slot < buffers || slot >= buffers + MAX_BUFFERS || !entries[slot - buffers].active) return(CL_FALSE);
+	entry = &entries[slot - buffers];
+
+	evicted = entry->host != NULL;
+	if (evicted) devices[entry->device].on_host -= entry->size;
+	else devices[entry->device].used -= entry->size;
+
+	free(entry->host);
+	entry->host		= NULL;
+	entry->active	= CL_FALSE;
+	if (evicted) *slot = NULL;
+
+	clReleaseCommandQueue(entry->queue);
+	entry->queue	= NULL;
+
+	return(evicted);
+}
+
+// Bring an evicted buffer back to its device.
+static int fRestore(cl_uint index, cl_bool verbose, char* log_file)
+{
+	residency_entry*	entry = &entries[index];
+	cl_uint				device_index;
+	cl_mem_flags		flags = entry->flags & (CL_MEM_READ_WRITE | CL_MEM_WRITE_ONLY | CL_MEM_READ_ONLY);
+	cl_mem				mem;
+	cl_int				error;
+	FILE*				pfile = NULL;
+
+	entry->launch = CL_TRUE;
+	fReserve(entry->queue, entry->size, &device_index, verbose, log_file);
+
+	mem = clCreateBuffer(entry->context, flags, (size_t) entry->size, NULL, &error);
+	if (error == CL_MEM_OBJECT_ALLOCATION_FAILURE || error == CL_OUT_OF_RESOURCES)
+	{
+		if (fEvictFor(entry->device, entry->size, CL_TRUE, verbose, log_file) > 0)
+		{
+			mem = clCreateBuffer(entry->context, flags, (size_t) entry->size, NULL, &error);
+		}
+	}
+	if (error == CL_SUCCESS)
+	{
+		error = clEnqueueWriteBuffer(entry->queue, mem, CL_TRUE, 0, (size_t) entry->size, entry->host, 0, NULL, NULL);
+		if (error != CL_SUCCESS) clReleaseMemObject(mem);
+	}
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to bring buffer %u (%llu bytes) back to the device! %d \n", index,
+					(unsigned long long) entry->size, error);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+
+	free(entry->host);
+	entry->host		= NULL;
+	buffers[index]	= mem;
+
+	residency_device* device = &devices[entry->device];
+	device->used += entry->size;
+	device->on_host -= entry->size;
+	device->restores++;
+	if (device->used > device->high_water) device->high_water = device->used;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Buffer %u (%llu bytes) back on the device, %llu of %llu bytes in use.\n", index,
+				(unsigned long long) entry->size, (unsigned long long) device->used, (unsigned long long) fBudget(device));
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The slot of buffer index, its buffer on the device (brought back if it was
+// moved to the host) and marked as just used. pin keeps it there for good.
+// NULL when the buffer could not be brought back; it then stays on the host.
+//
+cl_mem* fResident(cl_uint index, cl_bool pin, cl_bool verbose, char* log_file)
+{
+	std::lock_guard<std::recursive_mutex>	lock(residency_lock);
+	residency_entry*						entry;
+
+	if (index >= MAX_BUFFERS || !entries[index].active) return(&buffers[index]);
+	entry = &entries[index];
+
+	if (entry->host != NULL)
+	{
+		int result = fRestore(index, verbose, log_file);
+		entry->launch = CL_FALSE;
+		if (result < 0) return(NULL);
+	}
+	entry->last_use = ++use_clock;
+	if (pin) entry->pinned = CL_TRUE;
+
+	return(&buffers[index]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Kernel arguments: the buffers a kernel was given, to bring them back (and
+// set them again) before it runs.
+//
+void fResidencyBindArg(cl_kernel kernel, cl_uint arg_index, cl_uint index)
+{
+	std::lock_guard<std::recursive_mutex>	lock(residency_lock);
+	residency_binding						binding;
+
+	if (index >= MAX_BUFFERS || !entries[index].active)
+	{
+		// data or a buffer that is not tracked: nothing to bring back
+		if (bindings.count(kernel)) bindings[kernel].erase(arg_index);
+		return;
+	}
+
+	binding.index		= index;
+	binding.generation	= entries[index].generation;
+	binding.mem			= buffers[index];
+	bindings[kernel][arg_index] = binding;
+}
+
+void fResidencyForgetKernel(cl_kernel kernel)
+{
+	std::lock_guard<std::recursive_mutex>	lock(residency_lock);
+
+	bindings.erase(kernel);
+}
+
+int fResidencyLaunch(cl_kernel kernel, cl_ulong* held, cl_bool verbose, char* log_file)
+{
+	std::lock_guard<std::recursive_mutex>	lock(residency_lock);
+	int										result = 0;
+
+	if (held != NULL) *held = 0;
+	if (bindings.empty() || bindings.find(kernel) == bindings.end()) return(0);
+
+	std::map<cl_uint, residency_binding>&	args = bindings[kernel];
+	std::map<cl_uint, residency_binding>::iterator it;
+
+	// The arguments stay put while the others are brought back
+	for (it = args.begin(); it != args.end(); ++it)
+	{
+		residency_entry* entry = &entries[it->second.index];
+		if (entry->active && entry->generation == it->second.generation) entry->launch = CL_TRUE;
+	}
+
+	for (it = args.begin(); it != args.end() && result == 0; ++it)
+	{
+		residency_binding*	binding = &it->second;
+		residency_entry*	entry = &entries[binding->index];
+
+		// released or recreated since: the argument is the caller's business
+		if (!entry->active || entry->generation != binding->generation) continue;
+
+		if (entry->host != NULL) result = fRestore(binding->index, verbose, log_file);
+		entry->last_use = ++use_clock;
+
+		if (result == 0 && buffers[binding->index] != binding->mem)
+		{
+			binding->mem = buffers[binding->index];
+			result = fSetKernelArg(kernel, it->first, sizeof(cl_mem), &buffers[binding->index], verbose, log_file);
+		}
+	}
+
+	// A launch that returns before the kernel has run keeps its arguments
+	// (one bit per slot in held) until fResidencyLaunchDone
+	if (held != NULL && result == 0)
+	{
+		for (it = args.begin(); it != args.end(); ++it)
+		{
+			residency_entry* entry = &entries[it->second.index];
+			if (!entry->active || entry->generation != it->second.generation) continue;
+
+			entry->held++;
+			*held |= 1ULL << it->second.index;
+		}
+	}
+
+	for (cl_uint ii = 0; ii < MAX_BUFFERS; ii++)
+	{
+		entries[ii].launch = CL_FALSE;
+	}
+
+	return(result);
+}
+
+void fResidencyLaunchDone(cl_ulong held)
+{
+	std::lock_guard<std::recursive_mutex>	lock(residency_lock);
+
+	for (cl_uint ii = 0; ii < MAX_BUFFERS; ii++)
+	{
+		if ((held & (1ULL << ii)) && entries[ii].held > 0) entries[ii].held--;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Budget of every device, in bytes; 0 is the device's global memory. Buffers
+// over a lower budget move to the host on the next allocation.
+//
+int fResidencyBudget(cl_ulong budget, cl_bool verbose, char* log_file)
+{
+	std::lock_guard<std::recursive_mutex>	lock(residency_lock);
+	FILE*									pfile = NULL;
+
+	residency_budget = budget;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Device memory budget %llu bytes%s.\n", (unsigned long long) budget,
+				budget == 0 ? " (global memory of the device)" : "");
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Usage of the queue's device: status[0..7] = bytes in use, high-water mark,
+// budget, global memory, largest allocation, bytes moved to the host now,
+// evictions, restores.
+//
+int fResidencyStatus(cl_command_queue* commands, cl_ulong* status, cl_bool verbose, char* log_file)
+{
+	std::lock_guard<std::recursive_mutex>	lock(residency_lock);
+	cl_uint									device_index;
+	residency_device*						device;
+	FILE*									pfile = NULL;
+
+	memset(status, 0, 8 * sizeof(cl_ulong));
+	if (fClientActive() || fNativeQueue(commands)) return(0);
+	if (fResidencyDevice(*commands, &device_index) < 0) return(-3);
+
+	device = &devices[device_index];
+	status[0] = device->used;
+	status[1] = device->high_water;
+	status[2] = fBudget(device);
+	status[3] = device->global_mem_size;
+	status[4] = device->max_alloc_size;
+	status[5] = device->on_host;
+	status[6] = device->evictions;
+	status[7] = device->restores;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Device memory: %llu bytes in use (high-water %llu) of %llu, %llu on the host, %llu evictions, %llu restores.\n",
+				(unsigned long long) status[0], (unsigned long long) status[1], (unsigned long long) status[2],
+				(unsigned long long) status[5], (unsigned long long) status[6], (unsigned long long) status[7]);
+		fclose(pfile);
+	}
+
+	return(0);
+}
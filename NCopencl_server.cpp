@@ -0,0 +1,1361 @@
+// NCopencl_server.cpp : Projection server. One long-lived process (fServerRun,
+// or the opencl_server executable) owns the OpenCL contexts, the compiled
+// kernels and the resident buffers, and IDL sessions talk to it over a Unix
+// domain socket. After fClientConnect the bridge calls of a session are sent
+// to the server instead of going to OpenCL: requests are small fixed headers
+// on the socket, bulk data (buffer contents, kernel sources and arguments)
+// goes through a shared memory segment that the client passes to the server.
+//
+// The server creates one context per force_cpu value, on first use, and every
+// session queue shares it. Kernels are built once per (file, function,
+// compile options) and shared too; a session's kernel arguments are kept by
+// the server and set again right before each of its launches. Requests of
+// all sessions are served one at a time in arrival order, so sessions take
+// turns on the device instead of fighting over it.
+//
+// Forwarded: command queues, kernels, buffer creation / transfers / release,
+// the sinogram preprocessing and the pyramid resampling. Images, rectangular
+// transfers, sub-buffers, warp states and the cached system matrix (state of
+// the server process shared by all sessions) are not.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#ifndef WIN32
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#define SERVER_VERSION		1
+#define SERVER_ARG_SIZE		64
+#define SERVER_MIN_SHM		(1 << 20)
+#define SERVER_MASTERS		3
+
+// Requests, besides the forwarded library calls in NCopencl_help.h.
+#define SERVER_HELLO			1
+#define SERVER_MAP				2
+#define SERVER_SHUTDOWN			3
+#define SERVER_CREATE_QUEUE		4
+#define SERVER_SHARE_QUEUE		5
+#define SERVER_RELEASE_QUEUE	6
+#define SERVER_BUILD_KERNELS	7
+#define SERVER_RELEASE_KERNELS	8
+#define SERVER_SET_KERNEL_ARG	9
+#define SERVER_EXECUTE_KERNEL	10
+#define SERVER_ALLOCATE_BUFFER	11
+#define SERVER_READ_BUFFER		12
+#define SERVER_WRITE_BUFFER		13
+#define SERVER_RELEASE_BUFFER	14
+
+// Request flags.
+#define SERVER_FLAG_MEM			1
+#define SERVER_FLAG_LOCAL		1
+
+typedef struct {
+	cl_uint		op;
+	cl_uint		verbose;
+	cl_uint		count;
+	cl_uint		flags;
+	cl_ulong	queue;
+	cl_ulong	kernel;
+	cl_ulong	mem[3];
+	cl_ulong	value[MAX_KERNELS];
+	cl_ulong	payload;			// bytes in the shared segment
+} server_request;
+
+typedef struct {
+	cl_int		result;
+	cl_uint		count;
+	cl_ulong	value[MAX_KERNELS];
+} server_reply;
+
+///////////////////////////////////////////////////////////////////////////////
+// Socket transfers. An open file descriptor can ride along with a header.
+//
+static int fServerSend(int socket, const void* data, size_t size, int fd)
+{
+	const char*	ptr = (const char*) data;
+	ssize_t		sent;
+
+	if (fd >= 0)
+	{
+		struct msghdr	message;
+		struct iovec	iov;
+		char			control[CMSG_SPACE(sizeof(int))];
+
+		memset(&message, 0, sizeof(message));
+		memset(control, 0, sizeof(control));
+		iov.iov_base			= (void*) ptr;
+		iov.iov_len				= size;
+		message.msg_iov			= &iov;
+		message.msg_iovlen		= 1;
+		message.msg_control		= control;
+		message.msg_controllen	= sizeof(control);
+
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type  = SCM_RIGHTS;
+		cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+		do sent = sendmsg(socket, &message, MSG_NOSIGNAL); while (sent < 0 && errno == EINTR);
+		if (sent <= 0) return(-1);
+		ptr  += sent;
+		size -= sent;
+	}
+
+	while (size > 0)
+	{
+		sent = send(socket, ptr, size, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) continue;
+		if (sent <= 0) return(-1);
+		ptr  += sent;
+		size -= sent;
+	}
+
+	return(0);
+}
+
+static int fServerReceive(int socket, void* data, size_t size, int* fd)
+{
+	char*	ptr = (char*) data;
+	ssize_t	received;
+
+	if (fd != NULL)
+	{
+		struct msghdr	message;
+		struct iovec	iov;
+		char			control[CMSG_SPACE(sizeof(int))];
+
+		memset(&message, 0, sizeof(message));
+		iov.iov_base			= ptr;
+		iov.iov_len				= size;
+		message.msg_iov			= &iov;
+		message.msg_iovlen		= 1;
+		message.msg_control		= control;
+		message.msg_controllen	= sizeof(control);
+
+		*fd = -1;
+		do received = recvmsg(socket, &message, 0); while (received < 0 && errno == EINTR);
+		if (received <= 0) return(-1);
+
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+		{
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			{
+				memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+			}
+		}
+		ptr  += received;
+		size -= received;
+	}
+
+	while (size > 0)
+	{
+		received = recv(socket, ptr, size, 0);
+		if (received < 0 && errno == EINTR) continue;
+		if (received <= 0) return(-1);
+		ptr  += received;
+		size -= received;
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Server state. Everything below is only touched by the session holding the
+// turn (fServerEnter / fServerLeave).
+//
+typedef struct {
+	cl_command_queue*	queue;
+	int					master;
+} server_queue;
+
+typedef struct {
+	cl_uint		index;
+	cl_ulong	size;
+	cl_bool		is_mem;
+	cl_ulong	mem;
+	cl_uchar	data[SERVER_ARG_SIZE];
+} server_arg;
+
+typedef struct {
+	cl_kernel				kernel;
+	std::vector<server_arg>	args;
+} server_kernel;
+
+typedef struct {
+	int			master;
+	std::string	key;
+	cl_kernel	kernel;
+} server_program;
+
+typedef struct {
+	int								socket;
+	void*							shm;
+	size_t							shm_size;
+	std::vector<server_queue*>		queues;
+	std::vector<server_kernel*>		kernels;
+	std::vector<cl_mem>				mems;
+} server_session;
+
+static cl_command_queue					server_masters[SERVER_MASTERS];
+static cl_bool							server_master_ready[SERVER_MASTERS];
+static std::vector<server_program*>		server_programs;
+
+// Turns: a ticket per request, served in order.
+static std::mutex						server_mutex;
+static std::condition_variable			server_turn;
+static cl_ulong							server_next = 0;
+static cl_ulong							server_serving = 0;
+
+// Running sessions, for the shutdown.
+static int								server_listen = -1;
+static cl_bool							server_stop = CL_FALSE;
+static std::vector<int>					server_sockets;
+
+static void fServerEnter()
+{
+	std::unique_lock<std::mutex> lock(server_mutex);
+	cl_ulong ticket = server_next++;
+	server_turn.wait(lock, [&]{ return ticket == server_serving; });
+}
+
+static void fServerLeave()
+{
+	{
+		std::lock_guard<std::mutex> lock(server_mutex);
+		server_serving++;
+	}
+	server_turn.notify_all();
+}
+
+static server_queue* fServerQueue(server_session* session, cl_ulong handle)
+{
+	for (size_t ii = 0; ii < session->queues.size(); ii++)
+	{
+		if ((cl_ulong) session->queues[ii] == handle) return(session->queues[ii]);
+	}
+	return(NULL);
+}
+
+static server_kernel* fServerKernel(server_session* session, cl_ulong handle)
+{
+	for (size_t ii = 0; ii < session->kernels.size(); ii++)
+	{
+		if ((cl_ulong) session->kernels[ii] == handle) return(session->kernels[ii]);
+	}
+	return(NULL);
+}
+
+static cl_mem* fServerMem(server_session* session, cl_ulong handle)
+{
+	for (size_t ii = 0; ii < session->mems.size(); ii++)
+	{
+		if ((cl_ulong) session->mems[ii] == handle) return(&session->mems[ii]);
+	}
+	return(NULL);
+}
+
+static int fServerInvalid(const char* what, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Error: Invalid %s in a server request.\n", what);
+		fclose(pfile);
+	}
+
+	return(-1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Kernels shared by all sessions, built on the master queue on first use.
+//
+static int fServerProgram(int master, char* file_path, char* function_name, char* compile_options, cl_kernel* kernel, cl_bool verbose, char* log_file)
+{
+	std::string	key = std::string(file_path) + '\n' + function_name + '\n' + compile_options;
+	idls		path, name, options;
+	int			result;
+	FILE*		pfile = NULL;
+
+	for (size_t ii = 0; ii < server_programs.size(); ii++)
+	{
+		if (server_programs[ii]->master == master && server_programs[ii]->key == key)
+		{
+			*kernel = server_programs[ii]->kernel;
+			return(0);
+		}
+	}
+
+	path.s		= file_path;
+	path.slen	= (short) strlen(file_path);
+	name.s		= function_name;
+	name.slen	= (short) strlen(function_name);
+	options.s	= compile_options;
+	options.slen= (short) strlen(compile_options);
+
+	result = fBuildKernels(&server_masters[master], kernel, 1, &path, &name, &options, verbose, log_file);
+	if (result != 0) return(result);
+
+	server_program* program = new server_program;
+	program->master = master;
+	program->key	= key;
+	program->kernel	= *kernel;
+	server_programs.push_back(program);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Server kernel %s built from %s.\n", function_name, file_path);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Whether the peer of a session runs as the user running the server.
+//
+static cl_bool fServerOwner(int socket)
+{
+#ifdef SO_PEERCRED
+	struct ucred	cred;
+	socklen_t		length = sizeof(cred);
+
+	if (getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &cred, &length) != 0) return(CL_FALSE);
+	return(cred.uid == geteuid() ? CL_TRUE : CL_FALSE);
+#else
+	uid_t	uid;
+	gid_t	gid;
+
+	if (getpeereid(socket, &uid, &gid) != 0) return(CL_FALSE);
+	return(uid == geteuid() ? CL_TRUE : CL_FALSE);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Serve one request of a session.
+//
+static int fServerProcess(server_session* session, server_request* request, server_reply* reply, int fd, cl_bool verbose, char* log_file)
+{
+	server_queue*	queue = NULL;
+	server_kernel*	kernel = NULL;
+	cl_mem*			mem[3] = {NULL, NULL, NULL};
+	cl_mem			created = NULL;
+	char*			shm = (char*) session->shm;
+	FILE*			pfile = NULL;
+
+	memset(reply, 0, sizeof(server_reply));
+
+	if (request->payload > session->shm_size)
+	{
+		return(fServerInvalid("payload size", verbose, log_file));
+	}
+
+	// Handles of the request
+	switch (request->op)
+	{
+	case SERVER_HELLO:
+	case SERVER_MAP:
+	case SERVER_SHUTDOWN:
+	case SERVER_CREATE_QUEUE:
+	case SERVER_RELEASE_KERNELS:
+	case SERVER_SET_KERNEL_ARG:
+	case SERVER_RELEASE_BUFFER:
+		break;
+	default:
+		queue = fServerQueue(session, request->queue);
+		if (queue == NULL) return(fServerInvalid("command queue", verbose, log_file));
+	}
+	if (request->op == SERVER_SET_KERNEL_ARG || request->op == SERVER_EXECUTE_KERNEL)
+	{
+		kernel = fServerKernel(session, request->kernel);
+		if (kernel == NULL) return(fServerInvalid("kernel", verbose, log_file));
+	}
+	for (int ii = 0; ii < 3; ii++)
+	{
+		if (request->mem[ii] == 0) continue;
+		mem[ii] = fServerMem(session, request->mem[ii]);
+		if (mem[ii] == NULL) return(fServerInvalid("buffer", verbose, log_file));
+	}
+
+	switch (request->op)
+	{
+	case SERVER_HELLO:
+		return(request->value[0] == SERVER_VERSION ? 0 : fServerInvalid("protocol version", verbose, log_file));
+
+	case SERVER_MAP:
+	{
+		void* shm_new;
+
+		if (fd < 0) return(fServerInvalid("shared memory", verbose, log_file));
+		shm_new = mmap(NULL, request->value[0], PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (shm_new == MAP_FAILED) return(fServerInvalid("shared memory", verbose, log_file));
+		if (session->shm != NULL) munmap(session->shm, session->shm_size);
+		session->shm		= shm_new;
+		session->shm_size	= request->value[0];
+		return(0);
+	}
+
+	case SERVER_SHUTDOWN:
+		return(fServerOwner(session->socket) ? 0 : fServerInvalid("shutdown by another user", verbose, log_file));
+
+	case SERVER_CREATE_QUEUE:
+	{
+		int master = (int) request->value[0];
+		int result;
+
+		if (master < 0 || master >= SERVER_MASTERS) return(fServerInvalid("force_cpu", verbose, log_file));
+		if (!server_master_ready[master])
+		{
+			result = fCreateCommandQueue(&server_masters[master], (cl_bool) master, verbose, log_file);
+			if (result != 0) return(result);
+			server_master_ready[master] = CL_TRUE;
+		}
+
+		queue = new server_queue;
+		queue->queue	= (cl_command_queue*) malloc(sizeof(cl_command_queue));
+		queue->master	= master;
+
+		result = fCreateCommandQueueShared(queue->queue, &server_masters[master], verbose, log_file);
+		if (result != 0)
+		{
+			free(queue->queue);
+			delete queue;
+			return(result);
+		}
+
+		session->queues.push_back(queue);
+		reply->value[0] = (cl_ulong) queue;
+		return(0);
+	}
+
+	case SERVER_SHARE_QUEUE:
+	{
+		server_queue*	shared = new server_queue;
+		int				result;
+
+		shared->queue	= (cl_command_queue*) malloc(sizeof(cl_command_queue));
+		shared->master	= queue->master;
+
+		result = fCreateCommandQueueShared(shared->queue, queue->queue, verbose, log_file);
+		if (result != 0)
+		{
+			free(shared->queue);
+			delete shared;
+			return(result);
+		}
+
+		session->queues.push_back(shared);
+		reply->value[0] = (cl_ulong) shared;
+		return(0);
+	}
+
+	case SERVER_RELEASE_QUEUE:
+	{
+		int result = fReleaseCommandQueue(queue->queue, verbose, log_file);
+
+		for (size_t ii = 0; ii < session->queues.size(); ii++)
+		{
+			if (session->queues[ii] != queue) continue;
+			session->queues.erase(session->queues.begin() + ii);
+			break;
+		}
+		free(queue->queue);
+		delete queue;
+		return(result);
+	}
+
+	case SERVER_BUILD_KERNELS:
+	{
+		char*	strings[3 * MAX_KERNELS];
+		char*	ptr = shm;
+		int		result;
+
+		if (request->count > MAX_KERNELS) return(fServerInvalid("number of kernels", verbose, log_file));
+
+		// file path, function name and compile options per kernel, zero terminated
+		for (cl_uint ii = 0; ii < 3 * request->count; ii++)
+		{
+			char* end = (char*) memchr(ptr, 0, shm + request->payload - ptr);
+			if (end == NULL) return(fServerInvalid("kernel strings", verbose, log_file));
+			strings[ii] = ptr;
+			ptr = end + 1;
+		}
+
+		for (cl_uint ii = 0; ii < request->count; ii++)
+		{
+			server_kernel* built = new server_kernel;
+
+			result = fServerProgram(queue->master, strings[3*ii], strings[3*ii+1], strings[3*ii+2], &built->kernel, verbose, log_file);
+			if (result != 0)
+			{
+				delete built;
+				return(result);
+			}
+
+			session->kernels.push_back(built);
+			reply->value[ii] = (cl_ulong) built;
+		}
+		reply->count = request->count;
+		return(0);
+	}
+
+	case SERVER_RELEASE_KERNELS:
+		for (cl_uint ii = 0; ii < request->count && ii < MAX_KERNELS; ii++)
+		{
+			for (size_t jj = 0; jj < session->kernels.size(); jj++)
+			{
+				if ((cl_ulong) session->kernels[jj] != request->value[ii]) continue;
+				delete session->kernels[jj];
+				session->kernels.erase(session->kernels.begin() + jj);
+				break;
+			}
+		}
+		return(0);
+
+	case SERVER_SET_KERNEL_ARG:
+	{
+		server_arg arg;
+
+		arg.index	= (cl_uint) request->value[0];
+		arg.size	= request->value[1];
+		arg.is_mem	= (request->flags & SERVER_FLAG_MEM) ? CL_TRUE : CL_FALSE;
+		arg.mem		= request->mem[0];
+
+		if (arg.is_mem && mem[0] == NULL) return(fServerInvalid("buffer argument", verbose, log_file));
+		if (!arg.is_mem)
+		{
+			if (arg.size > SERVER_ARG_SIZE || arg.size > request->payload) return(fServerInvalid("argument size", verbose, log_file));
+			memcpy(arg.data, shm, arg.size);
+		}
+
+		for (size_t ii = 0; ii < kernel->args.size(); ii++)
+		{
+			if (kernel->args[ii].index == arg.index)
+			{
+				kernel->args[ii] = arg;
+				return(0);
+			}
+		}
+		kernel->args.push_back(arg);
+		return(0);
+	}
+
+	case SERVER_EXECUTE_KERNEL:
+	{
+		size_t	global[3];
+		size_t	local[3];
+		int		result;
+
+		// The kernel may be shared with other sessions: set all of this
+		// session's arguments again.
+		for (size_t ii = 0; ii < kernel->args.size(); ii++)
+		{
+			server_arg*	arg = &kernel->args[ii];
+			void*		value = arg->data;
+
+			if (arg->is_mem)
+			{
+				value = fServerMem(session, arg->mem);
+				if (value == NULL) return(fServerInvalid("released buffer argument", verbose, log_file));
+			}
+
+			result = fSetKernelArg(kernel->kernel, arg->index, arg->size, value, verbose, log_file);
+			if (result != 0) return(result);
+		}
+
+		if (request->count < 1 || request->count > 3) return(fServerInvalid("work_dim", verbose, log_file));
+
+		for (int ii = 0; ii < 3; ii++)
+		{
+			global[ii]	= (size_t) request->value[ii];
+			local[ii]	= (size_t) request->value[3 + ii];
+		}
+
+		return(fExecuteKernel(queue->queue, &kernel->kernel, request->count, global,
+							  (request->flags & SERVER_FLAG_LOCAL) ? local : NULL, verbose, log_file));
+	}
+
+	case SERVER_ALLOCATE_BUFFER:
+	{
+		cl_ulong	size = request->value[0];
+		cl_int		mode = (cl_int) request->value[2];
+		int			result;
+
+		if (mode < 0 || mode > 3) return(fServerInvalid("allocation mode", verbose, log_file));
+		if (mode == 3 && size > request->payload) return(fServerInvalid("buffer content", verbose, log_file));
+		if (mode == 1 && request->value[3] > request->payload) return(fServerInvalid("fill pattern", verbose, log_file));
+		if (mode == 2 && mem[0] == NULL) return(fServerInvalid("copy source", verbose, log_file));
+
+		if (mode == 3)
+		{
+			result = fCreateBuffer(queue->queue, &created, shm, size, (cl_int) request->value[1], CL_FALSE, verbose, log_file);
+		}
+		else
+		{
+			result = fAllocateBuffer(queue->queue, &created, size, (cl_int) request->value[1], mode,
+									 shm, request->value[3], mem[0], verbose, log_file);
+		}
+		if (result != 0) return(result);
+
+		session->mems.push_back(created);
+		reply->value[0] = (cl_ulong) created;
+		return(0);
+	}
+
+	case SERVER_READ_BUFFER:
+	case SERVER_WRITE_BUFFER:
+		if (mem[0] == NULL || request->value[1] > session->shm_size) return(fServerInvalid("transfer", verbose, log_file));
+		if (request->op == SERVER_READ_BUFFER)
+		{
+			return(fReadBufferRegion(queue->queue, mem[0], shm, request->value[0], request->value[1], verbose, log_file));
+		}
+		return(fWriteBufferRegion(queue->queue, mem[0], shm, request->value[0], request->value[1], verbose, log_file));
+
+	case SERVER_RELEASE_BUFFER:
+	{
+		cl_mem	released;
+
+		if (mem[0] == NULL) return(fServerInvalid("buffer", verbose, log_file));
+		released = *mem[0];
+		session->mems.erase(session->mems.begin() + (mem[0] - &session->mems[0]));
+		return(fReleaseBuffer(released, verbose, log_file));
+	}
+
+	case SERVER_SINO_GATHER:
+	case SERVER_SINO_SCATTER:
+	case SERVER_SINO_SWAP:
+	case SERVER_SINO_REBIN:
+	case SERVER_RESAMPLE_DOWN:
+	case SERVER_RESAMPLE_UP:
+	{
+		cl_uint4	size_a, size_b;
+		cl_float	scale;
+		cl_bool		use_subset	= (request->flags & SERVER_FLAG_SUBSET) ? CL_TRUE : CL_FALSE;
+		cl_bool		option		= (request->flags & SERVER_FLAG_OPTION) ? CL_TRUE : CL_FALSE;
+
+		if (mem[0] == NULL || mem[1] == NULL || (use_subset && mem[2] == NULL)) return(fServerInvalid("buffer", verbose, log_file));
+
+		for (int ii = 0; ii < 4; ii++)
+		{
+			size_a.s[ii] = (cl_uint) request->value[ii];
+			size_b.s[ii] = (cl_uint) request->value[4 + ii];
+		}
+		memcpy(&scale, &request->value[8], sizeof(cl_float));
+
+		switch (request->op)
+		{
+		case SERVER_SINO_GATHER:	return(fSinoGather(queue->queue, mem[0], mem[1], mem[2], use_subset, size_a, size_b, verbose, log_file));
+		case SERVER_SINO_SCATTER:	return(fSinoScatter(queue->queue, mem[0], mem[1], mem[2], use_subset, size_a, size_b, option, verbose, log_file));
+		case SERVER_SINO_SWAP:		return(fSinoSwap(queue->queue, mem[0], mem[1], size_a, verbose, log_file));
+		case SERVER_SINO_REBIN:		return(fSinoRebin(queue->queue, mem[0], mem[1], size_a, size_b, verbose, log_file));
+		case SERVER_RESAMPLE_DOWN:	return(fResampleDown(queue->queue, mem[0], mem[1], size_a, size_b, option, verbose, log_file));
+		default:					return(fResampleUp(queue->queue, mem[0], mem[1], size_a, size_b, scale, verbose, log_file));
+		}
+	}
+
+	default:
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Unknown server request %u.\n", request->op);
+			fclose(pfile);
+		}
+		return(-1);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stop the server: no new sessions, and the running ones are cut off.
+//
+static void fServerStop()
+{
+	std::lock_guard<std::mutex> lock(server_mutex);
+
+	server_stop = CL_TRUE;
+	if (server_listen >= 0) shutdown(server_listen, SHUT_RDWR);
+	for (size_t ii = 0; ii < server_sockets.size(); ii++)
+	{
+		shutdown(server_sockets[ii], SHUT_RDWR);
+	}
+}
+
+static void fServerSession(int socket, cl_bool verbose, char* log_file)
+{
+	server_session	session;
+	server_request	request;
+	server_reply	reply;
+	int				fd;
+	FILE*			pfile = NULL;
+
+	session.socket		= socket;
+	session.shm			= NULL;
+	session.shm_size	= 0;
+
+	while (fServerReceive(socket, &request, sizeof(request), &fd) == 0)
+	{
+		cl_bool request_verbose = verbose && request.verbose;
+
+		fServerEnter();
+		reply.result = fServerProcess(&session, &request, &reply, fd, request_verbose, log_file);
+		fServerLeave();
+
+		if (fd >= 0 && request.op != SERVER_MAP) close(fd);
+		if (fServerSend(socket, &reply, sizeof(reply), -1) != 0) break;
+		if (request.op == SERVER_SHUTDOWN && reply.result == 0) fServerStop();
+	}
+
+	// Whatever the session left behind
+	fServerEnter();
+	for (size_t ii = 0; ii < session.kernels.size(); ii++)
+	{
+		delete session.kernels[ii];
+	}
+	for (size_t ii = 0; ii < session.mems.size(); ii++)
+	{
+		fReleaseBuffer(session.mems[ii], verbose, log_file);
+	}
+	for (size_t ii = 0; ii < session.queues.size(); ii++)
+	{
+		fReleaseCommandQueue(session.queues[ii]->queue, verbose, log_file);
+		free(session.queues[ii]->queue);
+		delete session.queues[ii];
+	}
+	fServerLeave();
+
+	if (session.shm != NULL) munmap(session.shm, session.shm_size);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Server session closed, %llu buffers released.\n", (unsigned long long) session.mems.size());
+		fclose(pfile);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(server_mutex);
+		for (size_t ii = 0; ii < server_sockets.size(); ii++)
+		{
+			if (server_sockets[ii] != socket) continue;
+			server_sockets.erase(server_sockets.begin() + ii);
+			break;
+		}
+		close(socket);
+	}
+	server_turn.notify_all();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Serve sessions on a Unix socket until one of them asks for a shutdown.
+// The socket is only accessible to the user running the server, and only
+// that user can shut it down.
+//
+int fServerRun(char* socket_path, cl_bool verbose, char* log_file)
+{
+	struct sockaddr_un	address;
+	int					client;
+	int					bound;
+	mode_t				old_mask;
+	FILE*				pfile = NULL;
+
+	if (strlen(socket_path) >= sizeof(address.sun_path))
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Socket path too long: %s\n", socket_path);
+			fclose(pfile);
+		}
+		return(-1);
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socket_path);
+
+	server_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socket_path);
+
+	// The socket file is created by bind: no window in which others can connect.
+	old_mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+	bound = server_listen >= 0 ? bind(server_listen, (struct sockaddr*) &address, sizeof(address)) : -1;
+	umask(old_mask);
+
+	if (server_listen < 0
+		|| bound != 0
+		|| listen(server_listen, 16) != 0)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to listen on %s! %d \n", socket_path, errno);
+			fclose(pfile);
+		}
+		if (server_listen >= 0) close(server_listen);
+		server_listen = -1;
+		return(-2);
+	}
+
+	server_stop = CL_FALSE;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Projection server listening on %s.\n", socket_path);
+		fclose(pfile);
+	}
+
+	while (CL_TRUE)
+	{
+		client = accept(server_listen, NULL, NULL);
+
+		std::lock_guard<std::mutex> lock(server_mutex);
+		if (server_stop)
+		{
+			if (client >= 0) close(client);
+			break;
+		}
+		if (client < 0) continue;
+
+		server_sockets.push_back(client);
+		std::thread(fServerSession, client, verbose, log_file).detach();
+	}
+
+	// Wait for the sessions to clean up
+	{
+		std::unique_lock<std::mutex> lock(server_mutex);
+		server_turn.wait(lock, []{ return server_sockets.empty(); });
+		close(server_listen);
+		server_listen = -1;
+	}
+	unlink(socket_path);
+
+	for (size_t ii = 0; ii < server_programs.size(); ii++)
+	{
+		fReleaseKernels(&server_programs[ii]->kernel, 1, verbose, log_file);
+		delete server_programs[ii];
+	}
+	server_programs.clear();
+
+	for (int ii = 0; ii < SERVER_MASTERS; ii++)
+	{
+		if (!server_master_ready[ii]) continue;
+		fReleaseCommandQueue(&server_masters[ii], verbose, log_file);
+		server_master_ready[ii] = CL_FALSE;
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Projection server stopped.\n");
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Client side. After fClientConnect the bridge calls of this process go to
+// the server; handles (queues, kernels, buffers) are the server's.
+//
+extern cl_mem	buffers[MAX_BUFFERS];
+
+static int		client_socket = -1;
+static void*	client_shm = NULL;
+static size_t	client_shm_size = 0;
+static cl_uint	client_segments = 0;
+
+cl_bool fClientActive()
+{
+	return(client_socket >= 0 ? CL_TRUE : CL_FALSE);
+}
+
+int fClientUnsupported(const char* what, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Error: %s is not available through the projection server.\n", what);
+		fclose(pfile);
+	}
+
+	return(-1);
+}
+
+static void fClientRequest(server_request* request, cl_uint op, cl_bool verbose)
+{
+	memset(request, 0, sizeof(server_request));
+	request->op			= op;
+	request->verbose	= verbose ? 1 : 0;
+}
+
+// Send a request, with payload bytes already in the shared segment.
+static int fClientCall(server_request* request, server_reply* reply, int fd, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	if (fServerSend(client_socket, request, sizeof(server_request), fd) != 0
+		|| fServerReceive(client_socket, reply, sizeof(server_reply), NULL) != 0)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Lost the connection to the projection server! %d \n", errno);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+
+	if (reply->result != 0 && verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Error: Server request %u failed! %d (see the server log)\n", request->op, reply->result);
+		fclose(pfile);
+	}
+
+	return(reply->result);
+}
+
+// Make the shared segment hold at least size bytes. A larger one replaces it
+// and is handed to the server with the request.
+static int fClientReserve(cl_ulong size, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+	char			name[64];
+	size_t			new_size;
+	void*			new_shm;
+	int				fd;
+	int				result;
+	FILE*			pfile = NULL;
+
+	if (size <= client_shm_size) return(0);
+
+	new_size = client_shm_size * 2;
+	if (new_size < size) new_size = (size_t) size;
+	if (new_size < SERVER_MIN_SHM) new_size = SERVER_MIN_SHM;
+
+	sprintf(name, "/ncopencl.%d.%u", (int) getpid(), client_segments++);
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+	if (fd >= 0) shm_unlink(name);
+
+	if (fd < 0 || ftruncate(fd, new_size) != 0
+		|| (new_shm = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to create %llu bytes of shared memory! %d \n", (unsigned long long) new_size, errno);
+			fclose(pfile);
+		}
+		if (fd >= 0) close(fd);
+		return(-4);
+	}
+
+	fClientRequest(&request, SERVER_MAP, verbose);
+	request.value[0] = new_size;
+	result = fClientCall(&request, &reply, fd, verbose, log_file);
+	close(fd);
+
+	if (result != 0)
+	{
+		munmap(new_shm, new_size);
+		return(result);
+	}
+
+	if (client_shm != NULL) munmap(client_shm, client_shm_size);
+	client_shm		= new_shm;
+	client_shm_size	= new_size;
+
+	return(0);
+}
+
+int fClientConnect(char* socket_path, cl_bool verbose, char* log_file)
+{
+	struct sockaddr_un	address;
+	server_request		request;
+	server_reply		reply;
+	int					result;
+	FILE*				pfile = NULL;
+
+	if (client_socket >= 0 || strlen(socket_path) >= sizeof(address.sun_path))
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Already connected, or socket path too long: %s\n", socket_path);
+			fclose(pfile);
+		}
+		return(-1);
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socket_path);
+
+	client_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (client_socket < 0 || connect(client_socket, (struct sockaddr*) &address, sizeof(address)) != 0)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: No projection server on %s! %d \n", socket_path, errno);
+			fclose(pfile);
+		}
+		if (client_socket >= 0) close(client_socket);
+		client_socket = -1;
+		return(-2);
+	}
+
+	fClientRequest(&request, SERVER_HELLO, verbose);
+	request.value[0] = SERVER_VERSION;
+	result = fClientCall(&request, &reply, -1, verbose, log_file);
+
+	if (result != 0)
+	{
+		close(client_socket);
+		client_socket = -1;
+		return(result);
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Connected to the projection server on %s.\n", socket_path);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+// The server releases what the session still holds.
+int fClientDisconnect(cl_bool stop_server, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+	int				result = 0;
+	FILE*			pfile = NULL;
+
+	if (client_socket < 0) return(0);
+
+	if (stop_server)
+	{
+		fClientRequest(&request, SERVER_SHUTDOWN, verbose);
+		result = fClientCall(&request, &reply, -1, verbose, log_file);
+	}
+
+	close(client_socket);
+	client_socket = -1;
+
+	if (client_shm != NULL) munmap(client_shm, client_shm_size);
+	client_shm		= NULL;
+	client_shm_size	= 0;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Disconnected from the projection server.\n");
+		fclose(pfile);
+	}
+
+	return(result);
+}
+
+int fClientCreateQueue(cl_command_queue* commands, cl_command_queue* source, cl_bool force_cpu, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+	int				result;
+
+	fClientRequest(&request, source ? SERVER_SHARE_QUEUE : SERVER_CREATE_QUEUE, verbose);
+	request.queue		= source ? (cl_ulong) *source : 0;
+	request.value[0]	= force_cpu;
+
+	result = fClientCall(&request, &reply, -1, verbose, log_file);
+	*commands = (cl_command_queue) reply.value[0];
+
+	return(result);
+}
+
+int fClientReleaseQueue(cl_command_queue* commands, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+
+	fClientRequest(&request, SERVER_RELEASE_QUEUE, verbose);
+	request.queue = (cl_ulong) *commands;
+
+	return(fClientCall(&request, &reply, -1, verbose, log_file));
+}
+
+// Relative kernel paths are resolved in the client's working directory; names
+// of embedded kernels are passed on as they are.
+int fClientBuildKernels(cl_command_queue* commands, cl_kernel* kernels, cl_ulong n_kernels, idls* file_paths, idls* function_names, idls* compile_options, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+	std::string		strings;
+	char			cwd[4096];
+	int				result;
+
+	if (n_kernels > MAX_KERNELS) return(fClientUnsupported("More than MAX_KERNELS kernels", verbose, log_file));
+	if (getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = 0;
+
+	for (cl_ulong ii = 0; ii < n_kernels; ii++)
+	{
+		if (file_paths[ii].s[0] != '/' && fEmbeddedKernel(file_paths[ii].s) == NULL) strings += std::string(cwd) + '/';
+		strings += file_paths[ii].s;
+		strings += '\0';
+		strings += function_names[ii].s;
+		strings += '\0';
+		strings += compile_options[ii].s;
+		strings += '\0';
+	}
+
+	result = fClientReserve(strings.size(), verbose, log_file);
+	if (result != 0) return(result);
+	memcpy(client_shm, strings.data(), strings.size());
+
+	fClientRequest(&request, SERVER_BUILD_KERNELS, verbose);
+	request.queue	= (cl_ulong) *commands;
+	request.count	= (cl_uint) n_kernels;
+	request.payload	= strings.size();
+
+	result = fClientCall(&request, &reply, -1, verbose, log_file);
+
+	for (cl_uint ii = 0; ii < reply.count; ii++)
+	{
+		kernels[ii] = (cl_kernel) reply.value[ii];
+	}
+
+	return(result);
+}
+
+int fClientReleaseKernels(cl_kernel* kernels, cl_int n_kernels, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+
+	fClientRequest(&request, SERVER_RELEASE_KERNELS, verbose);
+	request.count = n_kernels < MAX_KERNELS ? n_kernels : MAX_KERNELS;
+	for (cl_uint ii = 0; ii < request.count; ii++)
+	{
+		request.value[ii] = (cl_ulong) kernels[ii];
+	}
+
+	return(fClientCall(&request, &reply, -1, verbose, log_file));
+}
+
+// Buffers are recognized by pointing into the registry of NCopencl.cpp.
+int fClientSetKernelArg(cl_kernel kernel, cl_uint arg_index, cl_ulong arg_size, void* arg_value, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+	int				result;
+
+	fClientRequest(&request, SERVER_SET_KERNEL_ARG, verbose);
+	request.kernel		= (cl_ulong) kernel;
+	request.value[0]	= arg_index;
+	request.value[1]	= arg_size;
+
+	if ((cl_mem*) arg_value >= buffers && (cl_mem*) arg_value < buffers + MAX_BUFFERS && arg_size == sizeof(cl_mem))
+	{
+		request.flags	= SERVER_FLAG_MEM;
+		request.mem[0]	= (cl_ulong) *(cl_mem*) arg_value;
+	}
+	else
+	{
+		if (arg_size > SERVER_ARG_SIZE) return(fClientUnsupported("A kernel argument of this size", verbose, log_file));
+		result = fClientReserve(arg_size, verbose, log_file);
+		if (result != 0) return(result);
+		memcpy(client_shm, arg_value, arg_size);
+		request.payload = arg_size;
+	}
+
+	return(fClientCall(&request, &reply, -1, verbose, log_file));
+}
+
+int fClientExecuteKernel(cl_command_queue* commands, cl_kernel* kernel, cl_uint work_dim, size_t* global, size_t* local, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+
+	fClientRequest(&request, SERVER_EXECUTE_KERNEL, verbose);
+	request.queue	= (cl_ulong) *commands;
+	request.kernel	= (cl_ulong) *kernel;
+	request.count	= work_dim;
+	request.flags	= local ? SERVER_FLAG_LOCAL : 0;
+
+	for (cl_uint ii = 0; ii < work_dim && ii < 3; ii++)
+	{
+		request.value[ii]		= global[ii];
+		request.value[3 + ii]	= local ? local[ii] : 0;
+	}
+
+	return(fClientCall(&request, &reply, -1, verbose, log_file));
+}
+
+// Modes of fAllocateBuffer (0 zero, 1 pattern, 2 copy), and 3 for the content
+// of fCreateBuffer.
+int fClientAllocate(cl_command_queue* commands, cl_mem* mem_ptr, cl_ulong size, cl_int read_write, cl_int mode, void* content, cl_ulong content_size, cl_mem* source, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+	cl_ulong		payload = mode == 3 ? size : (mode == 1 ? content_size : 0);
+	int				result;
+
+	result = fClientReserve(payload, verbose, log_file);
+	if (result != 0) return(result);
+	if (payload > 0) memcpy(client_shm, content, payload);
+
+	fClientRequest(&request, SERVER_ALLOCATE_BUFFER, verbose);
+	request.queue		= (cl_ulong) *commands;
+	request.mem[0]		= mode == 2 ? (cl_ulong) *source : 0;
+	request.value[0]	= size;
+	request.value[1]	= (cl_ulong) read_write;
+	request.value[2]	= (cl_ulong) mode;
+	request.value[3]	= content_size;
+	request.payload		= payload;
+
+	result = fClientCall(&request, &reply, -1, verbose, log_file);
+	if (result == 0) *mem_ptr = (cl_mem) reply.value[0];
+
+	return(result);
+}
+
+// Transfers larger than the shared segment go in pieces of its size.
+int fClientTransfer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong offset, cl_ulong size, cl_bool write, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+	char*			host = (char*) content;
+	int				result;
+
+	result = fClientReserve(size < SERVER_MIN_SHM * 256 ? size : SERVER_MIN_SHM * 256, verbose, log_file);
+	if (result != 0) return(result);
+
+	for (cl_ulong done = 0; done < size; )
+	{
+		cl_ulong piece = size - done < client_shm_size ? size - done : client_shm_size;
+
+		fClientRequest(&request, write ? SERVER_WRITE_BUFFER : SERVER_READ_BUFFER, verbose);
+		request.queue		= (cl_ulong) *commands;
+		request.mem[0]		= (cl_ulong) *mem_ptr;
+		request.value[0]	= offset + done;
+		request.value[1]	= piece;
+
+		if (write) memcpy(client_shm, host + done, piece);
+		result = fClientCall(&request, &reply, -1, verbose, log_file);
+		if (result != 0) return(result);
+		if (!write) memcpy(host + done, client_shm, piece);
+
+		done += piece;
+	}
+
+	return(0);
+}
+
+int fClientRelease(cl_mem mem, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+
+	fClientRequest(&request, SERVER_RELEASE_BUFFER, verbose);
+	request.mem[0] = (cl_ulong) mem;
+
+	return(fClientCall(&request, &reply, -1, verbose, log_file));
+}
+
+// Sinogram and pyramid calls: op is one of SERVER_SINO_* / SERVER_RESAMPLE_*.
+int fClientLibrary(cl_uint op, cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_mem* subset_ptr, cl_uint flags, cl_uint4 size_a, cl_uint4 size_b, cl_float scale, cl_bool verbose, char* log_file)
+{
+	server_request	request;
+	server_reply	reply;
+
+	fClientRequest(&request, op, verbose);
+	request.queue	= (cl_ulong) *commands;
+	request.flags	= flags;
+	request.mem[0]	= (cl_ulong) *src_ptr;
+	request.mem[1]	= (cl_ulong) *dst_ptr;
+	request.mem[2]	= (flags & SERVER_FLAG_SUBSET) ? (cl_ulong) *subset_ptr : 0;
+
+	for (int ii = 0; ii < 4; ii++)
+	{
+		request.value[ii]		= size_a.s[ii];
+		request.value[4 + ii]	= size_b.s[ii];
+	}
+	memcpy(&request.value[8], &scale, sizeof(cl_float));
+
+	return(fClientCall(&request, &reply, -1, verbose, log_file));
+}
+
+#else
+
+///////////////////////////////////////////////////////////////////////////////
+// No Unix sockets: the server and the client mode are not available.
+//
+int fServerRun(char* socket_path, cl_bool verbose, char* log_file)
+{
+	return(fClientUnsupported("The projection server", verbose, log_file));
+}
+
+cl_bool fClientActive()
+{
+	return(CL_FALSE);
+}
+
+int fClientUnsupported(const char* what, cl_bool verbose, char* log_file)
+{
+	FILE* pfile = NULL;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Error: %s is not available on this platform.\n", what);
+		fclose(pfile);
+	}
+
+	return(-1);
+}
+
+int fClientConnect(char* socket_path, cl_bool verbose, char* log_file)
+{
+	return(fClientUnsupported("The projection server", verbose, log_file));
+}
+
+int fClientDisconnect(cl_bool stop_server, cl_bool verbose, char* log_file)
+{
+	return(0);
+}
+
+int fClientCreateQueue(cl_command_queue* commands, cl_command_queue* source, cl_bool force_cpu, cl_bool verbose, char* log_file) { return(-1); }
+int fClientReleaseQueue(cl_command_queue* commands, cl_bool verbose, char* log_file) { return(-1); }
+int fClientBuildKernels(cl_command_queue* commands, cl_kernel* kernels, cl_ulong n_kernels, idls* file_paths, idls* function_names, idls* compile_options, cl_bool verbose, char* log_file) { return(-1); }
+int fClientReleaseKernels(cl_kernel* kernels, cl_int n_kernels, cl_bool verbose, char* log_file) { return(-1); }
+int fClientSetKernelArg(cl_kernel kernel, cl_uint arg_index, cl_ulong arg_size, void* arg_value, cl_bool verbose, char* log_file) { return(-1); }
+int fClientExecuteKernel(cl_command_queue* commands, cl_kernel* kernel, cl_uint work_dim, size_t* global, size_t* local, cl_bool verbose, char* log_file) { return(-1); }
+int fClientAllocate(cl_command_queue* commands, cl_mem* mem_ptr, cl_ulong size, cl_int read_write, cl_int mode, void* content, cl_ulong content_size, cl_mem* source, cl_bool verbose, char* log_file) { return(-1); }
+int fClientTransfer(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong offset, cl_ulong size, cl_bool write, cl_bool verbose, char* log_file) { return(-1); }
+int fClientRelease(cl_mem mem, cl_bool verbose, char* log_file) { return(-1); }
+int fClientLibrary(cl_uint op, cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_mem* subset_ptr, cl_uint flags, cl_uint4 size_a, cl_uint4 size_b, cl_float scale, cl_bool verbose, char* log_file) { return(-1); }
+
+#endif
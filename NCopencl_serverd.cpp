@@ -0,0 +1,36 @@
+// NCopencl_serverd.cpp : Stand-alone projection server, for running the
+// server without an IDL session holding it (see NCopencl_server.cpp).
+//
+//   opencl_server <socket path> [log file]
+//
+// Runs until a session disconnects with the stop flag set.
+//
+
+
+#include "NCopencl.h"
+
+int main(int argc, char* argv[])
+{
+	idls		path;
+	idls		log_file;
+	cl_bool		verbose;
+	void*		args[3];
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <socket path> [log file]\n", argv[0]);
+		return(1);
+	}
+
+	path.s			= argv[1];
+	path.slen		= (short) strlen(argv[1]);
+	log_file.s		= argc > 2 ? argv[2] : (char*) "";
+	log_file.slen	= (short) strlen(log_file.s);
+	verbose			= argc > 2 ? CL_TRUE : CL_FALSE;
+
+	args[0] = &path;
+	args[1] = &verbose;
+	args[2] = &log_file;
+
+	return(fNCserver_run(3, args) == 0 ? 0 : 1);
+}
@@ -0,0 +1,417 @@
+// NCopencl_sino.cpp : Device-side sinogram preprocessing (subset gather, trim,
+// axis swap and rebinning) for sinograms that stay resident on the device.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <map>
+
+///////////////////////////////////////////////////////////////////////////////
+// Kernel source. All arrays use the IDL (column major) layout: element
+// (d, y, z) of an array of size (nd, ny, nz) is stored at d + nd * (y + ny * z).
+// The detector index is always the fastest running one, so every kernel below
+// reads and writes contiguous detector rows.
+//
+static const char* sino_source =
+"__kernel void sino_gather(__global const float* src, __global float* dst,      \n"
+"                          __global const int* subset, uint4 size_src,          \n"
+"                          uint4 range, int use_subset)                          \n"
+"{                                                                               \n"
+"	// size_src : (ndet, nangles, nplanes, -)                                    \n"
+"	// range    : (trim0, ntrim, nsubset, swap)                                  \n"
+"	uint d = get_global_id(0);                                                   \n"
+"	uint a = get_global_id(1);                                                   \n"
+"	uint p = get_global_id(2);                                                   \n"
+"	if (d >= range.y || a >= range.z || p >= size_src.z) return;                 \n"
+"	uint   angle = use_subset ? (uint) subset[a] : a;                            \n"
+"	size_t s = range.x + d + (size_t) size_src.x * (angle + (size_t) size_src.y * p);\n"
+"	size_t o = range.w ? d + (size_t) range.y * (p + (size_t) size_src.z * a)    \n"
+"	                   : d + (size_t) range.y * (a + (size_t) range.z * p);      \n"
+"	dst[o] = src[s];                                                             \n"
+"}                                                                               \n"
+"                                                                                \n"
+"__kernel void sino_scatter(__global const float* src, __global float* dst,     \n"
+"                           __global const int* subset, uint4 size_dst,         \n"
+"                           uint4 range, int use_subset, int accumulate)         \n"
+"{                                                                               \n"
+"	// Inverse of sino_gather; subset indices are unique, so no atomics needed.  \n"
+"	uint d = get_global_id(0);                                                   \n"
+"	uint a = get_global_id(1);                                                   \n"
+"	uint p = get_global_id(2);                                                   \n"
+"	if (d >= range.y || a >= range.z || p >= size_dst.z) return;                 \n"
+"	uint   angle = use_subset ? (uint) subset[a] : a;                            \n"
+"	size_t o = range.x + d + (size_t) size_dst.x * (angle + (size_t) size_dst.y * p);\n"
+"	size_t s = range.w ? d + (size_t) range.y * (p + (size_t) size_dst.z * a)    \n"
+"	                   : d + (size_t) range.y * (a + (size_t) range.z * p);      \n"
+"	dst[o] = accumulate ? dst[o] + src[s] : src[s];                              \n"
+"}                                                                               \n"
+"                                                                                \n"
+"__kernel void sino_swap_yz(__global const float* src, __global float* dst,     \n"
+"                           uint4 size_src)                                      \n"
+"{                                                                               \n"
+"	// (nd, ny, nz) -> (nd, nz, ny), the device version of niswyz.               \n"
+"	uint d = get_global_id(0);                                                   \n"
+"	uint y = get_global_id(1);                                                   \n"
+"	uint z = get_global_id(2);                                                   \n"
+"	if (d >= size_src.x || y >= size_src.y || z >= size_src.z) return;          \n"
+"	dst[d + (size_t) size_src.x * (z + (size_t) size_src.z * y)] =               \n"
+"		src[d + (size_t) size_src.x * (y + (size_t) size_src.y * z)];            \n"
+"}                                                                               \n"
+"                                                                                \n"
+"__kernel void sino_rebin(__global const float* src, __global float* dst,       \n"
+"                         uint4 size_src, uint4 factor)                          \n"
+"{                                                                               \n"
+"	// Sum factor.x detector bins and factor.y angles, as det_rebin/angle_rebin. \n"
+"	uint nd = size_src.x / factor.x;                                             \n"
+"	uint na = size_src.y / factor.y;                                             \n"
+"	uint d  = get_global_id(0);                                                  \n"
+"	uint a  = get_global_id(1);                                                  \n"
+"	uint p  = get_global_id(2);                                                  \n"
+"	if (d >= nd || a >= na || p >= size_src.z) return;                          \n"
+"	float sum = 0.0f;                                                            \n"
+"	for (uint j = 0; j < factor.y; j++)                                          \n"
+"	{                                                                            \n"
+"		size_t row = (size_t) size_src.x * (a * factor.y + j + (size_t) size_src.y * p);\n"
+"		for (uint i = 0; i < factor.x; i++)                                      \n"
+"			sum += src[row + d * factor.x + i];                                  \n"
+"	}                                                                            \n"
+"	dst[d + (size_t) nd * (a + (size_t) na * p)] = sum;                          \n"
+"}                                                                               \n";
+
+#define SINO_GATHER  0
+#define SINO_SCATTER 1
+#define SINO_SWAP    2
+#define SINO_REBIN   3
+#define SINO_KERNELS 4
+
+static const char* sino_kernel_names[SINO_KERNELS] = {"sino_gather", "sino_scatter", "sino_swap_yz", "sino_rebin"};
+
+typedef struct {
+	cl_program	program;
+	cl_kernel	kernels[SINO_KERNELS];
+} sino_set;
+
+// Program is built once per context and reused for every subset.
+static std::map<cl_context, sino_set>	sino_sets;
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the preprocessing kernels for the context of the command queue, once
+// per context; *set receives the kernels of that context.
+//
+static int fSinoProgram(cl_command_queue* commands, sino_set** set, cl_bool verbose, char* log_file)
+{
+	cl_int			error;
+	cl_context		context;
+	sino_set		entry;
+	FILE*			pfile = NULL;
+
+	if (fNativeQueue(commands))
+	{
+		return(fNativeUnsupported("Sinogram kernels", verbose, log_file));
+	}
+
+	error = clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to retreive context! %d \n", error);
+			fclose(pfile);
+		}
+		return(-3);
+	}
+
+	std::map<cl_context, sino_set>::iterator it = sino_sets.find(context);
+	if (it != sino_sets.end())
+	{
+		*set = &it->second;
+		return(0);
+	}
+
+	error = fBuildLibraryProgram(commands, context, sino_source, "sinogram", sino_kernel_names, SINO_KERNELS, &entry.program, entry.kernels, verbose, log_file);
+	if (error < 0) return(error);
+
+	*set = &(sino_sets[context] = entry);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Sinogram preprocessing kernels built.\n");
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Launch one of the preprocessing kernels. The queue is in-order, so the
+// result is ready for any kernel or read enqueued afterwards.
+//
+static int fSinoLaunch(cl_command_queue* commands, cl_kernel kernel, size_t* global, cl_bool verbose, char* log_file)
+{
+	cl_int	error;
+	FILE*	pfile = NULL;
+
+	error = clEnqueueNDRangeKernel(*commands, kernel, 3, NULL, global, NULL, 0, NULL, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to execute sinogram kernel! %d \n", error);
+			fprintf(pfile, "Info: Global size: %u, %u, %u.\n", (cl_uint) global[0], (cl_uint) global[1], (cl_uint) global[2]);
+			fclose(pfile);
+		}
+		return(-11);
+	}
+
+	error = clFlush(*commands);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Sinogram kernel queued. Global size: %u, %u, %u.\n", (cl_uint) global[0], (cl_uint) global[1], (cl_uint) global[2]);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gather sinogram[trim0:trim0+ntrim-1, subset, *] from a resident sinogram,
+// optionally swapping to the (det, plane, angle) layout used by the kernels.
+//
+int fSinoGather(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_mem* subset_ptr, cl_bool use_subset, cl_uint4 size_src, cl_uint4 range, cl_bool verbose, char* log_file)
+{
+	int		result;
+	cl_int	error = CL_SUCCESS;
+	cl_int	flag  = use_subset ? 1 : 0;
+	size_t	global[3];
+	cl_kernel kernel;
+	sino_set* set;
+
+	if (fClientActive())
+	{
+		return(fClientLibrary(SERVER_SINO_GATHER, commands, src_ptr, dst_ptr, subset_ptr, use_subset ? SERVER_FLAG_SUBSET : 0, size_src, range, 0.0f, verbose, log_file));
+	}
+
+	result = fSinoProgram(commands, &set, verbose, log_file);
+	if (result != 0) return(result);
+
+	kernel = set->kernels[SINO_GATHER];
+	error |= clSetKernelArg(kernel, 0, sizeof(cl_mem),   src_ptr);
+	error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),   dst_ptr);
+	// The subset argument must be a valid buffer, even when it is not used.
+	error |= clSetKernelArg(kernel, 2, sizeof(cl_mem),   use_subset ? subset_ptr : src_ptr);
+	error |= clSetKernelArg(kernel, 3, sizeof(cl_uint4), &size_src);
+	error |= clSetKernelArg(kernel, 4, sizeof(cl_uint4), &range);
+	error |= clSetKernelArg(kernel, 5, sizeof(cl_int),   &flag);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			FILE* pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to set sinogram gather arguments! %d.\n", error);
+			fclose(pfile);
+		}
+		return(-12);
+	}
+
+	global[0] = range.s[1];
+	global[1] = range.s[2];
+	global[2] = size_src.s[2];
+
+	return(fSinoLaunch(commands, kernel, global, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scatter (and optionally accumulate) a subset sinogram back into the
+// resident full sinogram. Arguments mirror fSinoGather.
+//
+int fSinoScatter(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_mem* subset_ptr, cl_bool use_subset, cl_uint4 size_dst, cl_uint4 range, cl_bool accumulate, cl_bool verbose, char* log_file)
+{
+	int		result;
+	cl_int	error = CL_SUCCESS;
+	cl_int	flag  = use_subset ? 1 : 0;
+	cl_int	accum = accumulate ? 1 : 0;
+	size_t	global[3];
+	cl_kernel kernel;
+	sino_set* set;
+
+	if (fClientActive())
+	{
+		return(fClientLibrary(SERVER_SINO_SCATTER, commands, src_ptr, dst_ptr, subset_ptr, (use_subset ? SERVER_FLAG_SUBSET : 0) | (accumulate ? SERVER_FLAG_OPTION : 0), size_dst, range, 0.0f, verbose, log_file));
+	}
+
+	result = fSinoProgram(commands, &set, verbose, log_file);
+	if (result != 0) return(result);
+
+	kernel = set->kernels[SINO_SCATTER];
+	error |= clSetKernelArg(kernel, 0, sizeof(cl_mem),   src_ptr);
+	error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),   dst_ptr);
+	error |= clSetKernelArg(kernel, 2, sizeof(cl_mem),   use_subset ? subset_ptr : src_ptr);
+	error |= clSetKernelArg(kernel, 3, sizeof(cl_uint4), &size_dst);
+	error |= clSetKernelArg(kernel, 4, sizeof(cl_uint4), &range);
+	error |= clSetKernelArg(kernel, 5, sizeof(cl_int),   &flag);
+	error |= clSetKernelArg(kernel, 6, sizeof(cl_int),   &accum);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			FILE* pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to set sinogram scatter arguments! %d.\n", error);
+			fclose(pfile);
+		}
+		return(-12);
+	}
+
+	global[0] = range.s[1];
+	global[1] = range.s[2];
+	global[2] = size_dst.s[2];
+
+	return(fSinoLaunch(commands, kernel, global, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Swap the second and third axis: (nd, ny, nz) -> (nd, nz, ny).
+//
+int fSinoSwap(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_uint4 size_src, cl_bool verbose, char* log_file)
+{
+	int		result;
+	cl_int	error = CL_SUCCESS;
+	size_t	global[3];
+	cl_kernel kernel;
+	sino_set* set;
+
+	if (fClientActive())
+	{
+		return(fClientLibrary(SERVER_SINO_SWAP, commands, src_ptr, dst_ptr, NULL, 0, size_src, size_src, 0.0f, verbose, log_file));
+	}
+
+	result = fSinoProgram(commands, &set, verbose, log_file);
+	if (result != 0) return(result);
+
+	kernel = set->kernels[SINO_SWAP];
+	error |= clSetKernelArg(kernel, 0, sizeof(cl_mem),   src_ptr);
+	error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),   dst_ptr);
+	error |= clSetKernelArg(kernel, 2, sizeof(cl_uint4), &size_src);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			FILE* pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to set sinogram swap arguments! %d.\n", error);
+			fclose(pfile);
+		}
+		return(-12);
+	}
+
+	global[0] = size_src.s[0];
+	global[1] = size_src.s[1];
+	global[2] = size_src.s[2];
+
+	return(fSinoLaunch(commands, kernel, global, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sum factor[0] detector bins and factor[1] angles (det_rebin, angle_rebin).
+// Trailing bins that do not fill a complete group are dropped.
+//
+int fSinoRebin(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_uint4 size_src, cl_uint4 factor, cl_bool verbose, char* log_file)
+{
+	int		result;
+	cl_int	error = CL_SUCCESS;
+	size_t	global[3];
+	cl_kernel kernel;
+	sino_set* set;
+
+	if (fClientActive())
+	{
+		return(fClientLibrary(SERVER_SINO_REBIN, commands, src_ptr, dst_ptr, NULL, 0, size_src, factor, 0.0f, verbose, log_file));
+	}
+
+	if (factor.s[0] == 0 || factor.s[1] == 0)
+	{
+		return(-1);
+	}
+
+	result = fSinoProgram(commands, &set, verbose, log_file);
+	if (result != 0) return(result);
+
+	kernel = set->kernels[SINO_REBIN];
+	error |= clSetKernelArg(kernel, 0, sizeof(cl_mem),   src_ptr);
+	error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),   dst_ptr);
+	error |= clSetKernelArg(kernel, 2, sizeof(cl_uint4), &size_src);
+	error |= clSetKernelArg(kernel, 3, sizeof(cl_uint4), &factor);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			FILE* pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to set sinogram rebin arguments! %d.\n", error);
+			fclose(pfile);
+		}
+		return(-12);
+	}
+
+	global[0] = size_src.s[0] / factor.s[0];
+	global[1] = size_src.s[1] / factor.s[1];
+	global[2] = size_src.s[2];
+
+	return(fSinoLaunch(commands, kernel, global, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Release the preprocessing kernels and program of the context of the queue;
+// other contexts keep theirs.
+//
+int fReleaseSinoKernels(cl_command_queue* commands, cl_bool verbose, char* log_file)
+{
+	cl_context	context;
+	FILE*		pfile = NULL;
+
+	if (fClientActive() || fNativeQueue(commands))
+	{
+		return(0);
+	}
+
+	if (clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL) != CL_SUCCESS)
+	{
+		return(0);
+	}
+
+	std::map<cl_context, sino_set>::iterator it = sino_sets.find(context);
+	if (it == sino_sets.end())
+	{
+		return(0);
+	}
+
+	for (int ii = 0; ii < SINO_KERNELS; ii++)
+	{
+		if (it->second.kernels[ii] != NULL)
+		{
+			clReleaseKernel(it->second.kernels[ii]);
+		}
+	}
+
+	clReleaseProgram(it->second.program);
+	sino_sets.erase(it);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Sinogram preprocessing kernels released.\n");
+		fclose(pfile);
+	}
+
+	return(0);
+}
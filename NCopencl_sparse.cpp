@@ -0,0 +1,942 @@
+// NCopencl_sparse.cpp : Cached sparse system matrix. The coefficients of a
+// projector with fixed geometry are recorded once by its kernels, then later
+// forward and back projections run as sparse matrix-vector products, on the
+// device (sliced ELL, optionally half precision weights) or, for CPU devices,
+// in host memory (CSR of the matrix and of its transpose).
+//
+// Recording protocol. Kernels built with -D RECORD_SYSMAT get two extra
+// buffer arguments, the counter (uint[2] = {count, capacity}) and the
+// coordinate list (uint[3 * capacity]), and append every coefficient as
+//
+//	uint slot = atomic_inc(&sysmat_count[0]);
+//	if (slot < sysmat_count[1])
+//	{
+//		sysmat_coo[3 * slot]     = sino_index;     // row: d + ndet * (p + nplanes * view)
+//		sysmat_coo[3 * slot + 1] = image_index;    // column
+//		sysmat_coo[3 * slot + 2] = as_uint(weight);
+//	}
+//
+// Rows are sinogram bins in the (det, plane, angle) layout of the kernels, so
+// every view owns view_rows consecutive rows and one ELL slice.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <map>
+
+// Rows (host products) or columns per thread below which work stays serial.
+#define SYSMAT_MIN_ROWS_PER_THREAD 4096
+
+#define SYSMAT_NONE   0
+#define SYSMAT_DEVICE 1
+#define SYSMAT_HOST   2
+
+///////////////////////////////////////////////////////////////////////////////
+// Kernel source. Slice v (view v) starts at slice_ptr[v] and stores entry k of
+// its row r at slice_ptr[v] + k * view_rows + r, so neighbouring work items
+// read neighbouring entries. Padding entries have weight 0.
+//
+static const char* sysmat_source =
+"float sysmat_load(__global const float* vals, uint half_flag, size_t i)       \n"
+"{                                                                               \n"
+"	return half_flag ? vload_half(i, (__global const half*) vals) : vals[i];     \n"
+"}                                                                               \n"
+"                                                                                \n"
+"void sysmat_atomic_add(volatile __global float* addr, float value)            \n"
+"{                                                                               \n"
+"	union { uint u; float f; } old_val, new_val;                                 \n"
+"	do                                                                           \n"
+"	{                                                                            \n"
+"		old_val.f = *addr;                                                       \n"
+"		new_val.f = old_val.f + value;                                           \n"
+"	} while (atomic_cmpxchg((volatile __global uint*) addr, old_val.u, new_val.u) != old_val.u);\n"
+"}                                                                               \n"
+"                                                                                \n"
+"__kernel void sysmat_spmv(__global const ulong* slice_ptr,                     \n"
+"                          __global const uint* slice_width,                     \n"
+"                          __global const uint* cols,                            \n"
+"                          __global const float* vals, uint half_flag,           \n"
+"                          __global const float* x, __global float* y,           \n"
+"                          __global const int* subset, int use_subset,           \n"
+"                          ulong view_rows, ulong nrows, int transpose, int accumulate)\n"
+"{                                                                               \n"
+"	// One work item per sinogram bin of the subset. Forward: y = A x, gather.   \n"
+"	// Transpose: y += A^T x, scattered with atomic additions.                   \n"
+"	size_t gid  = get_global_id(0);                                              \n"
+"	size_t v    = gid / view_rows;                                               \n"
+"	size_t r    = gid - v * view_rows;                                           \n"
+"	size_t view = use_subset ? (size_t) subset[v] : v;                           \n"
+"	if (view * view_rows + r >= nrows) return;                                   \n"
+"	size_t base  = slice_ptr[view] + r;                                          \n"
+"	uint   width = slice_width[view];                                            \n"
+"	if (!transpose)                                                              \n"
+"	{                                                                            \n"
+"		float sum = 0.0f;                                                        \n"
+"		for (uint k = 0; k < width; k++)                                         \n"
+"		{                                                                        \n"
+"			size_t i = base + k * view_rows;                                     \n"
+"			sum += sysmat_load(vals, half_flag, i) * x[cols[i]];                 \n"
+"		}                                                                        \n"
+"		y[gid] = accumulate ? y[gid] + sum : sum;                                \n"
+"	}                                                                            \n"
+"	else                                                                         \n"
+"	{                                                                            \n"
+"		float value = x[gid];                                                    \n"
+"		if (value == 0.0f) return;                                               \n"
+"		for (uint k = 0; k < width; k++)                                         \n"
+"		{                                                                        \n"
+"			size_t i = base + k * view_rows;                                     \n"
+"			float  w = sysmat_load(vals, half_flag, i);                          \n"
+"			if (w != 0.0f) sysmat_atomic_add(&y[cols[i]], w * value);            \n"
+"		}                                                                        \n"
+"	}                                                                            \n"
+"}                                                                               \n"
+"                                                                                \n"
+"__kernel void sysmat_pack_half(__global const float* src, __global half* dst,  \n"
+"                               ulong n)                                         \n"
+"{                                                                               \n"
+"	size_t i = get_global_id(0);                                                 \n"
+"	if (i < n) vstore_half(src[i], i, dst);                                      \n"
+"}                                                                               \n";
+
+#define SYSMAT_SPMV    0
+#define SYSMAT_PACK    1
+#define SYSMAT_KERNELS 2
+
+static const char* sysmat_kernel_names[SYSMAT_KERNELS] = {"sysmat_spmv", "sysmat_pack_half"};
+
+typedef struct {
+	cl_program	program;
+	cl_kernel	kernels[SYSMAT_KERNELS];
+
+	// The cached matrix: nrows sinogram bins x ncols voxels, view_rows rows per view.
+	cl_int		status;
+	cl_ulong	nrows;
+	cl_ulong	ncols;
+	cl_ulong	view_rows;
+	cl_ulong	nviews;
+	cl_uint		half;
+	// Geometry id, image and sinogram dims the matrix was recorded for.
+	cl_ulong	key[SYSMAT_KEY_SIZE];
+
+	// Device storage (sliced ELL).
+	cl_mem		slice_ptr;
+	cl_mem		slice_width;
+	cl_mem		cols;
+	cl_mem		vals;
+
+	// Host storage (CSR of A and of A^T).
+	std::vector<cl_ulong>	row_ptr;
+	std::vector<cl_uint>	row_cols;
+	std::vector<cl_float>	row_vals;
+	std::vector<cl_ulong>	col_ptr;
+	std::vector<cl_uint>	col_rows;
+	std::vector<cl_float>	col_vals;
+} sysmat_set;
+
+// Kernels and cached matrix per context; a matrix is only ever applied with
+// the queues of the context it was built in.
+static std::map<cl_context, sysmat_set>	sysmat_sets;
+
+///////////////////////////////////////////////////////////////////////////////
+// The sparse kernels and matrix of the context of the command queue, NULL
+// when none were built for it.
+//
+static sysmat_set* fSysmatFind(cl_command_queue* commands)
+{
+	cl_context	context;
+
+	if (fClientActive() || fNativeQueue(commands))
+	{
+		return(NULL);
+	}
+
+	if (clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL) != CL_SUCCESS)
+	{
+		return(NULL);
+	}
+
+	std::map<cl_context, sysmat_set>::iterator it = sysmat_sets.find(context);
+
+	return(it == sysmat_sets.end() ? NULL : &it->second);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the sparse kernels for the context of the command queue, once per
+// context.
+//
+static int fSysmatProgram(cl_command_queue* commands, sysmat_set** set, cl_bool verbose, char* log_file)
+{
+	int			result;
+	cl_int		error;
+	cl_context	context;
+	sysmat_set	entry;
+	FILE*		pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientUnsupported("The cached system matrix", verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeUnsupported("The cached system matrix", verbose, log_file));
+	}
+
+	error = clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to retreive context! %d \n", error);
+			fclose(pfile);
+		}
+		return(-3);
+	}
+
+	std::map<cl_context, sysmat_set>::iterator it = sysmat_sets.find(context);
+	if (it != sysmat_sets.end())
+	{
+		*set = &it->second;
+		return(0);
+	}
+
+	result = fBuildLibraryProgram(commands, context, sysmat_source, "system matrix", sysmat_kernel_names, SYSMAT_KERNELS, &entry.program, entry.kernels, verbose, log_file);
+	if (result < 0) return(result);
+
+	entry.status      = SYSMAT_NONE;
+	entry.nrows       = 0;
+	entry.ncols       = 0;
+	entry.view_rows   = 0;
+	entry.nviews      = 0;
+	entry.half        = 0;
+	entry.slice_ptr   = NULL;
+	entry.slice_width = NULL;
+	entry.cols        = NULL;
+	entry.vals        = NULL;
+	memset(entry.key, 0, sizeof(entry.key));
+
+	*set = &(sysmat_sets[context] = entry);
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Drop the cached matrix of a context, keeping its kernels.
+//
+static void fReleaseSysmatMatrix(sysmat_set* set)
+{
+	cl_mem* device[4] = {&set->slice_ptr, &set->slice_width, &set->cols, &set->vals};
+
+	for (int ii = 0; ii < 4; ii++)
+	{
+		if (*device[ii] != NULL)
+		{
+			clReleaseMemObject(*device[ii]);
+			*device[ii] = NULL;
+		}
+	}
+
+	std::vector<cl_ulong>().swap(set->row_ptr);
+	std::vector<cl_uint>().swap(set->row_cols);
+	std::vector<cl_float>().swap(set->row_vals);
+	std::vector<cl_ulong>().swap(set->col_ptr);
+	std::vector<cl_uint>().swap(set->col_rows);
+	std::vector<cl_float>().swap(set->col_vals);
+
+	memset(set->key, 0, sizeof(set->key));
+	set->status = SYSMAT_NONE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Memory available for the matrix: the given budget, or by default half the
+// global memory of the device. max_alloc receives the largest single buffer.
+//
+static cl_ulong fSysmatBudget(cl_command_queue* commands, cl_ulong budget, cl_ulong* max_alloc)
+{
+	cl_device_id	device_id;
+	cl_ulong		global_mem = 0;
+
+	clGetCommandQueueInfo(*commands, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device_id, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_GLOBAL_MEM_SIZE,    sizeof(cl_ulong), &global_mem, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), max_alloc,   NULL);
+
+	return(budget > 0 ? budget : global_mem / 2);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocate the recording buffers for at most max_entries coefficients.
+// Returns 1, without allocating, when they do not fit in the budget (bytes,
+// 0 = default); the caller then keeps projecting on the fly.
+//
+int fSysmatRecordBegin(cl_command_queue* commands, cl_mem* coo_ptr, cl_mem* count_ptr, cl_ulong max_entries, cl_ulong budget, cl_bool verbose, char* log_file)
+{
+	cl_int		error;
+	cl_context	context;
+	cl_ulong	max_alloc = 0;
+	cl_ulong	coo_size  = 3 * sizeof(cl_uint) * max_entries;
+	cl_uint		counter[2];
+	FILE*		pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientUnsupported("The cached system matrix", verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeUnsupported("The cached system matrix", verbose, log_file));
+	}
+
+	if (max_entries == 0)
+	{
+		return(-1);
+	}
+
+	// The kernels count with a 32 bit atomic.
+	if (max_entries > 0xFFFFFFFFULL || coo_size > fSysmatBudget(commands, budget, &max_alloc) || coo_size > max_alloc)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: System matrix recording (%llu bytes) exceeds the memory budget, projecting on the fly.\n", (unsigned long long) coo_size);
+			fclose(pfile);
+		}
+		return(1);
+	}
+
+	clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+
+	counter[0] = 0;
+	counter[1] = (cl_uint) max_entries;
+
+	*count_ptr = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(counter), counter, &error);
+
+	if (error == CL_SUCCESS)
+	{
+		*coo_ptr = clCreateBuffer(context, CL_MEM_WRITE_ONLY, coo_size, NULL, &error);
+
+		if (error != CL_SUCCESS)
+		{
+			clReleaseMemObject(*count_ptr);
+			*count_ptr = NULL;
+		}
+	}
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to create system matrix recording buffers! %d \n", error);
+			fclose(pfile);
+		}
+		return(-4);
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Recording up to %llu system matrix coefficients.\n", (unsigned long long) max_entries);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Convert the recorded coefficients into the cached matrix. placement 1 puts
+// it on the device, with half precision weights if use_half is set, 2 keeps
+// it in host memory and 0 picks host memory for CPU devices. key identifies
+// the geometry, see fSysmatProject. Returns 1 when the recording overflowed
+// or the matrix does not fit in the budget.
+//
+int fSysmatBuild(cl_command_queue* commands, cl_mem* coo_ptr, cl_mem* count_ptr, cl_ulong nrows, cl_ulong ncols, cl_ulong view_rows, const cl_ulong* key, cl_bool use_half, cl_int placement, cl_ulong budget, cl_bool verbose, char* log_file)
+{
+	int				result;
+	cl_int			error;
+	cl_context		context;
+	cl_device_id	device_id;
+	cl_device_type	device_type = CL_DEVICE_TYPE_GPU;
+	cl_bool			host;
+	cl_uint		counter[2];
+	cl_ulong	n_entries;
+	cl_ulong	max_alloc = 0;
+	cl_ulong	available;
+	sysmat_set*	set   = NULL;
+	FILE*		pfile = NULL;
+
+	if (nrows == 0 || ncols == 0 || view_rows == 0)
+	{
+		return(-1);
+	}
+
+	result = fSysmatProgram(commands, &set, verbose, log_file);
+	if (result != 0) return(result);
+
+	fReleaseSysmatMatrix(set);
+
+	if (placement == 0)
+	{
+		clGetCommandQueueInfo(*commands, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device_id, NULL);
+		clGetDeviceInfo(device_id, CL_DEVICE_TYPE, sizeof(cl_device_type), &device_type, NULL);
+	}
+	host = (placement == 2) || (placement == 0 && (device_type & CL_DEVICE_TYPE_CPU));
+
+	error = clEnqueueReadBuffer(*commands, *count_ptr, CL_TRUE, 0, sizeof(counter), counter, 0, NULL, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to read system matrix counter! %d \n", error);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+
+	if (counter[0] > counter[1])
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: System matrix recording overflowed (%u > %u), projecting on the fly.\n", counter[0], counter[1]);
+			fclose(pfile);
+		}
+		return(1);
+	}
+
+	n_entries = counter[0];
+
+	std::vector<cl_uint> coo(3 * n_entries);
+
+	if (n_entries > 0)
+	{
+		error = clEnqueueReadBuffer(*commands, *coo_ptr, CL_TRUE, 0, coo.size() * sizeof(cl_uint), &coo[0], 0, NULL, NULL);
+
+		if (error != CL_SUCCESS)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: Failed to read recorded coefficients! %d \n", error);
+				fclose(pfile);
+			}
+			return(-2);
+		}
+	}
+
+	// CSR by counting sort on the row; out of range entries are dropped.
+	std::vector<cl_ulong>	row_ptr(nrows + 1, 0);
+	cl_ulong				nnz = 0;
+
+	for (cl_ulong ii = 0; ii < n_entries; ii++)
+	{
+		if (coo[3*ii] < nrows && coo[3*ii + 1] < ncols)
+		{
+			row_ptr[coo[3*ii] + 1]++;
+			nnz++;
+		}
+	}
+	for (cl_ulong rr = 0; rr < nrows; rr++)
+	{
+		row_ptr[rr + 1] += row_ptr[rr];
+	}
+
+	std::vector<cl_uint>	row_cols(nnz);
+	std::vector<cl_float>	row_vals(nnz);
+	std::vector<cl_ulong>	fill(row_ptr.begin(), row_ptr.end() - 1);
+
+	for (cl_ulong ii = 0; ii < n_entries; ii++)
+	{
+		cl_uint row = coo[3*ii];
+		cl_uint col = coo[3*ii + 1];
+
+		if (row < nrows && col < ncols)
+		{
+			cl_ulong pos = fill[row]++;
+			row_cols[pos] = col;
+			memcpy(&row_vals[pos], &coo[3*ii + 2], sizeof(cl_float));
+		}
+	}
+	std::vector<cl_uint>().swap(coo);
+
+	// Nothing recorded (e.g. a projector built without RECORD_SYSMAT) or
+	// nothing inside the image: an empty matrix would project zeros.
+	if (nnz == 0)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: No system matrix coefficients recorded (%llu entries), projecting on the fly.\n", (unsigned long long) n_entries);
+			fclose(pfile);
+		}
+		return(1);
+	}
+
+	set->nrows     = nrows;
+	set->ncols     = ncols;
+	set->view_rows = view_rows;
+	set->nviews    = (nrows + view_rows - 1) / view_rows;
+	memcpy(set->key, key, sizeof(set->key));
+
+	if (host)
+	{
+		// A^T by counting sort on the column, for race free back projection.
+		cl_ulong host_size = nnz * 2 * (sizeof(cl_uint) + sizeof(cl_float)) + (nrows + ncols + 2) * sizeof(cl_ulong);
+
+		if (budget > 0 && host_size > budget)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Info: System matrix (%llu bytes) exceeds the memory budget, projecting on the fly.\n", (unsigned long long) host_size);
+				fclose(pfile);
+			}
+			return(1);
+		}
+
+		std::vector<cl_ulong>	col_ptr(ncols + 1, 0);
+		std::vector<cl_uint>	col_rows(nnz);
+		std::vector<cl_float>	col_vals(nnz);
+
+		for (cl_ulong ii = 0; ii < nnz; ii++)
+		{
+			col_ptr[row_cols[ii] + 1]++;
+		}
+		for (cl_ulong cc = 0; cc < ncols; cc++)
+		{
+			col_ptr[cc + 1] += col_ptr[cc];
+		}
+		std::vector<cl_ulong> col_fill(col_ptr.begin(), col_ptr.end() - 1);
+		for (cl_ulong rr = 0; rr < nrows; rr++)
+		{
+			for (cl_ulong ii = row_ptr[rr]; ii < row_ptr[rr + 1]; ii++)
+			{
+				cl_ulong pos = col_fill[row_cols[ii]]++;
+				col_rows[pos] = (cl_uint) rr;
+				col_vals[pos] = row_vals[ii];
+			}
+		}
+
+		set->row_ptr.swap(row_ptr);
+		set->row_cols.swap(row_cols);
+		set->row_vals.swap(row_vals);
+		set->col_ptr.swap(col_ptr);
+		set->col_rows.swap(col_rows);
+		set->col_vals.swap(col_vals);
+		set->half   = 0;
+		set->status = SYSMAT_HOST;
+
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: System matrix cached in host memory, %llu coefficients, %llu bytes.\n", (unsigned long long) nnz, (unsigned long long) host_size);
+			fclose(pfile);
+		}
+
+		return(0);
+	}
+
+	// Sliced ELL, one slice per view, as wide as its longest row.
+	std::vector<cl_ulong>	slice_ptr(set->nviews);
+	std::vector<cl_uint>	slice_width(set->nviews);
+	cl_ulong				padded = 0;
+
+	for (cl_ulong vv = 0; vv < set->nviews; vv++)
+	{
+		cl_ulong width = 0;
+
+		for (cl_ulong rr = vv * view_rows; rr < (vv + 1) * view_rows && rr < nrows; rr++)
+		{
+			if (row_ptr[rr + 1] - row_ptr[rr] > width) width = row_ptr[rr + 1] - row_ptr[rr];
+		}
+		slice_ptr[vv]   = padded;
+		slice_width[vv] = (cl_uint) width;
+		padded += width * view_rows;
+	}
+
+	cl_ulong val_size    = padded * (use_half ? sizeof(cl_half) : sizeof(cl_float));
+	cl_ulong device_size = padded * sizeof(cl_uint) + val_size + set->nviews * (sizeof(cl_ulong) + sizeof(cl_uint));
+
+	available = fSysmatBudget(commands, budget, &max_alloc);
+
+	if (device_size > available || padded * sizeof(cl_float) > max_alloc)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: System matrix (%llu bytes) exceeds the memory budget, projecting on the fly.\n", (unsigned long long) device_size);
+			fclose(pfile);
+		}
+		return(1);
+	}
+
+	std::vector<cl_uint>	ell_cols(padded, 0);
+	std::vector<cl_float>	ell_vals(padded, 0.0f);
+
+	fParallelFor(set->nviews, 1, [&](cl_ulong first, cl_ulong last)
+	{
+		for (cl_ulong vv = first; vv < last; vv++)
+		{
+			for (cl_ulong rr = vv * view_rows; rr < (vv + 1) * view_rows && rr < nrows; rr++)
+			{
+				cl_ulong r = rr - vv * view_rows;
+
+				for (cl_ulong kk = 0; kk < row_ptr[rr + 1] - row_ptr[rr]; kk++)
+				{
+					ell_cols[slice_ptr[vv] + kk * view_rows + r] = row_cols[row_ptr[rr] + kk];
+					ell_vals[slice_ptr[vv] + kk * view_rows + r] = row_vals[row_ptr[rr] + kk];
+				}
+			}
+		}
+	});
+
+	clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+
+	cl_int errors[4];
+	set->slice_ptr   = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, set->nviews * sizeof(cl_ulong), &slice_ptr[0],   &errors[0]);
+	set->slice_width = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, set->nviews * sizeof(cl_uint),  &slice_width[0], &errors[1]);
+	set->cols        = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, padded * sizeof(cl_uint),       &ell_cols[0],    &errors[2]);
+	set->vals        = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, padded * sizeof(cl_float),      &ell_vals[0],    &errors[3]);
+
+	error = errors[0] | errors[1] | errors[2] | errors[3];
+
+	if (error == CL_SUCCESS && use_half)
+	{
+		cl_mem		packed;
+		cl_kernel	kernel = set->kernels[SYSMAT_PACK];
+		size_t		global = (size_t) padded;
+
+		packed = clCreateBuffer(context, CL_MEM_READ_WRITE, val_size, NULL, &error);
+
+		if (error == CL_SUCCESS)
+		{
+			error  = clSetKernelArg(kernel, 0, sizeof(cl_mem),   &set->vals);
+			error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),   &packed);
+			error |= clSetKernelArg(kernel, 2, sizeof(cl_ulong), &padded);
+			if (error == CL_SUCCESS) error = clEnqueueNDRangeKernel(*commands, kernel, 1, NULL, &global, NULL, 0, NULL, NULL);
+
+			// Released by the runtime once the pack kernel is done.
+			clReleaseMemObject(set->vals);
+			set->vals = packed;
+		}
+	}
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to upload the system matrix! %d \n", error);
+			fclose(pfile);
+		}
+		fReleaseSysmatMatrix(set);
+		return(-4);
+	}
+
+	set->half   = use_half ? 1 : 0;
+	set->status = SYSMAT_DEVICE;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: System matrix cached on the device, %llu coefficients, %llu bytes (%s weights).\n", (unsigned long long) nnz, (unsigned long long) device_size, use_half ? "half" : "float");
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Host products on mapped registry buffers.
+//
+static int fSysmatHostProject(cl_command_queue* commands, const sysmat_set* set, cl_mem* x_ptr, cl_mem* y_ptr, cl_int* subset, cl_ulong nsubset, cl_bool transpose, cl_bool accumulate, cl_bool verbose, char* log_file)
+{
+	cl_int		error;
+	cl_ulong	view_rows = set->view_rows;
+	cl_ulong	x_size    = transpose ? nsubset * view_rows : set->ncols;
+	cl_ulong	y_size    = transpose ? set->ncols : nsubset * view_rows;
+	cl_float*	x;
+	cl_float*	y;
+	FILE*		pfile = NULL;
+
+	x = (cl_float*) clEnqueueMapBuffer(*commands, *x_ptr, CL_TRUE, CL_MAP_READ, 0, x_size * sizeof(cl_float), 0, NULL, NULL, &error);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to map system matrix input! %d \n", error);
+			fclose(pfile);
+		}
+		return(-2);
+	}
+
+	y = (cl_float*) clEnqueueMapBuffer(*commands, *y_ptr, CL_TRUE, accumulate ? CL_MAP_READ | CL_MAP_WRITE : CL_MAP_WRITE_INVALIDATE_REGION, 0, y_size * sizeof(cl_float), 0, NULL, NULL, &error);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to map system matrix output! %d \n", error);
+			fclose(pfile);
+		}
+		clEnqueueUnmapMemObject(*commands, *x_ptr, x, 0, NULL, NULL);
+		return(-2);
+	}
+
+	if (!transpose)
+	{
+		fParallelFor(nsubset * view_rows, SYSMAT_MIN_ROWS_PER_THREAD, [=](cl_ulong first, cl_ulong last)
+		{
+			for (cl_ulong ii = first; ii < last; ii++)
+			{
+				cl_ulong	v    = ii / view_rows;
+				cl_ulong	row  = (subset ? (cl_ulong) subset[v] : v) * view_rows + ii % view_rows;
+				cl_float	sum  = 0.0f;
+
+				if (row < set->nrows)
+				{
+					for (cl_ulong kk = set->row_ptr[row]; kk < set->row_ptr[row + 1]; kk++)
+					{
+						sum += set->row_vals[kk] * x[set->row_cols[kk]];
+					}
+				}
+				y[ii] = accumulate ? y[ii] + sum : sum;
+			}
+		});
+	}
+	else
+	{
+		// Position of each view in the subset sinogram, -1 when absent.
+		std::vector<cl_long> position(set->nviews, -1);
+
+		for (cl_ulong vv = 0; vv < nsubset; vv++)
+		{
+			cl_ulong view = subset ? (cl_ulong) subset[vv] : vv;
+			if (view < set->nviews) position[view] = (cl_long) vv;
+		}
+
+		const cl_long* pos = &position[0];
+
+		fParallelFor(set->ncols, SYSMAT_MIN_ROWS_PER_THREAD, [=](cl_ulong first, cl_ulong last)
+		{
+			for (cl_ulong cc = first; cc < last; cc++)
+			{
+				cl_float sum = 0.0f;
+
+				for (cl_ulong kk = set->col_ptr[cc]; kk < set->col_ptr[cc + 1]; kk++)
+				{
+					cl_ulong row = set->col_rows[kk];
+					cl_long  p   = pos[row / view_rows];
+
+					if (p >= 0) sum += set->col_vals[kk] * x[p * view_rows + row % view_rows];
+				}
+				y[cc] = accumulate ? y[cc] + sum : sum;
+			}
+		});
+	}
+
+	clEnqueueUnmapMemObject(*commands, *y_ptr, y, 0, NULL, NULL);
+	clEnqueueUnmapMemObject(*commands, *x_ptr, x, 0, NULL, NULL);
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Forward (y = A x) or back (y = A^T x) projection with the cached matrix.
+// The sinogram side holds the nsubset views of subset (all views in order
+// when use_subset is not set), in the (det, plane, angle) layout. key must
+// match the one the matrix was built with, so that a matrix of another
+// geometry or image size is never applied.
+//
+int fSysmatProject(cl_command_queue* commands, cl_mem* x_ptr, cl_mem* y_ptr, cl_mem* subset_ptr, cl_bool use_subset, cl_ulong nsubset, const cl_ulong* key, cl_bool transpose, cl_bool accumulate, cl_bool verbose, char* log_file)
+{
+	cl_int		error = CL_SUCCESS;
+	cl_int		flag  = use_subset ? 1 : 0;
+	cl_int		trans = transpose ? 1 : 0;
+	cl_int		accum = accumulate ? 1 : 0;
+	size_t		global;
+	cl_kernel	kernel;
+	sysmat_set*	set   = fSysmatFind(commands);
+	FILE*		pfile = NULL;
+
+	if (set == NULL || set->status == SYSMAT_NONE)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: No cached system matrix!\n");
+			fclose(pfile);
+		}
+		return(-1);
+	}
+
+	if (memcmp(key, set->key, sizeof(set->key)) != 0)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: The cached system matrix was recorded for another geometry!\n");
+			fclose(pfile);
+		}
+		return(-13);
+	}
+
+	if (set->status == SYSMAT_HOST)
+	{
+		std::vector<cl_int> subset;
+
+		if (use_subset)
+		{
+			subset.resize(nsubset);
+			error = clEnqueueReadBuffer(*commands, *subset_ptr, CL_TRUE, 0, nsubset * sizeof(cl_int), &subset[0], 0, NULL, NULL);
+			if (error != CL_SUCCESS) return(-2);
+		}
+
+		return(fSysmatHostProject(commands, set, x_ptr, y_ptr, use_subset ? &subset[0] : NULL, nsubset, transpose, accumulate, verbose, log_file));
+	}
+
+	if (transpose && !accumulate)
+	{
+		cl_float zero = 0.0f;
+
+		error = clEnqueueFillBuffer(*commands, *y_ptr, &zero, sizeof(cl_float), 0, set->ncols * sizeof(cl_float), 0, NULL, NULL);
+
+		if (error != CL_SUCCESS)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: Failed to clear back projection! %d \n", error);
+				fclose(pfile);
+			}
+			return(-5);
+		}
+	}
+
+	kernel = set->kernels[SYSMAT_SPMV];
+	error |= clSetKernelArg(kernel,  0, sizeof(cl_mem),   &set->slice_ptr);
+	error |= clSetKernelArg(kernel,  1, sizeof(cl_mem),   &set->slice_width);
+	error |= clSetKernelArg(kernel,  2, sizeof(cl_mem),   &set->cols);
+	error |= clSetKernelArg(kernel,  3, sizeof(cl_mem),   &set->vals);
+	error |= clSetKernelArg(kernel,  4, sizeof(cl_uint),  &set->half);
+	error |= clSetKernelArg(kernel,  5, sizeof(cl_mem),   x_ptr);
+	error |= clSetKernelArg(kernel,  6, sizeof(cl_mem),   y_ptr);
+	// The subset argument must be a valid buffer, even when it is not used.
+	error |= clSetKernelArg(kernel,  7, sizeof(cl_mem),   use_subset ? subset_ptr : &set->slice_width);
+	error |= clSetKernelArg(kernel,  8, sizeof(cl_int),   &flag);
+	error |= clSetKernelArg(kernel,  9, sizeof(cl_ulong), &set->view_rows);
+	error |= clSetKernelArg(kernel, 10, sizeof(cl_ulong), &set->nrows);
+	error |= clSetKernelArg(kernel, 11, sizeof(cl_int),   &trans);
+	error |= clSetKernelArg(kernel, 12, sizeof(cl_int),   &accum);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to set system matrix arguments! %d.\n", error);
+			fclose(pfile);
+		}
+		return(-12);
+	}
+
+	global = (size_t) (nsubset * set->view_rows);
+
+	error = clEnqueueNDRangeKernel(*commands, kernel, 1, NULL, &global, NULL, 0, NULL, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to execute system matrix kernel! %d \n", error);
+			fclose(pfile);
+		}
+		return(-11);
+	}
+
+	clFlush(*commands);
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 0: no matrix cached, 1: on the device, 2: in host memory, for the context
+// of the command queue. key receives the key of the cached matrix.
+//
+int fSysmatStatus(cl_command_queue* commands, cl_int* status, cl_ulong* size, cl_ulong* key)
+{
+	sysmat_set* set = fSysmatFind(commands);
+
+	if (set == NULL)
+	{
+		*status = SYSMAT_NONE;
+		size[0] = size[1] = size[2] = 0;
+		memset(key, 0, SYSMAT_KEY_SIZE * sizeof(cl_ulong));
+		return(0);
+	}
+
+	*status = set->status;
+	size[0] = set->nrows;
+	size[1] = set->ncols;
+	size[2] = set->view_rows;
+	memcpy(key, set->key, sizeof(set->key));
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Release the cached matrix, the kernels and the program of the context of
+// the queue; other contexts keep theirs.
+//
+int fReleaseSysmat(cl_command_queue* commands, cl_bool verbose, char* log_file)
+{
+	cl_context	context;
+	FILE*		pfile = NULL;
+
+	if (fClientActive() || fNativeQueue(commands))
+	{
+		return(0);
+	}
+
+	if (clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL) != CL_SUCCESS)
+	{
+		return(0);
+	}
+
+	std::map<cl_context, sysmat_set>::iterator it = sysmat_sets.find(context);
+	if (it == sysmat_sets.end())
+	{
+		return(0);
+	}
+
+	fReleaseSysmatMatrix(&it->second);
+
+	for (int ii = 0; ii < SYSMAT_KERNELS; ii++)
+	{
+		if (it->second.kernels[ii] != NULL)
+		{
+			clReleaseKernel(it->second.kernels[ii]);
+		}
+	}
+
+	clReleaseProgram(it->second.program);
+	sysmat_sets.erase(it);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: System matrix released.\n");
+		fclose(pfile);
+	}
+
+	return(0);
+}
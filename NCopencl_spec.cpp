@@ -0,0 +1,375 @@
+// NCopencl_spec.cpp : Geometry-specialized kernel variants. Arguments that stay
+// fixed for a whole reconstruction (image and sinogram size, voxel size, ...)
+// can be compiled into the program as constants. fBuildKernels takes
+//
+//	-specialize=<index>:<type>:<name>[,<index>:<type>:<name>...]
+//
+// in the compile options of a kernel (type int, uint, float or a 2/4 vector
+// of those). The kernel is built as usual; the values set for those arguments
+// are recorded, and a launch with all of them set runs a variant built with
+//
+//	-D SPECIALIZED -D SPEC_<name>=<value>
+//
+// e.g. -D SPEC_size_img=(uint4)(256u,256u,64u,0u). Variants are cached per
+// kernel by the values, so alternating geometries each compile once. All
+// arguments are still set on the variant, so a kernel only has to prefer the
+// constant when it is there:
+//
+//	#ifdef SPEC_size_img
+//		const uint4 size_img = SPEC_size_img;
+//	#else
+//		const uint4 size_img = size_img_arg;
+//	#endif
+//
+// Floating point values are written as hexadecimal literals, exactly the bits
+// that were set (as_float() for infinities and NaN).
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <mutex>
+#include <string>
+
+// Variants per kernel; later geometries run the generic kernel
+#define MAX_SPEC_VARIANTS 8
+
+typedef struct {
+	cl_uint				index;
+	char				base;		// 'i', 'u' or 'f'
+	cl_uint				width;		// 1, 2 or 4
+	std::string			name;
+} spec_arg;
+
+typedef struct {
+	cl_bool				set;
+	cl_bool				local;		// size only (__local)
+	cl_uint				generation;
+	std::string			value;
+} spec_value;
+
+typedef struct {
+	std::string			key;
+	cl_program			program;
+	cl_kernel			kernel;
+	std::vector<cl_uint>	applied;	// generation of each argument on this variant
+} spec_variant;
+
+typedef struct {
+	cl_kernel			kernel;
+	cl_context			context;
+	cl_device_id		device_id;
+	std::string			source;
+	std::string			options;
+	std::string			function_name;
+	std::vector<spec_arg>		args;
+	std::vector<spec_value>		values;
+	std::vector<spec_variant>	variants;
+	cl_bool				full;		// MAX_SPEC_VARIANTS reached, logged once
+} spec_kernel;
+
+static std::mutex					spec_lock;
+static std::vector<spec_kernel*>	spec_kernels;
+
+static spec_kernel* fSpecFind(cl_kernel kernel)
+{
+	for (size_t ii = 0; ii < spec_kernels.size(); ii++)
+	{
+		if (spec_kernels[ii]->kernel == kernel) return(spec_kernels[ii]);
+	}
+	return(NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Take the -specialize=... token out of the compile options.
+//
+void fSpecStrip(const char* options, std::string& stripped, std::string& spec)
+{
+	const char*	token = strstr(options, "-specialize=");
+	const char*	end;
+
+	spec.clear();
+	if (token == NULL)
+	{
+		stripped = options;
+		return;
+	}
+
+	end = token;
+	while (*end != 0 && *end != ' ' && *end != '\t') end++;
+
+	spec.assign(token + strlen("-specialize="), end);
+	stripped.assign(options, token);
+	stripped += end;
+}
+
+// One <index>:<type>:<name> entry.
+static cl_bool fSpecParseArg(const std::string& entry, spec_arg* arg)
+{
+	size_t	first = entry.find(':');
+	size_t	second = entry.find(':', first + 1);
+
+	if (first == std::string::npos || second == std::string::npos || second + 1 >= entry.size()) return(CL_FALSE);
+
+	std::string type = entry.substr(first + 1, second - first - 1);
+	arg->index	= (cl_uint) atoi(entry.substr(0, first).c_str());
+	arg->name	= entry.substr(second + 1);
+
+	if		(type.compare(0, 3, "int") == 0)	{ arg->base = 'i'; type = type.substr(3); }
+	else if (type.compare(0, 4, "uint") == 0)	{ arg->base = 'u'; type = type.substr(4); }
+	else if (type.compare(0, 5, "float") == 0)	{ arg->base = 'f'; type = type.substr(5); }
+	else return(CL_FALSE);
+
+	if		(type == "")	arg->width = 1;
+	else if (type == "2")	arg->width = 2;
+	else if (type == "4")	arg->width = 4;
+	else return(CL_FALSE);
+
+	return(CL_TRUE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Register a freshly built kernel for specialization; options are the ones it
+// was built with (without the -specialize token).
+//
+int fSpecRegister(cl_kernel kernel, cl_context context, cl_device_id device_id, const char* source, const char* options, const char* function_name, const std::string& spec, cl_bool verbose, char* log_file)
+{
+	spec_kernel*	record = new spec_kernel;
+	spec_arg		arg;
+	cl_uint			n_args = 0;
+	size_t			start = 0;
+	size_t			comma;
+	FILE*			pfile = NULL;
+
+	clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(cl_uint), &n_args, NULL);
+
+	while (start < spec.size())
+	{
+		comma = spec.find(',', start);
+		if (comma == std::string::npos) comma = spec.size();
+
+		if (!fSpecParseArg(spec.substr(start, comma - start), &arg) || arg.index >= n_args)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: Invalid specialization '%s' of kernel %s (%u arguments).\n", spec.substr(start, comma - start).c_str(), function_name, n_args);
+				fclose(pfile);
+			}
+			delete record;
+			return(-11);
+		}
+		record->args.push_back(arg);
+		start = comma + 1;
+	}
+
+	record->kernel			= kernel;
+	record->context			= context;
+	record->device_id		= device_id;
+	record->source			= source;
+	record->options			= options;
+	record->function_name	= function_name;
+	record->full			= CL_FALSE;
+	record->values.resize(n_args);
+	for (cl_uint ii = 0; ii < n_args; ii++)
+	{
+		record->values[ii].set			= CL_FALSE;
+		record->values[ii].local		= CL_FALSE;
+		record->values[ii].generation	= 0;
+	}
+
+	std::lock_guard<std::mutex> lock(spec_lock);
+	spec_kernels.push_back(record);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Kernel %s specializes %d arguments.\n", function_name, (int) record->args.size());
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Record an argument set on a specialized kernel; others are ignored.
+//
+void fSpecSetArg(cl_kernel kernel, cl_uint arg_index, cl_ulong arg_size, void* arg_value)
+{
+	std::lock_guard<std::mutex> lock(spec_lock);
+	spec_kernel*	record = fSpecFind(kernel);
+
+	if (record == NULL || arg_index >= record->values.size()) return;
+
+	spec_value*		value = &record->values[arg_index];
+
+	value->set		= CL_TRUE;
+	value->local	= arg_value == NULL;
+	value->generation++;
+	if (arg_value != NULL) value->value.assign((const char*) arg_value, (size_t) arg_size);
+	else value->value.assign((size_t) arg_size, '\0');
+}
+
+// -D SPEC_<name>=<literal> for the recorded value of one argument.
+static void fSpecDefine(const spec_arg* arg, const std::string& value, std::string& options)
+{
+	char	literal[64];
+	cl_uint	word;
+	float	number;
+
+	options += " -D SPEC_" + arg->name + "=";
+	if (arg->width > 1)
+	{
+		options += std::string("(") + (arg->base == 'i' ? "int" : arg->base == 'u' ? "uint" : "float");
+		sprintf(literal, "%u)(", arg->width);
+		options += literal;
+	}
+
+	for (cl_uint ii = 0; ii < arg->width; ii++)
+	{
+		memcpy(&word, value.data() + 4 * ii, 4);
+		if (arg->base == 'f')
+		{
+			memcpy(&number, &word, 4);
+			if (isfinite(number)) sprintf(literal, "(%af)", (double) number);
+			else sprintf(literal, "as_float(0x%08xu)", word);
+		}
+		else if (arg->base == 'i') sprintf(literal, "(%d)", (cl_int) word);
+		else sprintf(literal, "%uu", word);
+
+		if (ii > 0) options += ",";
+		options += literal;
+	}
+	if (arg->width > 1) options += ")";
+}
+
+static int fSpecBuild(spec_kernel* record, const std::string& key, spec_variant* variant, cl_bool verbose, char* log_file)
+{
+	cl_int			error;
+	const char*		source = record->source.c_str();
+	size_t			source_size = record->source.size();
+	std::string		options = record->options + " -D SPECIALIZED";
+	size_t			offset = 0;
+	FILE*			pfile = NULL;
+
+	for (size_t ii = 0; ii < record->args.size(); ii++)
+	{
+		fSpecDefine(&record->args[ii], key.substr(offset, 4 * record->args[ii].width), options);
+		offset += 4 * record->args[ii].width;
+	}
+
+	variant->key		= key;
+	variant->kernel		= NULL;
+	variant->program	= clCreateProgramWithSource(record->context, 1, &source, &source_size, &error);
+	if (error == CL_SUCCESS) error = clBuildProgram(variant->program, 1, &record->device_id, options.c_str(), NULL, NULL);
+	if (error == CL_SUCCESS) variant->kernel = clCreateKernel(variant->program, record->function_name.c_str(), &error);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to build specialized kernel %s! %d Options:\n%s\n", record->function_name.c_str(), error, options.c_str());
+			fclose(pfile);
+		}
+		if (variant->program != NULL) clReleaseProgram(variant->program);
+		variant->program = NULL;
+		return(-9);
+	}
+
+	variant->applied.assign(record->values.size(), 0);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Specialized kernel %s built. Options:\n%s\n", record->function_name.c_str(), options.c_str());
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Kernel to launch in place of kernel: the variant for the recorded values of
+// its specialized arguments, with the current arguments, or kernel itself.
+//
+cl_kernel fSpecKernel(cl_kernel kernel, cl_bool verbose, char* log_file)
+{
+	std::lock_guard<std::mutex> lock(spec_lock);
+	spec_kernel*	record = fSpecFind(kernel);
+	spec_variant*	variant = NULL;
+	spec_variant	built;
+	std::string		key;
+	FILE*			pfile = NULL;
+
+	if (record == NULL) return(kernel);
+
+	for (size_t ii = 0; ii < record->args.size(); ii++)
+	{
+		const spec_value* value = &record->values[record->args[ii].index];
+		if (!value->set || value->local || value->value.size() != 4 * record->args[ii].width) return(kernel);
+		key += value->value;
+	}
+
+	for (size_t ii = 0; ii < record->variants.size(); ii++)
+	{
+		if (record->variants[ii].key == key) variant = &record->variants[ii];
+	}
+	if (variant != NULL && variant->kernel == NULL) return(kernel);	// failed to build before
+
+	if (variant == NULL)
+	{
+		if (record->variants.size() >= MAX_SPEC_VARIANTS)
+		{
+			if (verbose && !record->full)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Info: %d variants of kernel %s, further geometries run generic.\n", MAX_SPEC_VARIANTS, record->function_name.c_str());
+				fclose(pfile);
+			}
+			record->full = CL_TRUE;
+			return(kernel);
+		}
+		// A failed build is kept (without kernel) so it is not retried
+		fSpecBuild(record, key, &built, verbose, log_file);
+		record->variants.push_back(built);
+		variant = &record->variants.back();
+		if (variant->kernel == NULL) return(kernel);
+	}
+
+	// Bring the variant's arguments up to date
+	for (cl_uint ii = 0; ii < record->values.size(); ii++)
+	{
+		const spec_value* value = &record->values[ii];
+		if (!value->set || variant->applied[ii] == value->generation) continue;
+
+		clSetKernelArg(variant->kernel, ii, value->value.size(), value->local ? NULL : value->value.data());
+		variant->applied[ii] = value->generation;
+	}
+
+	return(variant->kernel);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The kernel is released: release its variants.
+//
+void fSpecForget(cl_kernel kernel)
+{
+	std::lock_guard<std::mutex> lock(spec_lock);
+
+	for (size_t ii = 0; ii < spec_kernels.size(); ii++)
+	{
+		if (spec_kernels[ii]->kernel != kernel) continue;
+
+		for (size_t jj = 0; jj < spec_kernels[ii]->variants.size(); jj++)
+		{
+			if (spec_kernels[ii]->variants[jj].kernel == NULL) continue;
+			clReleaseKernel(spec_kernels[ii]->variants[jj].kernel);
+			clReleaseProgram(spec_kernels[ii]->variants[jj].program);
+		}
+		delete spec_kernels[ii];
+		spec_kernels.erase(spec_kernels.begin() + ii);
+		break;
+	}
+}
@@ -0,0 +1,309 @@
+// NCopencl_svm.cpp : Shared virtual memory (OpenCL 2.0) behind buffers[] slots.
+// fSvmCreate allocates with clSVMAlloc and wraps the allocation in a
+// CL_MEM_USE_HOST_PTR buffer, so the slot works with every entry point;
+// kernel arguments are set with clSetKernelArgSVMPointer, and buffer reads
+// and writes become a host copy (fine grained) or an SVM copy (coarse
+// grained), none at all when the host memory is the allocation itself.
+//
+// The granularity is taken from CL_DEVICE_SVM_CAPABILITIES unless asked for:
+// fine grained system (the host memory given is used as is), else fine
+// grained buffer, else coarse grained buffer. Fine grained memory is shared
+// with the host without map/unmap (NCOCL_SVM_ARRAY in NCopencl_dlm.cpp).
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <map>
+#include <mutex>
+
+typedef struct {
+	void*		ptr;
+	cl_ulong	size;
+	cl_context	context;
+	cl_uint		granularity;	// SVM_*
+} svm_entry;
+
+static std::mutex					svm_lock;
+static std::map<cl_mem, svm_entry>	svm;
+
+static const char* fSvmName(cl_uint granularity)
+{
+	switch (granularity)
+	{
+	case SVM_COARSE:	return("coarse grained buffer");
+	case SVM_FINE:		return("fine grained buffer");
+	case SVM_SYSTEM:	return("fine grained system");
+	default:			return("none");
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Create an SVM buffer in *mem_ptr, filled with content (if not NULL).
+// Returns the granularity used (SVM_*), -4 if the device has none that fits.
+//
+int fSvmCreate(cl_command_queue* commands, cl_mem* mem_ptr, void* content, cl_ulong content_size, cl_int read_write, cl_uint mode, cl_bool verbose, char* log_file)
+{
+	FILE*			pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientUnsupported("Shared virtual memory", verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeUnsupported("Shared virtual memory", verbose, log_file));
+	}
+
+#ifdef CL_VERSION_2_0
+	cl_int						error;
+	cl_context					context;
+	cl_device_id				device_id;
+	cl_device_svm_capabilities	caps = 0;
+	cl_mem_flags				mem_flags;
+	cl_uint						granularity = 0;
+	void*						ptr = NULL;
+
+	clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+	clGetCommandQueueInfo(*commands, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device_id, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_SVM_CAPABILITIES, sizeof(caps), &caps, NULL);
+
+	// Fastest granularity of the device, or the one asked for if it has it
+	if ((mode == SVM_AUTO || mode == SVM_SYSTEM) && (caps & CL_DEVICE_SVM_FINE_GRAIN_SYSTEM) && content != NULL)
+	{
+		granularity = SVM_SYSTEM;
+	}
+	else if ((mode == SVM_AUTO || mode == SVM_FINE) && (caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER))
+	{
+		granularity = SVM_FINE;
+	}
+	else if ((mode == SVM_AUTO || mode == SVM_COARSE) && (caps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER))
+	{
+		granularity = SVM_COARSE;
+	}
+
+	if (granularity == 0)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: No shared virtual memory for mode %u (device capabilities 0x%llx)!\n", mode, (unsigned long long) caps);
+			fclose(pfile);
+		}
+		return(-4);
+	}
+
+	switch (read_write)
+	{
+		case 1 :
+			mem_flags = CL_MEM_WRITE_ONLY;
+			break;
+		case 2 :
+			mem_flags = CL_MEM_READ_ONLY;
+			break;
+		default:
+			mem_flags = CL_MEM_READ_WRITE;
+	}
+
+	if (granularity == SVM_SYSTEM)
+	{
+		ptr = content;
+	}
+	else
+	{
+		ptr = clSVMAlloc(context, mem_flags | (granularity == SVM_FINE ? CL_MEM_SVM_FINE_GRAIN_BUFFER : 0), (size_t) content_size, 0);
+		if (ptr == NULL)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: Failed to allocate %llu bytes of shared virtual memory!\n", (unsigned long long) content_size);
+				fclose(pfile);
+			}
+			return(-2);
+		}
+
+		if (content != NULL)
+		{
+			if (granularity == SVM_FINE)
+			{
+				memcpy(ptr, content, (size_t) content_size);
+			}
+			else
+			{
+				clEnqueueSVMMemcpy(*commands, CL_TRUE, ptr, content, (size_t) content_size, 0, NULL, NULL);
+			}
+		}
+	}
+
+	// The buffer uses the SVM allocation (CL_MEM_USES_SVM_POINTER)
+	*mem_ptr = clCreateBuffer(context, mem_flags | CL_MEM_USE_HOST_PTR, (size_t) content_size, ptr, &error);
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to allocate buffer on shared virtual memory! %d \n", error);
+			fclose(pfile);
+		}
+		if (granularity != SVM_SYSTEM) clSVMFree(context, ptr);
+		return(-2);
+	}
+
+	svm_entry entry;
+	entry.ptr			= ptr;
+	entry.size			= content_size;
+	entry.context		= context;
+	entry.granularity	= granularity;
+	clRetainContext(context);
+	{
+		std::lock_guard<std::mutex> lock(svm_lock);
+		svm[*mem_ptr] = entry;
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Buffer of %llu bytes on shared virtual memory (%s).\n", (unsigned long long) content_size, fSvmName(granularity));
+		fclose(pfile);
+	}
+
+	return((int) granularity);
+#else
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Error: Shared virtual memory needs OpenCL 2.0 headers.\n");
+		fclose(pfile);
+	}
+	return(-4);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SVM allocation of a buffer and its granularity, NULL if it has none
+//
+void* fSvmPointer(cl_mem mem, cl_uint* granularity, cl_ulong* size)
+{
+	std::lock_guard<std::mutex> lock(svm_lock);
+
+	std::map<cl_mem, svm_entry>::iterator it = svm.find(mem);
+	if (it == svm.end()) return(NULL);
+
+	if (granularity != NULL) *granularity = it->second.granularity;
+	if (size != NULL) *size = it->second.size;
+	return(it->second.ptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Buffer read or write of an SVM buffer: a host copy when fine grained, none
+// when content is the allocation itself.
+//
+int fSvmTransfer(cl_command_queue* commands, cl_mem mem, void* content, cl_ulong content_size, cl_bool write, cl_bool verbose, char* log_file)
+{
+	cl_uint		granularity = 0;
+	cl_ulong	size = 0;
+	void*		ptr = fSvmPointer(mem, &granularity, &size);
+	cl_ulong	tile_status[4];
+	FILE*		pfile = NULL;
+
+	if (ptr == NULL) return(-1);
+	if (content_size > size) content_size = size;
+
+	// The tiles of a launch without wait may still be using the memory; its
+	// result is left for the caller's fTileWait
+	if (fTileProgress(commands, tile_status) == TILE_RUNNING)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Shared virtual memory transfer while a tiled launch is running, wait for it first!\n");
+			fclose(pfile);
+		}
+		return(-5);
+	}
+
+	if (content != ptr)
+	{
+#ifdef CL_VERSION_2_0
+		if (granularity == SVM_COARSE)
+		{
+			clEnqueueSVMMemcpy(*commands, CL_TRUE, write ? ptr : content, write ? content : ptr, (size_t) content_size, 0, NULL, NULL);
+		}
+		else
+#endif
+		{
+			// Kernels have finished (fExecuteKernel waits for them)
+			memcpy(write ? ptr : content, write ? content : ptr, (size_t) content_size);
+		}
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: %llu bytes %s shared virtual memory%s.\n", (unsigned long long) content_size, write ? "written to" : "read from",
+				content == ptr ? " (in place)" : "");
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Set an SVM buffer as kernel argument by its allocation. Specialized
+// variants get the buffer itself, which uses the same memory.
+//
+int fSvmSetArg(cl_kernel kernel, cl_uint arg_index, cl_mem mem, cl_bool verbose, char* log_file)
+{
+	cl_int	error = CL_INVALID_OPERATION;
+	FILE*	pfile = NULL;
+
+#ifdef CL_VERSION_2_0
+	error = clSetKernelArgSVMPointer(kernel, arg_index, fSvmPointer(mem, NULL, NULL));
+#endif
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to set kernel argument on shared virtual memory! %d.\n", error);
+			fclose(pfile);
+		}
+		return(-3);
+	}
+
+	fSpecSetArg(kernel, arg_index, sizeof(cl_mem), &mem);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Kernel argument set (shared virtual memory).\n");
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Free the allocation of a released SVM buffer
+//
+void fSvmRelease(cl_mem mem)
+{
+	svm_entry	entry;
+
+	{
+		std::lock_guard<std::mutex> lock(svm_lock);
+
+		std::map<cl_mem, svm_entry>::iterator it = svm.find(mem);
+		if (it == svm.end()) return;
+		entry = it->second;
+		svm.erase(it);
+	}
+
+#ifdef CL_VERSION_2_0
+	if (entry.granularity != SVM_SYSTEM) clSVMFree(entry.context, entry.ptr);
+#endif
+	clReleaseContext(entry.context);
+}
@@ -0,0 +1,369 @@
+// NCopencl_tile.cpp : Tiled kernel launches. The global range is cut along its
+// last dimension larger than 1 (the views of a projection) into tiles that are
+// launched with a global work offset, so a long projection becomes a stream of
+// short kernels: no single launch runs into a driver watchdog, and work of
+// other sessions on the device gets in between tiles. Kernels see the same
+// get_global_id values as with a single launch.
+//
+// At most in_flight tiles are queued at a time, the next one is queued when the
+// oldest has finished. A tile size of 0 adapts it: the first tile is small,
+// the next ones are sized from the measured time per slice so that a tile runs
+// for about TILE_TARGET_MS.
+//
+// A tiled launch runs on the calling thread, or without wait on a worker
+// thread (one launch per queue); fTileProgress reports the slices done and
+// fTileCancel stops the launch once the tiles in flight have finished. Kernel
+// arguments, and the buffers the kernel uses, must be left alone until
+// fTileWait; buffers of the buffers[] slots stay on the device until then.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define TILE_TARGET_MS	50		// adaptive tiles run for about this long
+#define TILE_FIRST		256		// the first adaptive tile is 1/TILE_FIRST of the range
+
+typedef struct {
+	cl_command_queue		queue;
+	cl_kernel				kernel;			// retained for the launch
+	cl_uint					work_dim;
+	cl_uint					dim;			// dimension cut into tiles
+	size_t					global[3];
+	size_t					local[3];
+	cl_bool					use_local;
+	cl_ulong				tile;			// slices per tile, 0 adaptive
+	cl_uint					in_flight;
+	std::atomic<cl_ulong>	done;			// slices finished
+	std::atomic<cl_ulong>	size;			// current slices per tile
+	std::atomic<int>		state;			// TILE_*
+	std::atomic<bool>		cancel;
+	int						result;
+	cl_ulong				held;			// slots kept on the device (fResidencyLaunch)
+	std::thread*			worker;
+} tile_job;
+
+typedef struct {
+	cl_event				event;
+	cl_ulong				slices;
+	std::chrono::steady_clock::time_point	queued;
+} tile_chunk;
+
+static std::mutex							tile_lock;
+static std::map<cl_command_queue, tile_job*>	tile_jobs;
+
+///////////////////////////////////////////////////////////////////////////////
+// Seconds a finished tile ran on the device; from the host clock when the
+// queue has no profiling, counted from when the tile before it finished.
+//
+static double fTileSeconds(tile_chunk* chunk, std::chrono::steady_clock::time_point previous)
+{
+	cl_ulong	start = 0;
+	cl_ulong	end = 0;
+
+	if (clGetEventProfilingInfo(chunk->event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL) == CL_SUCCESS &&
+		clGetEventProfilingInfo(chunk->event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL) == CL_SUCCESS && end > start)
+	{
+		return((end - start) * 1e-9);
+	}
+
+	if (previous < chunk->queued) previous = chunk->queued;
+	return(std::chrono::duration<double>(std::chrono::steady_clock::now() - previous).count());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Launch all tiles of a job, at most in_flight queued at a time
+//
+static void fTileRun(tile_job* job, cl_bool verbose, std::string log_file)
+{
+	std::deque<tile_chunk>	pending;
+	cl_int					error = CL_SUCCESS;
+	cl_int					status;
+	cl_ulong				total = job->global[job->dim];
+	cl_ulong				step = job->use_local ? job->local[job->dim] : 1;
+	cl_ulong				next = 0;
+	cl_ulong				n_tiles = 0;
+	cl_ulong				largest = 0;
+	cl_ulong				tile;
+	FILE*					pfile = NULL;
+
+	std::chrono::steady_clock::time_point	previous = std::chrono::steady_clock::now();
+
+	if (step == 0) step = 1;
+	tile = job->tile > 0 ? job->tile : total / TILE_FIRST;
+	tile = (tile + step - 1) / step * step;
+	if (tile < step) tile = step;
+	job->size = tile;
+
+	while (error == CL_SUCCESS && (next < total || !pending.empty()))
+	{
+		// Queue tiles up to the bound
+		while (next < total && pending.size() < job->in_flight && !job->cancel)
+		{
+			size_t		offset[3] = {0, 0, 0};
+			size_t		global[3] = {job->global[0], job->global[1], job->global[2]};
+			tile_chunk	chunk;
+
+			chunk.slices = total - next < tile ? total - next : tile;
+			offset[job->dim] = (size_t) next;
+			global[job->dim] = (size_t) chunk.slices;
+			chunk.queued = std::chrono::steady_clock::now();
+
+			error = clEnqueueNDRangeKernel(job->queue, job->kernel, job->work_dim, offset, global, job->use_local ? job->local : NULL, 0, NULL, &chunk.event);
+			if (error != CL_SUCCESS) break;
+			clFlush(job->queue);
+
+			pending.push_back(chunk);
+			next += chunk.slices;
+			n_tiles++;
+			if (chunk.slices > largest) largest = chunk.slices;
+		}
+
+		if (pending.empty()) break;
+
+		// Wait for the oldest tile
+		tile_chunk chunk = pending.front();
+		pending.pop_front();
+
+		status = CL_COMPLETE;
+		if (clWaitForEvents(1, &chunk.event) != CL_SUCCESS ||
+			clGetEventInfo(chunk.event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL) != CL_SUCCESS || status < 0)
+		{
+			if (error == CL_SUCCESS) error = status < 0 ? status : CL_INVALID_EVENT;
+		}
+		else
+		{
+			job->done += chunk.slices;
+
+			// Size the next tiles for the target time, growing at most 4 times at once
+			double seconds = fTileSeconds(&chunk, previous);
+			previous = std::chrono::steady_clock::now();
+			if (job->tile == 0 && seconds > 0)
+			{
+				double	slices = chunk.slices * (TILE_TARGET_MS * 1e-3) / seconds;
+				if (slices > 4.0 * tile) slices = 4.0 * tile;
+				tile = (cl_ulong) slices / step * step;
+				if (tile < step) tile = step;
+				if (tile > total) tile = total;
+				job->size = tile;
+			}
+		}
+		clReleaseEvent(chunk.event);
+	}
+
+	// On an error, let the tiles already queued finish before returning
+	if (!pending.empty())
+	{
+		clFinish(job->queue);
+		for (size_t ii = 0; ii < pending.size(); ii++) clReleaseEvent(pending[ii].event);
+	}
+
+	if (error != CL_SUCCESS)
+	{
+		job->result = -2;
+		job->state = TILE_FAILED;
+	}
+	else if (job->done < total)
+	{
+		job->result = 1;
+		job->state = TILE_CANCELLED;
+	}
+	else
+	{
+		job->result = 0;
+		job->state = TILE_DONE;
+	}
+
+	if (verbose)
+	{
+		pfile = fopen(log_file.c_str(), "a");
+		if (error != CL_SUCCESS)
+		{
+			fprintf(pfile, "Error: Failed to execute kernel tile at %llu of %llu! %d \n", (unsigned long long) next,
+					(unsigned long long) total, error);
+		}
+		else
+		{
+			fprintf(pfile, "Info: Kernel executed in %llu tiles of up to %llu slices (dimension %u, %u in flight)%s.\n",
+					(unsigned long long) n_tiles, (unsigned long long) largest, job->dim, job->in_flight, job->state == TILE_CANCELLED ? ", cancelled" : "");
+			fprintf(pfile, "Info: Global size: %u, %u, %u, %llu of %llu slices done.\n", (cl_uint) job->global[0], (cl_uint) job->global[1],
+					(cl_uint) job->global[2], (unsigned long long) job->done, (unsigned long long) total);
+		}
+		fclose(pfile);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Wait for the tiled launch of a queue (if any) and forget it. Returns its
+// result: 0, 1 if it was cancelled, negative if it failed.
+//
+int fTileWait(cl_command_queue* commands, cl_bool verbose, char* log_file)
+{
+	tile_job*	job = NULL;
+	int			result;
+	FILE*		pfile = NULL;
+
+	{
+		std::lock_guard<std::mutex> lock(tile_lock);
+
+		std::map<cl_command_queue, tile_job*>::iterator it = tile_jobs.find(*commands);
+		if (it == tile_jobs.end()) return(0);
+
+		// A launch running on its caller's thread is waited for by that caller
+		if (it->second->worker == NULL && it->second->state == TILE_RUNNING) return(0);
+		job = it->second;
+		tile_jobs.erase(it);
+	}
+
+	if (job->worker != NULL)
+	{
+		job->worker->join();
+		delete job->worker;
+
+		// The launch ran on a worker: its result was not seen until now
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Info: Tiled launch joined, %llu of %llu slices done, result %d.\n", (unsigned long long) job->done,
+					(unsigned long long) job->global[job->dim], job->result);
+			fclose(pfile);
+		}
+	}
+
+	result = job->result;
+	fResidencyLaunchDone(job->held);
+	clReleaseKernel(job->kernel);
+	delete job;
+
+	return(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Launch a kernel in tiles of tile slices (0: adaptive) with at most in_flight
+// tiles queued. Without wait it returns once the launch has started; the
+// result comes from fTileWait.
+//
+int fTileExecute(cl_command_queue* commands, cl_kernel* kernel, cl_uint work_dim, size_t* global, size_t* local, cl_ulong tile, cl_uint in_flight,
+				 cl_bool wait, cl_bool verbose, char* log_file)
+{
+	tile_job*	job;
+	cl_ulong	held;
+	int			result;
+	FILE*		pfile = NULL;
+
+	// Remote and native CPU queues have no global offsets: one launch
+	if (fClientActive() || fNativeQueue(commands))
+	{
+		return(fExecuteKernel(commands, kernel, work_dim, global, local, verbose, log_file));
+	}
+
+	if (work_dim < 1 || work_dim > 3) return(-1);
+
+	// One launch per queue at a time
+	fTileWait(commands, verbose, log_file);
+
+	// Buffers spilled to host go back to the device, and stay there until
+	// fTileWait
+	result = fResidencyLaunch(*kernel, &held, verbose, log_file);
+	if (result < 0) return(result);
+
+	job				= new tile_job;
+	job->queue		= *commands;
+	job->kernel		= fSpecKernel(*kernel, verbose, log_file);
+	job->work_dim	= work_dim;
+	job->dim		= 0;
+	job->use_local	= local != NULL;
+	job->tile		= tile;
+	job->in_flight	= in_flight > 0 ? in_flight : 2;
+	job->done		= 0;
+	job->size		= 0;
+	job->state		= TILE_RUNNING;
+	job->cancel		= false;
+	job->result		= 0;
+	job->held		= held;
+	job->worker		= NULL;
+
+	for (cl_uint ii = 0; ii < 3; ii++)
+	{
+		job->global[ii] = ii < work_dim ? global[ii] : 1;
+		job->local[ii] = ii < work_dim && local != NULL ? local[ii] : 1;
+		if (ii < work_dim && job->global[ii] > 1) job->dim = ii;
+	}
+
+	clRetainKernel(job->kernel);
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Kernel is executing in tiles of %s%llu slices of dimension %u.\n", tile == 0 ? "initially " : "",
+				(unsigned long long) (tile > 0 ? tile : (cl_ulong) job->global[job->dim] / TILE_FIRST), job->dim);
+		fclose(pfile);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(tile_lock);
+		tile_jobs[*commands] = job;
+	}
+
+	if (!wait)
+	{
+		job->worker = new std::thread(fTileRun, job, verbose, std::string(log_file));
+		return(0);
+	}
+
+	fTileRun(job, verbose, std::string(log_file));
+	return(fTileWait(commands, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// status[4]: slices done, slices in total, state (TILE_*), current slices per
+// tile. Returns the state, TILE_NONE when the queue has no tiled launch.
+//
+int fTileProgress(cl_command_queue* commands, cl_ulong* status)
+{
+	std::lock_guard<std::mutex> lock(tile_lock);
+
+	status[0] = status[1] = status[2] = status[3] = 0;
+
+	std::map<cl_command_queue, tile_job*>::iterator it = tile_jobs.find(*commands);
+	if (it == tile_jobs.end()) return(TILE_NONE);
+
+	status[0] = it->second->done;
+	status[1] = it->second->global[it->second->dim];
+	status[2] = (cl_ulong) it->second->state;
+	status[3] = it->second->size;
+
+	return(it->second->state);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stop queueing tiles; the launch ends once the tiles in flight have finished
+//
+int fTileCancel(cl_command_queue* commands, cl_bool verbose, char* log_file)
+{
+	std::lock_guard<std::mutex>	lock(tile_lock);
+	FILE*						pfile = NULL;
+
+	std::map<cl_command_queue, tile_job*>::iterator it = tile_jobs.find(*commands);
+	if (it == tile_jobs.end()) return(-1);
+
+	it->second->cancel = true;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Tiled launch cancelled at %llu of %llu slices.\n", (unsigned long long) it->second->done,
+				(unsigned long long) it->second->global[it->second->dim]);
+		fclose(pfile);
+	}
+
+	return(0);
+}
@@ -0,0 +1,640 @@
+// NCopencl_warp.cpp : Device-side deformation field warping for nonrigid motion
+// compensation. A table of motion states keeps one deformation field per state
+// resident on the device, so gated reconstructions can warp registry buffers
+// without host transfers.
+//
+
+
+#include "NCopencl.h"
+#include "NCopencl_help.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Kernel source. Images are (nx, ny, nz) in the IDL layout, fields are
+// (fx, fy, fz, 3) displacements in image voxels, one component after the
+// other. A field may be stored as half (size_field.w = 1) and on a coarser
+// grid than the image; both are expanded on the fly when the field is read.
+// Field and image grids are cell centered and cover the same volume.
+//
+static const char* warp_source =
+"float warp_load(__global const float* f, uint half_flag, size_t i)            \n"
+"{                                                                               \n"
+"	return half_flag ? vload_half(i, (__global const half*) f) : f[i];           \n"
+"}                                                                               \n"
+"                                                                                \n"
+"float3 warp_field_at(__global const float* f, uint4 fs, float3 p)              \n"
+"{                                                                               \n"
+"	// Trilinear displacement at field grid position p, clamped to the edge.     \n"
+"	float3 top = convert_float3(fs.xyz) - 1.0f;                                  \n"
+"	p = clamp(p, (float3) (0.0f), top);                                          \n"
+"	int3   i0 = convert_int3(floor(p));                                          \n"
+"	int3   i1 = min(i0 + 1, convert_int3(fs.xyz) - 1);                           \n"
+"	float3 w  = p - convert_float3(i0);                                          \n"
+"	size_t n  = (size_t) fs.x * fs.y * fs.z;                                     \n"
+"	size_t r00 = (size_t) fs.x * (i0.y + (size_t) fs.y * i0.z);                  \n"
+"	size_t r10 = (size_t) fs.x * (i1.y + (size_t) fs.y * i0.z);                  \n"
+"	size_t r01 = (size_t) fs.x * (i0.y + (size_t) fs.y * i1.z);                  \n"
+"	size_t r11 = (size_t) fs.x * (i1.y + (size_t) fs.y * i1.z);                  \n"
+"	float  u[3];                                                                 \n"
+"	for (uint c = 0; c < 3; c++)                                                 \n"
+"	{                                                                            \n"
+"		size_t o = c * n;                                                        \n"
+"		float a = mix(warp_load(f, fs.w, o + r00 + i0.x), warp_load(f, fs.w, o + r00 + i1.x), w.x);\n"
+"		float b = mix(warp_load(f, fs.w, o + r10 + i0.x), warp_load(f, fs.w, o + r10 + i1.x), w.x);\n"
+"		float d = mix(warp_load(f, fs.w, o + r01 + i0.x), warp_load(f, fs.w, o + r01 + i1.x), w.x);\n"
+"		float e = mix(warp_load(f, fs.w, o + r11 + i0.x), warp_load(f, fs.w, o + r11 + i1.x), w.x);\n"
+"		u[c] = mix(mix(a, b, w.y), mix(d, e, w.y), w.z);                         \n"
+"	}                                                                            \n"
+"	return (float3) (u[0], u[1], u[2]);                                          \n"
+"}                                                                               \n"
+"                                                                                \n"
+"float3 warp_displacement(__global const float* f, uint4 fs, uint4 si, float3 x)\n"
+"{                                                                               \n"
+"	// Displacement at image voxel position x.                                   \n"
+"	float3 scale = convert_float3(fs.xyz) / convert_float3(si.xyz);              \n"
+"	return warp_field_at(f, fs, (x + 0.5f) * scale - 0.5f);                      \n"
+"}                                                                               \n"
+"                                                                                \n"
+"void warp_atomic_add(volatile __global float* addr, float value)              \n"
+"{                                                                               \n"
+"	union { uint u; float f; } old_val, new_val;                                 \n"
+"	do                                                                           \n"
+"	{                                                                            \n"
+"		old_val.f = *addr;                                                       \n"
+"		new_val.f = old_val.f + value;                                           \n"
+"	} while (atomic_cmpxchg((volatile __global uint*) addr, old_val.u, new_val.u) != old_val.u);\n"
+"}                                                                               \n"
+"                                                                                \n"
+"__kernel void warp_forward(__global const float* src, __global float* dst,     \n"
+"                           __global const float* field, uint4 size_img,        \n"
+"                           uint4 size_field, int accumulate)                    \n"
+"{                                                                               \n"
+"	// dst(x) = src(x + u(x)), trilinear, zero outside the image.                \n"
+"	uint x = get_global_id(0);                                                   \n"
+"	uint y = get_global_id(1);                                                   \n"
+"	uint z = get_global_id(2);                                                   \n"
+"	if (x >= size_img.x || y >= size_img.y || z >= size_img.z) return;          \n"
+"	float3 p  = (float3) (x, y, z);                                              \n"
+"	p += warp_displacement(field, size_field, size_img, p);                      \n"
+"	int3   i0 = convert_int3(floor(p));                                          \n"
+"	float3 w  = p - convert_float3(i0);                                          \n"
+"	float  v  = 0.0f;                                                            \n"
+"	for (int k = 0; k < 2; k++)                                                  \n"
+"	for (int j = 0; j < 2; j++)                                                  \n"
+"	for (int i = 0; i < 2; i++)                                                  \n"
+"	{                                                                            \n"
+"		int3 q = i0 + (int3) (i, j, k);                                          \n"
+"		if (any(q < 0) || any(q >= convert_int3(size_img.xyz))) continue;        \n"
+"		float c = (i ? w.x : 1.0f - w.x) * (j ? w.y : 1.0f - w.y) * (k ? w.z : 1.0f - w.z);\n"
+"		v += c * src[q.x + (size_t) size_img.x * (q.y + (size_t) size_img.y * q.z)];\n"
+"	}                                                                            \n"
+"	size_t o = x + (size_t) size_img.x * (y + (size_t) size_img.y * z);          \n"
+"	dst[o] = accumulate ? dst[o] + v : v;                                        \n"
+"}                                                                               \n"
+"                                                                                \n"
+"__kernel void warp_adjoint(__global const float* src, __global float* dst,     \n"
+"                           __global const float* field, uint4 size_img,        \n"
+"                           uint4 size_field)                                    \n"
+"{                                                                               \n"
+"	// Transpose of warp_forward: splat src(x) at x + u(x). Several voxels can   \n"
+"	// land on the same neighbours, so the additions are atomic.                 \n"
+"	uint x = get_global_id(0);                                                   \n"
+"	uint y = get_global_id(1);                                                   \n"
+"	uint z = get_global_id(2);                                                   \n"
+"	if (x >= size_img.x || y >= size_img.y || z >= size_img.z) return;          \n"
+"	float  v  = src[x + (size_t) size_img.x * (y + (size_t) size_img.y * z)];    \n"
+"	if (v == 0.0f) return;                                                       \n"
+"	float3 p  = (float3) (x, y, z);                                              \n"
+"	p += warp_displacement(field, size_field, size_img, p);                      \n"
+"	int3   i0 = convert_int3(floor(p));                                          \n"
+"	float3 w  = p - convert_float3(i0);                                          \n"
+"	for (int k = 0; k < 2; k++)                                                  \n"
+"	for (int j = 0; j < 2; j++)                                                  \n"
+"	for (int i = 0; i < 2; i++)                                                  \n"
+"	{                                                                            \n"
+"		int3 q = i0 + (int3) (i, j, k);                                          \n"
+"		if (any(q < 0) || any(q >= convert_int3(size_img.xyz))) continue;        \n"
+"		float c = (i ? w.x : 1.0f - w.x) * (j ? w.y : 1.0f - w.y) * (k ? w.z : 1.0f - w.z);\n"
+"		warp_atomic_add(&dst[q.x + (size_t) size_img.x * (q.y + (size_t) size_img.y * q.z)], c * v);\n"
+"	}                                                                            \n"
+"}                                                                               \n"
+"                                                                                \n"
+"__kernel void warp_compose(__global const float* field_a, __global const float* field_b,\n"
+"                           __global float* out, uint4 size_img,               \n"
+"                           uint4 size_a, uint4 size_b)                          \n"
+"{                                                                               \n"
+"	// Warping by out equals warping by a, then by b:                            \n"
+"	//   out(x) = b(x) + a(x + b(x)), a float field on the image grid.           \n"
+"	uint x = get_global_id(0);                                                   \n"
+"	uint y = get_global_id(1);                                                   \n"
+"	uint z = get_global_id(2);                                                   \n"
+"	if (x >= size_img.x || y >= size_img.y || z >= size_img.z) return;          \n"
+"	float3 p  = (float3) (x, y, z);                                              \n"
+"	float3 ub = warp_displacement(field_b, size_b, size_img, p);                 \n"
+"	float3 u  = ub + warp_displacement(field_a, size_a, size_img, p + ub);       \n"
+"	size_t n  = (size_t) size_img.x * size_img.y * size_img.z;                   \n"
+"	size_t o  = x + (size_t) size_img.x * (y + (size_t) size_img.y * z);         \n"
+"	out[o]         = u.x;                                                        \n"
+"	out[o + n]     = u.y;                                                        \n"
+"	out[o + 2 * n] = u.z;                                                        \n"
+"}                                                                               \n"
+"                                                                                \n"
+"__kernel void warp_pack_half(__global const float* src, __global half* dst,    \n"
+"                             ulong n)                                           \n"
+"{                                                                               \n"
+"	size_t i = get_global_id(0);                                                 \n"
+"	if (i < n) vstore_half(src[i], i, dst);                                      \n"
+"}                                                                               \n";
+
+#define WARP_FORWARD 0
+#define WARP_ADJOINT 1
+#define WARP_COMPOSE 2
+#define WARP_PACK    3
+#define WARP_KERNELS 4
+
+// Number of motion states (gates) that can be resident at the same time.
+#define WARP_MAX_STATES 32
+
+static const char* warp_kernel_names[WARP_KERNELS] = {"warp_forward", "warp_adjoint", "warp_compose", "warp_pack_half"};
+
+// Program, kernels and motion states per context, kept like the sinogram
+// kernels: bridges on different contexts each have their own motion states.
+#define WARP_MAX_CONTEXTS 4
+
+typedef struct {
+	cl_context	context;
+	cl_program	program;
+	cl_kernel	kernels[WARP_KERNELS];
+	cl_mem		fields[WARP_MAX_STATES];	// resident field per motion state
+	cl_uint4	sizes[WARP_MAX_STATES];		// its (fx, fy, fz, half)
+} warp_set;
+
+static warp_set		warp_sets[WARP_MAX_CONTEXTS];
+
+// Warp set of the context of the queue, NULL if it has none.
+static warp_set* fWarpFind(cl_command_queue* commands)
+{
+	cl_context	context;
+
+	if (clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL) != CL_SUCCESS) return(NULL);
+
+	for (int ii = 0; ii < WARP_MAX_CONTEXTS; ii++)
+	{
+		if (warp_sets[ii].context == context) return(&warp_sets[ii]);
+	}
+	return(NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the warp kernels for the context of the command queue, once per
+// context; *set receives the warp set of that context.
+//
+static int fWarpProgram(cl_command_queue* commands, warp_set** set, cl_bool verbose, char* log_file)
+{
+	cl_int			error;
+	cl_context		context;
+	warp_set*		entry = NULL;
+	FILE*			pfile = NULL;
+
+	if (fClientActive())
+	{
+		return(fClientUnsupported("Warping", verbose, log_file));
+	}
+	if (fNativeQueue(commands))
+	{
+		return(fNativeUnsupported("Warping", verbose, log_file));
+	}
+
+	error = clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to retreive context! %d \n", error);
+			fclose(pfile);
+		}
+		return(-3);
+	}
+
+	*set = fWarpFind(commands);
+	if (*set != NULL)
+	{
+		return(0);
+	}
+
+	for (int ii = 0; ii < WARP_MAX_CONTEXTS && entry == NULL; ii++)
+	{
+		if (warp_sets[ii].context == NULL) entry = &warp_sets[ii];
+	}
+
+	if (entry == NULL)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Warping is in use by %d other contexts!\n", WARP_MAX_CONTEXTS);
+			fclose(pfile);
+		}
+		return(-13);
+	}
+
+	error = fBuildLibraryProgram(commands, context, warp_source, "warp", warp_kernel_names, WARP_KERNELS, &entry->program, entry->kernels, verbose, log_file);
+	if (error < 0) return(error);
+
+	for (int ii = 0; ii < WARP_MAX_STATES; ii++)
+	{
+		entry->fields[ii] = NULL;
+	}
+	entry->context = context;
+	*set = entry;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Warp kernels built.\n");
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Enqueue a warp kernel; the in-order queue orders it with later work.
+//
+static int fWarpLaunch(cl_command_queue* commands, cl_kernel kernel, cl_uint work_dim, size_t* global, cl_bool verbose, char* log_file)
+{
+	cl_int	error;
+	FILE*	pfile = NULL;
+
+	error = clEnqueueNDRangeKernel(*commands, kernel, work_dim, NULL, global, NULL, 0, NULL, NULL);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to execute warp kernel! %d \n", error);
+			fclose(pfile);
+		}
+		return(-11);
+	}
+
+	clFlush(*commands);
+
+	return(0);
+}
+
+static cl_bool fWarpValidState(warp_set* set, cl_uint state)
+{
+	return(set != NULL && state < WARP_MAX_STATES && set->fields[state] != NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Upload the deformation field of one motion state. field holds
+// size_field.x * size_field.y * size_field.z * 3 floats; with size_field.w set
+// it is packed to half on the device, halving its footprint. A field already
+// stored for the state is replaced.
+//
+int fWarpSetState(cl_command_queue* commands, cl_uint state, cl_float* field, cl_uint4 size_field, cl_bool verbose, char* log_file)
+{
+	warp_set*	set;
+	int			result;
+	cl_int		error;
+	cl_context	context;
+	cl_mem		staging;
+	cl_mem		stored;
+	cl_ulong	n = 3 * (cl_ulong) size_field.s[0] * size_field.s[1] * size_field.s[2];
+	FILE*		pfile = NULL;
+
+	if (state >= WARP_MAX_STATES || n == 0)
+	{
+		return(-1);
+	}
+
+	result = fWarpProgram(commands, &set, verbose, log_file);
+	if (result != 0) return(result);
+
+	clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+
+	staging = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(cl_float), field, &error);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to upload deformation field! %d \n", error);
+			fprintf(pfile, "Info: Size (bytes): %llu.\n", (unsigned long long) (n * sizeof(cl_float)));
+			fclose(pfile);
+		}
+		return(-4);
+	}
+
+	if (size_field.s[3])
+	{
+		size_t		global = (size_t) n;
+		cl_kernel	kernel = set->kernels[WARP_PACK];
+
+		stored = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_half), NULL, &error);
+
+		if (error != CL_SUCCESS)
+		{
+			if (verbose)
+			{
+				pfile = fopen(log_file, "a");
+				fprintf(pfile, "Error: Failed to create half precision field! %d \n", error);
+				fclose(pfile);
+			}
+			clReleaseMemObject(staging);
+			return(-4);
+		}
+
+		error  = clSetKernelArg(kernel, 0, sizeof(cl_mem),   &staging);
+		error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),   &stored);
+		error |= clSetKernelArg(kernel, 2, sizeof(cl_ulong), &n);
+
+		result = (error == CL_SUCCESS) ? fWarpLaunch(commands, kernel, 1, &global, verbose, log_file) : -12;
+
+		// The release is deferred by the runtime until the pack kernel is done.
+		clReleaseMemObject(staging);
+
+		if (result != 0)
+		{
+			clReleaseMemObject(stored);
+			return(result);
+		}
+	}
+	else
+	{
+		stored = staging;
+	}
+
+	if (set->fields[state] != NULL)
+	{
+		clReleaseMemObject(set->fields[state]);
+	}
+	set->fields[state] = stored;
+	set->sizes[state]  = size_field;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Motion state %u stored, field %u x %u x %u (%s).\n", state, size_field.s[0], size_field.s[1], size_field.s[2], size_field.s[3] ? "half" : "float");
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Warp a registry image with the field of a motion state, or apply the
+// adjoint warp. Without accumulate the destination is overwritten.
+//
+int fWarpApply(cl_command_queue* commands, cl_mem* src_ptr, cl_mem* dst_ptr, cl_uint state, cl_uint4 size_img, cl_bool adjoint, cl_bool accumulate, cl_bool verbose, char* log_file)
+{
+	warp_set*	set;
+	int			result;
+	cl_int		error = CL_SUCCESS;
+	cl_int		accum = accumulate ? 1 : 0;
+	size_t		global[3];
+	cl_kernel	kernel;
+	FILE*		pfile = NULL;
+
+	result = fWarpProgram(commands, &set, verbose, log_file);
+	if (result != 0) return(result);
+
+	if (!fWarpValidState(set, state))
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Motion state %u has no deformation field!\n", state);
+			fclose(pfile);
+		}
+		return(-1);
+	}
+
+	if (adjoint)
+	{
+		// The adjoint only adds to its destination, so clear it first.
+		if (!accumulate)
+		{
+			cl_float zero = 0.0f;
+			size_t   size = sizeof(cl_float) * size_img.s[0] * size_img.s[1] * size_img.s[2];
+
+			error = clEnqueueFillBuffer(*commands, *dst_ptr, &zero, sizeof(cl_float), 0, size, 0, NULL, NULL);
+
+			if (error != CL_SUCCESS)
+			{
+				if (verbose)
+				{
+					pfile = fopen(log_file, "a");
+					fprintf(pfile, "Error: Failed to clear adjoint warp destination! %d \n", error);
+					fclose(pfile);
+				}
+				return(-5);
+			}
+		}
+
+		kernel = set->kernels[WARP_ADJOINT];
+		error |= clSetKernelArg(kernel, 0, sizeof(cl_mem),   src_ptr);
+		error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),   dst_ptr);
+		error |= clSetKernelArg(kernel, 2, sizeof(cl_mem),   &set->fields[state]);
+		error |= clSetKernelArg(kernel, 3, sizeof(cl_uint4), &size_img);
+		error |= clSetKernelArg(kernel, 4, sizeof(cl_uint4), &set->sizes[state]);
+	}
+	else
+	{
+		kernel = set->kernels[WARP_FORWARD];
+		error |= clSetKernelArg(kernel, 0, sizeof(cl_mem),   src_ptr);
+		error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),   dst_ptr);
+		error |= clSetKernelArg(kernel, 2, sizeof(cl_mem),   &set->fields[state]);
+		error |= clSetKernelArg(kernel, 3, sizeof(cl_uint4), &size_img);
+		error |= clSetKernelArg(kernel, 4, sizeof(cl_uint4), &set->sizes[state]);
+		error |= clSetKernelArg(kernel, 5, sizeof(cl_int),   &accum);
+	}
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to set warp arguments! %d.\n", error);
+			fclose(pfile);
+		}
+		return(-12);
+	}
+
+	global[0] = size_img.s[0];
+	global[1] = size_img.s[1];
+	global[2] = size_img.s[2];
+
+	return(fWarpLaunch(commands, kernel, 3, global, verbose, log_file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Store in state_out the field that warps by state_a followed by state_b.
+// The result is a float field on the image grid; state_out may be one of the
+// inputs.
+//
+int fWarpCompose(cl_command_queue* commands, cl_uint state_out, cl_uint state_a, cl_uint state_b, cl_uint4 size_img, cl_bool verbose, char* log_file)
+{
+	warp_set*	set;
+	int			result;
+	cl_int		error = CL_SUCCESS;
+	cl_context	context;
+	cl_mem		composed;
+	cl_ulong	n = 3 * (cl_ulong) size_img.s[0] * size_img.s[1] * size_img.s[2];
+	size_t		global[3];
+	cl_kernel	kernel;
+	FILE*		pfile = NULL;
+
+	result = fWarpProgram(commands, &set, verbose, log_file);
+	if (result != 0) return(result);
+
+	if (state_out >= WARP_MAX_STATES || !fWarpValidState(set, state_a) || !fWarpValidState(set, state_b))
+	{
+		return(-1);
+	}
+
+	clGetCommandQueueInfo(*commands, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+
+	composed = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_float), NULL, &error);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to create composed field! %d \n", error);
+			fclose(pfile);
+		}
+		return(-4);
+	}
+
+	kernel = set->kernels[WARP_COMPOSE];
+	error |= clSetKernelArg(kernel, 0, sizeof(cl_mem),   &set->fields[state_a]);
+	error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),   &set->fields[state_b]);
+	error |= clSetKernelArg(kernel, 2, sizeof(cl_mem),   &composed);
+	error |= clSetKernelArg(kernel, 3, sizeof(cl_uint4), &size_img);
+	error |= clSetKernelArg(kernel, 4, sizeof(cl_uint4), &set->sizes[state_a]);
+	error |= clSetKernelArg(kernel, 5, sizeof(cl_uint4), &set->sizes[state_b]);
+
+	if (error != CL_SUCCESS)
+	{
+		if (verbose)
+		{
+			pfile = fopen(log_file, "a");
+			fprintf(pfile, "Error: Failed to set warp compose arguments! %d.\n", error);
+			fclose(pfile);
+		}
+		clReleaseMemObject(composed);
+		return(-12);
+	}
+
+	global[0] = size_img.s[0];
+	global[1] = size_img.s[1];
+	global[2] = size_img.s[2];
+
+	result = fWarpLaunch(commands, kernel, 3, global, verbose, log_file);
+
+	if (result != 0)
+	{
+		clReleaseMemObject(composed);
+		return(result);
+	}
+
+	if (set->fields[state_out] != NULL)
+	{
+		clReleaseMemObject(set->fields[state_out]);
+	}
+	set->fields[state_out] = composed;
+	set->sizes[state_out].s[0] = size_img.s[0];
+	set->sizes[state_out].s[1] = size_img.s[1];
+	set->sizes[state_out].s[2] = size_img.s[2];
+	set->sizes[state_out].s[3] = 0;
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Make the field of a motion state available as a registry buffer, e.g. as a
+// kernel argument of the NMC projectors. The registry holds its own reference.
+//
+int fWarpBindState(cl_command_queue* commands, cl_uint state, cl_mem* mem_ptr, cl_bool verbose, char* log_file)
+{
+	warp_set*	set = NULL;
+	FILE*		pfile = NULL;
+
+	if (!fClientActive() && !fNativeQueue(commands)) set = fWarpFind(commands);
+
+	if (!fWarpValidState(set, state))
+	{
+		return(-1);
+	}
+
+	clRetainMemObject(set->fields[state]);
+	*mem_ptr = set->fields[state];
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Motion state %u bound to a registry buffer.\n", state);
+		fclose(pfile);
+	}
+
+	return(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Release the warp kernels, the program and the motion states of the context
+// of the queue; other contexts keep theirs.
+//
+int fReleaseWarp(cl_command_queue* commands, cl_bool verbose, char* log_file)
+{
+	warp_set*	set;
+	FILE*		pfile = NULL;
+
+	if (fClientActive() || fNativeQueue(commands))
+	{
+		return(0);
+	}
+
+	set = fWarpFind(commands);
+	if (set == NULL)
+	{
+		return(0);
+	}
+
+	for (int ii = 0; ii < WARP_MAX_STATES; ii++)
+	{
+		if (set->fields[ii] != NULL)
+		{
+			clReleaseMemObject(set->fields[ii]);
+			set->fields[ii] = NULL;
+		}
+	}
+
+	for (int ii = 0; ii < WARP_KERNELS; ii++)
+	{
+		if (set->kernels[ii] != NULL)
+		{
+			clReleaseKernel(set->kernels[ii]);
+			set->kernels[ii] = NULL;
+		}
+	}
+
+	clReleaseProgram(set->program);
+	set->program = NULL;
+	set->context = NULL;
+
+	if (verbose)
+	{
+		pfile = fopen(log_file, "a");
+		fprintf(pfile, "Info: Warp kernels and motion states released.\n");
+		fclose(pfile);
+	}
+
+	return(0);
+}
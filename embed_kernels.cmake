@@ -0,0 +1,75 @@
+#################################################################################
+# Embed the OpenCL kernel sources in the library.
+#
+#   cmake -DKERNEL_DIR=<dir with .cl files> -DOUTPUT=<file.cpp> -P embed_kernels.cmake
+#
+# Every .cl file under KERNEL_DIR becomes an entry of the embedded_kernels
+# registry (see NCopencl_help.h), named by its path relative to KERNEL_DIR,
+# with its quoted #include files inlined and the SHA-1 of the resulting text.
+# fBuildKernels takes such a name in place of a file path. Without KERNEL_DIR
+# the registry is empty.
+#################################################################################
+
+# Source text of a kernel file with its #include "..." files inlined,
+# relative to the including file.
+function( embed_resolve path depth result )
+    if( depth GREATER 16 )
+        message( FATAL_ERROR "Kernel includes nested too deep (cycle?) at ${path}" )
+    endif( )
+    file( READ ${path} text )
+    get_filename_component( dir ${path} PATH )
+    string( REGEX MATCHALL "#[ \t]*include[ \t]*\"[^\"]+\"" includes "${text}" )
+    foreach( include ${includes} )
+        string( REGEX REPLACE "#[ \t]*include[ \t]*\"([^\"]+)\"" "\\1" name "${include}" )
+        if( NOT EXISTS ${dir}/${name} )
+            message( FATAL_ERROR "Kernel include ${name} of ${path} not found" )
+        endif( )
+        math( EXPR next "${depth} + 1" )
+        embed_resolve( ${dir}/${name} ${next} included )
+        string( REPLACE "${include}" "${included}" text "${text}" )
+    endforeach( )
+    set( ${result} "${text}" PARENT_SCOPE )
+endfunction( )
+
+set( sources "" )
+set( entries "" )
+set( index 0 )
+
+if( KERNEL_DIR )
+    file( GLOB_RECURSE kernel_files RELATIVE ${KERNEL_DIR} ${KERNEL_DIR}/*.cl )
+    list( SORT kernel_files )
+    foreach( name ${kernel_files} )
+        embed_resolve( ${KERNEL_DIR}/${name} 0 text )
+        string( SHA1 hash "${text}" )
+
+        # Bytes rather than a string literal: no escaping, no literal limits
+        file( WRITE ${OUTPUT}.tmp "${text}" )
+        file( READ ${OUTPUT}.tmp bytes HEX )
+        string( LENGTH "${bytes}" size )
+        math( EXPR size "${size} / 2" )
+        string( REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${bytes}" )
+
+        set( sources "${sources}static const unsigned char embedded_${index}[] = {${bytes}0x00};\n" )
+        set( entries "${entries}\t{\"${name}\", \"${hash}\", (const char*) embedded_${index}, ${size}},\n" )
+        math( EXPR index "${index} + 1" )
+    endforeach( )
+    file( REMOVE ${OUTPUT}.tmp )
+endif( )
+
+file( WRITE ${OUTPUT}.new
+"// Generated by embed_kernels.cmake (KERNEL_DIR '${KERNEL_DIR}'), do not edit.\n"
+"\n"
+"#include \"NCopencl.h\"\n"
+"#include \"NCopencl_help.h\"\n"
+"\n"
+"${sources}"
+"\n"
+"const embedded_kernel embedded_kernels[] = {\n"
+"${entries}"
+"\t{NULL, NULL, NULL, 0}\n"
+"};\n" )
+
+# Only touch the output when the kernels changed
+execute_process( COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.new ${OUTPUT} )
+file( REMOVE ${OUTPUT}.new )
+message( STATUS "Embedded ${index} kernel sources from '${KERNEL_DIR}'" )
@@ -0,0 +1,212 @@
+// distd_sinogram_spiralct_pic_ref.cl : Reference distance driven spiral CT
+// projector, with the arguments of NIproj_distd_spiralct_ocl_pic and the
+// geometry and weights of the native backend (see NCopencl_cpu.cpp for both).
+// One work item per sinogram bin (column, plane, view); the projection adds
+// the bin's line integral to sino, with -D BACK_PROJECT the bin is spread
+// over the image with atomic adds instead. -D MC applies the motion matrices.
+// -D RECORD_SYSMAT adds the counter and coordinate list of the cached system
+// matrix as arguments 10 and 11 and appends every coefficient to them, as
+// described in NCopencl_sparse.cpp.
+// Built with -specialize (see NCopencl_spec.cpp), the image and sinogram size,
+// voxel size and zalign_cotg come from the SPEC_* constants instead of the
+// arguments.
+//
+// Written to be read and checked, not for speed: opencl_projbench runs it
+// where the production kernels are not at hand. The _ref name keeps it from
+// taking the place of the production kernel in the embedded registry
+// (KERNEL_DIR=kernels).
+//
+
+#ifdef BACK_PROJECT
+void atomic_add_float(volatile __global float* address, float value)
+{
+	union { uint u; float f; } expected, desired;
+
+	do
+	{
+		expected.f	= *address;
+		desired.f	= expected.f + value;
+	} while (atomic_cmpxchg((volatile __global uint*) address, expected.u, desired.u) != expected.u);
+}
+#endif
+
+// Point at tube angle 0 to its position for this view.
+void transform(float4 srcloc, float4 center, __global const float4* m, float lx, float ly, float lz, float* world)
+{
+	float c = cos(srcloc.x);
+	float s = sin(srcloc.x);
+	float x = lx - center.x;
+	float y = ly - center.y;
+	float w[3];
+
+	w[0] = center.x + c * x - s * y;
+	w[1] = center.y + s * x + c * y;
+	w[2] = lz + srcloc.y;
+
+#ifdef MC
+	for (int rr = 0; rr < 3; rr++)
+	{
+		world[rr] = m[rr].x * w[0] + m[rr].y * w[1] + m[rr].z * w[2] + m[rr].w;
+	}
+#else
+	world[0] = w[0];
+	world[1] = w[1];
+	world[2] = w[2];
+#endif
+}
+
+void detector_point(float4 srcloc, __global const float4* detbins, __global const float4* m, uint ncols, uint col, uint plane, float* world)
+{
+	float4 d = detbins[2 + col + ncols * plane];
+
+	transform(srcloc, detbins[0], m, d.x, d.y, d.z, world);
+}
+
+__kernel void main_kernel(__global float*			image,
+						  __global float*			sino,
+						  __global const float4*	srclocs,
+						  __global const float4*	detbins,
+						  uint4						size_img_arg,
+						  uint4						size_sino_arg,
+						  float4					img_offset,
+						  float4					vox_size_arg,
+						  float4					zalign_cotg_arg,
+						  __global const float4*	mc
+#ifdef RECORD_SYSMAT
+						, __global uint*			sysmat_count
+						, __global uint*			sysmat_coo
+#endif
+						  )
+{
+#ifdef SPEC_size_img
+	const uint4		size_img    = SPEC_size_img;
+#else
+	const uint4		size_img    = size_img_arg;
+#endif
+#ifdef SPEC_size_sino
+	const uint4		size_sino   = SPEC_size_sino;
+#else
+	const uint4		size_sino   = size_sino_arg;
+#endif
+#ifdef SPEC_vox_size
+	const float4	vox_size    = SPEC_vox_size;
+#else
+	const float4	vox_size    = vox_size_arg;
+#endif
+#ifdef SPEC_zalign_cotg
+	const float4	zalign_cotg = SPEC_zalign_cotg;
+#else
+	const float4	zalign_cotg = zalign_cotg_arg;
+#endif
+	uint	cc      = get_global_id(0);
+	uint	pp      = get_global_id(1);
+	uint	view    = get_global_id(2);
+	uint	ndet    = size_sino.x;
+	uint	nplanes = size_sino.y;
+	uint	ncols   = ndet + 1;
+
+	if (cc >= ndet || pp >= nplanes || view >= size_sino.z) return;
+
+	float4					srcloc = srclocs[view];
+	__global const float4*	m      = mc + 4 * view;
+	float					n[3]   = {size_img.x, size_img.y, size_img.z};
+	float					offset[3] = {img_offset.x, img_offset.y, img_offset.z};
+	float					vox[3] = {vox_size.x, vox_size.y, vox_size.z};
+	float					src[3], mid[3], c0[3], c1[3], d00[3], d10[3], d01[3], d11[3];
+
+	// source with the flying focal spot offsets
+	transform(srcloc, detbins[0], m, detbins[1].x + srcloc.z, detbins[1].y - srcloc.w * zalign_cotg.x,
+			  detbins[1].z + srcloc.w, src);
+
+	// slabs across the axis closest to the central ray
+	detector_point(srcloc, detbins, m, ncols, ndet / 2, nplanes / 2, mid);
+	uint sa = fabs(mid[1] - src[1]) >= fabs(mid[0] - src[0]) ? 1 : 0;
+	uint ta = 1 - sa;
+
+	// column boundary rays at the central plane, plane boundary rays at the
+	// column center, as slopes per unit along the slab axis
+	detector_point(srcloc, detbins, m, ncols, cc,     nplanes / 2, c0);
+	detector_point(srcloc, detbins, m, ncols, cc + 1, nplanes / 2, c1);
+	detector_point(srcloc, detbins, m, ncols, cc,     pp,     d00);
+	detector_point(srcloc, detbins, m, ncols, cc + 1, pp,     d10);
+	detector_point(srcloc, detbins, m, ncols, cc,     pp + 1, d01);
+	detector_point(srcloc, detbins, m, ncols, cc + 1, pp + 1, d11);
+
+	float ka0 = (c0[ta] - src[ta]) / (c0[sa] - src[sa]);
+	float ka1 = (c1[ta] - src[ta]) / (c1[sa] - src[sa]);
+	float kz0 = (0.5f * (d00[2] + d10[2]) - src[2]) / (0.5f * (d00[sa] + d10[sa]) - src[sa]);
+	float kz1 = (0.5f * (d01[2] + d11[2]) - src[2]) / (0.5f * (d01[sa] + d11[sa]) - src[sa]);
+	float dt  = 0.5f * (ka0 + ka1);
+	float dz  = 0.5f * (kz0 + kz1);
+	float len = vox[sa] * sqrt(1.0f + dt * dt + dz * dz);
+
+	int		nt = (int) n[ta];
+	int		nz = (int) n[2];
+	ulong	st = ta == 0 ? 1 : size_img.x;
+	ulong	ss = sa == 0 ? 1 : size_img.x;
+	ulong	sz = (ulong) size_img.x * size_img.y;
+	ulong	bin = cc + ndet * (pp + (ulong) nplanes * view);
+
+#ifdef BACK_PROJECT
+	float value = sino[bin];
+	if (value == 0.0f) return;
+#else
+	float sum = 0.0f;
+#endif
+
+	for (uint jj = 0; jj < (uint) n[sa]; jj++)
+	{
+		float ds  = offset[sa] + (jj + 0.5f) * vox[sa] - src[sa];
+		float a0  = src[ta] + ka0 * ds;
+		float a1  = src[ta] + ka1 * ds;
+		float b0  = src[2] + kz0 * ds;
+		float b1  = src[2] + kz1 * ds;
+		float alo = fmin(a0, a1);
+		float ahi = fmax(a0, a1);
+		float zlo = fmin(b0, b1);
+		float zhi = fmax(b0, b1);
+
+		if (ahi <= alo || zhi <= zlo) continue;
+
+		int t_first = max((int) floor((alo - offset[ta]) / vox[ta]), 0);
+		int t_last  = min((int) ceil((ahi - offset[ta]) / vox[ta]), nt);
+		int k_first = max((int) floor((zlo - offset[2]) / vox[2]), 0);
+		int k_last  = min((int) ceil((zhi - offset[2]) / vox[2]), nz);
+		float zscale = len / (zhi - zlo) / (ahi - alo);
+
+		for (int kk = k_first; kk < k_last; kk++)
+		{
+			float zk0 = offset[2] + kk * vox[2];
+			float wz  = fmax(0.0f, fmin(zhi, zk0 + vox[2]) - fmax(zlo, zk0)) * zscale;
+
+			for (int tt = t_first; tt < t_last; tt++)
+			{
+				float	lo  = offset[ta] + tt * vox[ta];
+				float	w   = (fmin(ahi, lo + vox[ta]) - fmax(alo, lo)) * wz;
+				ulong	idx = jj * ss + kk * sz + tt * st;
+
+#ifdef RECORD_SYSMAT
+				if (w != 0.0f)
+				{
+					uint slot = atomic_inc(&sysmat_count[0]);
+					if (slot < sysmat_count[1])
+					{
+						sysmat_coo[3 * slot]     = (uint) bin;
+						sysmat_coo[3 * slot + 1] = (uint) idx;
+						sysmat_coo[3 * slot + 2] = as_uint(w);
+					}
+				}
+#endif
+#ifdef BACK_PROJECT
+				atomic_add_float(&image[idx], w * value);
+#else
+				sum += w * image[idx];
+#endif
+			}
+		}
+	}
+
+#ifndef BACK_PROJECT
+	sino[bin] += sum;
+#endif
+}
@@ -82,6 +82,46 @@
 ;               bit ugly. But that should not matter too much for
 ;               iterative reconstruction.
 ;
+;    SHARE_BRIDGE : an existing niopencl bridge (e.g. the oclbridge of
+;               another projdescrip). The new projector then gets its own
+;               command queue on the same context, so both can use the
+;               same device buffers. See NIdef_projspiralct_ocl_pyramid.
+;
+;    RECORD_SYSMAT : build the projector with -D RECORD_SYSMAT, so it can
+;               record its coefficients for the cached system matrix
+;               (see the SYSMAT keyword of NIproj_distd_spiralct_ocl_pic).
+;               The matrix is tied to this projdescrip (its sysmat_id)
+;               and image size; call NIdef again when the geometry or
+;               the motion changes.
+;
+;    FORCE_CPU : 1 runs the OpenCL kernels on a CPU device even when a GPU
+;               is present. 2 uses the native CPU backend of the library
+;               instead of OpenCL (distance driven projector only, no
+;               RESIDENT sinogram); it needs no OpenCL runtime at all.
+;
+;    DEVICE : OpenCL device to use, by (part of) its name or by its index
+;               in the device overview of the log; 'memory' or 'calibrate'
+;               rank the devices by global memory or by a short test run
+;               instead of compute units x clock (see NIopencl::select_device).
+;
+;    SERVER : socket path of a running projection server (see
+;               NIopencl::serve). The bridge calls of this IDL session
+;               then go to the server, which keeps the context, compiled
+;               kernels and buffers, and shares the device with other
+;               sessions. Not with RECORD_SYSMAT or nonrigid motion.
+;
+;    KERNEL_PATH : directory of the .cl kernel files, ending in a path
+;               separator. Empty or not given: use the kernel sources
+;               embedded in the library at build time (CMake KERNEL_DIR),
+;               which needs no file access and always matches the build.
+;
+;    LAZY : 1 compiles the projector and backprojector kernels on their
+;               first use instead of here, so a script that only
+;               projects (or only backprojects) never compiles the
+;               other one. 2 also builds them in a background thread
+;               right away, which hides the compile time of the first
+;               projection behind the rest of the setup.
+;
 ; OUTPUTS:
 ;    PROJDESCRIP : a structure, ready to be used by NIproj (which will
 ;                  call NIproj_distd_spiralct to do the job).
@@ -155,7 +195,12 @@ function NIdef_projspiralct_ocl, tubeangle, tablepos, alignment, $
 								  kernel_path = kernel_path, $
                                   supsample   = supsample, $
 								  smallbin    = smallbin, $
-								  nonrigmotion = nonrigmotion
+								  nonrigmotion = nonrigmotion, $
+								  share_bridge = share_bridge, $
+								  record_sysmat = record_sysmat, $
+								  server = server, $
+								  lazy = lazy, $
+								  device = device
 
 
 
@@ -164,6 +209,7 @@ common NIfiles
 ;'WIN32':  NIpath_kernels = '\\uz\data\Admin\ngeresearch\taosun\code\opencl\'  + path_sep()
 ;'LINUX':  NIpath_kernels = '/uz/data/Admin/ngeresearch/taosun/code/opencl'  + path_sep()
 ;endcase
+if n_elements(kernel_path) eq 0 then kernel_path = ''
 NIpath_kernels = kernel_path
 log_file = kernel_path + 'log.txt'   ; deprecated
 
@@ -176,6 +222,8 @@ if n_elements(fwhm)        eq 0 then fwhm = 0.0
 if n_elements(coloffset) eq 0 then coloffset = 0.0
 if n_elements(rowoffset) eq 0 then rowoffset = 0.0
 if n_elements(planeoffset) eq 0 then planeoffset = 0.0
+; identifies this geometry for the cached system matrix
+sysmat_id = keyword_set(record_sysmat) ? ulong64(systime(1) * 1d6) : 0ULL
 if keyword_set(supsample) or keyword_set(smallbin) then begin 
   factor = 2
 endif else factor = 1
@@ -478,14 +526,24 @@ zfactor = focus2detector / focus2centermm  ;yields 1.82456
 ; not the one of the image!
 center   = [0., 0., mean(tablepos)] ;- [0.5, 0.5, 0.5]
 
-hoeken   = (findgen(nchannels+1) - nchannels/2.0 + fan_coroffset) $
-           * fanangle / float(nchannels)
-detcols0 = focus2detector * sin(hoeken)
-detrows0 = focus2detector * cos(hoeken) - focus2centermm
+oclbridge = obj_new('niopencl')
 
-detplanes0 = reform(tablepos[0,*])
-detplanes0 = [2 * detplanes0[0] - detplanes0[1], detplanes0]
-detplanes0 = (detplanes0 - mean(detplanes0)) * zfactor
+if keyword_set(server) then b = oclbridge->connect_server(server)
+if n_elements(force_cpu) gt 0 then *(oclbridge->get_ptr('force_cpu')) = long(force_cpu)
+if n_elements(device) gt 0 then begin
+  if size(device, /type) ne 7 then b = oclbridge->select_device(index = device) $
+  else if strlowcase(device) eq 'memory' then b = oclbridge->select_device(/memory) $
+  else if strlowcase(device) eq 'calibrate' then b = oclbridge->select_device(/calibrate) $
+  else b = oclbridge->select_device(name = device)
+endif
+if keyword_set(share_bridge) $
+  then b = oclbridge->create_command_queue_shared(share_bridge) $
+  else b = oclbridge->create_command_queue()
+
+; detector fan (detcols0, detrows0) and plane boundaries (detplanes0)
+b = oclbridge->geom_detector(nchannels, $
+                             [fan_coroffset, fanangle, focus2detector, focus2centermm, zfactor], $
+                             reform(tablepos[0,*]), detcols0, detrows0, detplanes0)
 ;stop
 ; op volgende manier minder afrondingsfouten
 ;ketplanes0 = reform(tablepos[0,*])
@@ -587,6 +645,7 @@ if n_elements(anodeangle) eq 0 $
   if keyword_set(force_cpu)    then temp += ' -D RUN_ON_CPU'
   if keyword_set(fast_math)    then temp += ' -D FAST_MATH'
   if keyword_set(smallbin)     then temp += ' -D SMALLBIN'
+  if keyword_set(record_sysmat) then temp += ' -D RECORD_SYSMAT'
   compile_options = temp
   if keyword_set(flat) then begin
     file_paths = NIpath_kernels + 'distd_sinogram.cl'                          ; deprecated
@@ -644,15 +703,14 @@ if n_elements(anodeangle) eq 0 $
 
 
 
-  ;-- Actual bridge creation
-  oclbridge = obj_new('niopencl')
-  
-  b = oclbridge->create_command_queue()
+  ;-- Kernel build, the bridge itself is created with the detector fan
 
   b = oclbridge->build_kernels(file_paths,     $
                                function_names, $
                                idl_call_names, $
-                               compile_options)
+                               compile_options, $
+                               lazy = keyword_set(lazy), $
+                               prefetch = n_elements(lazy) gt 0 ? lazy eq 2 : 0)
 							   
 
 ;if keyword_set(coords_array) eq 0 then coords_array = -1
@@ -664,15 +722,9 @@ if not keyword_set(raytracing) then begin
  ; Initial coordinates for the kernel, instead we can supply the 
   ; whole set of coordinates after transform too, but this seems more efficient
   npoints = (nchannels+1)* (ndetplanes+1)+1 +1           ; center, source and detector
-  initial_coords = make_array(4, npoints, /float, value=1.0)
-  initial_coords[0:2,0]   = center ;[0.0, 0.0, 0.0]  
-  initial_coords[3,0]   = 0.
-  initial_coords[0,1]   = mean(detcols1)
-  initial_coords[1,1]   = mean(detrows1)
-  initial_coords[2,1]   = mean(detplanes1)
-  initial_coords[0,2:npoints-1] = detcols0 # (fltarr(1,ndetplanes+1)+1)
-  initial_coords[1,2:npoints-1] = detrows0 # (fltarr(1,ndetplanes+1)+1)
-  initial_coords[2,2:npoints-1] = (fltarr(nchannels+1,1)+1) # reform(detplanes0,1,ndetplanes+1)
+  b = oclbridge->geom_initial_coords(detcols0, detrows0, detplanes0, center, $
+                                     [mean(detcols1), mean(detrows1), mean(detplanes1)], $
+                                     0, initial_coords)
   
 ;stop
 
@@ -720,6 +772,8 @@ if not keyword_set(raytracing) then begin
     fast_math     : fast_math,  $
     force_cpu     : force_cpu,  $
     oclbridge     : oclbridge,  $
+    record_sysmat : keyword_set(record_sysmat), $
+    sysmat_id     : sysmat_id, $
     flat          : flat,   $
     parse_initial : parse_initial,   $
     opt_mem       : opt_mem, $
@@ -852,6 +906,8 @@ endif else begin
     fast_math     : fast_math,  $
     force_cpu     : force_cpu,  $
     oclbridge     : oclbridge,  $
+    record_sysmat : keyword_set(record_sysmat), $
+    sysmat_id     : sysmat_id, $
     flat          : flat,   $
     parse_initial : parse_initial,   $
     opt_mem       : opt_mem, $
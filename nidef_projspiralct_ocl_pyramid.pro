@@ -0,0 +1,129 @@
+;+
+; NAME:
+;    NIdef_projspiralct_ocl_pyramid
+;
+; PURPOSE:
+;    Define a resolution pyramid of helical CT (back)projectors for
+;    coarse-to-fine reconstruction. All levels share one OpenCL
+;    context, so the library kernels and buffers are shared, and
+;    NIpyramid_resample moves images and sinograms between levels
+;    on the device, from one buffer to another.
+;
+; CATEGORY:
+;    Reconstruction
+;
+; CALLING SEQUENCE:
+;    pyramid = NIdef_projspiralct_ocl_pyramid(tubeangle, tablepos, alignment, $
+;                                             ncols, nrows, nplanes, $
+;                                             pixelsizemm, planesepmm, $
+;                                             nlevels = 3, ctmodel = ctmodel, ...)
+;
+; INPUTS:
+;    As NIdef_projspiralct_ocl, for the finest level.
+;
+; KEYWORD PARAMETERS:
+;    NLEVELS : number of levels, default 2. Level l has the image
+;              dimensions divided by 2^l, the voxel sizes and DET_REBIN
+;              multiplied by 2^l. The image dimensions and the number of
+;              detector channels must be divisible by 2^(nlevels-1).
+;
+;    DET_REBIN : detector rebinning of the finest level, default 1.
+;
+;    All other keywords are passed to NIdef_projspiralct_ocl.
+;
+; OUTPUTS:
+;    PYRAMID : pointer array of NLEVELS projdescrips, level 0 is the
+;              finest. Use *pyramid[l] as projdescrip for NIproj.
+;
+; EXAMPLE:
+;    pyramid = NIdef_projspiralct_ocl_pyramid(..., nlevels = 3)
+;    bridge  = (*pyramid[0]).oclbridge
+;    b = bridge->create_buffer(5, sino, 0, 0)        ; level 0 sinogram
+;    dims2 = NIpyramid_resample(pyramid, 0, 2, 5, 9, size(sino, /dimensions), /sinogram)
+;    ; ... iterations at level 2 on buffer 9 ...
+;    dims1 = NIpyramid_resample(pyramid, 2, 1, 10, 11, img_dims2)
+;    ; ... and so on down to level 0; read_buffer when done
+;
+; SEE ALSO:
+;    NIdef_projspiralct_ocl, NIproj_distd_spiralct_ocl_pic
+;-
+
+compile_opt strictarrsubs
+
+function NIpyramid_resample, pyramid, from_level, to_level, src_ptr, dst_ptr, dims, $
+                             sinogram = sinogram, result = result
+;+
+; Resample buffer SRC_PTR, of dimensions DIMS at level FROM_LEVEL, into
+; buffer DST_PTR at level TO_LEVEL of the pyramid, on the device. Both
+; are registry slots of the caller; DST_PTR is (re)created and the data
+; stays on the device. Returns the dimensions of DST_PTR.
+; Images are averaged (down) or interpolated (up) in all three
+; dimensions. With /SINOGRAM only the detector dimension changes;
+; bins are summed (as DET_REBIN) going down and split going up.
+; RESULT, if present, receives a copy read back from the device.
+;-
+
+  bridge = (*pyramid[to_level]).oclbridge
+  size_src = long(dims)
+  if n_elements(size_src) lt 3 then size_src = [size_src, replicate(1L, 3 - n_elements(size_src))]
+
+  f = 2L ^ abs(to_level - from_level)
+  if keyword_set(sinogram) then factor = [f, 1, 1] $
+                           else factor = [f, f, f]
+
+  if to_level gt from_level then out_dims = size_src / factor $
+                            else out_dims = size_src * factor
+
+  b = bridge->create_buffer_empty(dst_ptr, 4ULL * product(out_dims, /integer), 0)
+
+  if to_level gt from_level then begin
+    b = bridge->resample_down(src_ptr, dst_ptr, size_src, factor, $
+                              average = keyword_set(sinogram) eq 0)
+  endif else begin
+    b = bridge->resample_up(src_ptr, dst_ptr, size_src, out_dims, $
+                            scale = keyword_set(sinogram) ? 1.0 / f : 1.0)
+  endelse
+
+  if arg_present(result) then begin
+    result = fltarr(out_dims)
+    b = bridge->read_buffer(dst_ptr, result)
+  endif
+
+  return, out_dims
+
+end
+
+function NIdef_projspiralct_ocl_pyramid, tubeangle, tablepos, alignment, $
+                                          ncols, nrows, nplanes,          $
+                                          pixelsizemm, planesepmm,        $
+                                          nlevels   = nlevels,            $
+                                          det_rebin = det_rebin,          $
+                                          _extra    = extra
+
+if n_elements(nlevels)   eq 0 then nlevels = 2
+if n_elements(det_rebin) eq 0 then det_rebin = 1
+
+pyramid = ptrarr(nlevels)
+
+; The finest level creates the context, the others share it.
+for level = 0, nlevels-1 do begin
+  f = 2L ^ level
+  if (ncols mod f) ne 0 or (nrows mod f) ne 0 or (nplanes mod f) ne 0 then begin
+    print, 'NIdef_projspiralct_ocl_pyramid: image size not divisible by ', f
+    stop
+  endif
+
+  projdescrip = NIdef_projspiralct_ocl(tubeangle, tablepos, alignment,      $
+                                       ncols / f, nrows / f, nplanes / f,    $
+                                       pixelsizemm * f, planesepmm * f,      $
+                                       det_rebin    = det_rebin * f,         $
+                                       share_bridge = level eq 0 ? obj_new() $
+                                                    : (*pyramid[0]).oclbridge, $
+                                       _extra       = extra)
+
+  pyramid[level] = ptr_new(projdescrip, /no_copy)
+endfor
+
+return, pyramid
+
+end
@@ -60,6 +60,15 @@ function niopencl::init
   *(self.nc_ocl_lib)   = NC_opencl_wrapper
   *(self.nc_ocl_log)   = curDir + path_sep() +'log.txt' ; nge() + 'opencl.log'
   *(self.kernel_names) = ''
+
+  ; Typed entry points (NCopencl_dlm.cpp) when the library was built with the
+  ; IDL headers and its .dlm is on IDL_DLM_PATH, next to NC_opencl_wrapper
+  catch, err
+  if err EQ 0 then begin
+     dlm_load, 'ncopencl'
+     self.dlm = 1B
+  endif
+  catch, /cancel
 ;  stop
   return, 1
 
@@ -92,7 +101,7 @@ function niopencl::get_ptr, rawVar
 
   case var of
      'verbose'       : return, self.verbose
-     'force_cpu'     : return, self.foce_cpu
+     'force_cpu'     : return, self.force_cpu
      'nc_ocl_lib'    : return, self.nc_ocl_lib
      'nc_ocl_log'    : return, self.nc_ocl_log
      'command_queue' : return, self.command_queue
@@ -133,6 +142,48 @@ function niopencl::set_ptr, rawVar, ptr
 
 end
 
+function niopencl::select_device, name = name, index = index, $
+                                  memory = memory, calibrate = calibrate
+;+
+; Choose the device of later create_command_queue calls, for all
+; bridges in this IDL session. By default the GPU (or with force_cpu
+; the CPU) with the most compute units x clock is used; /memory ranks
+; by global memory instead, /calibrate by a short test kernel run once
+; on each device. name (part of the device name) or index (position
+; in the device overview of the log) pick one device directly.
+;-
+
+  policy = keyword_set(calibrate) ? 2L : (keyword_set(memory) ? 1L : 0L)
+
+  b = call_external(*(self.nc_ocl_lib), $
+                    'fNCselect_device', $
+                    policy,             $
+                    n_elements(name)  gt 0 ? string(name) : '', $
+                    n_elements(index) gt 0 ? long(index)  : -1L, $
+                    *(self.verbose),    $
+                    *(self.nc_ocl_log)  )
+
+  return, b
+
+end
+
+function niopencl::native_threads, n_threads
+;+
+; Number of threads of the native CPU backend (force_cpu = 2), for
+; all bridges in this IDL session; 0 (default) uses all hardware
+; threads.
+;-
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    'fNCnative_threads', $
+                    ulong(n_threads),    $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, b
+
+end
+
 function niopencl::create_command_queue
 ;+
 ; Create an OpenCL command queue for one device
@@ -141,6 +192,15 @@ function niopencl::create_command_queue
 ; clGetDeviceIDs
 ; clCreateContext
 ; clCreateCommandQueue
+;
+; force_cpu: 1 selects a CPU device, 2 the native CPU backend of the
+; library, which does not use OpenCL at all. Without it the fastest
+; GPU is used (see select_device); platforms and devices are only
+; enumerated for the first queue of the session.
+;
+; Bridges that select the same device (and verbose setting) get
+; queues on one shared context, and build_kernels reuses programs
+; already built there with the same source and compile options.
 ;-
 
   command_queue_ptr = 0ULL
@@ -158,6 +218,74 @@ function niopencl::create_command_queue
 
 end
 
+function niopencl::create_command_queue_shared, other
+;+
+; Create a command queue on the context and device of another
+; bridge, so both can use the same buffers and library kernels
+; (e.g. the levels of a resolution pyramid).
+;-
+
+  command_queue_ptr = 0ULL
+
+  b = call_external(*(self.nc_ocl_lib),               $
+                    'fNCcreate_command_queue_shared', $
+                    command_queue_ptr,                $
+                    other->get_command_queue(),       $
+                    *(self.verbose),                  $
+                    *(self.nc_ocl_log)                )
+
+  self.command_queue = command_queue_ptr
+
+  return, b
+
+end
+
+function niopencl::get_command_queue
+
+  return, self.command_queue
+
+end
+
+function niopencl::device_caps, caps
+;+
+; Capabilities of the device of the command queue, as a structure.
+; build_kernels already adds matching defines to the compile options:
+; RUN_ON_CPU on CPU devices, DEV_COMPUTE_UNITS, DEV_VECTOR_WIDTH,
+; DEV_LOCAL_TILE (work items with a float4 each in half the local
+; memory), DEV_UNIFIED_MEMORY, DEV_FP16 and DEV_IMAGES, and with
+; -D FAST_MATH also -cl-fast-relaxed-math and -cl-mad-enable.
+; Options given explicitly are left as they are.
+;-
+
+  values = ulon64arr(16)
+
+  b = call_external(*(self.nc_ocl_lib), $
+                    'fNCdevice_caps',   $
+                    self.command_queue, $
+                    values,             $
+                    *(self.verbose),    $
+                    *(self.nc_ocl_log)  )
+
+  caps = {cpu                 : (values[0] and 2ULL) ne 0, $
+          compute_units       : values[1],  $
+          max_work_group_size : values[2],  $
+          local_mem_size      : values[3],  $
+          local_mem_dedicated : values[4] eq 1, $
+          global_mem_size     : values[5],  $
+          max_alloc_size      : values[6],  $
+          unified_memory      : values[7],  $
+          image_support       : values[8],  $
+          fp16                : values[9],  $
+          fp64                : values[10], $
+          vector_width_float  : values[11], $
+          vector_width_half   : values[12], $
+          native_width_float  : values[13], $
+          local_tile          : values[14]}
+
+  return, b
+
+end
+
 function niopencl::release_command_queue
 ;+
 ; Release the current command queue & context
@@ -181,7 +309,9 @@ end
 function niopencl::build_kernels, file_paths,     $
                                   function_names, $
                                   idl_call_names, $
-                                  compile_options
+                                  compile_options, $
+                                  lazy = lazy,     $
+                                  prefetch = prefetch
 ;+
 ; Build a list of kernels for the current command queue
 ;
@@ -189,6 +319,11 @@ function niopencl::build_kernels, file_paths,     $
 ; clCreateProgramWithSource
 ; clBuildProgram
 ; clCreateKernel
+;
+; With /LAZY the kernels are only registered, and each is built on its
+; first set_kernel_arg or execute_kernel; kernels that are never used
+; are never compiled. /PREFETCH (with /LAZY) builds them in the
+; background meanwhile.
 ;-
 
   kernel_list_ptr = 0ULL
@@ -199,16 +334,30 @@ function niopencl::build_kernels, file_paths,     $
   if n_elements(function_names)  NE n_kernels then print, 'Error'
   if n_elements(compile_options) NE n_kernels then print, 'Error'
 
-  b = call_external(*(self.nc_ocl_lib), $
-                    'fNCbuild_kernels', $
-                    self.command_queue, $
-                    kernel_list_ptr,    $
-                    n_kernels,          $
-                    file_paths,         $
-                    function_names,     $
-                    compile_options,    $
-                    *(self.verbose),    $
-                    *(self.nc_ocl_log)  )
+  if keyword_set(lazy) then begin
+    b = call_external(*(self.nc_ocl_lib),    $
+                      'fNCregister_kernels', $
+                      self.command_queue,    $
+                      kernel_list_ptr,       $
+                      n_kernels,             $
+                      file_paths,            $
+                      function_names,        $
+                      compile_options,       $
+                      long(keyword_set(prefetch)), $
+                      *(self.verbose),       $
+                      *(self.nc_ocl_log)     )
+  endif else begin
+    b = call_external(*(self.nc_ocl_lib), $
+                      'fNCbuild_kernels', $
+                      self.command_queue, $
+                      kernel_list_ptr,    $
+                      n_kernels,          $
+                      file_paths,         $
+                      function_names,     $
+                      compile_options,    $
+                      *(self.verbose),    $
+                      *(self.nc_ocl_log)  )
+  endelse
 
   self.kernel_list = kernel_list_ptr
 
@@ -254,6 +403,13 @@ function niopencl::create_buffer, mem_ptr, content, read_write, use_host_ptr
 ; use_host_ptr: 0/1 (false/true)
 ;-
 
+  forward_function ncocl_create_buffer
+
+  if self.dlm then $
+     return, ncocl_create_buffer(self.command_queue, mem_ptr, content, $
+                                 read_write, use_host_ptr,             $
+                                 *(self.verbose), *(self.nc_ocl_log))
+
   case size(content, /type) of
      1    : var_size = 1ULL ; byte
      2    : var_size = 2ULL ; int     - short
@@ -289,6 +445,93 @@ function niopencl::create_buffer, mem_ptr, content, read_write, use_host_ptr
 
 end
 
+function niopencl::create_buffer_empty, mem_ptr, content_size, read_write
+;+
+; Create OpenCL buffer of content_size bytes without uploading data.
+; Use this for buffers that a kernel overwrites completely.
+;
+; clCreateBuffer
+;-
+
+  b = call_external(*(self.nc_ocl_lib),     $
+                    'fNCcreate_buffer_empty', $
+                    self.command_queue,     $
+                    ulong(mem_ptr),         $
+                    ulong64(content_size),  $
+                    long(read_write),       $
+                    *(self.verbose),        $
+                    *(self.nc_ocl_log)      )
+
+  return, b
+
+end
+
+function niopencl::create_buffer_fill, mem_ptr, n_values, value, read_write
+;+
+; Create OpenCL buffer of n_values elements of the type of value,
+; all set to value on the device (e.g. a zero image for /new).
+;
+; clCreateBuffer
+; clEnqueueFillBuffer
+;-
+
+  case size(value, /type) of
+     1    : var_size = 1ULL ; byte
+     2    : var_size = 2ULL ; int     - short
+     3    : var_size = 4ULL ; long    - int
+     4    : var_size = 4ULL ; float
+     5    : var_size = 8ULL ; double
+     12   : var_size = 2ULL ; uint    - ushort
+     13   : var_size = 4ULL ; ulong   - uint
+     14   : var_size = 8ULL ; long64  - long
+     15   : var_size = 8ULL ; ulong64 - ulong
+     else : var_size = 0ULL
+  endcase
+
+  if var_size EQ 0 then begin
+     print, 'Variable size could not be determined.'
+     stop
+  endif
+
+  pattern = value[0]
+
+  b = call_external(*(self.nc_ocl_lib),     $
+                    'fNCcreate_buffer_fill', $
+                    self.command_queue,     $
+                    ulong(mem_ptr),         $
+                    ulong64(n_values) * var_size, $
+                    long(read_write),       $
+                    pattern,                $
+                    var_size,               $
+                    *(self.verbose),        $
+                    *(self.nc_ocl_log)      )
+
+  return, b
+
+end
+
+function niopencl::create_buffer_copy, mem_ptr, src_ptr, read_write
+;+
+; Create OpenCL buffer as a device-side copy of buffer src_ptr
+;
+; clCreateBuffer
+; clEnqueueCopyBuffer
+;-
+
+  b = call_external(*(self.nc_ocl_lib),     $
+                    'fNCcreate_buffer_copy', $
+                    self.command_queue,     $
+                    ulong(mem_ptr),         $
+                    ulong(src_ptr),         $
+                    0ULL,                   $
+                    long(read_write),       $
+                    *(self.verbose),        $
+                    *(self.nc_ocl_log)      )
+
+  return, b
+
+end
+
 ; ---------------------
 function niopencl::create_image, mem_ptr, content, image_width, image_height, image_depth, read_write, use_host_ptr
 ;+
@@ -352,6 +595,12 @@ function niopencl::write_buffer, mem_ptr, content
 ; clEnqueueWriteBuffer
 ;-
 
+  forward_function ncocl_write_buffer
+
+  if self.dlm then $
+     return, ncocl_write_buffer(self.command_queue, mem_ptr, content, $
+                                *(self.verbose), *(self.nc_ocl_log))
+
   case size(content, /type) of
      1    : var_size = 1ULL ; byte
      2    : var_size = 2ULL ; int     - short
@@ -392,6 +641,12 @@ function niopencl::read_buffer, mem_ptr, content
 ; clEnqueueReadBuffer
 ;-
 
+  forward_function ncocl_read_buffer
+
+  if self.dlm then $
+     return, ncocl_read_buffer(self.command_queue, mem_ptr, content, $
+                               *(self.verbose), *(self.nc_ocl_log))
+
   case size(content, /type) of
      1    : var_size = 1ULL ; byte
      2    : var_size = 2ULL ; int     - short
@@ -425,6 +680,157 @@ function niopencl::read_buffer, mem_ptr, content
 
 end
 
+function niopencl::read_buffer_region, mem_ptr, content, offset, write = write
+;+
+; Read content from buffer, starting at element offset
+; (or write content to it when /write is set)
+;
+; clEnqueueReadBuffer / clEnqueueWriteBuffer
+;-
+
+  case size(content, /type) of
+     1    : var_size = 1ULL ; byte
+     2    : var_size = 2ULL ; int     - short
+     3    : var_size = 4ULL ; long    - int
+     4    : var_size = 4ULL ; float
+     5    : var_size = 8ULL ; double
+     12   : var_size = 2ULL ; uint    - ushort
+     13   : var_size = 4ULL ; ulong   - uint
+     14   : var_size = 8ULL ; long64  - long
+     15   : var_size = 8ULL ; ulong64 - ulong
+     else : var_size = 0ULL
+  endcase
+
+  content_size = n_elements(content) * var_size
+
+  if content_size EQ 0 then begin
+     print, 'Variable size could not be determined.'
+     stop
+  endif
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    keyword_set(write) ? 'fNCwrite_buffer_region' : 'fNCread_buffer_region', $
+                    self.command_queue,  $
+                    ulong(mem_ptr),      $
+                    content,             $
+                    ulong64(offset) * var_size, $
+                    content_size,        $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, b
+
+end
+
+function niopencl::write_buffer_region, mem_ptr, content, offset
+;+
+; Write content to buffer, starting at element offset
+;
+; clEnqueueWriteBuffer
+;-
+
+  return, self->read_buffer_region(mem_ptr, content, offset, /write)
+
+end
+
+function niopencl::read_buffer_rect, mem_ptr, content, buf_dims, buf_origin, host_origin, region, write = write
+;+
+; Read a 3-D block from buffer into content
+; (or write it from content when /write is set)
+;
+; clEnqueueReadBufferRect / clEnqueueWriteBufferRect
+;
+; buf_dims:    dimensions of the array stored in the buffer
+; buf_origin:  first element of the block in the buffer
+; host_origin: first element of the block in content
+; region:      size of the block
+;
+; All in elements, e.g. sinogram planes 10-19 of a (ndet, nangles, nplanes)
+; buffer into a (ndet, nangles, 10) array:
+;   b = bridge->read_buffer_rect(1, slab, [ndet,nangles,nplanes], $
+;                                [0,0,10], [0,0,0], [ndet,nangles,10])
+;-
+
+  case size(content, /type) of
+     1    : var_size = 1ULL ; byte
+     2    : var_size = 2ULL ; int     - short
+     3    : var_size = 4ULL ; long    - int
+     4    : var_size = 4ULL ; float
+     5    : var_size = 8ULL ; double
+     12   : var_size = 2ULL ; uint    - ushort
+     13   : var_size = 4ULL ; ulong   - uint
+     14   : var_size = 8ULL ; long64  - long
+     15   : var_size = 8ULL ; ulong64 - ulong
+     else : var_size = 0ULL
+  endcase
+
+  if var_size EQ 0 then begin
+     print, 'Variable size could not be determined.'
+     stop
+  endif
+
+  buf_dims  = [ulong64(buf_dims), 1ULL, 1ULL]
+  host_dims = [ulong64(size(content, /dimensions)), 1ULL, 1ULL]
+
+  pitches   = [buf_dims[0],  buf_dims[0]  * buf_dims[1], $
+               host_dims[0], host_dims[0] * host_dims[1]] * var_size
+  b_origin  = ulong64(buf_origin[0:2])  * [var_size, 1ULL, 1ULL]
+  h_origin  = ulong64(host_origin[0:2]) * [var_size, 1ULL, 1ULL]
+  b_region  = ulong64(region[0:2])      * [var_size, 1ULL, 1ULL]
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    keyword_set(write) ? 'fNCwrite_buffer_rect' : 'fNCread_buffer_rect', $
+                    self.command_queue,  $
+                    ulong(mem_ptr),      $
+                    content,             $
+                    b_origin,            $
+                    h_origin,            $
+                    b_region,            $
+                    pitches,             $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, b
+
+end
+
+function niopencl::write_buffer_rect, mem_ptr, content, buf_dims, buf_origin, host_origin, region
+;+
+; Write a 3-D block of content to buffer, see read_buffer_rect
+;
+; clEnqueueWriteBufferRect
+;-
+
+  return, self->read_buffer_rect(mem_ptr, content, buf_dims, buf_origin, $
+                                 host_origin, region, /write)
+
+end
+
+function niopencl::create_sub_buffer, mem_ptr, parent_ptr, origin, size, read_write
+;+
+; Create buffer mem_ptr as a view on bytes [origin, origin+size) of
+; buffer parent_ptr. The origin must be aligned to the device base
+; address alignment (typically 128 or 4096 bytes).
+;
+; clCreateSubBuffer
+;
+; read_write: as create_buffer, -1 inherits from the parent
+;-
+
+  b = call_external(*(self.nc_ocl_lib),     $
+                    'fNCcreate_sub_buffer', $
+                    ulong(parent_ptr),      $
+                    ulong(mem_ptr),         $
+                    ulong64(origin),        $
+                    ulong64(size),          $
+                    long(read_write),       $
+                    *(self.verbose),        $
+                    *(self.nc_ocl_log)      )
+
+  return, b
+
+end
+
 function niopencl::release_buffer, mem_ptr
 ;+
 ; Release buffer
@@ -432,6 +838,11 @@ function niopencl::release_buffer, mem_ptr
 ; clReleaseMemObject
 ;-
 
+  forward_function ncocl_release_buffer
+
+  if self.dlm then $
+     return, ncocl_release_buffer(mem_ptr, *(self.verbose), *(self.nc_ocl_log))
+
   b = call_external(*(self.nc_ocl_lib),  $
                     'fNCrelease_buffer', $
                     ulong(mem_ptr),      $
@@ -469,6 +880,8 @@ function niopencl::set_kernel_arg, kernel, arg_index, arg_value, mem_ptr
 ; clSetKernelArg
 ;-
 
+  forward_function ncocl_set_kernel_arg
+
   for ii = 0, n_elements(*(self.kernel_names))-1 do begin
      if kernel EQ (*(self.kernel_names))[ii] then begin
         kernel_index = ulong(ii)
@@ -476,6 +889,11 @@ function niopencl::set_kernel_arg, kernel, arg_index, arg_value, mem_ptr
      endif
   endfor
 
+  if self.dlm then $
+     return, ncocl_set_kernel_arg(self.kernel_list, kernel_index, arg_index, $
+                                  arg_value, mem_ptr, *(self.verbose),      $
+                                  *(self.nc_ocl_log))
+
   if mem_ptr then begin
      arg_size  = 8ULL ; cl_mem
      arg_value = ulong(arg_value)
@@ -519,6 +937,8 @@ function niopencl::execute_kernel, kernel, global, local, use_local
 ; clGetEventProfilingInfo (if verbose = 1)
 ;-
 
+  forward_function ncocl_execute_kernel
+
   for ii = 0, n_elements(*(self.kernel_names))-1 do begin
      if kernel EQ (*(self.kernel_names))[ii] then begin
         kernel_index = ulong(ii)
@@ -526,6 +946,11 @@ function niopencl::execute_kernel, kernel, global, local, use_local
      endif
   endfor
 
+  if self.dlm then $
+     return, ncocl_execute_kernel(self.command_queue, self.kernel_list,   $
+                                  kernel_index, use_local, global, local, $
+                                  *(self.verbose), *(self.nc_ocl_log))
+
   b = call_external(*(self.nc_ocl_lib),  $
                     'fNCexecute_kernel', $
                     self.command_queue,  $
@@ -555,6 +980,916 @@ function niopencl::unload
 
 end
 
+function niopencl::sino_gather, src_ptr, dst_ptr, subset_ptr, size_src, range
+;+
+; Gather src[trim0:trim0+ntrim-1, subset, *] into dst on the device
+;
+; size_src: [ndetcols, nrangles, ndetplanes, 0] of the resident sinogram
+; range:    [trim0, ntrim, nsubset, swap]
+;  - swap = 1 stores dst as (det, plane, angle), as niswyz does
+;
+; subset_ptr: buffer with long subset indices, or -1 to take
+;             the first nsubset angles in order
+;-
+
+  use_subset = subset_ptr GE 0
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCsino_gather',     $
+                    self.command_queue,   $
+                    ulong(src_ptr),       $
+                    ulong(dst_ptr),       $
+                    ulong(use_subset ? subset_ptr : src_ptr), $
+                    long(use_subset),     $
+                    ulong(size_src),      $
+                    ulong(range),         $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::sino_scatter, src_ptr, dst_ptr, subset_ptr, size_dst, range, accumulate
+;+
+; Scatter a subset sinogram back into the resident sinogram,
+; the inverse of sino_gather.
+;
+; accumulate: 0/1, overwrite or add to the values in dst
+;-
+
+  use_subset = subset_ptr GE 0
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCsino_scatter',    $
+                    self.command_queue,   $
+                    ulong(src_ptr),       $
+                    ulong(dst_ptr),       $
+                    ulong(use_subset ? subset_ptr : src_ptr), $
+                    long(use_subset),     $
+                    ulong(size_dst),      $
+                    ulong(range),         $
+                    long(accumulate),     $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::sino_swap, src_ptr, dst_ptr, size_src
+;+
+; Swap the second and third dimension on the device (niswyz)
+;-
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCsino_swap',       $
+                    self.command_queue,   $
+                    ulong(src_ptr),       $
+                    ulong(dst_ptr),       $
+                    ulong(size_src),      $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::sino_rebin, src_ptr, dst_ptr, size_src, det_rebin, angle_rebin
+;+
+; Sum det_rebin detector bins and angle_rebin angles on the device
+;-
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCsino_rebin',      $
+                    self.command_queue,   $
+                    ulong(src_ptr),       $
+                    ulong(dst_ptr),       $
+                    ulong(size_src),      $
+                    ulong([det_rebin, angle_rebin, 1, 1]), $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::geom_srclocs, mem_ptr, angles, tablepos, align, zalign, subset, srclocs
+;+
+; Source locations (angle, mean tablepos, align, zalign) per view of subset.
+; mem_ptr >= 0 writes straight into that buffer, which must hold
+; 4 floats per view (e.g. create_buffer_empty(mem_ptr, 16*nsubset, 2));
+; mem_ptr < 0 returns the array in srclocs.
+;
+; subset: view indices, or -1 for all views
+;-
+
+  nrangles   = ulong64(n_elements(angles))
+  dims       = size(tablepos, /dimensions)
+  ndetplanes = n_elements(dims) ge 2 ? ulong(dims[1]) : 1UL
+  if n_elements(subset) eq 1 && subset[0] lt 0 $
+    then nsubset = nrangles $
+    else nsubset = ulong64(n_elements(subset))
+  to_device = mem_ptr GE 0
+  srclocs   = to_device ? 0.0 : fltarr(4, nsubset)
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    'fNCgeom_srclocs',   $
+                    self.command_queue,  $
+                    ulong(to_device ? mem_ptr : 0), $
+                    srclocs,             $
+                    long(to_device),     $
+                    float(angles),       $
+                    float(tablepos),     $
+                    float(align),        $
+                    float(zalign),       $
+                    nrangles,            $
+                    ndetplanes,          $
+                    long(subset),        $
+                    nsubset,             $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, b
+
+end
+
+function niopencl::geom_motion, mem_ptr, rigmotion, subset, matrices
+;+
+; 4x4 homogeneous rigid motion matrix per view of subset from the
+; 6 x nrangles RIGMOTION array [tx,ty,tz (mm), rx,ry,rz (degrees)].
+; mem_ptr as in geom_srclocs (16 floats per view).
+;-
+
+  if n_elements(subset) eq 1 && subset[0] lt 0 $
+    then nsubset = ulong64(n_elements(rigmotion) / 6) $
+    else nsubset = ulong64(n_elements(subset))
+  to_device = mem_ptr GE 0
+  matrices  = to_device ? 0.0 : fltarr(4, 4, nsubset)
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    'fNCgeom_motion',    $
+                    self.command_queue,  $
+                    ulong(to_device ? mem_ptr : 0), $
+                    matrices,            $
+                    long(to_device),     $
+                    float(rigmotion),    $
+                    long(subset),        $
+                    nsubset,             $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, b
+
+end
+
+function niopencl::geom_detector, nchannels, fan, tablepos0, detcols0, detrows0, detplanes0
+;+
+; Detector fan boundaries for NIdef_projspiralct_ocl.
+; fan: [fan_coroffset, fanangle, focus2detector, focus2centermm, zfactor]
+; tablepos0: table position of each detector row, tablepos[0,*]
+;-
+
+  ndetplanes = ulong(n_elements(tablepos0))
+  detcols0   = fltarr(nchannels+1)
+  detrows0   = fltarr(nchannels+1)
+  detplanes0 = fltarr(ndetplanes+1)
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    'fNCgeom_detector',  $
+                    ulong(nchannels),    $
+                    ndetplanes,          $
+                    float(fan),          $
+                    float(reform(tablepos0)), $
+                    detcols0,            $
+                    detrows0,            $
+                    detplanes0,          $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, b
+
+end
+
+function niopencl::geom_initial_coords, detcols0, detrows0, detplanes0, center, source, centers, initial_coords
+;+
+; Pack center, source and detector grid into the float4 initial
+; coordinates of the kernels. centers = 1 uses bin centers (ray tracing).
+;-
+
+  ncols   = ulong(n_elements(detcols0))
+  nplanes = ulong(n_elements(detplanes0))
+  npoints = keyword_set(centers) ? (ncols-1) * (nplanes-1) + 2 : ncols * nplanes + 2
+  initial_coords = fltarr(4, npoints)
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    'fNCgeom_initial_coords', $
+                    float(detcols0),     $
+                    float(detrows0),     $
+                    ncols,               $
+                    float(detplanes0),   $
+                    nplanes,             $
+                    float(center),       $
+                    float(source),       $
+                    long(keyword_set(centers)), $
+                    initial_coords,      $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, b
+
+end
+
+function niopencl::warp_set_state, state, field, half = half
+;+
+; Store the deformation field of one motion state on the device.
+;
+; field: (fx, fy, fz, 3) displacements in image voxels. The grid may be
+;        coarser than the image, it is upsampled trilinearly on the fly.
+; /half: keep the field in half precision
+;-
+
+  dims = size(field, /dimensions)
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCwarp_set_state',  $
+                    self.command_queue,   $
+                    ulong(state),         $
+                    float(field),         $
+                    ulong([dims[0:2], keyword_set(half)]), $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::warp, src_ptr, dst_ptr, state, img_dims, adjoint = adjoint, accumulate = accumulate
+;+
+; Warp the image in src_ptr with the field of a motion state:
+;   dst(x) = src(x + u(x))
+; /adjoint applies the transpose, /accumulate adds to dst.
+;
+; img_dims: [nx, ny, nz]
+;-
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCwarp',            $
+                    self.command_queue,   $
+                    ulong(src_ptr),       $
+                    ulong(dst_ptr),       $
+                    ulong(state),         $
+                    ulong([img_dims[0:2], 0]), $
+                    long(keyword_set(adjoint)),    $
+                    long(keyword_set(accumulate)), $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::warp_compose, state_out, state_a, state_b, img_dims
+;+
+; state_out = warp by state_a, then by state_b, as a float field
+; on the image grid.
+;-
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCwarp_compose',    $
+                    self.command_queue,   $
+                    ulong(state_out),     $
+                    ulong(state_a),       $
+                    ulong(state_b),       $
+                    ulong([img_dims[0:2], 0]), $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::warp_bind_state, state, mem_ptr
+;+
+; Make the field of a motion state available as buffer mem_ptr,
+; e.g. as kernel argument of the NMC projector.
+;-
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCwarp_bind_state', $
+                    self.command_queue,   $
+                    ulong(state),         $
+                    ulong(mem_ptr),       $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::resample_down, src_ptr, dst_ptr, size_src, factor, average = average
+;+
+; Downsample src by the integer factors [fx, fy, fz] into dst,
+; which holds size_src / factor elements.
+; /average takes the mean (volumes), else the sum (sinograms).
+;-
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCresample_down',   $
+                    self.command_queue,   $
+                    ulong(src_ptr),       $
+                    ulong(dst_ptr),       $
+                    ulong([size_src[0:2], 0]), $
+                    ulong([factor[0:2], 0]),   $
+                    long(keyword_set(average)), $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::resample_up, src_ptr, dst_ptr, size_src, size_dst, scale = scale
+;+
+; Trilinear upsampling of src (size_src) onto dst (size_dst),
+; multiplied by scale (default 1).
+;-
+
+  if n_elements(scale) eq 0 then scale = 1.0
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCresample_up',     $
+                    self.command_queue,   $
+                    ulong(src_ptr),       $
+                    ulong(dst_ptr),       $
+                    ulong([size_src[0:2], 0]), $
+                    ulong([size_dst[0:2], 0]), $
+                    float(scale),         $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::sysmat_record_begin, coo_ptr, count_ptr, capacity, budget = budget
+;+
+; Allocate the buffers in which a projector built with
+; -D RECORD_SYSMAT records up to CAPACITY coefficients.
+; Returns 1 (nothing allocated) when they exceed the memory
+; budget in bytes (default half the device memory).
+;-
+
+  if n_elements(budget) eq 0 then budget = 0ULL
+
+  b = call_external(*(self.nc_ocl_lib),     $
+                    'fNCsysmat_record_begin', $
+                    self.command_queue,     $
+                    ulong(coo_ptr),         $
+                    ulong(count_ptr),       $
+                    ulong64(capacity),      $
+                    ulong64(budget),        $
+                    *(self.verbose),        $
+                    *(self.nc_ocl_log)      )
+
+  return, b
+
+end
+
+function niopencl::sysmat_build, coo_ptr, count_ptr, nrows, ncols, view_rows, key, $
+                                 half = half, placement = placement, budget = budget
+;+
+; Turn the recorded coefficients into the cached system matrix
+; (NRows sinogram bins x NCOLS voxels, VIEW_ROWS bins per view).
+; KEY (7 x ulong64: geometry id, image cols, rows, planes, sinogram
+; detectors, planes, views) identifies what it was recorded for;
+; sysmat_project only applies it with the same key.
+;
+; /half:     half precision weights on the device
+; placement: 0 = host memory for CPU devices (default), 1 = device,
+;            2 = host memory
+;
+; Returns 1 when the recording overflowed or the matrix does not
+; fit in the budget; projections then stay on the fly.
+;-
+
+  if n_elements(placement) eq 0 then placement = 0
+  if n_elements(budget)    eq 0 then budget = 0ULL
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCsysmat_build',    $
+                    self.command_queue,   $
+                    ulong(coo_ptr),       $
+                    ulong(count_ptr),     $
+                    ulong64(nrows),       $
+                    ulong64(ncols),       $
+                    ulong64(view_rows),   $
+                    ulong64(key[0:6]),    $
+                    long(keyword_set(half)), $
+                    long(placement),      $
+                    ulong64(budget),      $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::sysmat_project, src_ptr, dst_ptr, subset_ptr, nviews, key, $
+                                   backproject = backproject, accumulate = accumulate
+;+
+; Forward (image -> sinogram) or, with /backproject, back projection
+; with the cached system matrix. The sinogram holds the NVIEWS views
+; listed in subset_ptr (long), or the first NVIEWS when subset_ptr is -1.
+; Fails when KEY differs from the one given to sysmat_build.
+;-
+
+  use_subset = subset_ptr GE 0
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCsysmat_project',  $
+                    self.command_queue,   $
+                    ulong(src_ptr),       $
+                    ulong(dst_ptr),       $
+                    ulong(use_subset ? subset_ptr : src_ptr), $
+                    long(use_subset),     $
+                    ulong64(nviews),      $
+                    ulong64(key[0:6]),    $
+                    long(keyword_set(backproject)), $
+                    long(keyword_set(accumulate)),  $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::sysmat_status, status, dims, key
+;+
+; status: 0 = no cached matrix, 1 = on the device, 2 = in host memory
+; dims:   [rows, columns, rows per view]
+; key:    the key it was built with, see sysmat_build
+;-
+
+  status = 0L
+  dims   = ulon64arr(3)
+  key    = ulon64arr(7)
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCsysmat_status',   $
+                    self.command_queue,   $
+                    status,               $
+                    dims,                 $
+                    key                   )
+
+  return, b
+
+end
+
+function niopencl::serve, socket_path
+;+
+; Run the projection server in this IDL session: it owns the
+; contexts, kernels and buffers of the sessions that connect to
+; socket_path, and returns when one of them disconnects with /stop.
+; The opencl_server executable does the same without IDL.
+;-
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCserver_run',      $
+                    string(socket_path),  $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::connect_server, socket_path
+;+
+; Send the calls of all bridges in this IDL session to the
+; projection server on socket_path, until disconnect_server.
+; Connect before create_command_queue; the queue, kernels and
+; buffers then live in the server.
+;-
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCserver_connect',  $
+                    string(socket_path),  $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+
+function niopencl::disconnect_server, stop = stop
+;+
+; Drop the connection; the server releases what this session
+; left behind. /stop also shuts the server down.
+;-
+
+  b = call_external(*(self.nc_ocl_lib),     $
+                    'fNCserver_disconnect', $
+                    long(keyword_set(stop)), $
+                    *(self.verbose),        $
+                    *(self.nc_ocl_log)      )
+
+  return, b
+
+end
+
+function niopencl::capture_start, trace_file, hash = hash, sample = sample
+;+
+; Workload capture: record the calls of this session (queues,
+; kernels with their sources, buffers and transfers, source
+; locations) to a trace file, until capture_stop. The
+; opencl_replay executable runs the trace again on any device.
+;
+; /hash keeps only a hash of uploaded image and sinogram data,
+; sample = n every n-th word of it; read-only buffers and small
+; data are always recorded in full.
+;-
+
+  content = 0L
+  if keyword_set(hash) then content = 1L
+  if n_elements(sample) gt 0 then content = 2L
+  if n_elements(sample) eq 0 then sample = 1
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    'fNCcapture_start',  $
+                    string(trace_file),  $
+                    content,             $
+                    ulong(sample),       $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, b
+
+end
+
+function niopencl::capture_stop
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    'fNCcapture_stop',   $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, b
+
+end
+
+function niopencl::memory_budget, bytes
+;+
+; Device memory budget in bytes (0: the global memory of the
+; device). Buffers over the budget are moved to host memory, least
+; recently used first, and brought back when they are used again.
+;-
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    'fNCmemory_budget',  $
+                    ulong64(bytes),      $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, b
+
+end
+
+function niopencl::memory_status
+;+
+; Device memory of the command queue's device, as
+; [bytes in use, high-water mark, budget, global memory,
+;  largest allocation, bytes moved to the host, evictions, restores]
+;-
+
+  status = ulon64arr(8)
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    'fNCmemory_status',  $
+                    self.command_queue,  $
+                    status,              $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, status
+
+end
+
+function niopencl::arena_array, type, dims, huge
+;+
+; Array of the given type code and dimensions in page aligned host
+; memory of the library's arena, optionally on huge pages. Buffers
+; created on it with use_host_ptr = 1 are used in place by runtimes
+; that can; the contents are undefined, as with make_array(/nozero).
+; The block returns to the arena when the array is freed.
+;
+; Without the DLM (see NCopencl_dlm.cpp) this is a plain array.
+;-
+
+  forward_function ncocl_arena_array
+
+  if n_elements(huge) EQ 0 then huge = 0
+
+  if not self.dlm then $
+     return, make_array(dims, type=type, /nozero)
+
+  return, ncocl_arena_array(type, dims, huge, *(self.verbose), *(self.nc_ocl_log))
+
+end
+function niopencl::arena_status, trim
+;+
+; Host arena as [bytes in use, bytes pooled for reuse, blocks,
+; bytes on huge pages]. trim = 1 first gives the pooled blocks back
+; to the system.
+;-
+
+  if n_elements(trim) EQ 0 then trim = 0
+
+  status = ulon64arr(4)
+
+  b = call_external(*(self.nc_ocl_lib),  $
+                    'fNCarena_status',   $
+                    status,              $
+                    long(trim),          $
+                    *(self.verbose),     $
+                    *(self.nc_ocl_log)   )
+
+  return, status
+
+end
+function niopencl::buffer_in_place, mem_ptr
+;+
+; 1 if the buffer created with use_host_ptr = 1 works on the host
+; memory itself, 0 if the runtime keeps its own copy.
+;-
+
+  b = call_external(*(self.nc_ocl_lib),   $
+                    'fNCbuffer_in_place', $
+                    self.command_queue,   $
+                    ulong(mem_ptr),       $
+                    *(self.verbose),      $
+                    *(self.nc_ocl_log)    )
+
+  return, b
+
+end
+function niopencl::create_buffer_svm, mem_ptr, content, read_write, mode
+;+
+; Create a buffer on OpenCL 2.0 shared virtual memory, filled with
+; content. Kernels get it by pointer and buffer reads and writes do
+; not go through the device queue.
+;
+; mode:
+;  - 0 : fastest the device has (default)
+;  - 1 : coarse grained buffer
+;  - 2 : fine grained buffer
+;  - 3 : fine grained system; content itself is shared, and must
+;        stay allocated as long as the buffer
+;
+; Returns the granularity used (1-3), -4 if the device has none.
+;-
+
+  if n_elements(mode) EQ 0 then mode = 0
+
+  case size(content, /type) of
+     1    : var_size = 1ULL ; byte
+     2    : var_size = 2ULL ; int     - short
+     3    : var_size = 4ULL ; long    - int
+     4    : var_size = 4ULL ; float
+     5    : var_size = 8ULL ; double
+     12   : var_size = 2ULL ; uint    - ushort
+     13   : var_size = 4ULL ; ulong   - uint
+     14   : var_size = 8ULL ; long64  - long
+     15   : var_size = 8ULL ; ulong64 - ulong
+     else : var_size = 0ULL
+  endcase
+
+  content_size = n_elements(content) * var_size
+
+  if content_size EQ 0 then begin
+     print, 'Variable size could not be determined.'
+     stop
+  endif
+
+  b = call_external(*(self.nc_ocl_lib),     $
+                    'fNCcreate_buffer_svm', $
+                    self.command_queue,     $
+                    ulong(mem_ptr),         $
+                    content,                $
+                    content_size,           $
+                    long(read_write),       $
+                    ulong(mode),            $
+                    *(self.verbose),        $
+                    *(self.nc_ocl_log)      )
+
+  return, b
+
+end
+function niopencl::svm_array, mem_ptr, type, dims
+;+
+; Array of the given type code and dimensions on the memory of a fine
+; grained SVM buffer (create_buffer_svm, granularity 2 or 3): host
+; and kernels share it without transfers. Only valid until the buffer
+; is released. Needs the DLM (see NCopencl_dlm.cpp).
+;-
+
+  forward_function ncocl_svm_array
+
+  if not self.dlm then begin
+     print, 'svm_array needs the ncopencl DLM.'
+     stop
+  endif
+
+  return, ncocl_svm_array(ulong(mem_ptr), type, dims)
+
+end
+function niopencl::execute_kernel_tiled, kernel, global, local, use_local, $
+                                       tile = tile, in_flight = in_flight, $
+                                       nowait = nowait
+;+
+; Execute kernel in tiles along the last dimension of global larger
+; than 1 (the views of a projection), each launched with a global
+; work offset. tile: slices per tile (default 0: sized for about 50 ms
+; per tile); in_flight: tiles queued at a time (default 2). With
+; /nowait it returns at once: follow it with tile_progress and
+; tile_cancel, and call tile_wait before setting arguments of the
+; kernel or reading its buffers. Returns 1 if cancelled.
+;
+; clEnqueueNDRangeKernel (global_work_offset)
+; clWaitForEvents
+;-
+
+  if n_elements(tile) EQ 0 then tile = 0
+  if n_elements(in_flight) EQ 0 then in_flight = 2
+  wait = keyword_set(nowait) ? 0UL : 1UL
+
+  for ii = 0, n_elements(*(self.kernel_names))-1 do begin
+     if kernel EQ (*(self.kernel_names))[ii] then begin
+        kernel_index = ulong(ii)
+        break
+     endif
+  endfor
+
+  b = call_external(*(self.nc_ocl_lib),        $
+                    'fNCexecute_kernel_tiled', $
+                    self.command_queue,        $
+                    self.kernel_list,          $
+                    kernel_index,              $
+                    ulong(use_local),          $
+                    ulong(global),             $
+                    ulong(local),              $
+                    ulong64(tile),             $
+                    ulong(in_flight),          $
+                    wait,                      $
+                    *(self.verbose),           $
+                    *(self.nc_ocl_log)         )
+
+  return, b
+
+end
+function niopencl::tile_progress
+;+
+; Tiled launch as [slices done, slices in total, state, slices per
+; tile]; state 0 none, 1 running, 2 done, 3 cancelled, 4 failed.
+;-
+
+  status = ulon64arr(4)
+
+  b = call_external(*(self.nc_ocl_lib), $
+                    'fNCtile_progress', $
+                    self.command_queue, $
+                    status              )
+
+  return, status
+
+end
+function niopencl::tile_cancel
+;+
+; Stop a tiled launch after the tiles already queued
+;-
+
+  b = call_external(*(self.nc_ocl_lib), $
+                    'fNCtile_cancel',   $
+                    self.command_queue, $
+                    *(self.verbose),    $
+                    *(self.nc_ocl_log)  )
+
+  return, b
+
+end
+function niopencl::tile_wait
+;+
+; Wait for a tiled launch started with /nowait. Returns its result:
+; 0, 1 if cancelled, negative on error.
+;-
+
+  b = call_external(*(self.nc_ocl_lib), $
+                    'fNCtile_wait',     $
+                    self.command_queue, $
+                    *(self.verbose),    $
+                    *(self.nc_ocl_log)  )
+
+  return, b
+
+end
+function niopencl::plan, dims, subsets = subsets, det_rebin = det_rebin, $
+                       angle_rebin = angle_rebin
+;+
+; Plan a projector job before launching it. dims: [nrcols, nrrows,
+; nrplanes, ndetcols, ndetplanes, nrangles] as in the projector
+; description, before det_rebin and angle_rebin. Without subsets
+; the most subsets that keep 80% of the time projecting are
+; recommended. Returns a structure: the subsets, the device memory
+; and whether it fits the budget (see memory_budget), the layout
+; (0: sinogram per subset, 1: full sinogram kept on the device,
+; 2: image in slabs of slab_planes planes), and the predicted seconds
+; of a forward and a back projection of all views. The runtime model
+; is calibrated with plan_sample or plan_load; calibrated gives the
+; number of samples behind it, 0 when it is estimated.
+;-
+
+  options = ulonarr(3)
+  if n_elements(subsets)     gt 0 then options[0] = subsets
+  if n_elements(det_rebin)   gt 0 then options[1] = det_rebin
+  if n_elements(angle_rebin) gt 0 then options[2] = angle_rebin
+  plan = dblarr(12)
+
+  b = call_external(*(self.nc_ocl_lib), $
+                    'fNCplan',          $
+                    self.command_queue, $
+                    ulong64(dims),      $
+                    options,            $
+                    plan,               $
+                    *(self.verbose),    $
+                    *(self.nc_ocl_log)  )
+
+  return, {status          : b,                $
+           subsets         : ulong(plan[0]),   $
+           views           : ulong(plan[1]),   $
+           bytes           : ulong64(plan[2]), $
+           budget          : ulong64(plan[3]), $
+           fits            : plan[4] ne 0,     $
+           layout          : fix(plan[5]),     $
+           slab_planes     : ulong(plan[6]),   $
+           slabs           : ulong(plan[7]),   $
+           seconds_forward : plan[8],          $
+           seconds_back    : plan[9],          $
+           transfer_share  : plan[10],         $
+           calibrated      : ulong(plan[11])   }
+
+end
+
+function niopencl::plan_sample, dims, seconds, back = back, $
+                              transfer_bytes = transfer_bytes, $
+                              transfer_seconds = transfer_seconds
+;+
+; Add a timed launch to the planning model: dims as for plan, with
+; nrangles the views of the launch, and its seconds (with the
+; transfers, unless transfer_bytes and transfer_seconds are given).
+;-
+
+  if n_elements(transfer_bytes)   eq 0 then transfer_bytes = 0
+  if n_elements(transfer_seconds) eq 0 then transfer_seconds = 0
+
+  b = call_external(*(self.nc_ocl_lib),      $
+                    'fNCplan_sample',        $
+                    self.command_queue,      $
+                    long(keyword_set(back)), $
+                    ulong64(dims),           $
+                    double(seconds),         $
+                    ulong64(transfer_bytes), $
+                    double(transfer_seconds), $
+                    *(self.verbose),         $
+                    *(self.nc_ocl_log)       )
+
+  return, b
+
+end
+
+function niopencl::plan_load, calibration_file
+
+  b = call_external(*(self.nc_ocl_lib),     $
+                    'fNCplan_load',         $
+                    string(calibration_file), $
+                    *(self.verbose),        $
+                    *(self.nc_ocl_log)      )
+
+  return, b
+
+end
+
+function niopencl::plan_save, calibration_file
+
+  b = call_external(*(self.nc_ocl_lib),     $
+                    'fNCplan_save',         $
+                    string(calibration_file), $
+                    *(self.verbose),        $
+                    *(self.nc_ocl_log)      )
+
+  return, b
+
+end
+
 pro niopencl__define
 
   struct = {niopencl,                 $
@@ -565,7 +1900,8 @@ pro niopencl__define
             kernel_names  : ptr_new(),$
             command_queue : 0ULL,     $
             kernel_list   : 0ULL,     $
-            buffer_list   : 0ULL      }
+            buffer_list   : 0ULL,     $
+            dlm           : 0B        }
 
   return
 
@@ -59,6 +59,42 @@
 ;      the result of projection or backprojection is multiplied with
 ;      this scalefactor (assumed to be a scalar).
 ;
+;    LIBMOTION
+;      when set, the rigid motion matrices are computed in the library
+;      (bridge->geom_motion) instead of with NImotion2matrix. Its
+;      convention is R = Rz Ry Rx, rotations in degrees, translation
+;      after the rotation. The first call in an IDL session compares
+;      both for two non-trivial motions; if they differ, a message
+;      gives the largest difference and NImotion2matrix is used for
+;      the rest of the session.
+;
+;    RESIDENT
+;      when set, the full sinogram is kept on the device in buffer 5
+;      of PROJDESCRIP.oclbridge (create it once with
+;      bridge->create_buffer(5, sinogram, 0, 0)), and SINOGRAM is not
+;      transferred. The subset is gathered, trimmed and swapped on the
+;      device; a projection is added to the resident sinogram, which
+;      the caller reads back when needed. With /NEW the resident
+;      sinogram is zeroed on the device. Sinogram blurring (FWHM) is
+;      not applied in this mode.
+;
+;    SYSMAT
+;      number of coefficients to reserve when the system matrix is
+;      recorded (PROJDESCRIP defined with /RECORD_SYSMAT). The first
+;      forward projection over all angles records it, later
+;      (back)projections use the cached matrix. Default is a rough
+;      estimate from the image and sinogram sizes; if the recording
+;      overflows or the matrix does not fit in memory, projections
+;      simply stay on the fly. The matrix is only used for the
+;      projdescrip (sysmat_id) and image size it was recorded with.
+;
+;    TILE
+;      when set, the kernel is launched in tiles of views with a
+;      global offset (bridge->execute_kernel_tiled) so that long
+;      projections do not hit the driver watchdog and leave room for
+;      other work on the device. TILE = 1 sizes the tiles for about
+;      50 ms each, a larger value is the number of views per tile.
+;
 ; OUTPUTS:
 ;    IMAGE:     see INPUTS
 ;    SINOGRAM:  see INPUTS
@@ -67,7 +103,7 @@
 ;    none
 ;
 ; COMMON BLOCKS:
-;    none
+;    NIproj_distd_spiralct_ocl_libmotion: result of the LIBMOTION check
 ;
 ; SIDE EFFECTS:
 ;    none
@@ -96,10 +132,12 @@
 
 compile_opt strictarrsubs
 
+common NIproj_distd_spiralct_ocl_libmotion, libmotion_ok
 pro NIproj_distd_spiralct_ocl_pic, image, sinogram, backproject = backproject, $
     subset = subset, new = new, projdescrip = projdescrip, $
     attenuation = attenuation, scalefactor = scalefactor, $
-    calctime = calctime, subonly = subonly, holes=holes, where_holes=where_holes
+    calctime = calctime, subonly = subonly, holes=holes, where_holes=where_holes, $
+    resident = resident, libmotion = libmotion, sysmat = sysmat, tile = tile
     
   calctime = 0.0
   if projdescrip.type ne 'distd_spiralct_ocl' then begin
@@ -141,7 +179,7 @@ pro NIproj_distd_spiralct_ocl_pic, image, sinogram, backproject = backproject, $
     endif else begin
       ndetplanes = projdescrip.ndetplanes
     endelse
-    if n_elements(sinogram) le 1 then begin
+    if n_elements(sinogram) le 1 and not keyword_set(resident) then begin
       if keyword_set(subonly) $
         then sinogram = fltarr(projdescrip.ndetcols, n_elements(subset), $
         ndetplanes) $
@@ -150,11 +188,11 @@ pro NIproj_distd_spiralct_ocl_pic, image, sinogram, backproject = backproject, $
   endif
 endelse
 
-; Erase if requested.
+; Erase if requested. The image of a back projection and a resident
+; sinogram are zeroed on the device below; the host sinogram is summed into.
 ;-------
-if keyword_set(new) then $
-  if keyword_set(backproject) then image    = image    * 0.0 $
-                       else sinogram = sinogram * 0.0
+if keyword_set(new) and not keyword_set(backproject) and not keyword_set(resident) $
+  then sinogram = sinogram * 0.0
 
 ; Find fwhm_t and fwhm_a (transaxial and axial)
 ;-------
@@ -216,33 +254,8 @@ detbins0    = [[projdescrip.initial_coords[*,0:1]], [detbins0]]
 ;  subset = subsetnew
 
 
-; get the coordinates for current subset
-;detbins  = fltarr(4,8,nrangles)
-srclocs0  = fltarr(4,nrangles)
-rigmotion = fltarr(4,4,nrangles)
-;angles   = fltarr(nrangles)
-;tablepos = fltarr(nrangles, projdescrip.ndetplanes)
-
-
-for ii = 0L, nrangles-1 do begin
-  ;  detbins[*,*,ii] = projdescrip.detbins[*,*, subset[ii]]
-  ;  srclocs[*,ii] = projdescrip.srclocs[*, subset[ii]]
-  ;  angles[ii] = projdescrip.angles[subset[ii]]
-  ;  tablepos[ii,*] = projdescrip.tablepos[subset[ii], *]
-  ;  tableposmean[ii] = mean(projdescrip.tablepos[subset[ii], *])
-  srclocs0[0,ii] = projdescrip.angles[subset[ii]]
-  srclocs0[1,ii] = mean(projdescrip.tablepos[subset[ii], *])
-  srclocs0[2,ii] = projdescrip.align[subset[ii]]
-  srclocs0[3,ii] = projdescrip.zalign[subset[ii]]
-  
-  if n_elements(projdescrip.rigmotion) gt 1  then begin
-    dof = projdescrip.rigmotion[*,subset[ii]]
-    rigmotion[*,*,ii] = NImotion2matrix(motion=dof, /homo)               ; not the one in IDL!    
-  endif else begin
-;    rigmotion = 0.
-  endelse
-  
-endfor
+; the coordinates for the current subset (srclocs0 and the rigid motion
+; matrices) are generated in the library, straight into the buffers below
 
 
 
@@ -254,11 +267,21 @@ endfor
 ;  then sinoproj = sinogram           $
 ;else sinoproj = sinogram[*,subset,*]
 
-if keyword_set(subonly)              $
-  then sinoproj = sinogram[projdescrip.trim[0]:projdescrip.trim[1],*,*]           $
-else sinoproj = sinogram[projdescrip.trim[0]:projdescrip.trim[1],subset,*]
+if keyword_set(resident) then begin
+  ; trim, subset and axis swap are done on the device
+  if keyword_set(subonly)                                               $
+    then size_full = ulong([projdescrip.ndetcols, nrangles, projdescrip.ndetplanes, 0]) $
+  else size_full = ulong([projdescrip.ndetcols, projdescrip.nrangles, projdescrip.ndetplanes, 0])
+  sino_range = ulong([projdescrip.trim[0], size_sino[0], nrangles, 1])
+  if fwhm_t gt 0 or fwhm_a gt 0 then $
+    printf, -1, 'NIproj_distd_spiralct_ocl: FWHM is ignored for a resident sinogram'
+endif else begin
+  if keyword_set(subonly)              $
+    then sinoproj = sinogram[projdescrip.trim[0]:projdescrip.trim[1],*,*]           $
+  else sinoproj = sinogram[projdescrip.trim[0]:projdescrip.trim[1],subset,*]
 
-niswyz, sinoproj
+  niswyz, sinoproj
+endelse
 
 if keyword_set(backproject) then begin
   ;if (n_elements(image) LE 1)  OR (keyword_set(new)) then    $
@@ -267,10 +290,10 @@ if keyword_set(backproject) then begin
   ;  projdescrip.nrplanes)
   
     ;tmpimage = image * 0.0
-    ; resolution in sinogram
-    if fwhm_t gt 0 $
+    ; resolution in sinogram (not for a resident sinogram, see above)
+    if fwhm_t gt 0 and not keyword_set(resident) $
       then sinogram = NIconvolgauss(sinogram, fwhm = fwhm_t, dim=0)
-    if fwhm_a gt 0 $
+    if fwhm_a gt 0 and not keyword_set(resident) $
       then sinogram = NIconvolgauss(sinogram, fwhm = fwhm_a, dim=1)
     
 endif else begin
@@ -314,18 +337,67 @@ bptr_srclocs0 =  2L
 ;bptr_tablepos =  3L
 bptr_detbins0 =  3L
 bptr_mc       = 4L
+bptr_sinofull = 5L       ; only with /resident, owned by the caller
+bptr_subset   = 6L
+bptr_coo      = 7L       ; only with record_sysmat
+bptr_count    = 8L
 ;bptr_debug   =  5L
 
 
-b = bridge->create_buffer(bptr_image,   image,    0, 0)
-b = bridge->create_buffer(bptr_sino,    sinoproj, 0, 0)
+; with /new the output is zeroed on the device instead of uploaded
+if keyword_set(new) and keyword_set(backproject) $
+  then b = bridge->create_buffer_fill(bptr_image, n_elements(image), 0.0, 0) $
+  else b = bridge->create_buffer(bptr_image,   image,    0, 0)
+if keyword_set(resident) then begin
+  ; /new: the resident sinogram is replaced by zeros on the device
+  if keyword_set(new) and not keyword_set(backproject) then $
+    b = bridge->create_buffer_fill(bptr_sinofull, product(size_full[0:2], /integer), 0.0, 0)
+  b = bridge->create_buffer_empty(bptr_sino, 4ULL * product(size_sino[0:2], /integer), 0)
+  if keyword_set(subonly) then begin
+    b = bridge->sino_gather(bptr_sinofull, bptr_sino, -1, size_full, sino_range)
+  endif else begin
+    b = bridge->create_buffer(bptr_subset, long(subset), 2, 0)
+    b = bridge->sino_gather(bptr_sinofull, bptr_sino, bptr_subset, size_full, sino_range)
+  endelse
+endif else begin
+  if keyword_set(new) and not keyword_set(backproject) $
+    then b = bridge->create_buffer_fill(bptr_sino, n_elements(sinoproj), 0.0, 0) $
+    else b = bridge->create_buffer(bptr_sino,    sinoproj, 0, 0)
+endelse
 ;b = bridge->create_buffer(bptr_detbins, detbins,  2, 0)
-b = bridge->create_buffer(bptr_srclocs0, srclocs0,  2, 0)
+b = bridge->create_buffer_empty(bptr_srclocs0, 16ULL * nrangles, 2)
+b = bridge->geom_srclocs(bptr_srclocs0, projdescrip.angles, projdescrip.tablepos, $
+                         projdescrip.align, projdescrip.zalign, subset)
 ;b = bridge->create_buffer(bptr_angles,  angles,   2, 0)
 ;b = bridge->create_buffer(bptr_detplanes, detplanes,  2, 0)
 ;b = bridge->create_buffer(bptr_tablepos, tableposmean,  2, 0)
 b = bridge->create_buffer(bptr_detbins0, detbins0,  2, 0)
-b = bridge->create_buffer(bptr_mc, rigmotion, 2,0)
+if keyword_set(libmotion) and n_elements(libmotion_ok) eq 0 then begin
+  testmotion = [[12.5, -7.0, 3.25, 10.0, -25.0, 40.0], $
+                [-4.0, 9.5, -1.5, -3.0, 7.5, -120.0]]
+  b = bridge->geom_motion(-1L, testmotion, -1L, libmatrices)
+  maxdiff = 0.0
+  for ii = 0, 1 do $
+    maxdiff = maxdiff > max(abs(libmatrices[*,*,ii] $
+                      - NImotion2matrix(motion=testmotion[*,ii], /homo)))
+  libmotion_ok = b eq 0 and maxdiff lt 1.e-4
+  if not libmotion_ok then $
+    printf, -1, 'NIproj_distd_spiralct_ocl: bridge->geom_motion differs from ' $
+      + 'NImotion2matrix by ' + strtrim(maxdiff, 2) + ', LIBMOTION is ignored'
+endif
+if n_elements(projdescrip.rigmotion) gt 1 then begin
+  if keyword_set(libmotion) and keyword_set(libmotion_ok) then begin
+    b = bridge->create_buffer_empty(bptr_mc, 64ULL * nrangles, 2)
+    b = bridge->geom_motion(bptr_mc, projdescrip.rigmotion, subset)
+  endif else begin
+    rigmotion = fltarr(4,4,nrangles)
+    for ii = 0L, nrangles-1 do $
+      rigmotion[*,*,ii] = NImotion2matrix(motion=projdescrip.rigmotion[*,subset[ii]], /homo)  ; not the one in IDL!
+    b = bridge->create_buffer(bptr_mc, rigmotion, 2,0)
+  endelse
+endif else begin
+  b = bridge->create_buffer_fill(bptr_mc, 16ULL * nrangles, 0.0, 2)
+endelse
 ;output = fltarr(4, nrangles)   ;sinoproj                        ; shouldn't turn on if too many views at one time
 ;output = fltarr(6)
 ;b = bridge->create_buffer(bptr_debug, output,  0, 0)       ;write_only;
@@ -360,6 +432,39 @@ b = bridge->set_kernel_arg(kernel, 8, zalign_cotg,false)
 ;b = bridge->set_kernel_arg(kernel, 10, radius,  false)
 ;b = bridge->set_kernel_arg(kernel, 11, focus2center,  false)
 b = bridge->set_kernel_arg(kernel, 9, bptr_mc, true)
+
+;== Cached system matrix: use it once built for this geometry and these
+;   sizes, record it on the first forward projection over all angles
+;   (projdescrips defined before RECORD_SYSMAT existed have no such tag)
+record_sysmat = 0
+if (where(tag_names(projdescrip) eq 'RECORD_SYSMAT'))[0] ge 0 then $
+  record_sysmat = projdescrip.record_sysmat
+use_sysmat = 0
+if record_sysmat then begin
+  sysmat_key = ulong64([projdescrip.sysmat_id, size_img[0:2], size_sino[0:1], projdescrip.nrangles])
+  b = bridge->sysmat_status(sysmat_state, sysmat_dims, cached_key)
+  use_sysmat = sysmat_state gt 0 and kernel ne 'projexpmin' and array_equal(cached_key, sysmat_key)
+endif
+record     = 0
+sysmat_subset = -1
+if record_sysmat then begin
+  if not use_sysmat and not keyword_set(backproject) and not keyword_set(subonly) $
+    and nrangles eq projdescrip.nrangles then $
+    record = array_equal(subset, lindgen(projdescrip.nrangles))
+  if record then begin
+    if n_elements(sysmat) eq 1 && sysmat gt 1 $
+      then capacity = ulong64(sysmat) $
+      else capacity = 4ULL * product(size_sino[0:2], /integer) * max(size_img[0:1])
+    record = bridge->sysmat_record_begin(bptr_coo, bptr_count, capacity) eq 0
+  endif
+  ; the recording kernels always take the two buffers, a capacity of 0 disables them
+  if not record then begin
+    b = bridge->create_buffer(bptr_count, ulonarr(2), 2, 0)
+    b = bridge->create_buffer(bptr_coo,   ulonarr(3), 2, 0)
+  endif
+  b = bridge->set_kernel_arg(kernel, 10, bptr_count, true)
+  b = bridge->set_kernel_arg(kernel, 11, bptr_coo,   true)
+endif
 ;var_deb = 0.
 ;b = bridge->set_kernel_arg(kernel, 10, bptr_debug, true)
 
@@ -373,7 +478,24 @@ local  = ulong([0,0,0])
 ;    else global = ulong(size_sino[0:2])
 
 ;start_time = systime(1)
-b = bridge->execute_kernel(kernel, global, local, false)
+if use_sysmat then begin
+  ; the kernels add to the uploaded output, so does the matrix product;
+  ; the matrix always needs the views of the subset, also with /subonly
+  if not keyword_set(resident) or keyword_set(subonly) then $
+    b = bridge->create_buffer(bptr_subset, long(subset), 2, 0)
+  sysmat_subset = bptr_subset
+  if keyword_set(backproject) $
+    then b = bridge->sysmat_project(bptr_sino, bptr_image, sysmat_subset, nrangles, sysmat_key, /backproject, /accumulate) $
+    else b = bridge->sysmat_project(bptr_image, bptr_sino, sysmat_subset, nrangles, sysmat_key, /accumulate)
+endif else if keyword_set(tile) then begin
+  b = bridge->execute_kernel_tiled(kernel, global, local, false, tile = tile GT 1 ? tile : 0)
+endif else begin
+  b = bridge->execute_kernel(kernel, global, local, false)
+endelse
+if record then $
+  b = bridge->sysmat_build(bptr_coo, bptr_count, product(size_sino[0:2], /integer), $
+                           product(size_img[0:2], /integer), size_sino[0] * size_sino[1], $
+                           sysmat_key, /half)
 ;print, keyword_set(backproject), 'opencl time:', (systime(1)-start_time)/60.
 
 ;== Read out data
@@ -405,6 +527,11 @@ if keyword_set(backproject) then begin
    
    
    ;image += tmpimage
+endif else if keyword_set(resident) then begin
+  ; add the projection to the resident sinogram, nothing is read back
+  b = bridge->sino_scatter(bptr_sino, bptr_sinofull,                 $
+                           keyword_set(subonly) ? -1 : bptr_subset,  $
+                           size_full, sino_range, 1)
 endif else begin
   b = bridge->read_buffer(bptr_sino, sinoproj)
 
@@ -436,6 +563,12 @@ endelse
 ;== Clean up buffers
 b = bridge->release_buffer(bptr_image)
 b = bridge->release_buffer(bptr_sino)
+if (keyword_set(resident) and not keyword_set(subonly)) or sysmat_subset ne -1 then $
+  b = bridge->release_buffer(bptr_subset)
+if record_sysmat then begin
+  b = bridge->release_buffer(bptr_coo)
+  b = bridge->release_buffer(bptr_count)
+endif
 b = bridge->release_buffer(bptr_detbins0)
 b = bridge->release_buffer(bptr_srclocs0)
 ;b = bridge->release_buffer(bptr_angles)